@@ -32,12 +32,50 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stddef.h>
 
 typedef unsigned char BYTE;
 typedef int BOOL;
 #define TRUE  1
 #define FALSE 0
 
+/**
+ * Linkage of the functions defined in the module headers
+ * 
+ * Each module is a header that defines its functions, so they are local
+ * to every translation unit that includes it. The headers can therefore
+ * be included in several translation units of a program, or next to the
+ * libzxtap library, without duplicate symbols; the library only exports
+ * its `zxtap_*` API. Functions that a program does not use are not
+ * reported as unused.
+ */
+#ifndef MODULE_FUNC
+#   if defined(__GNUC__) || defined(__clang__)
+#       define MODULE_FUNC static __attribute__((unused))
+#   else
+#       define MODULE_FUNC static
+#   endif
+#endif
+
+/**
+ * Hooks to route the memory used by the tape readers through a custom allocator
+ * (a NULL pointer to a ZXSAllocator means the standard C library allocator)
+ */
+typedef struct ZXSAllocator {
+    void* (*realloc_fn)(void* user, void* ptr, size_t size); /**< Same as realloc(), `ptr` is NULL to allocate */
+    void  (*free_fn)(void* user, void* ptr);                 /**< Same as free() */
+    void*   user;                                            /**< Passed as is to both hooks */
+} ZXSAllocator;
+
+/**
+ * Hook to read a tape stream through a decoder (e.g. a decompressor) instead of with fread()
+ * (a NULL pointer to a ZXSReader means the stream is read with fread())
+ */
+typedef struct ZXSReader {
+    size_t (*read_fn)(void* user, BYTE* buffer, size_t size); /**< Like fread(), returns less than `size` bytes only at the end */
+    void*    user;                                            /**< Passed as is to the hook */
+} ZXSReader;
+
 /**
  * @brief Macro to extract a 16-bit unsigned integer from a byte stream in little-endian format.
  * @param ptr    A pointer to the byte stream data.
@@ -46,6 +84,14 @@ typedef int BOOL;
  */
 #define GET_LE_WORD(ptr, index) ( (((unsigned char *)ptr)[index + 1] << 8) | (((unsigned char *)ptr)[index]) )
 
+/**
+ * @brief Macro to extract a 32-bit unsigned integer from a byte stream in little-endian format.
+ * @param ptr    A pointer to the byte stream data.
+ * @param index  The starting index (in bytes) from which to read the 32-bit word.
+ * @return       A 32-bit unsigned integer (unsigned long) formed by combining the four bytes in little-endian format.
+ */
+#define GET_LE_DWORD(ptr, index) ( (unsigned long)GET_LE_WORD(ptr, index) | ((unsigned long)GET_LE_WORD(ptr, (index) + 2) << 16) )
+
 /**
  * @brief Macro to extract a 16-bit unsigned integer from a byte stream in big-endian format.
  * @param ptr    A pointer to the byte stream data.
@@ -54,6 +100,24 @@ typedef int BOOL;
  */
 #define GET_BE_WORD(ptr, index) ( (((unsigned char *)ptr)[index] << 8) | (((unsigned char *)ptr)[index + 1]) )
 
+/**
+ * @brief Macro to store a 16-bit unsigned integer in a byte stream in little-endian format.
+ * @param ptr    A pointer to the byte stream data.
+ * @param index  The starting index (in bytes) where the 16-bit word is stored.
+ * @param value  The value to store.
+ */
+#define SET_LE_WORD(ptr, index, value) ( ((unsigned char *)ptr)[index]     = (unsigned char)((value)      ), \
+                                         ((unsigned char *)ptr)[index + 1] = (unsigned char)((value) >>  8) )
+
+/**
+ * @brief Macro to store a 32-bit unsigned integer in a byte stream in little-endian format.
+ * @param ptr    A pointer to the byte stream data.
+ * @param index  The starting index (in bytes) where the 32-bit word is stored.
+ * @param value  The value to store.
+ */
+#define SET_LE_DWORD(ptr, index, value) ( SET_LE_WORD(ptr, index, (value) & 0xFFFF), \
+                                          SET_LE_WORD(ptr, (index) + 2, ((value) >> 16) & 0xFFFF) )
+
 /**
  * Displays a warning message to stderr with color formatting
  * @param message The main warning message
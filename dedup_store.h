@@ -0,0 +1,222 @@
+/*
+| File    : dedup_store.h
+| Purpose : Content-addressed store that keeps one copy of each block payload.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef DEDUP_STORE_H
+#define DEDUP_STORE_H
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "file_dir.h"
+#include "hash64.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+/* Name of the directory of the store where the payloads are saved */
+#define DEDUP_OBJECTS_DIR "objects"
+
+/* Name of the file of the store where the references to the payloads are listed */
+#define DEDUP_REFS_FILE "refs.tsv"
+
+/**
+ * A directory where each distinct payload is saved only once
+ * 
+ * Payloads are saved as `objects/XX/XXXXXXXXXXXXXXXX`, named after the
+ * hexadecimal XXH64 hash of their content (the first two digits are used as
+ * a fan-out subdirectory). Adding a payload that is already present, either
+ * in this run or in a previous one, writes nothing.
+ * 
+ * The store can be shared by the threads of a pool, only the lookup of the
+ * hash is serialized, the payloads are written in parallel.
+ */
+typedef struct DedupStore {
+    char*               dir;          /**< Directory of the store */
+    char*               refs_path;    /**< Path of the default references file (refs.tsv) */
+    Mutex               lock;         /**< Protects `hashes` and `fanout_ready` */
+    unsigned long long* hashes;       /**< Hash table of the hashes added in this run (0 = empty slot) */
+    unsigned            hash_size;    /**< Number of slots in `hashes` (always a power of two) */
+    unsigned            hash_count;   /**< Number of hashes stored in `hashes` */
+    BOOL                has_zero;     /**< TRUE if the hash 0 (not storable in `hashes`) was added */
+    BYTE                fanout_ready[256 / 8]; /**< Bitmap of the fan-out subdirectories known to exist */
+} DedupStore;
+
+/*============================ INTERNAL HELPERS ============================*/
+
+/**
+ * Ensures that a directory exists, creating it if required.
+ * @param path  The directory path.
+ * @return TRUE if the directory exists.
+ */
+MODULE_FUNC BOOL _dedup_ensure_directory(const char* path) {
+    if( is_directory(path) ) { return TRUE; }
+    if( !create_directory(path) ) { return FALSE; }
+    STATS_ADD(STATS_DIRS_CREATED, 1);
+    return TRUE;
+}
+
+/**
+ * Adds a hash to the table of hashes of this run (the lock must be held).
+ * @param store  The dedup store.
+ * @param hash   The hash to add.
+ * @return 1 if the hash was added, 0 if it was already there, -1 if out of memory.
+ */
+MODULE_FUNC int _dedup_claim_hash(DedupStore* store, unsigned long long hash) {
+    unsigned long long *old_hashes, *slot;
+    unsigned i, old_size, mask;
+
+    if( hash == 0 ) {
+        if( store->has_zero ) { return 0; }
+        store->has_zero = TRUE; return 1;
+    }
+    /* grow the table keeping it at most half full */
+    if( (store->hash_count + 1) * 2 > store->hash_size ) {
+        old_hashes = store->hashes; old_size = store->hash_size;
+        store->hash_size = old_size ? old_size * 2 : 1024;
+        store->hashes    = (unsigned long long*)calloc(store->hash_size, sizeof(unsigned long long));
+        STATS_ADD(STATS_ALLOCATIONS, 1);
+        if( !store->hashes ) { store->hashes = old_hashes; store->hash_size = old_size; return -1; }
+        mask = store->hash_size - 1;
+        for( i = 0 ; i < old_size ; ++i ) {
+            if( !old_hashes[i] ) { continue; }
+            slot = &store->hashes[ old_hashes[i] & mask ];
+            while( *slot ) { slot = &store->hashes[ (slot - store->hashes + 1) & mask ]; }
+            *slot = old_hashes[i];
+        }
+        free(old_hashes);
+    }
+    mask = store->hash_size - 1;
+    slot = &store->hashes[ hash & mask ];
+    while( *slot ) {
+        if( *slot == hash ) { return 0; }
+        slot = &store->hashes[ (slot - store->hashes + 1) & mask ];
+    }
+    *slot = hash; ++store->hash_count;
+    return 1;
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Opens a dedup store, creating its directories if they do not exist.
+ * @param store  Pointer to the DedupStore structure to initialize.
+ * @param dir    The directory of the store.
+ * @return TRUE on success, FALSE if the directories could not be created or out of memory.
+ */
+MODULE_FUNC BOOL dedup_store_open(DedupStore* store, const char* dir) {
+    char* objects_dir;
+    BOOL  success;
+    assert( store != NULL && dir != NULL );
+
+    memset(store, 0, sizeof(DedupStore));
+    store->dir       = strdup_(dir);
+    store->refs_path = alloc_concat5(dir, "/", DEDUP_REFS_FILE, NULL, NULL);
+    objects_dir      = alloc_concat5(dir, "/", DEDUP_OBJECTS_DIR, NULL, NULL);
+    success = store->dir && store->refs_path && objects_dir &&
+              _dedup_ensure_directory(dir) && _dedup_ensure_directory(objects_dir);
+    free(objects_dir);
+    if( !success ) { free(store->dir); free(store->refs_path); return FALSE; }
+    mutex_init(&store->lock);
+    return TRUE;
+}
+
+/**
+ * Closes a dedup store, releasing all its memory.
+ * @param store  Pointer to the DedupStore structure opened with `dedup_store_open()`.
+ */
+MODULE_FUNC void dedup_store_close(DedupStore* store) {
+    assert( store != NULL );
+    mutex_destroy(&store->lock);
+    free(store->hashes);
+    free(store->refs_path);
+    free(store->dir);
+    memset(store, 0, sizeof(DedupStore));
+}
+
+/**
+ * Adds a payload to the store, saving it only if its content is not already there.
+ * @param store     The dedup store.
+ * @param data      The bytes of the payload.
+ * @param size      Number of bytes in `data`.
+ * @param out_hash  Receives the hash that identifies the payload in the store.
+ * @return 1 if the payload was saved, 0 if it was already in the store, -1 on error.
+ */
+MODULE_FUNC int dedup_store_add(DedupStore* store, const BYTE* data, size_t size, unsigned long long* out_hash) {
+    char name[24], fanout[4];
+    char *fanout_dir = NULL, *path = NULL, *temp_path = NULL;
+    unsigned long long hash;
+    long long timer;
+    FILE* file;
+    int result, bucket;
+    assert( store != NULL && out_hash != NULL );
+
+    hash = *out_hash = hash64(data, size, 0);
+    sprintf(fanout, "%02x", (unsigned)(hash >> 56));
+    sprintf(name, "%08lx%08lx", (unsigned long)(hash >> 32), (unsigned long)(hash & 0xFFFFFFFFUL));
+    bucket = (int)(hash >> 56);
+    timer  = stats_start_timer();
+
+    /* claim the hash, only the first thread adding a payload writes it */
+    mutex_lock(&store->lock);
+    result = _dedup_claim_hash(store, hash);
+    if( result > 0 ) {
+        fanout_dir = alloc_concat5(store->dir, "/" DEDUP_OBJECTS_DIR "/", fanout, NULL, NULL);
+        path       = alloc_concat5(store->dir, "/" DEDUP_OBJECTS_DIR "/", fanout, "/", name);
+        if( !fanout_dir || !path ) { result = -1; }
+        else if( !(store->fanout_ready[bucket / 8] & (1 << (bucket % 8))) ) {
+            if( _dedup_ensure_directory(fanout_dir) ) { store->fanout_ready[bucket / 8] |= (BYTE)(1 << (bucket % 8)); }
+            else { result = -1; }
+        }
+        if( result > 0 && path_exists(path) ) { result = 0; }
+    }
+    mutex_unlock(&store->lock);
+
+    /* write the payload to a temporary file renamed when complete,
+     * so an interrupted run never leaves a truncated object */
+    if( result > 0 ) {
+        temp_path = alloc_concat5(path, ".tmp", NULL, NULL, NULL);
+        file      = temp_path ? fopen(temp_path, "wb") : NULL;
+        if( !file ) { error("Cannot create file in the dedup store '%s'", store->dir); result = -1; }
+        else {
+            STATS_ADD(STATS_FILES_CREATED, 1);
+            STATS_ADD(STATS_OUTPUT_BYTES, size);
+            if( size > 0 && fwrite(data, 1, size, file) != size ) { result = -1; }
+            if( fclose(file) != 0 ) { result = -1; }
+            if( result > 0 && rename(temp_path, path) != 0 ) { result = -1; }
+            if( result < 0 ) { error("Cannot write file '%s'", path); remove(temp_path); }
+        }
+    }
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+    free(temp_path); free(path); free(fanout_dir);
+    return result;
+}
+
+#endif /* DEDUP_STORE_H */
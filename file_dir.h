@@ -31,19 +31,67 @@
 \_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
 #ifndef FILE_DIR_H
 #define FILE_DIR_H
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE /* syscall() and sendfile(), also with -std=c99 (only if included first) */
+#endif
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "common.h"
+#include "stats.h"
 #ifdef _WIN32
 #   include <windows.h>
 #else
+#   include <errno.h>
+#   include <dirent.h>
 #   include <unistd.h>
+#   include <fcntl.h>
 #   include <sys/stat.h>
+#   if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#       include <sys/mman.h>
+#       define FILE_DIR_HAS_MMAP
+#   endif
+#   if defined(__linux__)
+#       include <sys/sendfile.h>
+#       include <sys/syscall.h>
+#       define FILE_DIR_HAS_SENDFILE
+#   endif
+#endif
+
+/**
+ * A read-only view of the whole content of a file
+ */
+typedef struct FileMap {
+    const BYTE* data;      /**< Pointer to the first byte of the file content (NULL if the file is empty) */
+    size_t      size;      /**< Size of the file content in bytes */
+    BOOL        is_mapped; /**< TRUE if `data` is a memory mapping, FALSE if it is an allocated copy */
+    int         fd;        /**< Descriptor of the mapped file, kept open for zero-copy writes (-1 if none) */
+#ifdef _WIN32
+    HANDLE      mapping;   /**< Handle of the file mapping object (windows only) */
 #endif
+} FileMap;
+
+/**
+ * Function called for each entry found in a directory
+ * @param path       The path of the entry (the directory path followed by the entry name).
+ * @param is_dir     TRUE if the entry is a directory.
+ * @param user_data  The pointer passed to `for_each_dir_entry()`.
+ * @return TRUE to continue with the next entry, FALSE to stop.
+ */
+typedef BOOL (*DIR_ENTRY_FUNC)(const char* path, BOOL is_dir, void* user_data);
 
-char* strdup_(const char* str) {
+/**
+ * Basic information about a file
+ */
+typedef struct FileInfo {
+    unsigned long long size;  /**< Size of the file in bytes */
+    long long          mtime; /**< Last modification time (seconds since the epoch) */
+} FileInfo;
+
+MODULE_FUNC char* strdup_(const char* str) {
     char *allocated_str;
+    STATS_ADD(STATS_ALLOCATIONS, 1);
     return str && (allocated_str=malloc(strlen(str)+2)) ? strcpy(allocated_str, str) : NULL;
 }
 
@@ -53,7 +101,7 @@ char* strdup_(const char* str) {
  * @return
  *     A pointer to the start of the filename in the path.
  */
-const char* get_filename(const char* path) {
+MODULE_FUNC const char* get_filename(const char* path) {
     int i, last_sep = -1;
     for( i = 0 ; path[i] != '\0' ; i++ ) {
         if( path[i]=='/' || path[i]=='\\' ) { last_sep = i; }
@@ -68,7 +116,7 @@ const char* get_filename(const char* path) {
  *    The allocated filename without the extension or NULL on failure.
  *    The caller is responsible for freeing this memory.
  */
-char* alloc_name(const char* path) {
+MODULE_FUNC char* alloc_name(const char* path) {
     char* name = strdup_( get_filename( path ) );
     char* dot  = strrchr(name, '.');
     if( dot ) { *dot = '\0'; }
@@ -87,7 +135,7 @@ char* alloc_name(const char* path) {
  *    A pointer to the allocated buffer containing the concatenated strings.
  *    The caller is responsible for freeing this memory.
  */
-char* alloc_concat5(const char *str1, const char *str2, const char *str3, const char *str4, const char *str5) {
+MODULE_FUNC char* alloc_concat5(const char *str1, const char *str2, const char *str3, const char *str4, const char *str5) {
     int    len1, len2, len3, len4, len5;
     size_t total_length;
     char   *output, *ptr;
@@ -103,6 +151,7 @@ char* alloc_concat5(const char *str1, const char *str2, const char *str3, const
 
     /* copy each string into the output buffer */
     ptr = output = (char*)calloc(total_length, sizeof(char));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
     if( str1 ) { strcpy(ptr, str1); ptr += len1; }
     if( str2 ) { strcpy(ptr, str2); ptr += len2; }
     if( str3 ) { strcpy(ptr, str3); ptr += len3; }
@@ -123,7 +172,7 @@ char* alloc_concat5(const char *str1, const char *str2, const char *str3, const
  *    A pointer to the allocated wide string (UTF-16), or NULL if the input is invalid.
  *    The caller is responsible for freeing this memory.
  */
-wchar_t* alloc_wide_string(const char* utf8_str) {
+MODULE_FUNC wchar_t* alloc_wide_string(const char* utf8_str) {
     wchar_t* wide_str;
     size_t utf8_length, wide_length;
     if( utf8_str==NULL)  { return NULL; }
@@ -135,6 +184,7 @@ wchar_t* alloc_wide_string(const char* utf8_str) {
 
     /* allocate memory for wide string */
     wide_str = (wchar_t*)malloc((wide_length + 1) * sizeof(wchar_t));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
     if( wide_str==NULL ) { return NULL; }
 
     /* Perform the actual conversion */
@@ -143,6 +193,28 @@ wchar_t* alloc_wide_string(const char* utf8_str) {
 }
 #endif
 
+#if defined(_WIN32)
+/**
+ * Converts a wide string (UTF-16) to a UTF-8 string for Windows.
+ * 
+ * @param wide_str A wide string (UTF-16).
+ * @return
+ *    A pointer to the allocated UTF-8 string, or NULL if the input is invalid.
+ *    The caller is responsible for freeing this memory.
+ */
+MODULE_FUNC char* alloc_utf8_string(const wchar_t* wide_str) {
+    char* utf8_str; int utf8_length;
+    if( wide_str==NULL ) { return NULL; }
+    utf8_length = WideCharToMultiByte(CP_UTF8, 0, wide_str, -1, NULL, 0, NULL, NULL);
+    if( utf8_length==0 ) { return NULL; }
+    utf8_str = (char*)malloc(utf8_length);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( utf8_str==NULL ) { return NULL; }
+    WideCharToMultiByte(CP_UTF8, 0, wide_str, -1, utf8_str, utf8_length, NULL, NULL);
+    return utf8_str;
+}
+#endif
+
 /**
  * Checks if a file or directory exists at the specified path.
  * 
@@ -150,7 +222,8 @@ wchar_t* alloc_wide_string(const char* utf8_str) {
  * @return
  *    TRUE if the path exists, or FALSE if it does not.
  */
-int path_exists(const char *path) {
+MODULE_FUNC int path_exists(const char *path) {
+    STATS_ADD(STATS_PATH_PROBES, 1);
     #ifdef _WIN32
         /* windows specific code */
         wchar_t* wide_path       = wide_string_from_utf8(path);
@@ -162,9 +235,45 @@ int path_exists(const char *path) {
     #endif
 }
 
+/**
+ * Retrieves the size and last modification time of a file.
+ * 
+ * @param[in]  path  The file path.
+ * @param[out] info  The FileInfo structure to fill in.
+ * @return
+ *    TRUE if the information was retrieved, or FALSE if the file does not exist.
+ */
+MODULE_FUNC BOOL get_file_info(const char* path, FileInfo* info) {
+    assert( path!=NULL && info!=NULL );
+    #ifdef _WIN32
+    {   /* windows specific code */
+        WIN32_FILE_ATTRIBUTE_DATA attributes; BOOL success;
+        wchar_t* wide_path = alloc_wide_string(path);
+        success = GetFileAttributesExW(wide_path, GetFileExInfoStandard, &attributes);
+        free(wide_path);
+        if( !success ) { return FALSE; }
+        info->size  = ((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        info->mtime = (long long)(((unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32 |
+                                   attributes.ftLastWriteTime.dwLowDateTime) / 10000000ULL) - 11644473600LL;
+        return TRUE;
+    }
+    #else
+    {   /* linux/mac specific code */
+        struct stat file_stat;
+        if( stat(path, &file_stat) != 0 ) { return FALSE; }
+        info->size  = (unsigned long long)file_stat.st_size;
+        info->mtime = (long long)file_stat.st_mtime;
+        return TRUE;
+    }
+    #endif
+}
+
 /**
  * @brief Returns the first available path to not overwrite an existing file or dir.
  * 
+ * Each try is a `path_exists()` call, to generate many names in the same
+ * directory use a UniqueNamer instead.
+ * 
  * @param dir      The directory path. (may be NULL or empty)
  * @param filename The base filename without extension, e.g., "file". (must be a valid string)
  * @param ext      The file extension including the dot, e.g., ".txt". (may be NULL or empty)
@@ -172,12 +281,13 @@ int path_exists(const char *path) {
  *    A dynamically allocated string containing the unique path.
  *    The caller is responsible for freeing this memory.
  */
-char* alloc_unique_path(const char* dir, const char* filename, const char* ext) {
+MODULE_FUNC char* alloc_unique_path(const char* dir, const char* filename, const char* ext) {
     char *path;
     int number; char number_str[16];
     BOOL unique;
     const char* dir_end = "/";
     char last_dir_char;
+    long long timer = stats_start_timer();
     assert( filename!=NULL );
     
     /* check the need for a directory separator at the end of the directory */
@@ -193,6 +303,324 @@ char* alloc_unique_path(const char* dir, const char* filename, const char* ext)
         path   = alloc_concat5(dir, dir_end, filename, number_str, ext);
         unique = !path_exists(path);
     }
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+    return path;
+}
+
+/**
+ * Reads the whole content of an already opened file into an allocated buffer.
+ * 
+ * This is the fallback used when the file can not be memory mapped
+ * (e.g. pipes, special files or platforms without mmap support).
+ * 
+ * @param[out] map   The FileMap structure to fill in.
+ * @param[in]  file  The file pointer, opened in binary read mode.
+ * @return
+ *    TRUE if the content was read successfully, FALSE otherwise.
+ */
+MODULE_FUNC BOOL _read_whole_file(FileMap* map, FILE* file) {
+    BYTE *buffer = NULL, *new_buffer;
+    size_t size = 0, capacity = 0, bytes_read;
+
+    assert( map!=NULL && file!=NULL );
+    do {
+        if( size == capacity ) {
+            capacity   = capacity ? capacity * 2 : 65536;
+            new_buffer = (BYTE*)realloc(buffer, capacity);
+            STATS_ADD(STATS_ALLOCATIONS, 1);
+            if( !new_buffer ) { free(buffer); return FALSE; }
+            buffer = new_buffer;
+        }
+        bytes_read = fread(buffer + size, 1, capacity - size, file);
+        size      += bytes_read;
+    } while( bytes_read > 0 );
+
+    if( ferror(file) ) { free(buffer); return FALSE; }
+    map->data      = buffer;
+    map->size      = size;
+    map->is_mapped = FALSE;
+    return TRUE;
+}
+
+/**
+ * Maps the whole content of a file into memory for read-only access.
+ * 
+ * The file is memory mapped when the platform supports it, falling back
+ * to reading the entire file into an allocated buffer otherwise.
+ * Either way the content remains accessible until `unmap_file()` is called.
+ * 
+ * @param[out] map   The FileMap structure to fill in.
+ * @param[in]  path  The path of the file to map.
+ * @return
+ *    TRUE if the file was mapped successfully, FALSE otherwise.
+ */
+MODULE_FUNC BOOL map_file(FileMap* map, const char* path) {
+    BOOL  success = FALSE;
+    FILE* file;
+
+    assert( map!=NULL && path!=NULL );
+    memset(map, 0, sizeof(FileMap));
+    map->fd = -1;
+
+#   if defined(_WIN32)
+    {   /* windows specific code */
+        wchar_t*      wide_path = alloc_wide_string(path);
+        HANDLE        handle    = CreateFileW(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER file_size;
+        free(wide_path);
+        if( handle != INVALID_HANDLE_VALUE && GetFileSizeEx(handle, &file_size) ) {
+            map->size = (size_t)file_size.QuadPart;
+            success   = (map->size == 0);
+            if( !success ) { map->mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL); }
+            if( !success && map->mapping ) {
+                map->data      = (const BYTE*)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+                map->is_mapped = success = (map->data != NULL);
+                if( !success ) { CloseHandle(map->mapping); map->mapping = NULL; }
+            }
+        }
+        if( handle != INVALID_HANDLE_VALUE ) { CloseHandle(handle); }
+        if( success ) { return TRUE; }
+    }
+#   elif defined(FILE_DIR_HAS_MMAP)
+    {   /* linux/mac specific code */
+        struct stat file_stat;
+        void*       address;
+        int         fd = open(path, O_RDONLY);
+        if( fd >= 0 && fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) ) {
+            map->size = (size_t)file_stat.st_size;
+            success   = (map->size == 0);
+            if( !success ) {
+                address = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if( address != MAP_FAILED ) {
+                    map->data      = (const BYTE*)address;
+                    map->is_mapped = success = TRUE;
+                    map->fd        = fd;
+                }
+            }
+        }
+        if( fd >= 0 && map->fd != fd ) { close(fd); }
+        if( success ) { return TRUE; }
+    }
+#   endif
+
+    /* fallback: read the whole file into memory */
+    memset(map, 0, sizeof(FileMap));
+    map->fd = -1;
+    file = fopen(path, "rb");
+    if( !file ) { return FALSE; }
+    success = _read_whole_file(map, file);
+    fclose(file);
+    return success;
+}
+
+/**
+ * Releases the memory used by a file previously mapped with `map_file()`.
+ * @param map The FileMap structure to release.
+ */
+MODULE_FUNC void unmap_file(FileMap* map) {
+    assert( map!=NULL );
+    if( map->is_mapped ) {
+#       if defined(_WIN32)
+            UnmapViewOfFile((LPCVOID)map->data);
+            CloseHandle(map->mapping);
+#       elif defined(FILE_DIR_HAS_MMAP)
+            munmap((void*)map->data, map->size);
+            if( map->fd >= 0 ) { close(map->fd); }
+#       endif
+    }
+    else {
+        free((void*)map->data);
+    }
+    memset(map, 0, sizeof(FileMap));
+    map->fd = -1;
+}
+
+/**
+ * Writes a range of a file in memory to a new file.
+ * 
+ * When the descriptor of the source file is available the bytes are copied
+ * by the kernel (`copy_file_range()`, then `sendfile()` on Linux) without
+ * passing through user space; otherwise, or if the kernel can not copy
+ * them, they are written directly from `data` (e.g. a memory mapping)
+ * without any intermediate buffer.
+ * 
+ * @param path       The path of the file to create (overwritten if it exists).
+ * @param source_fd  Descriptor of the file whose content is in `data`, or -1 if unknown.
+ * @param data       Pointer to the content of the source file.
+ * @param offset     Offset of the first byte to write within the source file.
+ * @param size       Number of bytes to write.
+ * @return TRUE on success, FALSE if the file could not be created or written.
+ */
+MODULE_FUNC BOOL write_file_range(const char* path, int source_fd, const BYTE* data, size_t offset, size_t size) {
+    size_t written = 0;
+    BOOL   success;
+    assert( path!=NULL && (data!=NULL || size==0) );
+
+#   ifdef _WIN32
+    {   /* windows specific code */
+        FILE* file = fopen(path, "wb");
+        if( !file ) { return FALSE; }
+        written = size > 0 ? fwrite(data + offset, 1, size, file) : 0;
+        success = (fclose(file) == 0) && written == size;
+        (void)source_fd;
+    }
+#   else
+    {   /* linux/mac specific code */
+        ssize_t count; off_t source_offset = (off_t)offset;
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if( fd < 0 ) { return FALSE; }
+#       if defined(FILE_DIR_HAS_SENDFILE) && defined(SYS_copy_file_range)
+        while( source_fd >= 0 && written < size ) {
+            count = syscall(SYS_copy_file_range, source_fd, &source_offset, fd, NULL, size - written, 0);
+            if( count <= 0 ) { break; }
+            written += (size_t)count;
+        }
+#       endif
+#       if defined(FILE_DIR_HAS_SENDFILE)
+        while( source_fd >= 0 && written < size ) {
+            count = sendfile(fd, source_fd, &source_offset, size - written);
+            if( count <= 0 ) { break; }
+            written += (size_t)count;
+        }
+#       endif
+        while( written < size ) {
+            count = write(fd, data + offset + written, size - written);
+            if( count < 0 && errno == EINTR ) { continue; }
+            if( count <= 0 ) { break; }
+            written += (size_t)count;
+        }
+        success = (close(fd) == 0) && written == size;
+        (void)source_offset;
+    }
+#   endif
+    STATS_ADD(STATS_OUTPUT_BYTES, written);
+    return success;
+}
+
+/**
+ * Checks if a directory exists at the specified path.
+ * 
+ * @param path The directory path.
+ * @return
+ *    TRUE if the path exists and it is a directory, or FALSE otherwise.
+ */
+MODULE_FUNC BOOL is_directory(const char* path) {
+    #ifdef _WIN32
+        /* windows specific code */
+        wchar_t* wide_path       = alloc_wide_string(path);
+        DWORD    file_attributes = GetFileAttributesW(wide_path);
+        free(wide_path);
+        return file_attributes != INVALID_FILE_ATTRIBUTES && (file_attributes & FILE_ATTRIBUTE_DIRECTORY);
+    #else
+        struct stat file_stat;
+        return stat(path, &file_stat) == 0 && S_ISDIR(file_stat.st_mode);
+    #endif
+}
+
+/**
+ * Calls a function for each entry of a directory (except "." and "..").
+ * 
+ * @param dir        The directory path.
+ * @param func       The function to call for each entry.
+ * @param user_data  Pointer passed to `func` unchanged.
+ * @return
+ *    TRUE if all the entries were visited, FALSE if the directory could not
+ *    be read or `func` requested to stop.
+ */
+MODULE_FUNC BOOL for_each_dir_entry(const char* dir, DIR_ENTRY_FUNC func, void* user_data) {
+    const char* dir_end; char* path; const char* name; BOOL is_dir, keep_going = TRUE;
+    char last_dir_char;
+    assert( dir!=NULL && func!=NULL );
+
+    last_dir_char = dir[0]!='\0' ? dir[ strlen(dir)-1 ] : '/';
+    dir_end       = (last_dir_char=='/' || last_dir_char=='\\') ? NULL : "/";
+    #ifdef _WIN32
+    {   /* windows specific code */
+        WIN32_FIND_DATAW find_data; HANDLE handle; char* utf8_name;
+        wchar_t* wide_pattern;
+        path         = alloc_concat5(dir, dir_end, "*", NULL, NULL);
+        wide_pattern = alloc_wide_string(path);
+        handle       = FindFirstFileW(wide_pattern, &find_data);
+        free(wide_pattern); free(path);
+        if( handle == INVALID_HANDLE_VALUE ) { return FALSE; }
+        do {
+            utf8_name = alloc_utf8_string(find_data.cFileName);
+            name      = utf8_name ? utf8_name : "";
+            if( name[0] && strcmp(name, ".")!=0 && strcmp(name, "..")!=0 ) {
+                is_dir     = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+                path       = alloc_concat5(dir, dir_end, name, NULL, NULL);
+                keep_going = func(path, is_dir, user_data);
+                free(path);
+            }
+            free(utf8_name);
+        } while( keep_going && FindNextFileW(handle, &find_data) );
+        FindClose(handle);
+    }
+    #else
+    {   /* linux/mac specific code */
+        DIR* dir_stream; struct dirent* entry;
+        dir_stream = opendir(dir);
+        if( !dir_stream ) { return FALSE; }
+        while( keep_going && (entry = readdir(dir_stream)) != NULL ) {
+            name = entry->d_name;
+            if( strcmp(name, ".")==0 || strcmp(name, "..")==0 ) { continue; }
+            path = alloc_concat5(dir, dir_end, name, NULL, NULL);
+#           ifdef DT_DIR
+                is_dir = entry->d_type==DT_UNKNOWN ? is_directory(path) : entry->d_type==DT_DIR;
+#           else
+                is_dir = is_directory(path);
+#           endif
+            keep_going = func(path, is_dir, user_data);
+            free(path);
+        }
+        closedir(dir_stream);
+    }
+    #endif
+    return keep_going;
+}
+
+/**
+ * Creates a new directory, choosing the first name that is not already taken.
+ * 
+ * The names tried are `dir_name`, `dir_name_2_`, `dir_name_3_` and so on.
+ * Since creating a directory is atomic, it is safe to call this function
+ * concurrently from different threads or processes.
+ * 
+ * @param dir_name The preferred path of the directory.
+ * @return
+ *    A dynamically allocated string containing the path of the created directory,
+ *    or NULL if the directory could not be created.
+ *    The caller is responsible for freeing this memory.
+ */
+MODULE_FUNC char* alloc_new_directory(const char* dir_name) {
+    char *path = NULL; int number; char number_str[16];
+    BOOL created = FALSE, exists;
+    long long timer = stats_start_timer();
+    assert( dir_name!=NULL && dir_name[0]!='\0' );
+
+    for( number = 1 ; number <= 9999 ; ++number ) {
+        if( number > 1 ) { sprintf(number_str, "_%d_", number); }
+        path = alloc_concat5(dir_name, number > 1 ? number_str : NULL, NULL, NULL, NULL);
+        if( !path ) { break; }
+#       ifdef _WIN32
+        {   /* windows specific code */
+            wchar_t* wide_path = alloc_wide_string(path);
+            created = CreateDirectoryW(wide_path, NULL);
+            exists  = !created && GetLastError()==ERROR_ALREADY_EXISTS;
+            free(wide_path);
+        }
+#       else
+            /* linux/mac specific code */
+            created = mkdir(path, 0777) == 0;
+            exists  = !created && errno==EEXIST;
+#       endif
+        if( created || !exists ) { break; }
+        free(path); path = NULL;
+    }
+    if( !created ) { free(path); path = NULL; }
+    else           { STATS_ADD(STATS_DIRS_CREATED, 1); }
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
     return path;
 }
 
@@ -203,7 +631,7 @@ char* alloc_unique_path(const char* dir, const char* filename, const char* ext)
  *   - TRUE if the directory was successfully created.
  *   - FALSE if the directory path is invalid or directory creation failed.
  */
-BOOL create_directory(const char *path) {
+MODULE_FUNC BOOL create_directory(const char *path) {
     BOOL result = TRUE;
 
     assert( path!=NULL );
@@ -224,4 +652,227 @@ BOOL create_directory(const char *path) {
 }
 
 
+/*------------------------------ UNIQUE NAMES ------------------------------*/
+
+/**
+ * A hash table of names, each one with an associated number
+ */
+typedef struct _NameTable {
+    char**    names;       /**< The allocated names (NULL = empty slot) */
+    int*      numbers;     /**< The number associated to each name */
+    unsigned  size;        /**< Number of slots (always a power of two, or 0) */
+    unsigned  count;       /**< Number of names stored */
+} _NameTable;
+
+/**
+ * Generates unique file names inside a directory without probing the filesystem
+ * 
+ * The names present in the directory are read once with a single listing,
+ * after that every name handed out is remembered in memory and the `_N_`
+ * suffixes come from a counter kept for each requested name, so generating
+ * n names costs O(n) instead of O(n^2) `path_exists()` calls.
+ * The directory must not be modified by others while the namer is used.
+ */
+typedef struct UniqueNamer {
+    char*       dir;       /**< The directory where the names are generated */
+    const char* dir_end;   /**< Separator added after `dir` ("/" or NULL) */
+    _NameTable  used;      /**< Names present in the directory or already handed out */
+    _NameTable  requested; /**< Requested names (filename+ext), with the next number to try */
+} UniqueNamer;
+
+/* names are compared ignoring case on case-insensitive filesystems */
+#if defined(_WIN32) || defined(__APPLE__)
+#   define _NAME_CHAR(ch) ( ('A'<=(ch) && (ch)<='Z') ? (ch)-'A'+'a' : (ch) )
+#else
+#   define _NAME_CHAR(ch) (ch)
+#endif
+
+/** Returns the FNV-1a hash of a name (ignoring case where names are case-insensitive) */
+MODULE_FUNC unsigned _name_hash(const char* name) {
+    unsigned hash = 2166136261u;
+    for( ; *name ; ++name ) { hash = (hash ^ (unsigned char)_NAME_CHAR(*name)) * 16777619u; }
+    return hash;
+}
+
+/** Returns TRUE if two names refer to the same file */
+MODULE_FUNC BOOL _name_equals(const char* name1, const char* name2) {
+    for( ; *name1 && _NAME_CHAR(*name1)==_NAME_CHAR(*name2) ; ++name1, ++name2 ) { }
+    return _NAME_CHAR(*name1) == _NAME_CHAR(*name2);
+}
+
+/**
+ * Finds the slot of a name in a name table.
+ * @param table  The name table. (must have at least one empty slot)
+ * @param name   The name to find.
+ * @return The slot where the name is stored, or the empty slot where it would be stored.
+ */
+MODULE_FUNC unsigned _name_table_slot(const _NameTable* table, const char* name) {
+    unsigned slot = _name_hash(name) & (table->size - 1);
+    while( table->names[slot] && !_name_equals(table->names[slot], name) ) {
+        slot = (slot + 1) & (table->size - 1);
+    }
+    return slot;
+}
+
+/**
+ * Adds a name to a name table (if it is not already there).
+ * @param table  The name table.
+ * @param name   The name to add, a copy is stored.
+ * @return The slot where the name is stored, or -1 if there was not enough memory.
+ */
+MODULE_FUNC int _name_table_add(_NameTable* table, const char* name) {
+    _NameTable grown; unsigned i, slot;
+
+    /* keep the load factor under 1/2 */
+    if( (table->count + 1) * 2 > table->size ) {
+        grown.size    = table->size ? table->size * 2 : 64;
+        grown.count   = table->count;
+        grown.names   = (char**)calloc(grown.size, sizeof(char*));
+        grown.numbers = (int*)calloc(grown.size, sizeof(int));
+        STATS_ADD(STATS_ALLOCATIONS, 2);
+        if( !grown.names || !grown.numbers ) { free(grown.names); free(grown.numbers); return -1; }
+        for( i = 0 ; i < table->size ; ++i ) {
+            if( !table->names[i] ) { continue; }
+            slot = _name_table_slot(&grown, table->names[i]);
+            grown.names  [slot] = table->names[i];
+            grown.numbers[slot] = table->numbers[i];
+        }
+        free(table->names); free(table->numbers);
+        *table = grown;
+    }
+    slot = _name_table_slot(table, name);
+    if( !table->names[slot] ) {
+        if( !(table->names[slot] = strdup_(name)) ) { return -1; }
+        table->numbers[slot] = 1;
+        ++table->count;
+    }
+    return (int)slot;
+}
+
+/** Releases all the memory used by a name table */
+MODULE_FUNC void _name_table_free(_NameTable* table) {
+    unsigned i;
+    for( i = 0 ; i < table->size ; ++i ) { free(table->names[i]); }
+    free(table->names); free(table->numbers);
+    memset(table, 0, sizeof(_NameTable));
+}
+
+/** Adds the name of a directory entry to the used names (used with `for_each_dir_entry()`) */
+MODULE_FUNC BOOL _unique_namer_seed_entry(const char* path, BOOL is_dir, void* user_data) {
+    UniqueNamer* namer = (UniqueNamer*)user_data;
+    (void)is_dir;
+    return _name_table_add(&namer->used, get_filename(path)) >= 0;
+}
+
+/**
+ * Initializes a UniqueNamer reading the names present in a directory.
+ * @param namer  The UniqueNamer structure to initialize (release it with `unique_namer_free()`).
+ * @param dir    The directory where the names are generated, it may not exist yet.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+MODULE_FUNC BOOL unique_namer_init(UniqueNamer* namer, const char* dir) {
+    char last_dir_char;
+    long long timer = stats_start_timer();
+    assert( namer!=NULL && dir!=NULL );
+
+    memset(namer, 0, sizeof(UniqueNamer));
+    last_dir_char  = dir[0]!='\0' ? dir[ strlen(dir)-1 ] : '/';
+    namer->dir_end = (last_dir_char=='/' || last_dir_char=='\\') ? NULL : "/";
+    namer->dir     = strdup_(dir);
+    if( !namer->dir ) { return FALSE; }
+    if( is_directory(dir) && !for_each_dir_entry(dir, _unique_namer_seed_entry, namer) ) {
+        if( namer->used.count==0 ) { warning("Cannot read directory '%s'", dir); }
+    }
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+    return TRUE;
+}
+
+/**
+ * Releases the memory used by a UniqueNamer.
+ * @param namer The UniqueNamer to release.
+ */
+MODULE_FUNC void unique_namer_free(UniqueNamer* namer) {
+    assert( namer!=NULL );
+    _name_table_free(&namer->used);
+    _name_table_free(&namer->requested);
+    free(namer->dir);
+    namer->dir = NULL;
+}
+
+/**
+ * Checks if a name is one of those that a namer generates for a filename.
+ * @param name      The name to check, e.g., "file_2_.txt".
+ * @param filename  The base filename without extension, e.g., "file".
+ * @param ext       The file extension including the dot, e.g., ".txt". (may be NULL or empty)
+ * @return TRUE if `name` is `filename+ext` or `filename_N_+ext`.
+ */
+MODULE_FUNC BOOL unique_namer_is_name_of(const char* name, const char* filename, const char* ext) {
+    size_t filename_length = strlen(filename), ext_length = ext ? strlen(ext) : 0;
+    size_t name_length     = strlen(name);
+    const char *ptr, *end;
+    assert( name!=NULL && filename!=NULL );
+
+    if( name_length < filename_length + ext_length ) { return FALSE; }
+    if( strncmp(name, filename, filename_length) != 0 ) { return FALSE; }
+    if( ext_length > 0 && strcmp(name + name_length - ext_length, ext) != 0 ) { return FALSE; }
+    ptr = name + filename_length; end = name + name_length - ext_length;
+    if( ptr == end ) { return TRUE; }
+    if( end - ptr < 3 || ptr[0] != '_' || end[-1] != '_' ) { return FALSE; }
+    for( ++ptr ; ptr < end - 1 ; ++ptr ) { if( *ptr < '0' || *ptr > '9' ) { return FALSE; } }
+    return TRUE;
+}
+
+/**
+ * Marks a name as used, so the namer never generates it.
+ * @param namer  The UniqueNamer.
+ * @param name   The name of the file, including its extension.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+MODULE_FUNC BOOL unique_namer_reserve(UniqueNamer* namer, const char* name) {
+    assert( namer!=NULL && name!=NULL );
+    return _name_table_add(&namer->used, name) >= 0;
+}
+
+/**
+ * Returns a path in the directory of the namer that has not been used before.
+ * 
+ * The names tried are `filename+ext`, `filename_2_+ext`, `filename_3_+ext`
+ * and so on, as `alloc_unique_path()` does, but starting from the number
+ * where the previous request for the same name stopped.
+ * 
+ * @param namer     The UniqueNamer.
+ * @param filename  The base filename without extension, e.g., "file". (must be a valid string)
+ * @param ext       The file extension including the dot, e.g., ".txt". (may be NULL or empty)
+ * @return
+ *    A dynamically allocated string containing the unique path, or NULL if
+ *    there was not enough memory or all the numbers are in use.
+ *    The caller is responsible for freeing this memory.
+ */
+MODULE_FUNC char* unique_namer_alloc_path(UniqueNamer* namer, const char* filename, const char* ext) {
+    char *requested, *name = NULL, *path; char number_str[16];
+    int slot, number;
+    long long timer = stats_start_timer();
+    assert( namer!=NULL && filename!=NULL );
+
+    requested = alloc_concat5(filename, ext, NULL, NULL, NULL);
+    slot      = requested ? _name_table_add(&namer->requested, requested) : -1;
+    free(requested);
+    if( slot < 0 ) { return NULL; }
+
+    for( number = namer->requested.numbers[slot] ; number <= 9999 ; ++number ) {
+        if( number > 1 ) { sprintf(number_str, "_%d_", number); }
+        name = alloc_concat5(filename, number > 1 ? number_str : NULL, ext, NULL, NULL);
+        if( !name ) { break; }
+        if( !namer->used.names || !namer->used.names[ _name_table_slot(&namer->used, name) ] ) { break; }
+        free(name); name = NULL;
+    }
+    namer->requested.numbers[slot] = number + 1;
+    if( name && _name_table_add(&namer->used, name) < 0 ) { free(name); name = NULL; }
+    path = name ? alloc_concat5(namer->dir, namer->dir_end, name, NULL, NULL) : NULL;
+    free(name);
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+    return path;
+}
+
+
 #endif /* FILE_DIR_H */
@@ -33,73 +33,161 @@
 #define FMT_HEX_H
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "common.h"
-#define _HEX_MAX_BYTECOUNT (16) /**< Maximum number of bytes in a record */
+#include "stats.h"
+#include "out_buf.h"
+#if !defined(FMT_HEX_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   include <emmintrin.h>
+#   define FMT_HEX_HAS_SSE2
+#elif !defined(FMT_HEX_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#   include <arm_neon.h>
+#   define FMT_HEX_HAS_NEON
+#endif
+#define _HEX_MAX_BYTECOUNT  (16)                 /**< Maximum number of bytes in a record            */
+#define _HEX_MAX_RECORD_LEN (1+2+4+2+2*255+2+1)  /**< Length of the longest record (including '\n') */
+
+/** The two uppercase hex digits of each byte value, "00" ... "FF" */
+static const char _HEX_DIGIT_PAIRS[513] =
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
 
 /*----------------------- INTERNAL HELPER FUNCTIONS ------------------------*/
 
 /**
- * Calculates the checksum for an Intel HEX record.
+ * Writes the two hex digits of a byte.
+ * @param out   Destination for the two characters
+ * @param byte  The byte value (0x00-0xFF)
+ */
+#define _HEX_PUT_BYTE(out, byte) \
+    ( (out)[0] = _HEX_DIGIT_PAIRS[2*(byte)], (out)[1] = _HEX_DIGIT_PAIRS[2*(byte)+1] )
+
+/**
+ * Encodes 16 bytes as 32 hex digits.
+ * @param out   Destination for the 32 characters
+ * @param data  Pointer to the 16 bytes to encode
+ * @return
+ *    The sum of the 16 bytes
+ */
+MODULE_FUNC unsigned _hex_encode16(char* out, const BYTE* data) {
+#if defined(FMT_HEX_HAS_SSE2)
+    const __m128i mask  = _mm_set1_epi8(0x0F);
+    const __m128i nine  = _mm_set1_epi8(9);
+    const __m128i zero  = _mm_set1_epi8('0');
+    const __m128i alpha = _mm_set1_epi8('A'-'0'-10);
+    __m128i bytes, high, low, first, second, sum;
+    bytes  = _mm_loadu_si128((const __m128i*)data);
+    high   = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+    low    = _mm_and_si128(bytes, mask);
+    first  = _mm_unpacklo_epi8(high, low);
+    second = _mm_unpackhi_epi8(high, low);
+    first  = _mm_add_epi8(_mm_add_epi8(first , zero), _mm_and_si128(_mm_cmpgt_epi8(first , nine), alpha));
+    second = _mm_add_epi8(_mm_add_epi8(second, zero), _mm_and_si128(_mm_cmpgt_epi8(second, nine), alpha));
+    _mm_storeu_si128((__m128i*)(out   ), first );
+    _mm_storeu_si128((__m128i*)(out+16), second);
+    sum = _mm_sad_epu8(bytes, _mm_setzero_si128());
+    return (unsigned)(_mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4));
+#elif defined(FMT_HEX_HAS_NEON)
+    const uint8x16_t nine  = vdupq_n_u8(9);
+    const uint8x16_t zero  = vdupq_n_u8('0');
+    const uint8x16_t alpha = vdupq_n_u8('A'-'0'-10);
+    uint8x16_t bytes; uint8x16x2_t digits; uint64x2_t sum;
+    bytes  = vld1q_u8(data);
+    digits = vzipq_u8(vshrq_n_u8(bytes, 4), vandq_u8(bytes, vdupq_n_u8(0x0F)));
+    digits.val[0] = vaddq_u8(vaddq_u8(digits.val[0], zero), vandq_u8(vcgtq_u8(digits.val[0], nine), alpha));
+    digits.val[1] = vaddq_u8(vaddq_u8(digits.val[1], zero), vandq_u8(vcgtq_u8(digits.val[1], nine), alpha));
+    vst1q_u8((uint8_t*)(out   ), digits.val[0]);
+    vst1q_u8((uint8_t*)(out+16), digits.val[1]);
+    sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(bytes)));
+    return (unsigned)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+#else
+    unsigned sum = 0, i;
+    for( i = 0 ; i < 16 ; ++i, out += 2 ) { _HEX_PUT_BYTE(out, data[i]); sum += data[i]; }
+    return sum;
+#endif
+}
+
+/**
+ * Builds a complete Intel HEX record in memory, computing its checksum on the fly.
+ * @param record    Destination buffer (at least _HEX_MAX_RECORD_LEN characters)
  * @param reg_type  Record type (0x00 for data record, 0x01 for EOF record, etc.)
- * @param address   16-bit memory address where the record is loaded
- * @param data      Pointer to the data bytes of the record
+ * @param address   Memory address where the record is loaded (only its lower 16 bits are used)
+ * @param data      Pointer to the data bytes of the record (may be NULL if datasize is 0)
  * @param datasize  Number of data bytes in the record (must be <= 255)
  * @return
- *    The 8-bit checksum value (0x00-0xFF)
+ *    The number of characters written to `record` (no '\0' terminator is added)
  */
-int _hex_checksum(unsigned reg_type, unsigned address, const BYTE* data, unsigned datasize) {
+MODULE_FUNC size_t _hex_build_record(char* record, unsigned reg_type, unsigned address, const BYTE* data, unsigned datasize) {
     unsigned sum, i;
-    assert( 0 <= reg_type && reg_type <= 255 );
-    assert( 0 <= address && address <= 65535 );
-    assert( data != NULL );
-    assert( 0 <= datasize && datasize <= 255 );
+    char*    out = record;
+    assert( reg_type <= 255 );
+    assert( data != NULL || datasize == 0 );
+    assert( datasize <= 255 );
 
-    sum  = datasize & 0xFF;
-    sum += (address >> 8) & 0xFF;
-    sum += (address     ) & 0xFF;
-    sum += reg_type & 0xFF;
-    for ( i = 0 ; i < datasize ; ++i ) { sum += data[i]; }
-    return (-sum) & 0xFF;
+    /* the address comes from the tape, a block that crosses the top of memory wraps around to 0000 */
+    address &= 0xFFFF;
+    sum = datasize + (address >> 8) + (address & 0xFF) + reg_type;
+    *out++ = ':';
+    _HEX_PUT_BYTE(out, datasize      ); out += 2;
+    _HEX_PUT_BYTE(out, address >> 8  ); out += 2;
+    _HEX_PUT_BYTE(out, address & 0xFF); out += 2;
+    _HEX_PUT_BYTE(out, reg_type      ); out += 2;
+    for( i = 0 ; i+16 <= datasize ; i += 16, out += 32 ) { sum += _hex_encode16(out, data + i); }
+    for(       ; i    <  datasize ; i +=  1, out +=  2 ) { _HEX_PUT_BYTE(out, data[i]); sum += data[i]; }
+    _HEX_PUT_BYTE(out, (-sum) & 0xFF); out += 2;
+    return (size_t)(out - record);
 }
 
+/*============================ PUBLIC FUNCTIONS ============================*/
+
 /**
- * Writes a data record to an Intel HEX file.
- * @param ofile     File pointer to the output file
- * @param address   16-bit memory address where the record is loaded
- * @param data      Pointer to the data bytes of the record
- * @param datasize  Number of data bytes in the record (must be <= 255)
+ * Calculates the length of the Intel HEX records written for a block of data.
+ * @param datasize  Number of bytes in the data
  * @return
- *    0 on success, or an error code indicating what went wrong
+ *    The number of characters written by `write_hex_data()`, including the line breaks
  */
-int _hex_fprint_data_record(FILE* ofile, unsigned address, const BYTE* data, unsigned datasize) {
-    const unsigned reg_type = 0x00;
-    unsigned i;
-
-    /* write the record */
-    fprintf(ofile, ":%02X%04X%02X", datasize, address, reg_type);
-    for( i=0 ; i < datasize ; i++ ) { fprintf(ofile, "%02X", data[i]); }
-    fprintf(ofile, "%02X", _hex_checksum(reg_type, address, data, datasize));
-    return 0;
+MODULE_FUNC size_t hex_data_length(unsigned datasize) {
+    const size_t record_overhead = 1+2+4+2+2+1; /* colon, count, address, type, checksum and '\n' */
+    size_t length = (size_t)(datasize / _HEX_MAX_BYTECOUNT) * (record_overhead + 2*_HEX_MAX_BYTECOUNT);
+    if( datasize % _HEX_MAX_BYTECOUNT ) { length += record_overhead + 2*(datasize % _HEX_MAX_BYTECOUNT); }
+    return length;
 }
 
 /**
- * Writes an EOF record to an Intel HEX file.
- * @param ofile  File pointer to the output file
+ * Writes binary data as Intel HEX records to an output buffer.
+ * 
+ * The addresses of the records wrap around at 64K, as the Z80 does, so
+ * the data of a block that crosses the top of memory continues at 0000.
+ * 
+ * @param out       Pointer to the output buffer
+ * @param address   16-bit memory address where the data is loaded
+ * @param data      Pointer to the binary data to be written
+ * @param datasize  Number of bytes in the data
  * @return
  *    0 on success, or an error code indicating what went wrong
  */
-int _hex_fprint_eof_record(FILE* ofile) {
-    const unsigned reg_type = 0x01;
-    const unsigned address  = 0x0000;
+MODULE_FUNC int write_hex_data(OutBuf* out, unsigned address, const BYTE* data, unsigned datasize) {
+    char record[_HEX_MAX_RECORD_LEN];
+    unsigned bytes_left, chunk_size, i;
+    size_t length;
 
-    /* write the record */
-    fprintf(ofile, ":%02X%04X%02X", 0x00, address, reg_type);
-    fprintf(ofile, "%02X", _hex_checksum(reg_type, address, NULL, 0));
-    return 0;
+    /* split data into chunks of _HEX_MAX_BYTECOUNT bytes and write each as a data record */
+    for ( i = 0 ; i < datasize ; i += _HEX_MAX_BYTECOUNT ) {
+        bytes_left = (datasize - i);
+        chunk_size = bytes_left < _HEX_MAX_BYTECOUNT ? bytes_left : _HEX_MAX_BYTECOUNT;
+        length = _hex_build_record(record, 0x00, address + i, data + i, chunk_size);
+        record[length++] = '\n';
+        out_buf_write(out, record, length);
+    }
+    return out->err_code;
 }
 
-/*============================ PUBLIC FUNCTIONS ============================*/
-
 /**
  * Prints binary data as Intel HEX records.
  * @param ofile     File pointer to the output file
@@ -109,17 +197,23 @@ int _hex_fprint_eof_record(FILE* ofile) {
  * @return
  *    0 on success, or an error code indicating what went wrong
  */
-int fprint_hex_data(FILE* ofile, unsigned address, const BYTE* data, unsigned datasize) {
-    unsigned bytes_left, chunk_size, i;
+MODULE_FUNC int fprint_hex_data(FILE* ofile, unsigned address, const BYTE* data, unsigned datasize) {
+    char fallback[16*1024]; char *memory; size_t memory_size;
+    OutBuf out;
+    long long timer = stats_start_timer();
 
-    /* split data into chunks of _HEX_MAX_BYTECOUNT bytes and print each as a data record */
-    for ( i = 0 ; i < datasize ; i += _HEX_MAX_BYTECOUNT ) {
-        bytes_left = (datasize - i);
-        chunk_size = bytes_left < _HEX_MAX_BYTECOUNT ? bytes_left : _HEX_MAX_BYTECOUNT;
-        _hex_fprint_data_record(ofile, address + i, data + i, chunk_size);
-        fprintf(ofile, "\n");
-    }
-    return 0;
+    /* the whole output of the block is built in memory and written at once, */
+    /* if the memory can't be allocated then a smaller buffer is used         */
+    memory_size = ((size_t)datasize / _HEX_MAX_BYTECOUNT + 1) * (1+2+4+2+2*_HEX_MAX_BYTECOUNT+2+1);
+    memory      = (char*)malloc(memory_size);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( memory == NULL ) { memory = fallback; memory_size = sizeof(fallback); }
+    out_buf_init(&out, ofile, memory, memory_size);
+    write_hex_data(&out, address, data, datasize);
+    out_buf_flush(&out);
+    if( memory != fallback ) { free(memory); }
+    stats_end_timer(STATS_TIME_HEX, timer);
+    return out.err_code;
 }
 
 
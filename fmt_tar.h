@@ -0,0 +1,166 @@
+/*
+| File    : fmt_tar.h
+| Purpose : Support for writing tar archives (POSIX ustar) as a stream.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef FMT_TAR_H
+#define FMT_TAR_H
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "stats.h"
+
+#define TAR_BLOCK_SIZE    512  /**< Archives are written in blocks of this size */
+#define TAR_NAME_SIZE     100  /**< Size of the name field of the member headers */
+#define TAR_PREFIX_SIZE   155  /**< Size of the prefix field of the member headers (ustar) */
+#define TAR_COPY_BUFFER   (64*1024) /**< Size of the buffer used to copy members from a file */
+
+/*============================ INTERNAL HELPERS ============================*/
+
+/**
+ * Stores a number in octal, as tar headers do, padded with zeros and null-terminated.
+ * @param field  The header field.
+ * @param size   Size of the field in bytes (including the terminator).
+ * @param value  The value to store.
+ */
+MODULE_FUNC void _tar_put_octal(char* field, int size, unsigned long long value) {
+    field[--size] = '\0';
+    while( size > 0 ) { field[--size] = (char)('0' + (value & 7)); value >>= 3; }
+}
+
+/**
+ * Writes the zeros that complete the last block of a member.
+ * @param output  The archive stream.
+ * @param size    Size of the member data in bytes.
+ * @return TRUE on success, FALSE if the write failed.
+ */
+MODULE_FUNC BOOL _tar_write_padding(FILE* output, unsigned long long size) {
+    static const char ZEROS[TAR_BLOCK_SIZE];
+    size_t padding = (size_t)((TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+    return padding == 0 || fwrite(ZEROS, 1, padding, output) == padding;
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Writes the header of a regular file member of a tar archive.
+ * 
+ * Names longer than 100 characters are split between the prefix and name
+ * fields (ustar), names that can not be split that way are not supported.
+ * 
+ * @param output  The archive stream.
+ * @param name    The path of the member within the archive, e.g. "game/loader.bas".
+ * @param size    Size of the member data in bytes.
+ * @param mtime   Modification time of the member (seconds since the epoch).
+ * @return TRUE on success, FALSE if the name does not fit or the write failed.
+ */
+MODULE_FUNC BOOL tar_write_header(FILE* output, const char* name, unsigned long long size, long long mtime) {
+    char header[TAR_BLOCK_SIZE];
+    size_t length = strlen(name), split = 0;
+    unsigned checksum = 0; int i;
+    assert( output != NULL && name != NULL );
+
+    /* a long name is split at the first '/' that leaves a short enough name */
+    if( length > TAR_NAME_SIZE ) {
+        for( split = length - TAR_NAME_SIZE - 1 ; split < length && name[split] != '/' ; ++split ) { }
+        if( split >= length || split > TAR_PREFIX_SIZE ) { return FALSE; }
+    }
+    memset(header, 0, sizeof(header));
+    if( split > 0 ) { memcpy(&header[345], name, split); name += split + 1; }
+    memcpy(&header[0], name, strlen(name));
+    _tar_put_octal(&header[100],  8, 0644);               /* mode  */
+    _tar_put_octal(&header[108],  8, 0);                  /* uid   */
+    _tar_put_octal(&header[116],  8, 0);                  /* gid   */
+    _tar_put_octal(&header[124], 12, size);               /* size  */
+    _tar_put_octal(&header[136], 12, mtime > 0 ? (unsigned long long)mtime : 0);
+    header[156] = '0';                                    /* regular file */
+    memcpy(&header[257], "ustar", 6);
+    memcpy(&header[263], "00", 2);
+
+    /* the checksum is calculated with its own field filled with spaces */
+    memset(&header[148], ' ', 8);
+    for( i = 0 ; i < TAR_BLOCK_SIZE ; ++i ) { checksum += (unsigned char)header[i]; }
+    _tar_put_octal(&header[148], 7, checksum);
+    STATS_ADD(STATS_OUTPUT_BYTES, TAR_BLOCK_SIZE);
+    return fwrite(header, 1, sizeof(header), output) == sizeof(header);
+}
+
+/**
+ * Writes a regular file member of a tar archive from memory.
+ * @param output  The archive stream.
+ * @param name    The path of the member within the archive.
+ * @param data    Pointer to the member data.
+ * @param size    Size of the member data in bytes.
+ * @param mtime   Modification time of the member (seconds since the epoch).
+ * @return TRUE on success, FALSE if the name does not fit or the write failed.
+ */
+MODULE_FUNC BOOL tar_write_member(FILE* output, const char* name, const BYTE* data, size_t size, long long mtime) {
+    if( !tar_write_header(output, name, size, mtime) ) { return FALSE; }
+    if( size > 0 && fwrite(data, 1, size, output) != size ) { return FALSE; }
+    STATS_ADD(STATS_OUTPUT_BYTES, size);
+    return _tar_write_padding(output, size);
+}
+
+/**
+ * Writes a regular file member of a tar archive copying its data from a file.
+ * @param output  The archive stream.
+ * @param name    The path of the member within the archive.
+ * @param source  The file with the member data, read from its beginning.
+ * @param size    Size of the member data in bytes.
+ * @param mtime   Modification time of the member (seconds since the epoch).
+ * @return TRUE on success, FALSE if the name does not fit, or the read or write failed.
+ */
+MODULE_FUNC BOOL tar_copy_member(FILE* output, const char* name, FILE* source, unsigned long long size, long long mtime) {
+    char buffer[TAR_COPY_BUFFER];
+    unsigned long long remaining = size;
+    size_t chunk;
+
+    if( !tar_write_header(output, name, size, mtime) ) { return FALSE; }
+    rewind(source);
+    while( remaining > 0 ) {
+        chunk = remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+        if( fread(buffer, 1, chunk, source) != chunk || fwrite(buffer, 1, chunk, output) != chunk ) { return FALSE; }
+        remaining -= chunk;
+    }
+    STATS_ADD(STATS_OUTPUT_BYTES, size);
+    return _tar_write_padding(output, size);
+}
+
+/**
+ * Writes the end of a tar archive (two blocks of zeros).
+ * @param output  The archive stream.
+ * @return TRUE on success, FALSE if the write failed.
+ */
+MODULE_FUNC BOOL tar_write_end(FILE* output) {
+    static const char ZEROS[2 * TAR_BLOCK_SIZE];
+    return fwrite(ZEROS, 1, sizeof(ZEROS), output) == sizeof(ZEROS);
+}
+
+#endif /* FMT_TAR_H */
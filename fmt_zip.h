@@ -0,0 +1,346 @@
+/*
+| File    : fmt_zip.h
+| Purpose : Reading of tapes compressed with gzip or stored in zip archives.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef FMT_ZIP_H
+#define FMT_ZIP_H
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "stats.h"
+#include "inflate.h"
+
+#define ZIP_LOCAL_SIGNATURE    0x04034B50UL /**< Signature of the local header of each member */
+#define ZIP_CENTRAL_SIGNATURE  0x02014B50UL /**< Signature of each entry of the central directory */
+#define ZIP_END_SIGNATURE      0x06054B50UL /**< Signature of the end of central directory record */
+#define ZIP_LOCAL_SIZE         30           /**< Size of a local header, without its name and extra field */
+#define ZIP_CENTRAL_SIZE       46           /**< Size of a central directory entry, without its name, extra field and comment */
+#define ZIP_END_SIZE           22           /**< Size of the end of central directory record, without its comment */
+#define ZIP_MAX_COMMENT        65535        /**< Maximum size of the comment at the end of an archive */
+
+/**
+ * How the data read through an Unzipper is stored
+ */
+typedef enum UNZIP_FORMAT {
+    UNZIP_FORMAT_PLAIN,     /**< Not compressed, the bytes are passed as they are */
+    UNZIP_FORMAT_GZIP,      /**< A gzip file, possibly with several members one after another */
+    UNZIP_FORMAT_STORED,    /**< A member of a zip archive stored without compression */
+    UNZIP_FORMAT_DEFLATED   /**< A member of a zip archive compressed with DEFLATE */
+} UNZIP_FORMAT;
+
+/**
+ * A member of a zip archive, as listed in its central directory
+ */
+typedef struct ZipEntry {
+    char*          name;             /**< Name of the member, including its folders (allocated) */
+    unsigned       method;           /**< Compression method (0 = stored, 8 = DEFLATE) */
+    unsigned       flags;            /**< General purpose flags (bit 0 = encrypted) */
+    unsigned long  crc;              /**< CRC-32 of the uncompressed data */
+    size_t         compressed_size;  /**< Size of the data in the archive */
+    size_t         size;             /**< Size of the uncompressed data */
+    size_t         local_offset;     /**< Offset of the local header of the member within the archive */
+} ZipEntry;
+
+/**
+ * The central directory of a zip archive
+ */
+typedef struct ZipDirectory {
+    ZipEntry* entries;  /**< The members of the archive, in the order they are listed */
+    int       count;    /**< Number of elements in `entries` */
+} ZipDirectory;
+
+/**
+ * A reader of the data in a gzip file or in a member of a zip archive, decompressed on the fly
+ * 
+ * Plain files can also be read through it, then the data is passed as is.
+ * The checksums of the compressed data are verified as the end of each
+ * member is reached. It keeps an Inflater, so it is better allocated on
+ * the heap.
+ */
+typedef struct Unzipper {
+    Inflater       inflater;       /**< The decoder, also used to read the bytes that are not compressed */
+    UNZIP_FORMAT   format;         /**< How the data is stored */
+    unsigned long  crc;            /**< CRC-32 of the data read so far from the current member */
+    size_t         size;           /**< Number of bytes read so far from the current member */
+    unsigned long  expected_crc;   /**< CRC-32 of the member of a zip archive, from its directory */
+    size_t         expected_size;  /**< Size of the member of a zip archive, from its directory */
+    BOOL           at_end;         /**< TRUE once all the data has been read */
+    const char*    error;          /**< Description of the problem found in the data, NULL if none */
+} Unzipper;
+
+/*============================ INTERNAL HELPERS ============================*/
+
+/**
+ * Reads the header of a gzip member, leaving the data at its compressed stream.
+ * @return TRUE on success, FALSE if the header is not valid (then `error` is set).
+ */
+MODULE_FUNC BOOL _unzip_gzip_header(Unzipper* unzip) {
+    Inflater* inf = &unzip->inflater;
+    BYTE header[10], byte; unsigned flags, skip;
+
+    if( inflate_read_input(inf, header, 10) != 10 || header[0] != 0x1F || header[1] != 0x8B )
+    { unzip->error = "Invalid gzip header"; return FALSE; }
+    flags = header[3];
+    if( header[2] != 8 || (flags & 0xE0) != 0 ) { unzip->error = "Unsupported gzip compression method"; return FALSE; }
+
+    /* the optional fields are skipped: extra data, file name, comment and header CRC */
+    if( flags & 0x04 ) {
+        if( inflate_read_input(inf, header, 2) != 2 ) { unzip->error = "Invalid gzip header"; return FALSE; }
+        for( skip = GET_LE_WORD(header, 0) ; skip > 0 && inflate_read_input(inf, &byte, 1) == 1 ; --skip ) { }
+        if( skip > 0 ) { unzip->error = "Invalid gzip header"; return FALSE; }
+    }
+    if( flags & 0x08 ) { while( inflate_read_input(inf, &byte, 1) == 1 && byte != 0 ) { } }
+    if( flags & 0x10 ) { while( inflate_read_input(inf, &byte, 1) == 1 && byte != 0 ) { } }
+    if( (flags & 0x02) && inflate_read_input(inf, header, 2) != 2 ) { unzip->error = "Invalid gzip header"; return FALSE; }
+    return TRUE;
+}
+
+/**
+ * Checks the data of the member that has just been read whole, starting the next one if any.
+ * @param unzip  The Unzipper.
+ */
+MODULE_FUNC void _unzip_end_member(Unzipper* unzip) {
+    Inflater* inf = &unzip->inflater;
+    BYTE trailer[8];
+
+    unzip->at_end = TRUE;
+    if( unzip->format == UNZIP_FORMAT_PLAIN ) { return; }
+    if( inf->error ) { unzip->error = inf->error; return; }
+    if( unzip->format != UNZIP_FORMAT_STORED && !inflate_is_done(inf) ) { unzip->error = "The compressed data is truncated"; return; }
+    if( unzip->format != UNZIP_FORMAT_GZIP ) {
+        if( unzip->size != unzip->expected_size || unzip->crc != unzip->expected_crc )
+        { unzip->error = "The data is damaged (CRC mismatch)"; }
+        return;
+    }
+    if( inflate_read_input(inf, trailer, 8) != 8 ) { unzip->error = "The compressed data is truncated"; return; }
+    if( GET_LE_DWORD(trailer, 0) != unzip->crc || GET_LE_DWORD(trailer, 4) != (unzip->size & 0xFFFFFFFFUL) )
+    { unzip->error = "The data is damaged (CRC mismatch)"; return; }
+
+    /* concatenated gzip files are read as one, anything else after them is ignored */
+    if( inflate_peek_input(inf, trailer, 3) == 3 && trailer[0] == 0x1F && trailer[1] == 0x8B && _unzip_gzip_header(unzip) ) {
+        inflate_reset(inf);
+        unzip->crc    = 0;
+        unzip->size   = 0;
+        unzip->at_end = FALSE;
+    }
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Checks if some data starts as a gzip file.
+ * @param magic   The first bytes of the data.
+ * @param length  Number of bytes in `magic`.
+ * @return TRUE if the data starts with the signature of gzip and the DEFLATE method.
+ */
+MODULE_FUNC BOOL gzip_is_file(const BYTE* magic, size_t length) {
+    return length >= 3 && magic[0] == 0x1F && magic[1] == 0x8B && magic[2] == 8;
+}
+
+/**
+ * Checks if some data starts as a zip archive.
+ * @param magic   The first bytes of the data.
+ * @param length  Number of bytes in `magic`.
+ * @return TRUE if the data starts with a local header or with the end record of an empty archive.
+ */
+MODULE_FUNC BOOL zip_is_archive(const BYTE* magic, size_t length) {
+    return length >= 4 && (GET_LE_DWORD(magic, 0) == ZIP_LOCAL_SIGNATURE || GET_LE_DWORD(magic, 0) == ZIP_END_SIGNATURE);
+}
+
+/**
+ * Releases the memory used by the central directory of a zip archive.
+ * @param dir  The ZipDirectory to release.
+ */
+MODULE_FUNC void zip_free_directory(ZipDirectory* dir) {
+    int i;
+    assert( dir != NULL );
+    for( i = 0 ; i < dir->count ; ++i ) { free(dir->entries[i].name); }
+    free(dir->entries);
+    dir->entries = NULL;
+    dir->count   = 0;
+}
+
+/**
+ * Reads the central directory of a zip archive.
+ * 
+ * The directory is at the end of the archive, so the members can be read
+ * in any order (or at the same time, each from its own FILE) without
+ * reading the data of the ones before. ZIP64 archives are not supported.
+ * 
+ * @param dir   The ZipDirectory where the entries are stored (release it with `zip_free_directory()`).
+ * @param file  The zip archive opened in binary read mode.
+ * @return TRUE on success, FALSE if the file is not a valid zip archive or there was not enough memory.
+ */
+MODULE_FUNC BOOL zip_read_directory(ZipDirectory* dir, FILE* file) {
+    BYTE *tail = NULL, *central = NULL, *ptr;
+    long file_size, tail_size, end;
+    size_t central_size, central_offset, offset, name_length;
+    int entry_count;
+    BOOL success = FALSE;
+    ZipEntry* entry;
+    assert( dir != NULL && file != NULL );
+
+    memset(dir, 0, sizeof(ZipDirectory));
+    if( fseek(file, 0, SEEK_END) != 0 || (file_size = ftell(file)) < ZIP_END_SIZE ) { return FALSE; }
+    tail_size = file_size < ZIP_END_SIZE + ZIP_MAX_COMMENT ? file_size : ZIP_END_SIZE + ZIP_MAX_COMMENT;
+    tail      = (BYTE*)malloc((size_t)tail_size);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !tail || fseek(file, file_size - tail_size, SEEK_SET) != 0 || fread(tail, 1, (size_t)tail_size, file) != (size_t)tail_size )
+    { free(tail); return FALSE; }
+
+    /* the end record is searched backwards, since a comment may follow it */
+    for( end = tail_size - ZIP_END_SIZE ; end >= 0 && GET_LE_DWORD(tail, end) != ZIP_END_SIGNATURE ; --end ) { }
+    if( end >= 0 ) {
+        entry_count    = (int)GET_LE_WORD(tail, end + 10);
+        central_size   = (size_t)GET_LE_DWORD(tail, end + 12);
+        central_offset = (size_t)GET_LE_DWORD(tail, end + 16);
+        success = central_offset <= (size_t)file_size && central_size <= (size_t)file_size - central_offset;
+    }
+    free(tail);
+    if( success ) {
+        central      = (BYTE*)malloc(central_size > 0 ? central_size : 1);
+        dir->entries = (ZipEntry*)calloc(entry_count > 0 ? (size_t)entry_count : 1, sizeof(ZipEntry));
+        STATS_ADD(STATS_ALLOCATIONS, 2);
+        success = central && dir->entries && fseek(file, (long)central_offset, SEEK_SET) == 0 &&
+                  fread(central, 1, central_size, file) == central_size;
+    }
+    for( offset = 0 ; success && dir->count < entry_count ; offset += ZIP_CENTRAL_SIZE + name_length ) {
+        ptr     = central + offset;
+        success = central_size - offset >= ZIP_CENTRAL_SIZE && GET_LE_DWORD(ptr, 0) == ZIP_CENTRAL_SIGNATURE;
+        if( !success ) { break; }
+        name_length = GET_LE_WORD(ptr, 28);
+        success     = central_size - offset - ZIP_CENTRAL_SIZE >= name_length;
+        entry       = &dir->entries[ dir->count ];
+        entry->name = success ? (char*)malloc(name_length + 1) : NULL;
+        STATS_ADD(STATS_ALLOCATIONS, 1);
+        if( !entry->name ) { success = FALSE; break; }
+        memcpy(entry->name, ptr + ZIP_CENTRAL_SIZE, name_length);
+        entry->name[name_length] = '\0';
+        entry->flags             = GET_LE_WORD(ptr, 8);
+        entry->method            = GET_LE_WORD(ptr, 10);
+        entry->crc               = GET_LE_DWORD(ptr, 16);
+        entry->compressed_size   = (size_t)GET_LE_DWORD(ptr, 20);
+        entry->size              = (size_t)GET_LE_DWORD(ptr, 24);
+        entry->local_offset      = (size_t)GET_LE_DWORD(ptr, 42);
+        dir->count++;
+        name_length += GET_LE_WORD(ptr, 30) + GET_LE_WORD(ptr, 32); /* the extra field and the comment are skipped */
+        success      = central_size - offset - ZIP_CENTRAL_SIZE >= name_length;
+    }
+    free(central);
+    if( !success ) { zip_free_directory(dir); }
+    return success;
+}
+
+/**
+ * Starts reading a file that may be compressed with gzip, from its current position.
+ * @param unzip  The Unzipper structure to initialize.
+ * @param file   The file opened in binary read mode, it doesn't need to support `fseek()`.
+ * @return TRUE on success, FALSE if its gzip header is not valid (then `error` is set).
+ */
+MODULE_FUNC BOOL unzip_open(Unzipper* unzip, FILE* file) {
+    BYTE magic[3];
+    assert( unzip != NULL && file != NULL );
+    inflate_init(&unzip->inflater, file, INFLATE_UNLIMITED);
+    unzip->format        = UNZIP_FORMAT_PLAIN;
+    unzip->crc           = 0;
+    unzip->size          = 0;
+    unzip->expected_crc  = 0;
+    unzip->expected_size = 0;
+    unzip->at_end        = FALSE;
+    unzip->error         = NULL;
+    if( inflate_peek_input(&unzip->inflater, magic, 3) == 3 && gzip_is_file(magic, 3) ) {
+        unzip->format = UNZIP_FORMAT_GZIP;
+        return _unzip_gzip_header(unzip);
+    }
+    return TRUE;
+}
+
+/**
+ * Starts reading a member of a zip archive.
+ * @param unzip  The Unzipper structure to initialize.
+ * @param file   The zip archive opened in binary read mode.
+ * @param entry  The member to read, from the directory of the archive.
+ * @return TRUE on success, FALSE if the member can not be read (then `error` is set).
+ */
+MODULE_FUNC BOOL unzip_open_member(Unzipper* unzip, FILE* file, const ZipEntry* entry) {
+    BYTE local[ZIP_LOCAL_SIZE];
+    assert( unzip != NULL && file != NULL && entry != NULL );
+    unzip->format        = entry->method == 0 ? UNZIP_FORMAT_STORED : UNZIP_FORMAT_DEFLATED;
+    unzip->crc           = 0;
+    unzip->size          = 0;
+    unzip->expected_crc  = entry->crc;
+    unzip->expected_size = entry->size;
+    unzip->at_end        = FALSE;
+    unzip->error         = NULL;
+
+    if     ( entry->flags & 0x01 )                  { unzip->error = "Encrypted zip members are not supported"; }
+    else if( entry->method != 0 && entry->method != 8 ) { unzip->error = "Unsupported zip compression method"; }
+    else if( fseek(file, (long)entry->local_offset, SEEK_SET) != 0 ||
+             fread(local, 1, ZIP_LOCAL_SIZE, file) != ZIP_LOCAL_SIZE || GET_LE_DWORD(local, 0) != ZIP_LOCAL_SIGNATURE ||
+             fseek(file, (long)(GET_LE_WORD(local, 26) + GET_LE_WORD(local, 28)), SEEK_CUR) != 0 )
+    { unzip->error = "Invalid local header in the zip archive"; }
+    if( unzip->error ) { return FALSE; }
+    inflate_init(&unzip->inflater, file, entry->compressed_size);
+    return TRUE;
+}
+
+/**
+ * Reads the next bytes of data, decompressing them (a function compatible with ZXSReader).
+ * @param user    Pointer to the Unzipper.
+ * @param buffer  Where the bytes are stored.
+ * @param size    Number of bytes to read.
+ * @return
+ *    The number of bytes read, less than `size` at the end of the data
+ *    or if the data is damaged (then `error` is set).
+ */
+MODULE_FUNC size_t unzip_read(void* user, BYTE* buffer, size_t size) {
+    Unzipper* unzip = (Unzipper*)user;
+    size_t done = 0, count;
+    BOOL   ended;
+    assert( unzip != NULL && buffer != NULL );
+
+    while( done < size && !unzip->at_end ) {
+        if( unzip->format == UNZIP_FORMAT_PLAIN || unzip->format == UNZIP_FORMAT_STORED ) {
+            count = inflate_read_input(&unzip->inflater, buffer + done, size - done);
+        } else {
+            count = inflate_read(&unzip->inflater, buffer + done, size - done);
+        }
+        if( unzip->format != UNZIP_FORMAT_PLAIN ) { unzip->crc = crc32_update(unzip->crc, buffer + done, count); }
+        ended        = count < size - done;
+        unzip->size += count;
+        done        += count;
+        if( ended ) { _unzip_end_member(unzip); }
+    }
+    return done;
+}
+
+#endif /* FMT_ZIP_H */
@@ -0,0 +1,139 @@
+/*
+| File    : hash64.h
+| Purpose : Fast non-cryptographic 64-bit hash (XXH64) of blocks of data.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef HASH64_H
+#define HASH64_H
+#include <stddef.h>
+#include <string.h>
+#include "common.h"
+
+/* The primes used by the XXH64 algorithm */
+#define _HASH64_PRIME1 0x9E3779B185EBCA87ULL
+#define _HASH64_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define _HASH64_PRIME3 0x165667B19E3779F9ULL
+#define _HASH64_PRIME4 0x85EBCA77C2B2AE63ULL
+#define _HASH64_PRIME5 0x27D4EB2F165667C5ULL
+
+/* Rotates a 64-bit value `r` bits to the left */
+#define _HASH64_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/*============================ INTERNAL HELPERS ============================*/
+
+MODULE_FUNC unsigned long long _hash64_read64(const BYTE* ptr) {
+    return  (unsigned long long)ptr[0]        | (unsigned long long)ptr[1] <<  8 |
+            (unsigned long long)ptr[2] << 16  | (unsigned long long)ptr[3] << 24 |
+            (unsigned long long)ptr[4] << 32  | (unsigned long long)ptr[5] << 40 |
+            (unsigned long long)ptr[6] << 48  | (unsigned long long)ptr[7] << 56 ;
+}
+
+MODULE_FUNC unsigned long long _hash64_read32(const BYTE* ptr) {
+    return  (unsigned long long)ptr[0]        | (unsigned long long)ptr[1] <<  8 |
+            (unsigned long long)ptr[2] << 16  | (unsigned long long)ptr[3] << 24 ;
+}
+
+MODULE_FUNC unsigned long long _hash64_round(unsigned long long acc, unsigned long long input) {
+    acc += input * _HASH64_PRIME2;
+    acc  = _HASH64_ROTL(acc, 31);
+    return acc * _HASH64_PRIME1;
+}
+
+MODULE_FUNC unsigned long long _hash64_merge_round(unsigned long long acc, unsigned long long value) {
+    acc ^= _hash64_round(0, value);
+    return acc * _HASH64_PRIME1 + _HASH64_PRIME4;
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Calculates the 64-bit hash of a block of data.
+ * 
+ * It implements the XXH64 algorithm, so the values are the same as those
+ * of the reference xxHash library (e.g. `xxhsum -H64`), and processes the
+ * data 32 bytes at a time with four independent accumulators.
+ * 
+ * @param data  Pointer to the data to hash.
+ * @param size  Number of bytes in `data`.
+ * @param seed  Initial value, different seeds give unrelated hashes.
+ * @return The 64-bit hash of the data.
+ */
+MODULE_FUNC unsigned long long hash64(const BYTE* data, size_t size, unsigned long long seed) {
+    const BYTE* const end = data + size;
+    unsigned long long v1, v2, v3, v4, hash;
+
+    if( size >= 32 ) {
+        const BYTE* const limit = end - 32;
+        v1 = seed + _HASH64_PRIME1 + _HASH64_PRIME2;
+        v2 = seed + _HASH64_PRIME2;
+        v3 = seed;
+        v4 = seed - _HASH64_PRIME1;
+        do {
+            v1 = _hash64_round(v1, _hash64_read64(data     ));
+            v2 = _hash64_round(v2, _hash64_read64(data +  8));
+            v3 = _hash64_round(v3, _hash64_read64(data + 16));
+            v4 = _hash64_round(v4, _hash64_read64(data + 24));
+            data += 32;
+        } while( data <= limit );
+        hash = _HASH64_ROTL(v1, 1) + _HASH64_ROTL(v2, 7) + _HASH64_ROTL(v3, 12) + _HASH64_ROTL(v4, 18);
+        hash = _hash64_merge_round(hash, v1);
+        hash = _hash64_merge_round(hash, v2);
+        hash = _hash64_merge_round(hash, v3);
+        hash = _hash64_merge_round(hash, v4);
+    }
+    else {
+        hash = seed + _HASH64_PRIME5;
+    }
+    hash += (unsigned long long)size;
+
+    /* remaining bytes (less than 32) */
+    for( ; data + 8 <= end ; data += 8 ) {
+        hash ^= _hash64_round(0, _hash64_read64(data));
+        hash  = _HASH64_ROTL(hash, 27) * _HASH64_PRIME1 + _HASH64_PRIME4;
+    }
+    if( data + 4 <= end ) {
+        hash ^= _hash64_read32(data) * _HASH64_PRIME1;
+        hash  = _HASH64_ROTL(hash, 23) * _HASH64_PRIME2 + _HASH64_PRIME3;
+        data += 4;
+    }
+    for( ; data < end ; ++data ) {
+        hash ^= (*data) * _HASH64_PRIME5;
+        hash  = _HASH64_ROTL(hash, 11) * _HASH64_PRIME1;
+    }
+
+    /* final mix */
+    hash ^= hash >> 33;
+    hash *= _HASH64_PRIME2;
+    hash ^= hash >> 29;
+    hash *= _HASH64_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+#endif /* HASH64_H */
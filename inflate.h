@@ -0,0 +1,534 @@
+/*
+| File    : inflate.h
+| Purpose : Streaming decoder of DEFLATE compressed data (RFC 1951).
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef INFLATE_H
+#define INFLATE_H
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+
+#define INFLATE_WINDOW_SIZE  32768     /**< Size of the history the matches copy from (always a power of two) */
+#define INFLATE_INPUT_SIZE   (64*1024) /**< Size of the buffer the compressed data is read into */
+#define INFLATE_MAX_BITS     15        /**< Maximum length of a Huffman code */
+#define INFLATE_FAST_BITS    10        /**< Codes up to this length are decoded with a single table lookup */
+#define INFLATE_MAX_SYMBOLS  288       /**< Number of symbols of the largest code (literals and lengths) */
+#define INFLATE_UNLIMITED    ((size_t)-1) /**< Input size meaning that the data goes on until the end of the file */
+
+/**
+ * A canonical Huffman code, as used by the compressed blocks
+ */
+typedef struct InflateHuffman {
+    short          count[INFLATE_MAX_BITS + 1];     /**< Number of codes of each length */
+    short          symbol[INFLATE_MAX_SYMBOLS];     /**< The symbols, sorted by their code */
+    unsigned short fast[1 << INFLATE_FAST_BITS];    /**< For the next bits: symbol << 4 | code length, or 0 if the code is longer */
+} InflateHuffman;
+
+/**
+ * The part of a DEFLATE stream being decoded
+ */
+typedef enum INFLATE_STATE {
+    INFLATE_STATE_BLOCK,    /**< Next is the header of a block */
+    INFLATE_STATE_STORED,   /**< Inside a block of uncompressed data */
+    INFLATE_STATE_CODES,    /**< Inside a block of Huffman codes */
+    INFLATE_STATE_END       /**< The last block has been decoded */
+} INFLATE_STATE;
+
+/**
+ * A decoder of DEFLATE compressed data read from a file
+ * 
+ * The data is decoded on demand, as much as requested each time, so it is
+ * never stored whole anywhere: only the last 32 KB decoded are kept, since
+ * the matches copy from them. The structure is about 100 KB, it is better
+ * allocated on the heap.
+ */
+typedef struct Inflater {
+    FILE*          file;            /**< The file the compressed data is read from */
+    size_t         input_left;      /**< Bytes that can still be read from `file` (INFLATE_UNLIMITED = until its end) */
+    size_t         input_pos;       /**< Position of the next byte in `input` */
+    size_t         input_length;    /**< Number of bytes in `input` */
+    unsigned long  bits;            /**< Bits already taken from the input but not consumed yet (the next one in bit 0) */
+    int            bit_count;       /**< Number of bits in `bits` */
+    INFLATE_STATE  state;           /**< The part of the stream being decoded */
+    BOOL           last_block;      /**< TRUE if the current block is the last one */
+    unsigned       stored_left;     /**< Bytes left in the current stored block */
+    unsigned       copy_length;     /**< Bytes left to copy of the current match */
+    unsigned       copy_distance;   /**< Distance back in the history of the current match */
+    unsigned       window_pos;      /**< Position in `window` where the next byte decoded is stored */
+    size_t         total_out;       /**< Number of bytes decoded so far */
+    const char*    error;           /**< Description of the problem found in the data, NULL if none */
+    InflateHuffman lengths;         /**< Code of the literals, the end of block and the match lengths */
+    InflateHuffman distances;       /**< Code of the match distances */
+    BYTE           window[INFLATE_WINDOW_SIZE]; /**< The last bytes decoded */
+    BYTE           input[INFLATE_INPUT_SIZE];   /**< Compressed data read from `file` */
+} Inflater;
+
+/*============================ INTERNAL HELPERS ============================*/
+
+static const unsigned short INFLATE_LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE INFLATE_LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short INFLATE_DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE INFLATE_DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/**
+ * Reads more compressed data from the file when the input buffer is empty.
+ * @return TRUE if there is input available, FALSE at the end of the data.
+ */
+MODULE_FUNC BOOL _inflate_fill_input(Inflater* inf) {
+    size_t count;
+    if( inf->input_pos < inf->input_length ) { return TRUE; }
+    count = inf->input_left < INFLATE_INPUT_SIZE ? inf->input_left : INFLATE_INPUT_SIZE;
+    inf->input_pos    = 0;
+    inf->input_length = count > 0 ? fread(inf->input, 1, count, inf->file) : 0;
+    if( inf->input_left != INFLATE_UNLIMITED ) { inf->input_left -= inf->input_length; }
+    return inf->input_length > 0;
+}
+
+/**
+ * Loads input bytes until the bit buffer holds at least `count` bits (fewer at the end of the input).
+ */
+MODULE_FUNC void _inflate_need(Inflater* inf, int count) {
+    while( inf->bit_count < count && _inflate_fill_input(inf) ) {
+        inf->bits      |= (unsigned long)inf->input[ inf->input_pos++ ] << inf->bit_count;
+        inf->bit_count += 8;
+    }
+}
+
+/**
+ * Takes a number of bits from the input (the first one in bit 0), setting `error` if the input ends before.
+ */
+MODULE_FUNC unsigned _inflate_bits(Inflater* inf, int count) {
+    unsigned value;
+    _inflate_need(inf, count);
+    if( inf->bit_count < count ) { inf->error = "The compressed data is truncated"; return 0; }
+    value           = (unsigned)(inf->bits & ((1UL << count) - 1));
+    inf->bits     >>= count;
+    inf->bit_count -= count;
+    return value;
+}
+
+/**
+ * Builds a canonical Huffman code from the length of the code of each symbol.
+ * @param h        The code to build.
+ * @param lengths  The length of the code of each symbol (0 if the symbol is not used).
+ * @param n        Number of symbols.
+ * @return FALSE if the lengths describe more codes than possible.
+ */
+MODULE_FUNC BOOL _inflate_build_huffman(InflateHuffman* h, const BYTE* lengths, int n) {
+    short offsets[INFLATE_MAX_BITS + 1]; unsigned next_code[INFLATE_MAX_BITS + 1];
+    unsigned code, reversed, i;
+    int symbol, length, left;
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast , 0, sizeof(h->fast));
+    for( symbol = 0 ; symbol < n ; ++symbol ) { h->count[ lengths[symbol] ]++; }
+    h->count[0] = 0;
+    for( left = 1, length = 1 ; length <= INFLATE_MAX_BITS ; ++length ) {
+        left = 2 * left - h->count[length];
+        if( left < 0 ) { return FALSE; }
+    }
+
+    /* the symbols sorted by code, used by the codes longer than INFLATE_FAST_BITS */
+    offsets[1] = 0;
+    for( length = 1 ; length < INFLATE_MAX_BITS ; ++length ) { offsets[length + 1] = offsets[length] + h->count[length]; }
+    for( symbol = 0 ; symbol < n ; ++symbol ) {
+        if( lengths[symbol] ) { h->symbol[ offsets[ lengths[symbol] ]++ ] = (short)symbol; }
+    }
+
+    /* the short codes are stored bit-reversed, the way they come in the input */
+    next_code[0] = code = 0;
+    for( length = 1 ; length <= INFLATE_MAX_BITS ; ++length ) {
+        code = (code + (unsigned)h->count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+    for( symbol = 0 ; symbol < n ; ++symbol ) {
+        length = lengths[symbol];
+        if( length == 0 ) { continue; }
+        code = next_code[length]++;
+        if( length > INFLATE_FAST_BITS ) { continue; }
+        for( reversed = 0, i = 0 ; i < (unsigned)length ; ++i ) { reversed = (reversed << 1) | ((code >> i) & 1); }
+        for( i = reversed ; i < (1u << INFLATE_FAST_BITS) ; i += 1u << length ) {
+            h->fast[i] = (unsigned short)(symbol << 4 | length);
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Decodes the next symbol of the input.
+ * @return The symbol, or -1 if the data is not valid (then `error` is set).
+ */
+MODULE_FUNC int _inflate_decode(Inflater* inf, const InflateHuffman* h) {
+    unsigned long bits;
+    int entry, length, symbol, code, first, index, count;
+
+    _inflate_need(inf, INFLATE_MAX_BITS);
+    bits  = inf->bits;
+    entry = h->fast[ bits & ((1u << INFLATE_FAST_BITS) - 1) ];
+    if( entry ) { length = entry & 15; symbol = entry >> 4; }
+    else {
+        /* a long code, the bits are matched one length at a time */
+        code = first = index = 0; symbol = -1;
+        for( length = 1 ; length <= INFLATE_MAX_BITS ; ++length ) {
+            code  |= (int)(bits & 1); bits >>= 1;
+            count  = h->count[length];
+            if( code - count < first ) { symbol = h->symbol[index + (code - first)]; break; }
+            index += count;
+            first  = (first + count) << 1;
+            code <<= 1;
+        }
+        if( symbol < 0 ) { inf->error = "Invalid Huffman code in the compressed data"; return -1; }
+    }
+    if( length > inf->bit_count ) { inf->error = "The compressed data is truncated"; return -1; }
+    inf->bits     >>= length;
+    inf->bit_count -= length;
+    return symbol;
+}
+
+/**
+ * Reads the code lengths of a block compressed with dynamic Huffman codes and builds its codes.
+ * @return TRUE on success, FALSE if the data is not valid (then `error` is set).
+ */
+MODULE_FUNC BOOL _inflate_dynamic_codes(Inflater* inf) {
+    static const BYTE ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    BYTE lengths[INFLATE_MAX_SYMBOLS + 32];
+    int literal_count, distance_count, length_count, symbol, previous, repeat, i;
+
+    literal_count  = (int)_inflate_bits(inf, 5) + 257;
+    distance_count = (int)_inflate_bits(inf, 5) + 1;
+    length_count   = (int)_inflate_bits(inf, 4) + 4;
+    if( inf->error ) { return FALSE; }
+    if( literal_count > 286 || distance_count > 30 ) { inf->error = "Invalid code sizes in the compressed data"; return FALSE; }
+
+    /* the lengths of both codes are themselves Huffman coded */
+    memset(lengths, 0, sizeof(lengths));
+    for( i = 0 ; i < length_count ; ++i ) { lengths[ ORDER[i] ] = (BYTE)_inflate_bits(inf, 3); }
+    if( inf->error ) { return FALSE; }
+    if( !_inflate_build_huffman(&inf->lengths, lengths, 19) ) { inf->error = "Invalid code lengths in the compressed data"; return FALSE; }
+    for( i = 0 ; i < literal_count + distance_count ; ) {
+        symbol = _inflate_decode(inf, &inf->lengths);
+        if( symbol < 0 ) { return FALSE; }
+        if( symbol < 16 ) { lengths[i++] = (BYTE)symbol; continue; }
+        if( symbol == 16 ) {
+            if( i == 0 ) { inf->error = "Invalid code lengths in the compressed data"; return FALSE; }
+            previous = lengths[i - 1]; repeat = 3 + (int)_inflate_bits(inf, 2);
+        }
+        else if( symbol == 17 ) { previous = 0; repeat = 3  + (int)_inflate_bits(inf, 3); }
+        else                    { previous = 0; repeat = 11 + (int)_inflate_bits(inf, 7); }
+        if( inf->error ) { return FALSE; }
+        if( i + repeat > literal_count + distance_count ) { inf->error = "Invalid code lengths in the compressed data"; return FALSE; }
+        while( repeat-- > 0 ) { lengths[i++] = (BYTE)previous; }
+    }
+    if( lengths[256] == 0 ||
+        !_inflate_build_huffman(&inf->lengths  , lengths                , literal_count ) ||
+        !_inflate_build_huffman(&inf->distances, lengths + literal_count, distance_count) )
+    { inf->error = "Invalid code lengths in the compressed data"; return FALSE; }
+    return TRUE;
+}
+
+/**
+ * Builds the fixed Huffman codes defined by the format.
+ */
+MODULE_FUNC void _inflate_fixed_codes(Inflater* inf) {
+    BYTE lengths[INFLATE_MAX_SYMBOLS]; int i;
+    for( i = 0   ; i < 144 ; ++i ) { lengths[i] = 8; }
+    for( i = 144 ; i < 256 ; ++i ) { lengths[i] = 9; }
+    for( i = 256 ; i < 280 ; ++i ) { lengths[i] = 7; }
+    for( i = 280 ; i < 288 ; ++i ) { lengths[i] = 8; }
+    _inflate_build_huffman(&inf->lengths, lengths, 288);
+    for( i = 0   ; i < 30  ; ++i ) { lengths[i] = 5; }
+    _inflate_build_huffman(&inf->distances, lengths, 30);
+}
+
+/**
+ * Reads the header of the next block.
+ * @return TRUE on success, FALSE if the data is not valid (then `error` is set).
+ */
+MODULE_FUNC BOOL _inflate_block_header(Inflater* inf) {
+    unsigned type, length;
+    if( inf->last_block ) { inf->state = INFLATE_STATE_END; return TRUE; }
+    inf->last_block = (BOOL)_inflate_bits(inf, 1);
+    type            = _inflate_bits(inf, 2);
+    if( inf->error ) { return FALSE; }
+    switch( type ) {
+        case 0:
+            /* a stored block starts at a byte boundary */
+            inf->bits     >>= inf->bit_count & 7;
+            inf->bit_count -= inf->bit_count & 7;
+            length = _inflate_bits(inf, 16);
+            if( !inf->error && length != (~_inflate_bits(inf, 16) & 0xFFFF) ) { inf->error = "Invalid stored block in the compressed data"; }
+            inf->stored_left = length;
+            inf->state       = INFLATE_STATE_STORED;
+            break;
+        case 1:
+            _inflate_fixed_codes(inf);
+            inf->state = INFLATE_STATE_CODES;
+            break;
+        case 2:
+            if( _inflate_dynamic_codes(inf) ) { inf->state = INFLATE_STATE_CODES; }
+            break;
+        default:
+            inf->error = "Invalid block type in the compressed data";
+    }
+    return inf->error == NULL;
+}
+
+/**
+ * Stores a byte decoded at the end of the history.
+ */
+#define _INFLATE_PUT(inf, byte) ( (inf)->window[(inf)->window_pos] = (byte), \
+                                  (inf)->window_pos = ((inf)->window_pos + 1) & (INFLATE_WINDOW_SIZE - 1) )
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Prepares a decoder for a new DEFLATE stream that follows the last one in the same input.
+ * @param inf  The Inflater.
+ */
+MODULE_FUNC void inflate_reset(Inflater* inf) {
+    assert( inf != NULL );
+    inf->state         = INFLATE_STATE_BLOCK;
+    inf->last_block    = FALSE;
+    inf->stored_left   = 0;
+    inf->copy_length   = 0;
+    inf->copy_distance = 0;
+    inf->window_pos    = 0;
+    inf->total_out     = 0;
+    inf->error         = NULL;
+}
+
+/**
+ * Initializes a decoder of DEFLATE compressed data.
+ * @param inf         The Inflater structure to initialize.
+ * @param file        The file the compressed data is read from, from its current position.
+ * @param input_size  Number of bytes of compressed data, or INFLATE_UNLIMITED if it goes on until the end of the file.
+ */
+MODULE_FUNC void inflate_init(Inflater* inf, FILE* file, size_t input_size) {
+    assert( inf != NULL && file != NULL );
+    inf->file         = file;
+    inf->input_left   = input_size;
+    inf->input_pos    = 0;
+    inf->input_length = 0;
+    inf->bits         = 0;
+    inf->bit_count    = 0;
+    inflate_reset(inf);
+}
+
+/**
+ * Reads bytes from the input directly, without decoding them.
+ * 
+ * Used for the data around the compressed streams (e.g. the headers and
+ * trailers of gzip), and for data stored without compression. The bits
+ * left from the last byte decoded are dropped.
+ * 
+ * @param inf     The Inflater.
+ * @param output  Where the bytes are stored.
+ * @param size    Number of bytes to read.
+ * @return The number of bytes read, less than `size` only at the end of the input.
+ */
+MODULE_FUNC size_t inflate_read_input(Inflater* inf, BYTE* output, size_t size) {
+    size_t done = 0, chunk;
+    assert( inf != NULL && output != NULL );
+
+    inf->bits     >>= inf->bit_count & 7;
+    inf->bit_count -= inf->bit_count & 7;
+    for( ; done < size && inf->bit_count >= 8 ; inf->bits >>= 8, inf->bit_count -= 8 ) {
+        output[done++] = (BYTE)(inf->bits & 0xFF);
+    }
+    while( done < size && _inflate_fill_input(inf) ) {
+        chunk = inf->input_length - inf->input_pos;
+        if( chunk > size - done ) { chunk = size - done; }
+        memcpy(output + done, inf->input + inf->input_pos, chunk);
+        inf->input_pos += chunk;
+        done           += chunk;
+    }
+    return done;
+}
+
+/**
+ * Returns the next bytes of the input without taking them.
+ * @param inf     The Inflater, it must be at a byte boundary (after `inflate_init()` or `inflate_read_input()`).
+ * @param output  Where the bytes are stored.
+ * @param size    Number of bytes to return (up to INFLATE_INPUT_SIZE).
+ * @return The number of bytes returned, less than `size` only at the end of the input.
+ */
+MODULE_FUNC size_t inflate_peek_input(Inflater* inf, BYTE* output, size_t size) {
+    size_t count, available;
+    assert( inf != NULL && output != NULL && size <= INFLATE_INPUT_SIZE && inf->bit_count == 0 );
+
+    available = inf->input_length - inf->input_pos;
+    if( available < size ) {
+        memmove(inf->input, inf->input + inf->input_pos, available);
+        count = INFLATE_INPUT_SIZE - available < inf->input_left ? INFLATE_INPUT_SIZE - available : inf->input_left;
+        count = count > 0 ? fread(inf->input + available, 1, count, inf->file) : 0;
+        if( inf->input_left != INFLATE_UNLIMITED ) { inf->input_left -= count; }
+        inf->input_pos    = 0;
+        inf->input_length = available += count;
+    }
+    if( size > available ) { size = available; }
+    memcpy(output, inf->input + inf->input_pos, size);
+    return size;
+}
+
+/**
+ * Decodes the next bytes of a DEFLATE stream.
+ * @param inf     The Inflater.
+ * @param output  Where the decoded bytes are stored.
+ * @param size    Number of bytes to decode.
+ * @return
+ *    The number of bytes decoded, less than `size` at the end of the stream
+ *    or if the data is not valid (then `error` is set).
+ */
+MODULE_FUNC size_t inflate_read(Inflater* inf, BYTE* output, size_t size) {
+    size_t done = 0, chunk, i;
+    unsigned from, length, distance;
+    int symbol;
+    assert( inf != NULL && output != NULL );
+
+    while( done < size && !inf->error ) {
+        /* the rest of a match that did not fit in the last output */
+        if( inf->copy_length > 0 ) {
+            from = (inf->window_pos - inf->copy_distance) & (INFLATE_WINDOW_SIZE - 1);
+            for( ; inf->copy_length > 0 && done < size ; --inf->copy_length ) {
+                output[done++] = inf->window[from];
+                _INFLATE_PUT(inf, inf->window[from]);
+                from = (from + 1) & (INFLATE_WINDOW_SIZE - 1);
+            }
+            continue;
+        }
+        switch( inf->state ) {
+            case INFLATE_STATE_BLOCK:
+                _inflate_block_header(inf);
+                break;
+            case INFLATE_STATE_STORED:
+                if( inf->stored_left == 0 ) { inf->state = INFLATE_STATE_BLOCK; break; }
+                chunk = size - done < inf->stored_left ? size - done : inf->stored_left;
+                chunk = inflate_read_input(inf, output + done, chunk);
+                if( chunk == 0 ) { inf->error = "The compressed data is truncated"; break; }
+                for( i = 0 ; i < chunk ; ++i ) { _INFLATE_PUT(inf, output[done + i]); }
+                inf->stored_left -= (unsigned)chunk;
+                inf->total_out   += chunk;
+                done             += chunk;
+                break;
+            case INFLATE_STATE_CODES:
+                symbol = _inflate_decode(inf, &inf->lengths);
+                if( symbol < 0 ) { break; }
+                if( symbol < 256 ) {
+                    output[done++] = (BYTE)symbol;
+                    _INFLATE_PUT(inf, (BYTE)symbol);
+                    ++inf->total_out;
+                    break;
+                }
+                if( symbol == 256 ) { inf->state = INFLATE_STATE_BLOCK; break; }
+                symbol -= 257;
+                if( symbol >= 29 ) { inf->error = "Invalid match length in the compressed data"; break; }
+                length = INFLATE_LENGTH_BASE[symbol] + _inflate_bits(inf, INFLATE_LENGTH_EXTRA[symbol]);
+                symbol = _inflate_decode(inf, &inf->distances);
+                if( symbol < 0 ) { break; }
+                if( symbol >= 30 ) { inf->error = "Invalid match distance in the compressed data"; break; }
+                distance = INFLATE_DISTANCE_BASE[symbol] + _inflate_bits(inf, INFLATE_DISTANCE_EXTRA[symbol]);
+                if( inf->error ) { break; }
+                if( distance > inf->total_out ) { inf->error = "Invalid match distance in the compressed data"; break; }
+                inf->copy_length   = length;
+                inf->copy_distance = distance;
+                inf->total_out    += length;
+                break;
+            default:
+                return done;
+        }
+    }
+    return done;
+}
+
+/**
+ * Checks if a decoder has reached the end of its DEFLATE stream.
+ * @param inf  The Inflater.
+ * @return TRUE if the last block has been decoded whole.
+ */
+MODULE_FUNC BOOL inflate_is_done(const Inflater* inf) {
+    return inf->state == INFLATE_STATE_END && inf->copy_length == 0 && !inf->error;
+}
+
+/**
+ * Updates the CRC-32 (the one used by gzip and zip) of a sequence of bytes.
+ * @param crc   The CRC of the previous bytes (0 at the start).
+ * @param data  The next bytes.
+ * @param size  Number of bytes in `data`.
+ * @return The CRC of all the bytes.
+ */
+MODULE_FUNC unsigned long crc32_update(unsigned long crc, const BYTE* data, size_t size) {
+    static const unsigned long TABLE[256] = {
+        0x00000000UL, 0x77073096UL, 0xEE0E612CUL, 0x990951BAUL, 0x076DC419UL, 0x706AF48FUL, 0xE963A535UL, 0x9E6495A3UL,
+        0x0EDB8832UL, 0x79DCB8A4UL, 0xE0D5E91EUL, 0x97D2D988UL, 0x09B64C2BUL, 0x7EB17CBDUL, 0xE7B82D07UL, 0x90BF1D91UL,
+        0x1DB71064UL, 0x6AB020F2UL, 0xF3B97148UL, 0x84BE41DEUL, 0x1ADAD47DUL, 0x6DDDE4EBUL, 0xF4D4B551UL, 0x83D385C7UL,
+        0x136C9856UL, 0x646BA8C0UL, 0xFD62F97AUL, 0x8A65C9ECUL, 0x14015C4FUL, 0x63066CD9UL, 0xFA0F3D63UL, 0x8D080DF5UL,
+        0x3B6E20C8UL, 0x4C69105EUL, 0xD56041E4UL, 0xA2677172UL, 0x3C03E4D1UL, 0x4B04D447UL, 0xD20D85FDUL, 0xA50AB56BUL,
+        0x35B5A8FAUL, 0x42B2986CUL, 0xDBBBC9D6UL, 0xACBCF940UL, 0x32D86CE3UL, 0x45DF5C75UL, 0xDCD60DCFUL, 0xABD13D59UL,
+        0x26D930ACUL, 0x51DE003AUL, 0xC8D75180UL, 0xBFD06116UL, 0x21B4F4B5UL, 0x56B3C423UL, 0xCFBA9599UL, 0xB8BDA50FUL,
+        0x2802B89EUL, 0x5F058808UL, 0xC60CD9B2UL, 0xB10BE924UL, 0x2F6F7C87UL, 0x58684C11UL, 0xC1611DABUL, 0xB6662D3DUL,
+        0x76DC4190UL, 0x01DB7106UL, 0x98D220BCUL, 0xEFD5102AUL, 0x71B18589UL, 0x06B6B51FUL, 0x9FBFE4A5UL, 0xE8B8D433UL,
+        0x7807C9A2UL, 0x0F00F934UL, 0x9609A88EUL, 0xE10E9818UL, 0x7F6A0DBBUL, 0x086D3D2DUL, 0x91646C97UL, 0xE6635C01UL,
+        0x6B6B51F4UL, 0x1C6C6162UL, 0x856530D8UL, 0xF262004EUL, 0x6C0695EDUL, 0x1B01A57BUL, 0x8208F4C1UL, 0xF50FC457UL,
+        0x65B0D9C6UL, 0x12B7E950UL, 0x8BBEB8EAUL, 0xFCB9887CUL, 0x62DD1DDFUL, 0x15DA2D49UL, 0x8CD37CF3UL, 0xFBD44C65UL,
+        0x4DB26158UL, 0x3AB551CEUL, 0xA3BC0074UL, 0xD4BB30E2UL, 0x4ADFA541UL, 0x3DD895D7UL, 0xA4D1C46DUL, 0xD3D6F4FBUL,
+        0x4369E96AUL, 0x346ED9FCUL, 0xAD678846UL, 0xDA60B8D0UL, 0x44042D73UL, 0x33031DE5UL, 0xAA0A4C5FUL, 0xDD0D7CC9UL,
+        0x5005713CUL, 0x270241AAUL, 0xBE0B1010UL, 0xC90C2086UL, 0x5768B525UL, 0x206F85B3UL, 0xB966D409UL, 0xCE61E49FUL,
+        0x5EDEF90EUL, 0x29D9C998UL, 0xB0D09822UL, 0xC7D7A8B4UL, 0x59B33D17UL, 0x2EB40D81UL, 0xB7BD5C3BUL, 0xC0BA6CADUL,
+        0xEDB88320UL, 0x9ABFB3B6UL, 0x03B6E20CUL, 0x74B1D29AUL, 0xEAD54739UL, 0x9DD277AFUL, 0x04DB2615UL, 0x73DC1683UL,
+        0xE3630B12UL, 0x94643B84UL, 0x0D6D6A3EUL, 0x7A6A5AA8UL, 0xE40ECF0BUL, 0x9309FF9DUL, 0x0A00AE27UL, 0x7D079EB1UL,
+        0xF00F9344UL, 0x8708A3D2UL, 0x1E01F268UL, 0x6906C2FEUL, 0xF762575DUL, 0x806567CBUL, 0x196C3671UL, 0x6E6B06E7UL,
+        0xFED41B76UL, 0x89D32BE0UL, 0x10DA7A5AUL, 0x67DD4ACCUL, 0xF9B9DF6FUL, 0x8EBEEFF9UL, 0x17B7BE43UL, 0x60B08ED5UL,
+        0xD6D6A3E8UL, 0xA1D1937EUL, 0x38D8C2C4UL, 0x4FDFF252UL, 0xD1BB67F1UL, 0xA6BC5767UL, 0x3FB506DDUL, 0x48B2364BUL,
+        0xD80D2BDAUL, 0xAF0A1B4CUL, 0x36034AF6UL, 0x41047A60UL, 0xDF60EFC3UL, 0xA867DF55UL, 0x316E8EEFUL, 0x4669BE79UL,
+        0xCB61B38CUL, 0xBC66831AUL, 0x256FD2A0UL, 0x5268E236UL, 0xCC0C7795UL, 0xBB0B4703UL, 0x220216B9UL, 0x5505262FUL,
+        0xC5BA3BBEUL, 0xB2BD0B28UL, 0x2BB45A92UL, 0x5CB36A04UL, 0xC2D7FFA7UL, 0xB5D0CF31UL, 0x2CD99E8BUL, 0x5BDEAE1DUL,
+        0x9B64C2B0UL, 0xEC63F226UL, 0x756AA39CUL, 0x026D930AUL, 0x9C0906A9UL, 0xEB0E363FUL, 0x72076785UL, 0x05005713UL,
+        0x95BF4A82UL, 0xE2B87A14UL, 0x7BB12BAEUL, 0x0CB61B38UL, 0x92D28E9BUL, 0xE5D5BE0DUL, 0x7CDCEFB7UL, 0x0BDBDF21UL,
+        0x86D3D2D4UL, 0xF1D4E242UL, 0x68DDB3F8UL, 0x1FDA836EUL, 0x81BE16CDUL, 0xF6B9265BUL, 0x6FB077E1UL, 0x18B74777UL,
+        0x88085AE6UL, 0xFF0F6A70UL, 0x66063BCAUL, 0x11010B5CUL, 0x8F659EFFUL, 0xF862AE69UL, 0x616BFFD3UL, 0x166CCF45UL,
+        0xA00AE278UL, 0xD70DD2EEUL, 0x4E048354UL, 0x3903B3C2UL, 0xA7672661UL, 0xD06016F7UL, 0x4969474DUL, 0x3E6E77DBUL,
+        0xAED16A4AUL, 0xD9D65ADCUL, 0x40DF0B66UL, 0x37D83BF0UL, 0xA9BCAE53UL, 0xDEBB9EC5UL, 0x47B2CF7FUL, 0x30B5FFE9UL,
+        0xBDBDF21CUL, 0xCABAC28AUL, 0x53B39330UL, 0x24B4A3A6UL, 0xBAD03605UL, 0xCDD70693UL, 0x54DE5729UL, 0x23D967BFUL,
+        0xB3667A2EUL, 0xC4614AB8UL, 0x5D681B02UL, 0x2A6F2B94UL, 0xB40BBE37UL, 0xC30C8EA1UL, 0x5A05DF1BUL, 0x2D02EF8DUL };
+    crc = ~crc & 0xFFFFFFFFUL;
+    while( size-- > 0 ) { crc = (crc >> 8) ^ TABLE[(crc ^ *data++) & 0xFF]; }
+    return ~crc & 0xFFFFFFFFUL;
+}
+
+#endif /* INFLATE_H */
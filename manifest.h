@@ -0,0 +1,258 @@
+/*
+| File    : manifest.h
+| Purpose : Record of the files extracted from a tape, for incremental runs.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "file_dir.h"
+#include "stats.h"
+
+/* First line of every manifest file, changes whenever the format changes */
+#define MANIFEST_SIGNATURE "zxtapi-manifest 1"
+
+/* Maximum length of a line of the manifest file (including the newline) */
+#define MANIFEST_LINE_SIZE 1024
+
+/**
+ * A file created from one block of the tape
+ */
+typedef struct ManifestEntry {
+    int                position;   /**< Position of the block header within the tape index */
+    unsigned long long hash;       /**< Hash of the header and data of the block */
+    char*              name;       /**< Name of the file, relative to the directory of the manifest */
+    BOOL               used;       /**< TRUE once the entry was matched by a block of the new run */
+} ManifestEntry;
+
+/**
+ * The source tape of an extraction and the files created from it
+ * 
+ * It is saved as a text file in the output directory:
+ *     zxtapi-manifest 1
+ *     generator <version of the program that created the files>
+ *     source <size> <mtime> <hash>
+ *     block <position> <hash> <name>
+ *     ...
+ * with one "block" line per created file, and hashes in hexadecimal.
+ */
+typedef struct Manifest {
+    char               generator[32]; /**< Version of the program that created the files */
+    unsigned long long source_size;   /**< Size of the tape file in bytes */
+    long long          source_mtime;  /**< Modification time of the tape file (seconds since the epoch) */
+    unsigned long long source_hash;   /**< Hash of the whole content of the tape file */
+    ManifestEntry*     entries;       /**< The created files, in order of position */
+    int                entry_count;   /**< Number of elements in `entries` */
+    int                entry_capacity;/**< Number of allocated elements in `entries` */
+} Manifest;
+
+/*============================ INTERNAL HELPERS ============================*/
+
+/**
+ * Checks that a name read from a manifest is a bare file name, so it can not refer to a file outside its directory.
+ * @param name  The name of the file.
+ * @return TRUE if the name contains no path separator and no "..", FALSE otherwise.
+ */
+MODULE_FUNC BOOL _manifest_is_file_name(const char* name) {
+    return *name != '\0' && !strchr(name, '/') && !strchr(name, '\\') && !strstr(name, "..");
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Initializes an empty manifest.
+ * @param manifest   Pointer to the Manifest structure to initialize.
+ * @param generator  Version of the program that creates the files.
+ */
+MODULE_FUNC void manifest_init(Manifest* manifest, const char* generator) {
+    assert( manifest != NULL && generator != NULL );
+    memset(manifest, 0, sizeof(Manifest));
+    strncpy(manifest->generator, generator, sizeof(manifest->generator) - 1);
+}
+
+/**
+ * Releases all the memory used by a manifest.
+ * @param manifest  Pointer to the Manifest structure.
+ */
+MODULE_FUNC void manifest_free(Manifest* manifest) {
+    int i;
+    assert( manifest != NULL );
+    for( i = 0 ; i < manifest->entry_count ; ++i ) { free(manifest->entries[i].name); }
+    free(manifest->entries);
+    manifest->entries     = NULL;
+    manifest->entry_count = manifest->entry_capacity = 0;
+}
+
+/**
+ * Adds a created file to a manifest.
+ * @param manifest  Pointer to the Manifest structure.
+ * @param position  Position of the block header within the tape index.
+ * @param hash      Hash of the header and data of the block.
+ * @param name      Name of the file, relative to the directory of the manifest. (copied)
+ * @return TRUE on success, FALSE if out of memory.
+ */
+MODULE_FUNC BOOL manifest_add(Manifest* manifest, int position, unsigned long long hash, const char* name) {
+    ManifestEntry *entries, *entry;
+    int capacity;
+    assert( manifest != NULL && name != NULL );
+
+    if( manifest->entry_count == manifest->entry_capacity ) {
+        capacity = manifest->entry_capacity ? manifest->entry_capacity * 2 : 64;
+        entries  = (ManifestEntry*)realloc(manifest->entries, capacity * sizeof(ManifestEntry));
+        STATS_ADD(STATS_ALLOCATIONS, 1);
+        if( !entries ) { return FALSE; }
+        manifest->entries        = entries;
+        manifest->entry_capacity = capacity;
+    }
+    entry = &manifest->entries[ manifest->entry_count ];
+    entry->position = position;
+    entry->hash     = hash;
+    entry->name     = strdup_(name);
+    entry->used     = FALSE;
+    if( !entry->name ) { return FALSE; }
+    ++manifest->entry_count;
+    return TRUE;
+}
+
+/**
+ * Loads a manifest from a file.
+ * @param manifest  Pointer to the Manifest structure to fill in. (must be initialized)
+ * @param path      The path of the manifest file.
+ * @return TRUE if the manifest was loaded, FALSE if the file does not exist or is not valid.
+ */
+MODULE_FUNC BOOL manifest_load(Manifest* manifest, const char* path) {
+    char line[MANIFEST_LINE_SIZE], word[16], *name, *end;
+    unsigned long hash_hi, hash_lo, size_hi, size_lo, mtime_hi, mtime_lo;
+    int position, name_start;
+    BOOL valid;
+    FILE* file;
+    assert( manifest != NULL && path != NULL );
+
+    file = fopen(path, "rb");
+    if( !file ) { return FALSE; }
+    valid = fgets(line, sizeof(line), file) && strncmp(line, MANIFEST_SIGNATURE "\n", sizeof(MANIFEST_SIGNATURE)) == 0;
+    while( valid && fgets(line, sizeof(line), file) ) {
+        end = line + strlen(line);
+        if( end == line || end[-1] != '\n' ) { valid = FALSE; break; }
+        *--end = '\0';
+        if( sscanf(line, "%15s", word) != 1 ) { valid = FALSE; }
+        else if( strcmp(word, "generator") == 0 ) {
+            valid = sscanf(line, "generator %31s", manifest->generator) == 1;
+        }
+        else if( strcmp(word, "source") == 0 ) {
+            valid = sscanf(line, "source %8lx%8lx %8lx%8lx %8lx%8lx",
+                           &size_hi, &size_lo, &mtime_hi, &mtime_lo, &hash_hi, &hash_lo) == 6;
+            manifest->source_size  = (unsigned long long)size_hi << 32 | size_lo;
+            manifest->source_mtime = (long long)((unsigned long long)mtime_hi << 32 | mtime_lo);
+            manifest->source_hash  = (unsigned long long)hash_hi << 32 | hash_lo;
+        }
+        else if( strcmp(word, "block") == 0 ) {
+            name_start = 0;
+            valid = sscanf(line, "block %d %8lx%8lx %n", &position, &hash_hi, &hash_lo, &name_start) == 3 && name_start > 0;
+            name  = line + name_start;
+            valid = valid && _manifest_is_file_name(name) && manifest_add(manifest, position, (unsigned long long)hash_hi << 32 | hash_lo, name);
+        }
+    }
+    fclose(file);
+    if( !valid ) { manifest_free(manifest); }
+    return valid;
+}
+
+/**
+ * Saves a manifest to a file.
+ * 
+ * The manifest is written to a temporary file that replaces the old one
+ * only when it is complete.
+ * 
+ * @param manifest  Pointer to the Manifest structure.
+ * @param path      The path of the manifest file.
+ * @return TRUE on success, FALSE if the file could not be written.
+ */
+MODULE_FUNC BOOL manifest_save(const Manifest* manifest, const char* path) {
+    const ManifestEntry* entry;
+    char* temp_path;
+    BOOL success;
+    FILE* file;
+    int i;
+    assert( manifest != NULL && path != NULL );
+
+    temp_path = alloc_concat5(path, ".tmp", NULL, NULL, NULL);
+    file      = temp_path ? fopen(temp_path, "wb") : NULL;
+    if( !file ) { free(temp_path); return FALSE; }
+    fprintf(file, "%s\ngenerator %s\nsource %08lx%08lx %08lx%08lx %08lx%08lx\n", MANIFEST_SIGNATURE, manifest->generator,
+            (unsigned long)(manifest->source_size  >> 32), (unsigned long)(manifest->source_size  & 0xFFFFFFFFUL),
+            (unsigned long)((unsigned long long)manifest->source_mtime >> 32),
+            (unsigned long)((unsigned long long)manifest->source_mtime & 0xFFFFFFFFUL),
+            (unsigned long)(manifest->source_hash  >> 32), (unsigned long)(manifest->source_hash  & 0xFFFFFFFFUL));
+    for( i = 0 ; i < manifest->entry_count ; ++i ) {
+        entry = &manifest->entries[i];
+        fprintf(file, "block %d %08lx%08lx %s\n", entry->position,
+                (unsigned long)(entry->hash >> 32), (unsigned long)(entry->hash & 0xFFFFFFFFUL), entry->name);
+    }
+    success = !ferror(file);
+    if( fclose(file) != 0 ) { success = FALSE; }
+    remove(path);
+    if( success && rename(temp_path, path) != 0 ) { success = FALSE; }
+    if( !success ) { remove(temp_path); }
+    free(temp_path);
+    return success;
+}
+
+/**
+ * Finds the entry of a manifest that matches a block of a new run.
+ * 
+ * The entry created from a block with the same position and content is
+ * preferred, then any entry created from a block with the same content (the
+ * block moved within the tape), and last the entry created from a block at
+ * the same position (the block changed and its file is regenerated in place).
+ * 
+ * @param manifest  Pointer to the Manifest structure.
+ * @param position  Position of the block header within the tape index.
+ * @param hash      Hash of the header and data of the block.
+ * @return The matching entry not used so far, or NULL if there is none.
+ */
+MODULE_FUNC ManifestEntry* manifest_match(Manifest* manifest, int position, unsigned long long hash) {
+    ManifestEntry *entry, *same_hash = NULL, *same_position = NULL;
+    int i;
+    assert( manifest != NULL );
+    for( i = 0 ; i < manifest->entry_count ; ++i ) {
+        entry = &manifest->entries[i];
+        if( entry->used ) { continue; }
+        if( entry->hash == hash && entry->position == position ) { return entry; }
+        if( entry->hash == hash && !same_hash ) { same_hash = entry; }
+        if( entry->position == position && !same_position ) { same_position = entry; }
+    }
+    return same_hash ? same_hash : same_position;
+}
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,259 @@
+/*
+| File    : out_buf.h
+| Purpose : Buffered output writer that flushes to a file in large chunks.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef OUT_BUF_H
+#define OUT_BUF_H
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "stats.h"
+
+/* Default size of the buffers of the printers (it can be changed when compiling) */
+#ifndef OUT_BUF_SIZE
+#define OUT_BUF_SIZE (64*1024)
+#endif
+
+/**
+ * Where the data of an output buffer goes when the buffer gets full
+ */
+typedef enum OUT_SINK {
+    OUT_SINK_FILE,      /**< Written to a file */
+    OUT_SINK_MEMORY,    /**< Kept in memory, the buffer grows to hold all the data */
+    OUT_SINK_NULL       /**< Discarded, only the number of bytes is counted (for benchmarking) */
+} OUT_SINK;
+
+/**
+ * An output buffer that accumulates text in memory and passes it to its
+ * sink only when it gets full or is flushed.
+ * 
+ * All the formatters write to an OutBuf, so the same code renders to a
+ * file, to memory or nowhere. Writes larger than a whole buffer go
+ * straight to the file, without being copied first.
+ */
+typedef struct OutBuf {
+    OUT_SINK sink;               /**< Where the buffered data goes */
+    FILE*    file;               /**< File where the buffered data is written (OUT_SINK_FILE) */
+    char*    data;               /**< Memory used as buffer (for OUT_SINK_MEMORY, heap memory owned by the buffer) */
+    size_t   size;               /**< Size of `data` in bytes */
+    size_t   length;             /**< Number of bytes currently stored in `data` */
+    size_t   flushed;            /**< Number of bytes already passed to the sink */
+    int      err_code;           /**< Sticky error code, set when a write to the sink fails */
+} OutBuf;
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Initializes an output buffer that writes to a file.
+ * @param buf     Pointer to the OutBuf structure to initialize.
+ * @param file    File where the data will be written.
+ * @param memory  Memory used to store the data before writing it. (owned by the caller)
+ * @param size    Size of `memory` in bytes. (must be greater than 0)
+ */
+MODULE_FUNC void out_buf_init(OutBuf* buf, FILE* file, char* memory, size_t size) {
+    assert( buf != NULL && memory != NULL && size > 0 );
+    buf->sink     = OUT_SINK_FILE;
+    buf->file     = file;
+    buf->data     = memory;
+    buf->size     = size;
+    buf->length   = 0;
+    buf->flushed  = 0;
+    buf->err_code = file == NULL;
+}
+
+/**
+ * Initializes an output buffer that keeps all the data in memory.
+ * 
+ * The buffer takes `memory` and reallocates it as it grows. Once finished
+ * the caller takes the data from `buf->data` and frees it (it can also be
+ * passed again to this function, to reuse the memory already allocated).
+ * 
+ * @param buf     Pointer to the OutBuf structure to initialize.
+ * @param memory  Heap memory allocated with malloc, used as the initial buffer. (may be NULL)
+ * @param size    Size of `memory` in bytes.
+ */
+MODULE_FUNC void out_buf_init_memory(OutBuf* buf, char* memory, size_t size) {
+    assert( buf != NULL && (memory != NULL || size == 0) );
+    buf->sink     = OUT_SINK_MEMORY;
+    buf->file     = NULL;
+    buf->data     = memory;
+    buf->size     = size;
+    buf->length   = 0;
+    buf->flushed  = 0;
+    buf->err_code = 0;
+}
+
+/**
+ * Initializes an output buffer that discards the data, to measure the formatters alone.
+ * @param buf     Pointer to the OutBuf structure to initialize.
+ * @param memory  Memory used to store the data before discarding it. (owned by the caller)
+ * @param size    Size of `memory` in bytes. (must be greater than 0)
+ */
+MODULE_FUNC void out_buf_init_null(OutBuf* buf, char* memory, size_t size) {
+    out_buf_init(buf, stdout, memory, size);
+    buf->sink = OUT_SINK_NULL;
+    buf->file = NULL;
+}
+
+/**
+ * Passes all the buffered data to the sink.
+ * (for OUT_SINK_MEMORY nothing is done, the data stays in the buffer)
+ * @param buf  Pointer to the OutBuf structure.
+ * @return     0 on success, or an error code if any write failed.
+ */
+MODULE_FUNC int out_buf_flush(OutBuf* buf) {
+    assert( buf != NULL );
+    if( buf->sink == OUT_SINK_MEMORY ) { return buf->err_code; }
+    if( buf->sink == OUT_SINK_FILE && buf->length > 0 && !buf->err_code ) {
+        if( fwrite(buf->data, 1, buf->length, buf->file) != buf->length ) { buf->err_code = 1; }
+        STATS_ADD(STATS_OUTPUT_BYTES, buf->length);
+    }
+    buf->flushed += buf->length;
+    buf->length   = 0;
+    return buf->err_code;
+}
+
+/**
+ * Makes room in a full buffer, the memory ones grow and the others are flushed.
+ * If a memory buffer can not grow, its data is dropped and `err_code` is set.
+ * @param buf  Pointer to the OutBuf structure.
+ */
+MODULE_FUNC void _out_buf_make_room(OutBuf* buf) {
+    char* new_data; size_t new_size;
+    if( buf->sink != OUT_SINK_MEMORY ) { out_buf_flush(buf); return; }
+    new_size = buf->size > 0 ? 2 * buf->size : OUT_BUF_SIZE;
+    new_data = (char*)realloc(buf->data, new_size);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( new_data ) { buf->data = new_data; buf->size = new_size; return; }
+    buf->err_code = 1;
+    buf->flushed += buf->length;
+    buf->length   = 0;
+}
+
+/**
+ * Appends a sequence of bytes to the buffer, flushing it when it gets full.
+ * @param buf     Pointer to the OutBuf structure.
+ * @param str     The bytes to append.
+ * @param length  Number of bytes to append.
+ */
+MODULE_FUNC void out_buf_write(OutBuf* buf, const char* str, size_t length) {
+    size_t chunk;
+    assert( buf != NULL );
+
+    /* a write of a whole buffer or more goes straight to the file */
+    if( buf->sink == OUT_SINK_FILE && length >= buf->size ) {
+        if( out_buf_flush(buf) == 0 ) {
+            if( fwrite(str, 1, length, buf->file) != length ) { buf->err_code = 1; }
+            STATS_ADD(STATS_OUTPUT_BYTES, length);
+        }
+        buf->flushed += length;
+        return;
+    }
+    while( length > 0 ) {
+        if( buf->length == buf->size ) { _out_buf_make_room(buf); }
+        /* a memory buffer that could not grow drops the rest of the data */
+        if( buf->sink == OUT_SINK_MEMORY && buf->err_code ) { buf->flushed += length; return; }
+        chunk = buf->size - buf->length;
+        if( chunk > length ) { chunk = length; }
+        memcpy(buf->data + buf->length, str, chunk);
+        buf->length += chunk;
+        str         += chunk;
+        length      -= chunk;
+    }
+}
+
+/**
+ * Appends a single character to the buffer.
+ * @param buf  Pointer to the OutBuf structure.
+ * @param ch   The character to append.
+ */
+MODULE_FUNC void out_buf_putc(OutBuf* buf, char ch) {
+    assert( buf != NULL );
+    if( buf->length == buf->size ) { _out_buf_make_room(buf); }
+    if( buf->sink == OUT_SINK_MEMORY && buf->err_code ) { ++buf->flushed; return; }
+    buf->data[ buf->length++ ] = ch;
+}
+
+/**
+ * Appends a string left aligned to `width` characters.
+ * @param buf    Pointer to the OutBuf structure.
+ * @param str    The string to append.
+ * @param width  Minimum number of characters, padded with spaces on the right.
+ */
+MODULE_FUNC void out_buf_put_string(OutBuf* buf, const char* str, int width) {
+    size_t length = strlen(str);
+    out_buf_write(buf, str, length);
+    for( ; width > (int)length ; --width ) { out_buf_putc(buf, ' '); }
+}
+
+/**
+ * Appends an unsigned number in decimal, right aligned to `width` characters.
+ * @param buf     Pointer to the OutBuf structure.
+ * @param number  The number to append.
+ * @param width   Minimum number of characters, padded with spaces on the left.
+ */
+MODULE_FUNC void out_buf_put_uint(OutBuf* buf, unsigned number, int width) {
+    char digits[24]; int count = 0;
+    do { digits[count++] = (char)('0' + number % 10); number /= 10; } while( number > 0 );
+    for( ; width > count ; --width ) { out_buf_putc(buf, ' '); }
+    while( count > 0 ) { out_buf_putc(buf, digits[--count]); }
+}
+
+/**
+ * Appends a string as a quoted JSON string.
+ * 
+ * Quotes, backslashes, control characters and any byte outside the ASCII
+ * range are escaped (bytes 0x7F-0xFF as the \u00XX code point with the
+ * same value), so the result is always valid JSON whatever the input.
+ * 
+ * @param buf     Pointer to the OutBuf structure.
+ * @param str     The bytes of the string.
+ * @param length  Number of bytes in `str`.
+ */
+MODULE_FUNC void out_buf_put_json_string(OutBuf* buf, const char* str, size_t length) {
+    static const char HEX[] = "0123456789abcdef";
+    unsigned char ch; size_t i;
+    out_buf_putc(buf, '"');
+    for( i = 0 ; i < length ; ++i ) {
+        ch = (unsigned char)str[i];
+        if( ch == '"' || ch == '\\' ) { out_buf_putc(buf, '\\'); out_buf_putc(buf, (char)ch); }
+        else if( ch >= 0x20 && ch < 0x7F ) { out_buf_putc(buf, (char)ch); }
+        else {
+            out_buf_write(buf, "\\u00", 4);
+            out_buf_putc(buf, HEX[ch >> 4]);
+            out_buf_putc(buf, HEX[ch & 0x0F]);
+        }
+    }
+    out_buf_putc(buf, '"');
+}
+
+#endif /* OUT_BUF_H */
@@ -0,0 +1,397 @@
+/*
+| File    : render_cache.h
+| Purpose : A bounded LRU cache of the text rendered from the block payloads.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "file_dir.h"
+#include "hash64.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+/* Size of the outputs not kept in the cache, they are rendered every time */
+#define RENDER_CACHE_MAX_ENTRY (256 * 1024)
+
+/* Size of the cache used when only its directory is given */
+#define RENDER_CACHE_DEFAULT_SIZE (64 << 20)
+
+/* Size of the header of the persisted entries: magic, payload size, text hash */
+#define RENDER_CACHE_HEADER_SIZE 16
+
+/* Seed of the hash of the persisted texts, so it is unrelated to the hash of the payloads */
+#define RENDER_CACHE_TEXT_SEED 0x5A58524345ULL
+
+/**
+ * The rendered text of one payload
+ */
+typedef struct RenderEntry {
+    unsigned long long  hash;     /**< Hash of the payload */
+    unsigned long       size;     /**< Number of bytes of the payload */
+    unsigned long       format;   /**< How the payload was rendered (type of block and parameters) */
+    struct RenderEntry* newer;    /**< Next entry in the LRU list, towards the most recently used */
+    struct RenderEntry* older;    /**< Next entry in the LRU list, towards the least recently used */
+    struct RenderEntry* chain;    /**< Next entry in the same bucket of the hash table */
+    unsigned            refs;     /**< Number of threads writing `text` right now */
+    BOOL                evicted;  /**< TRUE once it was removed from the cache (freed when `refs` reaches 0) */
+    size_t              length;   /**< Number of bytes in `text` */
+    char                text[1];  /**< The rendered text (flexible array) */
+} RenderEntry;
+
+/**
+ * A bounded cache mapping a payload and its output format to the text rendered from it
+ * 
+ * Identical BASIC loaders and CODE blocks are found in many different tapes,
+ * with the cache each of them is only detokenized or encoded once per run.
+ * When its memory is full the least recently used entries are evicted.
+ * 
+ * If a directory is given the entries are also saved there, as
+ * `VERSION/XX/XXXXXXXXXXXXXXXX-FFFFFFFF` files named after the version of the
+ * renderer, the hash and the format (the first two digits are used as a
+ * fan-out subdirectory), so later runs of the same version find them even
+ * when they are no longer in memory. Each file starts with a header holding
+ * the size of the payload and a hash of the text, both checked on load, so
+ * a damaged or colliding file is rendered again instead of being trusted.
+ * 
+ * The cache can be shared by the threads of a pool, the text of an entry is
+ * written without holding the lock, and it is not freed while being written.
+ */
+typedef struct RenderCache {
+    char*         dir;            /**< Directory where the entries are persisted, per version (NULL = only in memory) */
+    Mutex         lock;           /**< Protects the entries, the LRU list and `fanout_ready` */
+    RenderEntry** buckets;        /**< Hash table of the entries */
+    unsigned      bucket_count;   /**< Number of elements in `buckets` (always a power of two) */
+    RenderEntry*  newest;         /**< The most recently used entry */
+    RenderEntry*  oldest;         /**< The least recently used entry, the first one evicted */
+    size_t        limit;          /**< Maximum number of bytes used by the entries */
+    size_t        used;           /**< Number of bytes used by the entries */
+    size_t        max_entry;      /**< Size of the largest text that can be kept */
+    BYTE          fanout_ready[256 / 8]; /**< Bitmap of the fan-out subdirectories known to exist */
+} RenderCache;
+
+/*============================ INTERNAL HELPERS ============================*/
+
+/**
+ * Returns the slot of the hash table where an entry is, or where it would be linked.
+ * (the lock must be held)
+ */
+MODULE_FUNC RenderEntry** _render_cache_slot(RenderCache* cache, unsigned long long hash, unsigned long size,
+                                             unsigned long format) {
+    RenderEntry** slot = &cache->buckets[ (hash ^ format) & (cache->bucket_count - 1) ];
+    while( *slot && ((*slot)->hash != hash || (*slot)->size != size || (*slot)->format != format) ) {
+        slot = &(*slot)->chain;
+    }
+    return slot;
+}
+
+/**
+ * Removes an entry from the cache, freeing it unless a thread is still writing it.
+ * (the lock must be held)
+ */
+MODULE_FUNC void _render_cache_evict(RenderCache* cache, RenderEntry* entry) {
+    RenderEntry** slot = _render_cache_slot(cache, entry->hash, entry->size, entry->format);
+    *slot = entry->chain;
+    if( entry->newer ) { entry->newer->older = entry->older; } else { cache->newest = entry->older; }
+    if( entry->older ) { entry->older->newer = entry->newer; } else { cache->oldest = entry->newer; }
+    cache->used   -= sizeof(RenderEntry) + entry->length;
+    entry->evicted = TRUE;
+    if( entry->refs == 0 ) { free(entry); }
+}
+
+/**
+ * Makes an entry the most recently used one, linking it first if it is new.
+ * (the lock must be held)
+ */
+MODULE_FUNC void _render_cache_touch(RenderCache* cache, RenderEntry* entry, BOOL is_new) {
+    if( !is_new ) {
+        if( cache->newest == entry ) { return; }
+        entry->newer->older = entry->older;
+        if( entry->older ) { entry->older->newer = entry->newer; } else { cache->oldest = entry->newer; }
+    }
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if( cache->newest ) { cache->newest->newer = entry; } else { cache->oldest = entry; }
+    cache->newest = entry;
+}
+
+/**
+ * Adds a new entry to the cache, evicting the least recently used ones to make room.
+ * If an entry with the same key was added meanwhile by another thread, the new one is freed.
+ * (the lock must be held)
+ * @return The entry that is in the cache.
+ */
+MODULE_FUNC RenderEntry* _render_cache_link(RenderCache* cache, RenderEntry* entry) {
+    RenderEntry** slot = _render_cache_slot(cache, entry->hash, entry->size, entry->format);
+    if( *slot ) { free(entry); return *slot; }
+    entry->chain = NULL; *slot = entry;
+    _render_cache_touch(cache, entry, TRUE);
+    cache->used += sizeof(RenderEntry) + entry->length;
+    while( cache->used > cache->limit && cache->oldest != entry ) { _render_cache_evict(cache, cache->oldest); }
+    return entry;
+}
+
+/**
+ * Allocates a new entry, not yet linked to the cache.
+ * @return The new entry with room for `length` bytes of text, or NULL if out of memory.
+ */
+MODULE_FUNC RenderEntry* _render_cache_alloc_entry(unsigned long long hash, unsigned long size, unsigned long format,
+                                                   size_t length) {
+    RenderEntry* entry = (RenderEntry*)malloc(sizeof(RenderEntry) + length);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !entry ) { return NULL; }
+    memset(entry, 0, sizeof(RenderEntry));
+    entry->hash   = hash;
+    entry->size   = size;
+    entry->format = format;
+    entry->length = length;
+    return entry;
+}
+
+/**
+ * Builds the path of the file where an entry is persisted.
+ * @param fanout_dir  Receives the path of its fan-out subdirectory (may be NULL).
+ * @return The path of the file allocated with malloc, or NULL if out of memory.
+ */
+MODULE_FUNC char* _render_cache_alloc_path(const RenderCache* cache, unsigned long long hash, unsigned long format,
+                               char** fanout_dir) {
+    char name[32], fanout[4];
+    sprintf(fanout, "%02x", (unsigned)(hash >> 56));
+    sprintf(name, "%08lx%08lx-%08lx", (unsigned long)(hash >> 32), (unsigned long)(hash & 0xFFFFFFFFUL),
+            format & 0xFFFFFFFFUL);
+    if( fanout_dir ) { *fanout_dir = alloc_concat5(cache->dir, "/", fanout, NULL, NULL); }
+    return alloc_concat5(cache->dir, "/", fanout, "/", name);
+}
+
+/**
+ * Builds the header of a persisted entry.
+ * @param header  Receives the RENDER_CACHE_HEADER_SIZE bytes of the header.
+ */
+MODULE_FUNC void _render_cache_make_header(BYTE* header, const RenderEntry* entry) {
+    unsigned long long text_hash = hash64((const BYTE*)entry->text, entry->length, RENDER_CACHE_TEXT_SEED);
+    memcpy(header, "ZXRC", 4);
+    SET_LE_DWORD(header,  4, entry->size);
+    SET_LE_DWORD(header,  8, (unsigned long)(text_hash & 0xFFFFFFFFUL));
+    SET_LE_DWORD(header, 12, (unsigned long)(text_hash >> 32));
+}
+
+/**
+ * Reads an entry persisted in the directory of the cache.
+ * The entry is only accepted if its header matches the size of the payload and the text read.
+ * @return The new entry, not yet linked to the cache, or NULL if it is not in the directory.
+ */
+MODULE_FUNC RenderEntry* _render_cache_load(RenderCache* cache, unsigned long long hash, unsigned long size,
+                                            unsigned long format) {
+    RenderEntry* entry = NULL;
+    BYTE header[RENDER_CACHE_HEADER_SIZE], expected[RENDER_CACHE_HEADER_SIZE];
+    char* path; FILE* file; long file_size;
+    long long timer = stats_start_timer();
+
+    path = _render_cache_alloc_path(cache, hash, format, NULL);
+    file = path ? fopen(path, "rb") : NULL;
+    if( file ) {
+        if( fseek(file, 0, SEEK_END) == 0 && (file_size = ftell(file)) >= RENDER_CACHE_HEADER_SIZE &&
+            (size_t)(file_size - RENDER_CACHE_HEADER_SIZE) <= cache->max_entry && fseek(file, 0, SEEK_SET) == 0 &&
+            (entry = _render_cache_alloc_entry(hash, size, format, (size_t)(file_size - RENDER_CACHE_HEADER_SIZE))) ) {
+            if( fread(header, 1, sizeof(header), file) != sizeof(header) ||
+                fread(entry->text, 1, entry->length, file) != entry->length ) { free(entry); entry = NULL; }
+        }
+        fclose(file);
+    }
+    if( entry ) {
+        _render_cache_make_header(expected, entry);
+        if( memcmp(header, expected, sizeof(header)) != 0 ) { free(entry); entry = NULL; }
+    }
+    free(path);
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+    return entry;
+}
+
+/**
+ * Persists an entry in the directory of the cache.
+ * The text is written to a temporary file renamed when complete,
+ * so an interrupted run never leaves a truncated entry.
+ */
+MODULE_FUNC void _render_cache_save(RenderCache* cache, const RenderEntry* entry) {
+    char *fanout_dir = NULL, *path, *temp_path = NULL;
+    BYTE header[RENDER_CACHE_HEADER_SIZE];
+    int bucket = (int)(entry->hash >> 56);
+    BOOL success;
+    FILE* file;
+    long long timer = stats_start_timer();
+
+    path    = _render_cache_alloc_path(cache, entry->hash, entry->format, &fanout_dir);
+    success = path && fanout_dir;
+    mutex_lock(&cache->lock);
+    if( success && !(cache->fanout_ready[bucket / 8] & (1 << (bucket % 8))) ) {
+        success = is_directory(fanout_dir) || create_directory(fanout_dir);
+        if( success ) { cache->fanout_ready[bucket / 8] |= (BYTE)(1 << (bucket % 8)); }
+    }
+    mutex_unlock(&cache->lock);
+    if( success ) {
+        temp_path = alloc_concat5(path, ".tmp", NULL, NULL, NULL);
+        file      = temp_path ? fopen(temp_path, "wb") : NULL;
+        if( file ) {
+            _render_cache_make_header(header, entry);
+            success = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                      fwrite(entry->text, 1, entry->length, file) == entry->length;
+            if( fclose(file) != 0 ) { success = FALSE; }
+            if( !success || rename(temp_path, path) != 0 ) { remove(temp_path); }
+        }
+    }
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+    free(temp_path); free(path); free(fanout_dir);
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Opens a render cache, creating its directory if it does not exist.
+ * 
+ * The entries are persisted in a subdirectory named after `version`, so the
+ * texts rendered by other versions of the program are never reused.
+ * 
+ * @param cache    Pointer to the RenderCache structure to initialize.
+ * @param limit    Maximum number of bytes of memory used by the entries.
+ * @param dir      The directory where the entries are persisted, or NULL to keep them only in memory.
+ * @param version  The version of the renderer, it must be a valid file name.
+ * @return TRUE on success, FALSE if the directory could not be created or out of memory.
+ */
+MODULE_FUNC BOOL render_cache_open(RenderCache* cache, size_t limit, const char* dir, const char* version) {
+    assert( cache != NULL && limit > 0 && version != NULL );
+    memset(cache, 0, sizeof(RenderCache));
+
+    /* about one bucket for each 1KB of text, the average size of a rendered loader */
+    cache->bucket_count = 256;
+    while( cache->bucket_count < (1u << 20) && cache->bucket_count < limit / 1024 ) { cache->bucket_count *= 2; }
+    cache->buckets   = (RenderEntry**)calloc(cache->bucket_count, sizeof(RenderEntry*));
+    cache->limit     = limit;
+    cache->max_entry = limit < RENDER_CACHE_MAX_ENTRY ? limit : RENDER_CACHE_MAX_ENTRY;
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( dir && (is_directory(dir) || create_directory(dir)) ) {
+        cache->dir = alloc_concat5(dir, "/", version, NULL, NULL);
+        if( cache->dir && !is_directory(cache->dir) ) {
+            if( create_directory(cache->dir) ) { STATS_ADD(STATS_DIRS_CREATED, 1); }
+            else                               { free(cache->dir); cache->dir = NULL; }
+        }
+    }
+    if( !cache->buckets || (dir && !cache->dir) ) { free(cache->buckets); free(cache->dir); return FALSE; }
+    mutex_init(&cache->lock);
+    return TRUE;
+}
+
+/**
+ * Closes a render cache, releasing all its memory.
+ * @param cache  Pointer to the RenderCache structure opened with `render_cache_open()`.
+ */
+MODULE_FUNC void render_cache_close(RenderCache* cache) {
+    RenderEntry *entry, *older;
+    assert( cache != NULL );
+    for( entry = cache->newest ; entry ; entry = older ) { older = entry->older; free(entry); }
+    mutex_destroy(&cache->lock);
+    free(cache->buckets);
+    free(cache->dir);
+    memset(cache, 0, sizeof(RenderCache));
+}
+
+/**
+ * Looks for the text rendered from a payload.
+ * 
+ * The entries that are not in memory are also searched in the directory
+ * of the cache. The entry found must be released with `render_cache_release()`
+ * once its text has been written.
+ * 
+ * @param cache   The render cache.
+ * @param hash    The hash of the payload.
+ * @param size    The number of bytes of the payload.
+ * @param format  How the payload is rendered.
+ * @return The entry with the text, or NULL if the payload was not rendered before.
+ */
+MODULE_FUNC const RenderEntry* render_cache_find(RenderCache* cache, unsigned long long hash, unsigned long size,
+                                                 unsigned long format) {
+    RenderEntry *entry, *loaded;
+    assert( cache != NULL );
+
+    mutex_lock(&cache->lock);
+    entry = *_render_cache_slot(cache, hash, size, format);
+    if( entry ) { _render_cache_touch(cache, entry, FALSE); ++entry->refs; }
+    mutex_unlock(&cache->lock);
+
+    if( !entry && cache->dir && (loaded = _render_cache_load(cache, hash, size, format)) != NULL ) {
+        mutex_lock(&cache->lock);
+        entry = _render_cache_link(cache, loaded);
+        ++entry->refs;
+        mutex_unlock(&cache->lock);
+    }
+    STATS_ADD(entry ? STATS_CACHE_HITS : STATS_CACHE_MISSES, 1);
+    return entry;
+}
+
+/**
+ * Releases an entry returned by `render_cache_find()`.
+ * @param cache  The render cache.
+ * @param entry  The entry, it must not be used after this call.
+ */
+MODULE_FUNC void render_cache_release(RenderCache* cache, const RenderEntry* entry) {
+    RenderEntry* mutable_entry = (RenderEntry*)entry;
+    assert( cache != NULL && entry != NULL && entry->refs > 0 );
+    mutex_lock(&cache->lock);
+    if( --mutable_entry->refs == 0 && mutable_entry->evicted ) { free(mutable_entry); }
+    mutex_unlock(&cache->lock);
+}
+
+/**
+ * Adds the text rendered from a payload to the cache (and to its directory).
+ * Texts larger than `max_entry` bytes are not kept.
+ * @param cache   The render cache.
+ * @param hash    The hash of the payload.
+ * @param size    The number of bytes of the payload.
+ * @param format  How the payload was rendered.
+ * @param text    The rendered text.
+ * @param length  Number of bytes in `text`.
+ */
+MODULE_FUNC void render_cache_add(RenderCache* cache, unsigned long long hash, unsigned long size,
+                                  unsigned long format, const char* text, size_t length) {
+    RenderEntry* entry;
+    assert( cache != NULL );
+    if( length > cache->max_entry ) { return; }
+    entry = _render_cache_alloc_entry(hash, size, format, length);
+    if( !entry ) { return; }
+    memcpy(entry->text, text, length);
+    if( cache->dir ) { _render_cache_save(cache, entry); }
+    mutex_lock(&cache->lock);
+    _render_cache_link(cache, entry);
+    mutex_unlock(&cache->lock);
+}
+
+#endif /* RENDER_CACHE_H */
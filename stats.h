@@ -0,0 +1,212 @@
+/*
+| File    : stats.h
+| Purpose : Optional counters and timers to find where the time of a run goes.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef STATS_H
+#define STATS_H
+#include <stdio.h>
+#include "common.h"
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <time.h>
+#endif
+
+/**
+ * The values collected while statistics are enabled
+ * 
+ * Timers accumulate the time spent in each phase by all threads, so in
+ * parallel runs their sum may be greater than the wall clock time.
+ */
+typedef enum STATS_ID {
+    STATS_BLOCKS_READ,       /**< Number of tape blocks read */
+    STATS_PAYLOAD_BYTES,     /**< Bytes in the payloads of the blocks read */
+    STATS_SKIPPED_BYTES,     /**< Bytes of damaged tapes skipped while resynchronising */
+    STATS_ALLOCATIONS,       /**< Number of heap allocations (malloc/calloc/realloc) */
+    STATS_OUTPUT_BYTES,      /**< Bytes of formatted output written (BASIC listings, HEX records, ...) */
+    STATS_FILES_CREATED,     /**< Number of output files created */
+    STATS_DIRS_CREATED,      /**< Number of directories created */
+    STATS_PATH_PROBES,       /**< Number of calls to `path_exists()` */
+    STATS_CACHE_HITS,        /**< Number of blocks whose rendered output was found in the render cache */
+    STATS_CACHE_MISSES,      /**< Number of blocks rendered while the render cache was enabled */
+    STATS_TIME_READ,         /**< Nanoseconds opening, mapping and reading tapes */
+    STATS_TIME_INDEX,        /**< Nanoseconds parsing the headers (building or loading the block index) */
+    STATS_TIME_BASIC,        /**< Nanoseconds detokenizing BASIC programs */
+    STATS_TIME_HEX,          /**< Nanoseconds encoding Intel HEX records */
+    STATS_TIME_FILESYSTEM,   /**< Nanoseconds in filesystem calls (unique paths, directories, opening files) */
+    STATS_ID_COUNT
+} STATS_ID;
+
+/**
+ * A snapshot of the statistics of the run
+ */
+typedef struct Stats {
+    BOOL       enabled;                  /**< TRUE while the statistics are being collected */
+    long long  values[STATS_ID_COUNT];   /**< The value of each counter and timer, indexed by STATS_ID */
+} Stats;
+
+#ifdef ZXS_NO_STATS
+/*
+  Built without statistics (e.g. as part of the library, which has no
+  global state): the calls used by the other modules do nothing.
+*/
+#define STATS_ADD(id, value)          ( (void)0 )
+#define stats_start_timer()           ( 0LL )
+#define stats_end_timer(id, start)    ( (void)(start) )
+#else
+
+/** The statistics collected by the modules of this translation unit (all zero and disabled by default) */
+static Stats global_stats;
+
+/** Names of the values, used when printing them */
+static const char* STATS_NAMES[STATS_ID_COUNT] = {
+    "blocks_read", "payload_bytes", "skipped_bytes", "allocations", "output_bytes", "files_created", "dirs_created",
+    "path_probes", "cache_hits", "cache_misses", "time_read", "time_index", "time_basic", "time_hex", "time_filesystem"
+};
+
+/**
+ * Adds a value to a counter or timer, only if the statistics are enabled.
+ * When they are disabled the cost is a single predictable branch.
+ */
+#define STATS_ADD(id, value) ( global_stats.enabled ? stats_add_(id, (long long)(value)) : (void)0 )
+
+/*----------------------- INTERNAL HELPER FUNCTIONS ------------------------*/
+
+/**
+ * Atomically adds a value to a counter or timer.
+ * @param id     The counter or timer.
+ * @param value  The value to add.
+ */
+MODULE_FUNC void stats_add_(STATS_ID id, long long value) {
+#   if defined(_MSC_VER)
+        InterlockedExchangeAdd64((volatile LONG64*)&global_stats.values[id], value);
+#   elif defined(__GNUC__) || defined(__clang__)
+        __atomic_fetch_add(&global_stats.values[id], value, __ATOMIC_RELAXED);
+#   else
+        global_stats.values[id] += value;
+#   endif
+}
+
+/**
+ * Returns the time elapsed since an arbitrary point, from a monotonic clock.
+ * 
+ * When the monotonic clock is not declared (e.g. compiling with -std=c99
+ * and no POSIX feature macro), the C11 wall clock or, failing that, the
+ * processor time of `clock()` are used instead.
+ * 
+ * @return The time in nanoseconds.
+ */
+MODULE_FUNC long long stats_now(void) {
+#   if defined(_WIN32)
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return (long long)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#   elif defined(CLOCK_MONOTONIC)
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+#   elif defined(TIME_UTC)
+        struct timespec now;
+        timespec_get(&now, TIME_UTC);
+        return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+#   else
+        return (long long)((double)clock() * 1e9 / (double)CLOCKS_PER_SEC);
+#   endif
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Enables or disables the collection of statistics.
+ * @param enabled  TRUE to start collecting statistics, FALSE to stop.
+ */
+MODULE_FUNC void stats_enable(BOOL enabled) {
+    global_stats.enabled = enabled;
+}
+
+/**
+ * Starts timing a phase.
+ * @return The start time to pass to `stats_end_timer()` (0 if the statistics are disabled).
+ */
+MODULE_FUNC long long stats_start_timer(void) {
+    return global_stats.enabled ? stats_now() : 0;
+}
+
+/**
+ * Finishes timing a phase, adding the time elapsed since `stats_start_timer()` to a timer.
+ * @param id     The timer (one of the STATS_TIME_xxx values).
+ * @param start  The value returned by `stats_start_timer()`.
+ */
+MODULE_FUNC void stats_end_timer(STATS_ID id, long long start) {
+    if( start ) { stats_add_(id, stats_now() - start); }
+}
+
+/**
+ * Gets a copy of the statistics collected so far.
+ * @param[out] stats  Pointer to the Stats structure to fill in.
+ */
+MODULE_FUNC void stats_get(Stats* stats) {
+    int i;
+    stats->enabled = global_stats.enabled;
+    for( i = 0 ; i < STATS_ID_COUNT ; ++i ) {
+#       if defined(__GNUC__) || defined(__clang__)
+            stats->values[i] = __atomic_load_n(&global_stats.values[i], __ATOMIC_RELAXED);
+#       else
+            stats->values[i] = global_stats.values[i];
+#       endif
+    }
+}
+
+/**
+ * Prints the statistics collected so far.
+ * @param file     The output stream, usually stderr.
+ * @param as_json  TRUE to print them as a single JSON object, FALSE as human-readable text.
+ */
+MODULE_FUNC void stats_fprint(FILE* file, BOOL as_json) {
+    Stats stats; int i; BOOL is_time;
+    stats_get(&stats);
+    if( as_json ) { fprintf(file, "{"); }
+    else          { fprintf(file, "\nStatistics:\n"); }
+    for( i = 0 ; i < STATS_ID_COUNT ; ++i ) {
+        is_time = i >= STATS_TIME_READ;
+        if( as_json ) {
+            fprintf(file, "%s\"%s%s\":%lld", i>0 ? "," : "", STATS_NAMES[i], is_time ? "_ns" : "", stats.values[i]);
+        } else if( is_time ) {
+            fprintf(file, "  %-16s %12.3f ms\n", STATS_NAMES[i], (double)stats.values[i] / 1e6);
+        } else {
+            fprintf(file, "  %-16s %12lld\n", STATS_NAMES[i], stats.values[i]);
+        }
+    }
+    if( as_json ) { fprintf(file, "}\n"); }
+}
+
+#endif /* ZXS_NO_STATS */
+#endif /* STATS_H */
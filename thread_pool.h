@@ -0,0 +1,292 @@
+/*
+| File    : thread_pool.h
+| Purpose : Portable thread pool used to process tapes and blocks in parallel.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <assert.h>
+#include <stdlib.h>
+#include "common.h"
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+#endif
+
+/*---------------------------- SYNCHRONIZATION -----------------------------*/
+
+#ifdef _WIN32
+    typedef CRITICAL_SECTION   Mutex;
+    typedef CONDITION_VARIABLE Condition;
+    typedef HANDLE             Thread;
+#   define mutex_init(m)       InitializeCriticalSection(m)
+#   define mutex_destroy(m)    DeleteCriticalSection(m)
+#   define mutex_lock(m)       EnterCriticalSection(m)
+#   define mutex_unlock(m)     LeaveCriticalSection(m)
+#   define cond_init(c)        InitializeConditionVariable(c)
+#   define cond_destroy(c)     ((void)(c))
+#   define cond_wait(c,m)      SleepConditionVariableCS(c, m, INFINITE)
+#   define cond_signal(c)      WakeConditionVariable(c)
+#   define cond_broadcast(c)   WakeAllConditionVariable(c)
+#else
+    typedef pthread_mutex_t    Mutex;
+    typedef pthread_cond_t     Condition;
+    typedef pthread_t          Thread;
+#   define mutex_init(m)       pthread_mutex_init(m, NULL)
+#   define mutex_destroy(m)    pthread_mutex_destroy(m)
+#   define mutex_lock(m)       pthread_mutex_lock(m)
+#   define mutex_unlock(m)     pthread_mutex_unlock(m)
+#   define cond_init(c)        pthread_cond_init(c, NULL)
+#   define cond_destroy(c)     pthread_cond_destroy(c)
+#   define cond_wait(c,m)      pthread_cond_wait(c, m)
+#   define cond_signal(c)      pthread_cond_signal(c)
+#   define cond_broadcast(c)   pthread_cond_broadcast(c)
+#endif
+
+/**
+ * Returns the number of processors available in the system.
+ * @return The number of online processors (at least 1).
+ */
+MODULE_FUNC int get_cpu_count(void) {
+    int count;
+#   ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        count = (int)info.dwNumberOfProcessors;
+#   else
+        count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#   endif
+    return count > 0 ? count : 1;
+}
+
+/*------------------------------ THREAD POOL -------------------------------*/
+
+/** A function executed by the thread pool */
+typedef void (*TASK_FUNC)(void* arg);
+
+/**
+ * A group of tasks that can be waited for as a whole
+ */
+typedef struct TaskGroup {
+    int pending;                 /**< Number of submitted tasks that have not finished yet */
+} TaskGroup;
+
+/**
+ * A task queued in the thread pool
+ */
+typedef struct _Task {
+    TASK_FUNC      func;         /**< Function to execute */
+    void*          arg;          /**< Argument passed to `func` */
+    TaskGroup*     group;        /**< Group the task belongs to */
+    struct _Task*  next;         /**< Next task in the queue */
+} _Task;
+
+/**
+ * A fixed set of worker threads that execute queued tasks
+ * 
+ * Threads waiting for a group with `thread_pool_wait()` also execute the
+ * queued tasks of that group while they wait, so tasks can safely submit and
+ * wait for subtasks without picking up unrelated work of other groups.
+ */
+typedef struct ThreadPool {
+    Mutex      mutex;            /**< Protects all the fields below */
+    Condition  task_available;   /**< Signaled when a task is added to the queue */
+    Condition  task_finished;    /**< Signaled when any task finishes */
+    _Task*     head;             /**< First task in the queue */
+    _Task*     tail;             /**< Last task in the queue */
+    Thread*    threads;          /**< The worker threads */
+    int        thread_count;     /**< Number of worker threads (0 = tasks run on the submitting thread) */
+    BOOL       stopping;         /**< TRUE when the workers must exit */
+} ThreadPool;
+
+/*----------------------- INTERNAL HELPER FUNCTIONS ------------------------*/
+
+/**
+ * Removes the first task of a group from the queue (the pool mutex must be locked)
+ * @param pool   The thread pool.
+ * @param group  The group of the task, or NULL to take the first task of any group.
+ */
+MODULE_FUNC _Task* _thread_pool_pop(ThreadPool* pool, const TaskGroup* group) {
+    _Task *task = pool->head, *previous = NULL;
+    while( task && group && task->group != group ) { previous = task; task = task->next; }
+    if( task ) {
+        if( previous ) { previous->next = task->next; } else { pool->head = task->next; }
+        if( pool->tail == task ) { pool->tail = previous; }
+    }
+    return task;
+}
+
+/**
+ * Executes a task removed from the queue (the pool mutex must be locked)
+ */
+MODULE_FUNC void _thread_pool_run(ThreadPool* pool, _Task* task) {
+    mutex_unlock(&pool->mutex);
+    task->func(task->arg);
+    mutex_lock(&pool->mutex);
+    --task->group->pending;
+    cond_broadcast(&pool->task_finished);
+    free(task);
+}
+
+#ifdef _WIN32
+MODULE_FUNC DWORD WINAPI _thread_pool_worker(LPVOID param)
+#else
+MODULE_FUNC void* _thread_pool_worker(void* param)
+#endif
+{
+    ThreadPool* pool = (ThreadPool*)param;
+    _Task* task;
+    mutex_lock(&pool->mutex);
+    for(;;) {
+        while( !pool->head && !pool->stopping ) { cond_wait(&pool->task_available, &pool->mutex); }
+        if( !pool->head ) { break; }
+        task = _thread_pool_pop(pool, NULL);
+        _thread_pool_run(pool, task);
+    }
+    mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Initializes a thread pool.
+ * @param pool          The ThreadPool structure to initialize.
+ * @param thread_count  Number of worker threads to start (0 = run tasks on the submitting thread).
+ * @return
+ *    TRUE on success, FALSE if the threads could not be started
+ *    (in which case the pool still works without worker threads).
+ */
+MODULE_FUNC BOOL thread_pool_init(ThreadPool* pool, int thread_count) {
+    int i; BOOL success = TRUE;
+    assert( pool!=NULL && thread_count>=0 );
+
+    pool->head = pool->tail = NULL;
+    pool->stopping     = FALSE;
+    pool->thread_count = 0;
+    pool->threads      = thread_count>0 ? (Thread*)malloc(thread_count * sizeof(Thread)) : NULL;
+    mutex_init(&pool->mutex);
+    cond_init(&pool->task_available);
+    cond_init(&pool->task_finished);
+    if( thread_count>0 && !pool->threads ) { return FALSE; }
+
+    for( i = 0 ; success && i < thread_count ; ++i ) {
+#       ifdef _WIN32
+            pool->threads[i] = CreateThread(NULL, 0, _thread_pool_worker, pool, 0, NULL);
+            success = (pool->threads[i] != NULL);
+#       else
+            success = pthread_create(&pool->threads[i], NULL, _thread_pool_worker, pool) == 0;
+#       endif
+        if( success ) { ++pool->thread_count; }
+    }
+    return success;
+}
+
+/**
+ * Stops all the worker threads and releases the pool resources.
+ * All tasks already submitted are executed before the workers exit.
+ * @param pool The thread pool to destroy.
+ */
+MODULE_FUNC void thread_pool_destroy(ThreadPool* pool) {
+    int i;
+    assert( pool!=NULL );
+    mutex_lock(&pool->mutex);
+    pool->stopping = TRUE;
+    cond_broadcast(&pool->task_available);
+    mutex_unlock(&pool->mutex);
+    for( i = 0 ; i < pool->thread_count ; ++i ) {
+#       ifdef _WIN32
+            WaitForSingleObject(pool->threads[i], INFINITE);
+            CloseHandle(pool->threads[i]);
+#       else
+            pthread_join(pool->threads[i], NULL);
+#       endif
+    }
+    free(pool->threads);
+    cond_destroy(&pool->task_finished);
+    cond_destroy(&pool->task_available);
+    mutex_destroy(&pool->mutex);
+    pool->threads      = NULL;
+    pool->thread_count = 0;
+}
+
+/**
+ * Submits a task to be executed by the thread pool.
+ * 
+ * If the pool has no worker threads (or the task can not be queued)
+ * the task is executed immediately on the calling thread.
+ * 
+ * @param pool   The thread pool.
+ * @param group  The group the task belongs to (see `thread_pool_wait()`).
+ * @param func   The function to execute.
+ * @param arg    The argument passed to `func`.
+ */
+MODULE_FUNC void thread_pool_submit(ThreadPool* pool, TaskGroup* group, TASK_FUNC func, void* arg) {
+    _Task* task;
+    assert( pool!=NULL && group!=NULL && func!=NULL );
+
+    task = pool->thread_count>0 ? (_Task*)malloc(sizeof(_Task)) : NULL;
+    if( !task ) { func(arg); return; }
+    task->func  = func;
+    task->arg   = arg;
+    task->group = group;
+    task->next  = NULL;
+
+    mutex_lock(&pool->mutex);
+    if( pool->tail ) { pool->tail->next = task; }
+    else             { pool->head       = task; }
+    pool->tail = task;
+    ++group->pending;
+    cond_signal(&pool->task_available);
+    mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Waits until all the tasks of a group have finished.
+ * While waiting, the calling thread helps executing the queued tasks of the
+ * same group, tasks of other groups are left to the worker threads.
+ * @param pool   The thread pool.
+ * @param group  The group to wait for.
+ */
+MODULE_FUNC void thread_pool_wait(ThreadPool* pool, TaskGroup* group) {
+    _Task* task;
+    assert( pool!=NULL && group!=NULL );
+    mutex_lock(&pool->mutex);
+    while( group->pending > 0 ) {
+        task = _thread_pool_pop(pool, group);
+        if( task ) { _thread_pool_run(pool, task);                  }
+        else       { cond_wait(&pool->task_finished, &pool->mutex); }
+    }
+    mutex_unlock(&pool->mutex);
+}
+
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,296 @@
+/*
+| File    : zxs_arr.h
+| Purpose : ZX-Spectrum number and character array decoder functions.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef ZXS_ARR_H
+#define ZXS_ARR_H
+
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "out_buf.h"
+#include "zxs_bas.h"
+
+/*
+  The data block of a saved array is the array as stored in the variables
+  area, without the name and length bytes:
+    - 1 byte with the number of dimensions
+    - 2 bytes (little-endian) with the size of each dimension
+    - the elements, the last dimension varying fastest, each one a 5-byte
+      number (number arrays) or a 1-byte character (character arrays)
+  The name of the array is in the high byte of the first header parameter.
+*/
+
+#define ZXS_NUMBER_SIZE        5   /**< Size in bytes of a ZX-Spectrum number */
+#define ZXS_ARRAY_MAX_DIMS     255 /**< Maximum number of dimensions of an array */
+#define ZXS_ARRAY_LINE_VALUES  16  /**< Maximum number of values written in each DATA line */
+#define ZXS_ARR_BUFFER_SIZE    OUT_BUF_SIZE /**< Size of the output buffer used by the zxs_fprint_* functions */
+
+/**
+ * The layout of an array saved in a data block
+ */
+typedef struct ZXSArray {
+    unsigned    dim_count;                  /**< Number of dimensions */
+    unsigned    dims[ZXS_ARRAY_MAX_DIMS];   /**< Size of each dimension */
+    unsigned    element_count;              /**< Total number of elements (product of all `dims`) */
+    const BYTE* elements;                   /**< Pointer to the first element */
+} ZXSArray;
+
+/**
+ * Returns the name of an array from the first parameter of its header.
+ * @param param1  The first parameter of the header, e.g. 0x8100 for the array "a".
+ * @return The lowercase letter that names the array.
+ */
+MODULE_FUNC char zxs_get_array_name(unsigned param1) {
+    return (char)( ((param1 >> 8) & 0x1F) | 0x60 );
+}
+
+/**
+ * Converts a ZX-Spectrum number (5 bytes) to a double.
+ * 
+ * Numbers are stored either in floating-point form, an exponent byte (biased
+ * by 128) and a 32-bit mantissa whose implicit leading 1 is replaced by the
+ * sign bit, or in the small integer form used for whole numbers between
+ * -65535 and 65535: a zero exponent, a sign byte (00 or FF) and the value in
+ * two's complement (2 bytes, little-endian).
+ * 
+ * The floating-point form maps to a normal IEEE-754 double just by moving
+ * the bits around, so both forms are computed without branches and the
+ * result is selected at the end, which lets the compiler vectorise loops
+ * over whole arrays (see `zxs_numbers_to_doubles()`).
+ * 
+ * @param number  Pointer to the 5 bytes of the number.
+ * @return The value of the number.
+ */
+MODULE_FUNC double zxs_number_to_double(const BYTE* number) {
+    unsigned long long bits; double floating; long integer;
+
+    /* 0.1mmm x 2^(e-128) == 1.mmm x 2^(e-129), the IEEE-754 exponent bias is 1023 */
+    bits = ((unsigned long long)(number[1] & 0x80) << 56)             |
+           ((unsigned long long)(number[0] + 1023 - 129) << 52)       |
+           ((unsigned long long)(number[1] & 0x7F) << 45)             |
+           ((unsigned long long)number[2] << 37)                      |
+           ((unsigned long long)number[3] << 29)                      |
+           ((unsigned long long)number[4] << 21);
+    memcpy(&floating, &bits, sizeof(floating));
+    integer = (long)(number[2] | (number[3] << 8)) - (number[1] ? 65536L : 0L);
+    return number[0] ? floating : (double)integer;
+}
+
+/**
+ * Converts a sequence of ZX-Spectrum numbers to doubles.
+ * @param data    Pointer to the numbers, 5 bytes each.
+ * @param count   Number of numbers to convert.
+ * @param values  Array of at least `count` doubles that receives the values.
+ */
+MODULE_FUNC void zxs_numbers_to_doubles(const BYTE* data, unsigned count, double* values) {
+    unsigned i;
+    for( i = 0 ; i < count ; ++i ) { values[i] = zxs_number_to_double(data + i * ZXS_NUMBER_SIZE); }
+}
+
+/**
+ * Writes a number as text, the way the ZX-Spectrum shows it (whole
+ * numbers up to 32 bits in full, any other value with up to 9 significant digits).
+ * @param out    Pointer to the output buffer.
+ * @param value  The number to write.
+ */
+MODULE_FUNC void zxs_write_number(OutBuf* out, double value) {
+    char formatted[32]; double magnitude = value < 0 ? -value : value;
+    if( magnitude < 4294967296.0 && magnitude == (double)(unsigned long)magnitude ) {
+        if( value < 0 ) { out_buf_putc(out, '-'); }
+        out_buf_put_uint(out, (unsigned)(unsigned long)magnitude, 0);
+        return;
+    }
+    sprintf(formatted, "%.9G", value);
+    out_buf_write(out, formatted, strlen(formatted));
+}
+
+/**
+ * Reads the layout of an array from its data block.
+ * @param[out] array         The ZXSArray structure to fill in.
+ * @param[in]  data          Pointer to the data block of the array.
+ * @param[in]  datasize      Size of the data block in bytes.
+ * @param[in]  element_size  Size of each element in bytes (5 for numbers, 1 for characters).
+ * @return TRUE if the layout is valid and all the elements are within the block.
+ */
+MODULE_FUNC BOOL zxs_parse_array(ZXSArray* array, const BYTE* data, unsigned datasize, unsigned element_size) {
+    unsigned i, available;
+
+    if( data == NULL || datasize < 1 ) { return FALSE; }
+    array->dim_count = data[0];
+    if( array->dim_count == 0 || datasize < 1 + 2 * array->dim_count ) { return FALSE; }
+
+    /* the product of the dimensions is checked against the available */
+    /* elements at each step, so it can never overflow                */
+    available = (datasize - 1 - 2 * array->dim_count) / element_size;
+    array->element_count = 1;
+    for( i = 0 ; i < array->dim_count ; ++i ) {
+        array->dims[i] = GET_LE_WORD(data, 1 + 2 * i);
+        if( array->dims[i] == 0 || array->dims[i] > available / array->element_count ) { return FALSE; }
+        array->element_count *= array->dims[i];
+    }
+    array->elements = data + 1 + 2 * array->dim_count;
+    return TRUE;
+}
+
+/**
+ * Writes the DIM statement of an array, e.g. "DIM a$(3,10)".
+ * @param out     Pointer to the output buffer.
+ * @param name    The name of the array, e.g. "a" or "a$".
+ * @param array   The layout of the array.
+ */
+MODULE_FUNC void _zxs_write_dim(OutBuf* out, const char* name, const ZXSArray* array) {
+    unsigned i;
+    out_buf_write(out, "DIM ", 4);
+    out_buf_write(out, name, strlen(name));
+    for( i = 0 ; i < array->dim_count ; ++i ) {
+        out_buf_putc(out, i == 0 ? '(' : ',');
+        out_buf_put_uint(out, array->dims[i], 0);
+    }
+    out_buf_write(out, ")\n", 2);
+}
+
+/**
+ * Writes a ZX Spectrum number array as text to an output buffer.
+ * 
+ * The array is written as its DIM statement followed by DATA lines with
+ * the values in the order they are stored, each row of the last dimension
+ * in its own lines, e.g.:
+ *     DIM a(2,3)
+ *     DATA 1,2,3
+ *     DATA 4,5.5,-6
+ * 
+ * @param out       Pointer to the output buffer.
+ * @param param1    The first parameter of the header, that contains the name of the array.
+ * @param data      Pointer to the data block of the array.
+ * @param datasize  Size of the data block in bytes.
+ * @return          0 on success, or an error code indicating what went wrong.
+ */
+MODULE_FUNC int zxs_write_number_array(OutBuf* out, unsigned param1, const BYTE* data, unsigned datasize) {
+    ZXSArray array; double values[ZXS_ARRAY_LINE_VALUES];
+    unsigned row_size, element, column, count, i;
+    char name[2];
+
+    if( out == NULL ) { return 1; /* invalid parameter */ }
+    if( !zxs_parse_array(&array, data, datasize, ZXS_NUMBER_SIZE) ) {
+        out_buf_flush(out); return ZXS_ERR_INVALID_NUMBERS;
+    }
+    name[0] = zxs_get_array_name(param1); name[1] = '\0';
+    _zxs_write_dim(out, name, &array);
+
+    row_size = array.dims[array.dim_count - 1];
+    for( element = 0 ; element < array.element_count ; element += row_size ) {
+        for( column = 0 ; column < row_size ; column += count ) {
+            count = row_size - column < ZXS_ARRAY_LINE_VALUES ? row_size - column : ZXS_ARRAY_LINE_VALUES;
+            zxs_numbers_to_doubles(array.elements + (element + column) * ZXS_NUMBER_SIZE, count, values);
+            out_buf_write(out, "DATA ", 5);
+            for( i = 0 ; i < count ; ++i ) {
+                if( i > 0 ) { out_buf_putc(out, ','); }
+                zxs_write_number(out, values[i]);
+            }
+            out_buf_putc(out, '\n');
+        }
+    }
+    return out->err_code;
+}
+
+/**
+ * Writes a ZX Spectrum character array as text to an output buffer.
+ * 
+ * The array is written as its DIM statement followed by one DATA line for
+ * each row of the last dimension, with the characters as a quoted string
+ * (see `zxs_write_string()`), e.g.:
+ *     DIM a$(2,5)
+ *     DATA "hello"
+ *     DATA "world"
+ * 
+ * @param out       Pointer to the output buffer.
+ * @param param1    The first parameter of the header, that contains the name of the array.
+ * @param data      Pointer to the data block of the array.
+ * @param datasize  Size of the data block in bytes.
+ * @return          0 on success, or an error code indicating what went wrong.
+ */
+MODULE_FUNC int zxs_write_string_array(OutBuf* out, unsigned param1, const BYTE* data, unsigned datasize) {
+    ZXSArray array; unsigned row_size, element;
+    char name[3];
+
+    if( out == NULL ) { return 1; /* invalid parameter */ }
+    if( !zxs_parse_array(&array, data, datasize, 1) ) {
+        out_buf_flush(out); return ZXS_ERR_INVALID_STRINGS;
+    }
+    name[0] = zxs_get_array_name(param1); name[1] = '$'; name[2] = '\0';
+    _zxs_write_dim(out, name, &array);
+
+    row_size = array.dims[array.dim_count - 1];
+    for( element = 0 ; element < array.element_count ; element += row_size ) {
+        out_buf_write(out, "DATA \"", 6);
+        zxs_write_string(out, array.elements + element, row_size);
+        out_buf_write(out, "\"\n", 2);
+    }
+    return out->err_code;
+}
+
+/**
+ * Prints a ZX Spectrum number array as text to a file (see `zxs_write_number_array()`).
+ * @param file      FILE pointer to the output file.
+ * @param param1    The first parameter of the header, that contains the name of the array.
+ * @param data      Pointer to the data block of the array.
+ * @param datasize  Size of the data block in bytes.
+ * @return          0 on success, or an error code indicating what went wrong.
+ */
+MODULE_FUNC int zxs_fprint_number_array(FILE* file, unsigned param1, const BYTE* data, unsigned datasize) {
+    char memory[ZXS_ARR_BUFFER_SIZE]; OutBuf out;
+    int err_code;
+    if( file == NULL ) { return 1; /* invalid parameter */ }
+    out_buf_init(&out, file, memory, sizeof(memory));
+    err_code = zxs_write_number_array(&out, param1, data, datasize);
+    if( out_buf_flush(&out) && !err_code ) { err_code = ZXS_ERR_OUTPUT; }
+    return err_code;
+}
+
+/**
+ * Prints a ZX Spectrum character array as text to a file (see `zxs_write_string_array()`).
+ * @param file      FILE pointer to the output file.
+ * @param param1    The first parameter of the header, that contains the name of the array.
+ * @param data      Pointer to the data block of the array.
+ * @param datasize  Size of the data block in bytes.
+ * @return          0 on success, or an error code indicating what went wrong.
+ */
+MODULE_FUNC int zxs_fprint_string_array(FILE* file, unsigned param1, const BYTE* data, unsigned datasize) {
+    char memory[ZXS_ARR_BUFFER_SIZE]; OutBuf out;
+    int err_code;
+    if( file == NULL ) { return 1; /* invalid parameter */ }
+    out_buf_init(&out, file, memory, sizeof(memory));
+    err_code = zxs_write_string_array(&out, param1, data, datasize);
+    if( out_buf_flush(&out) && !err_code ) { err_code = ZXS_ERR_OUTPUT; }
+    return err_code;
+}
+
+#endif /* ZXS_ARR_H */
@@ -35,6 +35,8 @@
 #include <stdio.h>
 #include <string.h>
 #include "common.h"
+#include "stats.h"
+#include "out_buf.h"
 
 /*
   Most of the info about ZX-Spectrum BASIC tokens is available at:
@@ -42,72 +44,321 @@
 */
 
 #define ZXS_COPYRIGHT_CHAR "{(C)}"
-static const char* ZXS_CTRL_CHARS[] = {
-/* 0x00 */   "{00}", "{01}", "{02}", "{03}", "{04}", "{05}",  "\t" , "{07}",
-/* 0x08 */   "{08}", "{09}", "{0A}", "{0B}", "{0C}", "\n"  ,  ""   , "{0F}",
-/* 0x10 */   "{INK %d}", "{PAPER %d}", "{FLASH %d}", "{BRIGHT %d}", "{INVERSE %d}", "{OVER %d}", "{AT %d,%d}", "{TAB %d,%d}",
-/* 0x18 */   "{18}", "{19}", "{1A}", "{1B}", "{1C}", "{1D}", "{1E}", "{1F}"
-};
 
-#define            ZXS_GRAPH_CHARS_START 0x80
-static const char* ZXS_GRAPH_CHARS[] = {
-/* 0x80 */   "{-8}", "{-1}", "{-2}", "{-3}", "{-4}", "{-5}", "{-6}", "{-7}",
-/* 0x88 */   "{+7}", "{+6}", "{+5}", "{+4}", "{+3}", "{+2}", "{+1}", "{+8}"
-};
+/**
+ * Error codes returned by the decoders of BASIC programs and arrays
+ */
+typedef enum ZXS_ERROR {
+    ZXS_OK                     = 0, /**< No error */
+    ZXS_ERR_OUTPUT             = 1, /**< Invalid output or the output could not be written */
+    ZXS_ERR_TRUNCATED_BASIC    = 2, /**< The BASIC program ends in the middle of a line */
+    ZXS_ERR_INVALID_NUMBERS    = 3, /**< The number array is invalid or truncated */
+    ZXS_ERR_INVALID_STRINGS    = 4  /**< The character array is invalid or truncated */
+} ZXS_ERROR;
+
+#define ZXS_TOKEN_KEYWORD        0x01 /**< The token is a BASIC keyword               */
+#define ZXS_TOKEN_LEADING_SPACE  0x02 /**< The token text starts with a space         */
+#define ZXS_TOKEN_TRAILING_SPACE 0x04 /**< The token text ends with a space           */
+#define ZXS_TOKEN_FORMAT         0x08 /**< The token text is a printf format (%d ...) */
+
+/**
+ * Precomputed information about how to print a byte of a BASIC line
+ */
+typedef struct ZXSToken {
+    const char*    text;         /**< Text printed for the byte (a printf format if ZXS_TOKEN_FORMAT) */
+    unsigned char  length;       /**< Length of `text` in characters */
+    unsigned char  skip;         /**< Number of following bytes consumed by the token (parameters) */
+    unsigned char  flags;        /**< Combination of ZXS_TOKEN_xxx flags */
+} ZXSToken;
+
+#define ZXS_TOKEN(text, skip, flags) { text, sizeof(text)-1, skip, flags }
 
-#define            ZXS_UDG_CHARS_START 0x90
-static const char* ZXS_UDG_CHARS[] = {
-/* 0x90 */   "{A}", "{B}", "{C}", "{D}", "{E}", "{F}", "{G}", "{H}",
-/* 0x98 */   "{I}", "{J}", "{K}", "{L}", "{M}", "{N}", "{O}", "{P}",
-/* 0xA0 */   "{Q}", "{R}", "{S}", "{T}", "{U}"
+/** How each of the 256 possible bytes is printed (outside of quotes) */
+static const ZXSToken ZXS_TOKENS[256] = {
+/* 0x00 */   ZXS_TOKEN("{00}", 0, 0),
+/* 0x01 */   ZXS_TOKEN("{01}", 0, 0),
+/* 0x02 */   ZXS_TOKEN("{02}", 0, 0),
+/* 0x03 */   ZXS_TOKEN("{03}", 0, 0),
+/* 0x04 */   ZXS_TOKEN("{04}", 0, 0),
+/* 0x05 */   ZXS_TOKEN("{05}", 0, 0),
+/* 0x06 */   ZXS_TOKEN("\t", 0, 0),
+/* 0x07 */   ZXS_TOKEN("{07}", 0, 0),
+/* 0x08 */   ZXS_TOKEN("{08}", 0, 0),
+/* 0x09 */   ZXS_TOKEN("{09}", 0, 0),
+/* 0x0A */   ZXS_TOKEN("{0A}", 0, 0),
+/* 0x0B */   ZXS_TOKEN("{0B}", 0, 0),
+/* 0x0C */   ZXS_TOKEN("{0C}", 0, 0),
+/* 0x0D */   ZXS_TOKEN("\n", 0, 0),
+/* 0x0E */   ZXS_TOKEN("", 5, 0),
+/* 0x0F */   ZXS_TOKEN("{0F}", 0, 0),
+/* 0x10 */   ZXS_TOKEN("{INK %d}", 1, ZXS_TOKEN_FORMAT),
+/* 0x11 */   ZXS_TOKEN("{PAPER %d}", 1, ZXS_TOKEN_FORMAT),
+/* 0x12 */   ZXS_TOKEN("{FLASH %d}", 1, ZXS_TOKEN_FORMAT),
+/* 0x13 */   ZXS_TOKEN("{BRIGHT %d}", 1, ZXS_TOKEN_FORMAT),
+/* 0x14 */   ZXS_TOKEN("{INVERSE %d}", 1, ZXS_TOKEN_FORMAT),
+/* 0x15 */   ZXS_TOKEN("{OVER %d}", 1, ZXS_TOKEN_FORMAT),
+/* 0x16 */   ZXS_TOKEN("{AT %d,%d}", 2, ZXS_TOKEN_FORMAT),
+/* 0x17 */   ZXS_TOKEN("{TAB %d,%d}", 2, ZXS_TOKEN_FORMAT),
+/* 0x18 */   ZXS_TOKEN("{18}", 0, 0),
+/* 0x19 */   ZXS_TOKEN("{19}", 0, 0),
+/* 0x1A */   ZXS_TOKEN("{1A}", 0, 0),
+/* 0x1B */   ZXS_TOKEN("{1B}", 0, 0),
+/* 0x1C */   ZXS_TOKEN("{1C}", 0, 0),
+/* 0x1D */   ZXS_TOKEN("{1D}", 0, 0),
+/* 0x1E */   ZXS_TOKEN("{1E}", 0, 0),
+/* 0x1F */   ZXS_TOKEN("{1F}", 0, 0),
+/* 0x20 */   ZXS_TOKEN(" ", 0, 0),
+/* 0x21 */   ZXS_TOKEN("!", 0, 0),
+/* 0x22 */   ZXS_TOKEN("\"", 0, 0),
+/* 0x23 */   ZXS_TOKEN("#", 0, 0),
+/* 0x24 */   ZXS_TOKEN("$", 0, 0),
+/* 0x25 */   ZXS_TOKEN("%", 0, 0),
+/* 0x26 */   ZXS_TOKEN("&", 0, 0),
+/* 0x27 */   ZXS_TOKEN("'", 0, 0),
+/* 0x28 */   ZXS_TOKEN("(", 0, 0),
+/* 0x29 */   ZXS_TOKEN(")", 0, 0),
+/* 0x2A */   ZXS_TOKEN("*", 0, 0),
+/* 0x2B */   ZXS_TOKEN("+", 0, 0),
+/* 0x2C */   ZXS_TOKEN(",", 0, 0),
+/* 0x2D */   ZXS_TOKEN("-", 0, 0),
+/* 0x2E */   ZXS_TOKEN(".", 0, 0),
+/* 0x2F */   ZXS_TOKEN("/", 0, 0),
+/* 0x30 */   ZXS_TOKEN("0", 0, 0),
+/* 0x31 */   ZXS_TOKEN("1", 0, 0),
+/* 0x32 */   ZXS_TOKEN("2", 0, 0),
+/* 0x33 */   ZXS_TOKEN("3", 0, 0),
+/* 0x34 */   ZXS_TOKEN("4", 0, 0),
+/* 0x35 */   ZXS_TOKEN("5", 0, 0),
+/* 0x36 */   ZXS_TOKEN("6", 0, 0),
+/* 0x37 */   ZXS_TOKEN("7", 0, 0),
+/* 0x38 */   ZXS_TOKEN("8", 0, 0),
+/* 0x39 */   ZXS_TOKEN("9", 0, 0),
+/* 0x3A */   ZXS_TOKEN(":", 0, 0),
+/* 0x3B */   ZXS_TOKEN(";", 0, 0),
+/* 0x3C */   ZXS_TOKEN("<", 0, 0),
+/* 0x3D */   ZXS_TOKEN("=", 0, 0),
+/* 0x3E */   ZXS_TOKEN(">", 0, 0),
+/* 0x3F */   ZXS_TOKEN("?", 0, 0),
+/* 0x40 */   ZXS_TOKEN("@", 0, 0),
+/* 0x41 */   ZXS_TOKEN("A", 0, 0),
+/* 0x42 */   ZXS_TOKEN("B", 0, 0),
+/* 0x43 */   ZXS_TOKEN("C", 0, 0),
+/* 0x44 */   ZXS_TOKEN("D", 0, 0),
+/* 0x45 */   ZXS_TOKEN("E", 0, 0),
+/* 0x46 */   ZXS_TOKEN("F", 0, 0),
+/* 0x47 */   ZXS_TOKEN("G", 0, 0),
+/* 0x48 */   ZXS_TOKEN("H", 0, 0),
+/* 0x49 */   ZXS_TOKEN("I", 0, 0),
+/* 0x4A */   ZXS_TOKEN("J", 0, 0),
+/* 0x4B */   ZXS_TOKEN("K", 0, 0),
+/* 0x4C */   ZXS_TOKEN("L", 0, 0),
+/* 0x4D */   ZXS_TOKEN("M", 0, 0),
+/* 0x4E */   ZXS_TOKEN("N", 0, 0),
+/* 0x4F */   ZXS_TOKEN("O", 0, 0),
+/* 0x50 */   ZXS_TOKEN("P", 0, 0),
+/* 0x51 */   ZXS_TOKEN("Q", 0, 0),
+/* 0x52 */   ZXS_TOKEN("R", 0, 0),
+/* 0x53 */   ZXS_TOKEN("S", 0, 0),
+/* 0x54 */   ZXS_TOKEN("T", 0, 0),
+/* 0x55 */   ZXS_TOKEN("U", 0, 0),
+/* 0x56 */   ZXS_TOKEN("V", 0, 0),
+/* 0x57 */   ZXS_TOKEN("W", 0, 0),
+/* 0x58 */   ZXS_TOKEN("X", 0, 0),
+/* 0x59 */   ZXS_TOKEN("Y", 0, 0),
+/* 0x5A */   ZXS_TOKEN("Z", 0, 0),
+/* 0x5B */   ZXS_TOKEN("[", 0, 0),
+/* 0x5C */   ZXS_TOKEN("\\", 0, 0),
+/* 0x5D */   ZXS_TOKEN("]", 0, 0),
+/* 0x5E */   ZXS_TOKEN("^", 0, 0),
+/* 0x5F */   ZXS_TOKEN("_", 0, 0),
+/* 0x60 */   ZXS_TOKEN("`", 0, 0),
+/* 0x61 */   ZXS_TOKEN("a", 0, 0),
+/* 0x62 */   ZXS_TOKEN("b", 0, 0),
+/* 0x63 */   ZXS_TOKEN("c", 0, 0),
+/* 0x64 */   ZXS_TOKEN("d", 0, 0),
+/* 0x65 */   ZXS_TOKEN("e", 0, 0),
+/* 0x66 */   ZXS_TOKEN("f", 0, 0),
+/* 0x67 */   ZXS_TOKEN("g", 0, 0),
+/* 0x68 */   ZXS_TOKEN("h", 0, 0),
+/* 0x69 */   ZXS_TOKEN("i", 0, 0),
+/* 0x6A */   ZXS_TOKEN("j", 0, 0),
+/* 0x6B */   ZXS_TOKEN("k", 0, 0),
+/* 0x6C */   ZXS_TOKEN("l", 0, 0),
+/* 0x6D */   ZXS_TOKEN("m", 0, 0),
+/* 0x6E */   ZXS_TOKEN("n", 0, 0),
+/* 0x6F */   ZXS_TOKEN("o", 0, 0),
+/* 0x70 */   ZXS_TOKEN("p", 0, 0),
+/* 0x71 */   ZXS_TOKEN("q", 0, 0),
+/* 0x72 */   ZXS_TOKEN("r", 0, 0),
+/* 0x73 */   ZXS_TOKEN("s", 0, 0),
+/* 0x74 */   ZXS_TOKEN("t", 0, 0),
+/* 0x75 */   ZXS_TOKEN("u", 0, 0),
+/* 0x76 */   ZXS_TOKEN("v", 0, 0),
+/* 0x77 */   ZXS_TOKEN("w", 0, 0),
+/* 0x78 */   ZXS_TOKEN("x", 0, 0),
+/* 0x79 */   ZXS_TOKEN("y", 0, 0),
+/* 0x7A */   ZXS_TOKEN("z", 0, 0),
+/* 0x7B */   ZXS_TOKEN("{", 0, 0),
+/* 0x7C */   ZXS_TOKEN("|", 0, 0),
+/* 0x7D */   ZXS_TOKEN("}", 0, 0),
+/* 0x7E */   ZXS_TOKEN("~", 0, 0),
+/* 0x7F */   ZXS_TOKEN(ZXS_COPYRIGHT_CHAR, 0, 0),
+/* 0x80 */   ZXS_TOKEN("{-8}", 0, 0),
+/* 0x81 */   ZXS_TOKEN("{-1}", 0, 0),
+/* 0x82 */   ZXS_TOKEN("{-2}", 0, 0),
+/* 0x83 */   ZXS_TOKEN("{-3}", 0, 0),
+/* 0x84 */   ZXS_TOKEN("{-4}", 0, 0),
+/* 0x85 */   ZXS_TOKEN("{-5}", 0, 0),
+/* 0x86 */   ZXS_TOKEN("{-6}", 0, 0),
+/* 0x87 */   ZXS_TOKEN("{-7}", 0, 0),
+/* 0x88 */   ZXS_TOKEN("{+7}", 0, 0),
+/* 0x89 */   ZXS_TOKEN("{+6}", 0, 0),
+/* 0x8A */   ZXS_TOKEN("{+5}", 0, 0),
+/* 0x8B */   ZXS_TOKEN("{+4}", 0, 0),
+/* 0x8C */   ZXS_TOKEN("{+3}", 0, 0),
+/* 0x8D */   ZXS_TOKEN("{+2}", 0, 0),
+/* 0x8E */   ZXS_TOKEN("{+1}", 0, 0),
+/* 0x8F */   ZXS_TOKEN("{+8}", 0, 0),
+/* 0x90 */   ZXS_TOKEN("{A}", 0, 0),
+/* 0x91 */   ZXS_TOKEN("{B}", 0, 0),
+/* 0x92 */   ZXS_TOKEN("{C}", 0, 0),
+/* 0x93 */   ZXS_TOKEN("{D}", 0, 0),
+/* 0x94 */   ZXS_TOKEN("{E}", 0, 0),
+/* 0x95 */   ZXS_TOKEN("{F}", 0, 0),
+/* 0x96 */   ZXS_TOKEN("{G}", 0, 0),
+/* 0x97 */   ZXS_TOKEN("{H}", 0, 0),
+/* 0x98 */   ZXS_TOKEN("{I}", 0, 0),
+/* 0x99 */   ZXS_TOKEN("{J}", 0, 0),
+/* 0x9A */   ZXS_TOKEN("{K}", 0, 0),
+/* 0x9B */   ZXS_TOKEN("{L}", 0, 0),
+/* 0x9C */   ZXS_TOKEN("{M}", 0, 0),
+/* 0x9D */   ZXS_TOKEN("{N}", 0, 0),
+/* 0x9E */   ZXS_TOKEN("{O}", 0, 0),
+/* 0x9F */   ZXS_TOKEN("{P}", 0, 0),
+/* 0xA0 */   ZXS_TOKEN("{Q}", 0, 0),
+/* 0xA1 */   ZXS_TOKEN("{R}", 0, 0),
+/* 0xA2 */   ZXS_TOKEN("{S}", 0, 0),
+/* 0xA3 */   ZXS_TOKEN(" SPECTRUM ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xA4 */   ZXS_TOKEN(" PLAY ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xA5 */   ZXS_TOKEN("RND", 0, ZXS_TOKEN_KEYWORD),
+/* 0xA6 */   ZXS_TOKEN("INKEY$", 0, ZXS_TOKEN_KEYWORD),
+/* 0xA7 */   ZXS_TOKEN("PI", 0, ZXS_TOKEN_KEYWORD),
+/* 0xA8 */   ZXS_TOKEN("FN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xA9 */   ZXS_TOKEN("POINT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xAA */   ZXS_TOKEN("SCREEN$ ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xAB */   ZXS_TOKEN("ATTR ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xAC */   ZXS_TOKEN("AT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xAD */   ZXS_TOKEN("TAB ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xAE */   ZXS_TOKEN("VAL$ ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xAF */   ZXS_TOKEN("CODE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB0 */   ZXS_TOKEN("VAL ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB1 */   ZXS_TOKEN("LEN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB2 */   ZXS_TOKEN("SIN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB3 */   ZXS_TOKEN("COS ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB4 */   ZXS_TOKEN("TAN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB5 */   ZXS_TOKEN("ASN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB6 */   ZXS_TOKEN("ACS ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB7 */   ZXS_TOKEN("ATN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB8 */   ZXS_TOKEN("LN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xB9 */   ZXS_TOKEN("EXP ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xBA */   ZXS_TOKEN("INT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xBB */   ZXS_TOKEN("SQR ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xBC */   ZXS_TOKEN("SGN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xBD */   ZXS_TOKEN("ABS ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xBE */   ZXS_TOKEN("PEEK ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xBF */   ZXS_TOKEN("IN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC0 */   ZXS_TOKEN("USR ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC1 */   ZXS_TOKEN("STR$ ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC2 */   ZXS_TOKEN("CHR$ ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC3 */   ZXS_TOKEN("NOT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC4 */   ZXS_TOKEN("BIN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC5 */   ZXS_TOKEN(" OR ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC6 */   ZXS_TOKEN(" AND ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xC7 */   ZXS_TOKEN("<=", 0, ZXS_TOKEN_KEYWORD),
+/* 0xC8 */   ZXS_TOKEN(">=", 0, ZXS_TOKEN_KEYWORD),
+/* 0xC9 */   ZXS_TOKEN("<>", 0, ZXS_TOKEN_KEYWORD),
+/* 0xCA */   ZXS_TOKEN(" LINE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xCB */   ZXS_TOKEN(" THEN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xCC */   ZXS_TOKEN(" TO ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xCD */   ZXS_TOKEN(" STEP ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xCE */   ZXS_TOKEN(" DEF FN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xCF */   ZXS_TOKEN(" CAT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD0 */   ZXS_TOKEN(" FORMAT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD1 */   ZXS_TOKEN(" MOVE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD2 */   ZXS_TOKEN(" ERASE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD3 */   ZXS_TOKEN(" OPEN #", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE),
+/* 0xD4 */   ZXS_TOKEN(" CLOSE #", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE),
+/* 0xD5 */   ZXS_TOKEN(" MERGE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD6 */   ZXS_TOKEN(" VERIFY ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD7 */   ZXS_TOKEN(" BEEP ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD8 */   ZXS_TOKEN(" CIRCLE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xD9 */   ZXS_TOKEN(" INK ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xDA */   ZXS_TOKEN(" PAPER ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xDB */   ZXS_TOKEN(" FLASH ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xDC */   ZXS_TOKEN(" BRIGHT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xDD */   ZXS_TOKEN(" INVERSE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xDE */   ZXS_TOKEN(" OVER ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xDF */   ZXS_TOKEN(" OUT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE0 */   ZXS_TOKEN(" LPRINT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE1 */   ZXS_TOKEN(" LLIST ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE2 */   ZXS_TOKEN(" STOP ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE3 */   ZXS_TOKEN(" READ ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE4 */   ZXS_TOKEN(" DATA ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE5 */   ZXS_TOKEN(" RESTORE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE6 */   ZXS_TOKEN(" NEW ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE7 */   ZXS_TOKEN(" BORDER ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE8 */   ZXS_TOKEN(" CONTINUE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xE9 */   ZXS_TOKEN(" DIM ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xEA */   ZXS_TOKEN(" REM ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xEB */   ZXS_TOKEN(" FOR ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xEC */   ZXS_TOKEN(" GO TO ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xED */   ZXS_TOKEN(" GO SUB ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xEE */   ZXS_TOKEN(" INPUT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xEF */   ZXS_TOKEN(" LOAD ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF0 */   ZXS_TOKEN(" LIST ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF1 */   ZXS_TOKEN(" LET ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF2 */   ZXS_TOKEN(" PAUSE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF3 */   ZXS_TOKEN(" NEXT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF4 */   ZXS_TOKEN(" POKE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF5 */   ZXS_TOKEN(" PRINT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF6 */   ZXS_TOKEN(" PLOT ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF7 */   ZXS_TOKEN(" RUN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF8 */   ZXS_TOKEN(" SAVE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xF9 */   ZXS_TOKEN(" RANDOMIZE ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xFA */   ZXS_TOKEN(" IF ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xFB */   ZXS_TOKEN(" CLS ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xFC */   ZXS_TOKEN(" DRAW ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xFD */   ZXS_TOKEN(" CLEAR ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xFE */   ZXS_TOKEN(" RETURN ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE),
+/* 0xFF */   ZXS_TOKEN(" COPY ", 0, ZXS_TOKEN_KEYWORD|ZXS_TOKEN_LEADING_SPACE|ZXS_TOKEN_TRAILING_SPACE)
 };
 
-#define            ZXS_KEYWORDS_START 0xA3
-static const char* ZXS_KEYWORDS[] = {
-/* 0xA3 */                                         " SPECTRUM ", " PLAY "  , "RND"      , "INKEY$"  , "PI"      ,
-/* 0xA8 */   "FN "       , "POINT "     , "SCREEN$ ", "ATTR "  , "AT "     , "TAB "     , "VAL$ "   , "CODE "   ,
-/* 0xB0 */   "VAL "      , "LEN "       , "SIN "    , "COS "   , "TAN "    , "ASN "     , "ACS "    , "ATN "    ,
-/* 0xB8 */   "LN "       , "EXP "       , "INT "    , "SQR "   , "SGN "    , "ABS "     , "PEEK "   , "IN "     ,
-/* 0xC0 */   "USR "      , "STR$ "      , "CHR$ "   , "NOT "   , "BIN "    , " OR "     , " AND "   , "<="      ,
-/* 0xC8 */   ">="        , "<>"         , " LINE "  , " THEN " , " TO "    , " STEP "   , " DEF FN ", " CAT "   ,
-/* 0xD0 */   " FORMAT "  , " MOVE "     , " ERASE " , " OPEN #", " CLOSE #", " MERGE "  , " VERIFY ", " BEEP "  ,
-/* 0xD8 */   " CIRCLE "  , " INK "      , " PAPER " , " FLASH ", " BRIGHT ", " INVERSE ", " OVER "  , " OUT "   ,
-/* 0xE0 */   " LPRINT "  , " LLIST "    , " STOP "  , " READ " , " DATA "  , " RESTORE ", " NEW "   , " BORDER ",
-/* 0xE8 */   " CONTINUE ", " DIM "      , " REM "   , " FOR "  , " GO TO " , " GO SUB " , " INPUT " , " LOAD "  ,
-/* 0xF0 */   " LIST "    , " LET "      , " PAUSE " , " NEXT " , " POKE "  , " PRINT "  , " PLOT "  , " RUN "   ,
-/* 0xF8 */   " SAVE "    , " RANDOMIZE ", " IF "    , " CLS "  , " DRAW "  , " CLEAR "  , " RETURN ", " COPY "
+/** Inside quotes, 0xA3 and 0xA4 are the UDG chars T and U instead of keywords */
+#define               ZXS_QUOTED_UDG_START 0xA3
+#define               ZXS_QUOTED_UDG_END   0xA5
+static const ZXSToken ZXS_QUOTED_UDG_TOKENS[] = {
+/* 0xA3 */   ZXS_TOKEN("{T}", 0, 0),
+/* 0xA4 */   ZXS_TOKEN("{U}", 0, 0)
 };
 
+#define ZXS_BAS_BUFFER_SIZE OUT_BUF_SIZE /**< Size of the output buffer used by the zxs_fprint_* functions */
 
-/**
- * Counts the number of '%' parameters in a string.
- * @param str The input string to analyze.
- * @return    The number of '%' characters found in the string.
- */
-int zxs_count_parameters(const char* str) {
-    int count = 0;
-    for( ; *str ; ++str) {
-        if (*str == '%') { count++; }
-    }
-    return count;
-}
 
 /**
- * Prints a ZX Spectrum BASIC line in human-readable format to a file.
- * @param file         FILE pointer to the output file.
+ * Writes a ZX Spectrum BASIC line in human-readable format to an output buffer.
+ * @param out          Pointer to the output buffer.
  * @param data         Pointer to the byte array containing the BASIC line data.
  * @param datasize     Size of the data array in bytes.
  * @return             0 on success, or an error code indicating what went wrong.
  */
-int zxs_fprint_basic_line(FILE* file, BYTE* data, unsigned datasize) {
-    int i; BYTE byte; unsigned char last_char;
-    const char *control_name; int param1, param2;
-    const char *keyword;
+MODULE_FUNC int zxs_write_basic_line(OutBuf* out, const BYTE* data, unsigned datasize) {
+    unsigned i; BYTE byte; unsigned char last_char;
+    const ZXSToken *token; char formatted[32];
     BOOL in_quotes, in_rem;
     int  err_code = 0;
 
     /* check parameters */
-    if( file == NULL ) { err_code = 1; /* invalid parameter */ }
+    if( out  == NULL ) { err_code = 1; /* invalid parameter */ }
     if( data == NULL ) { datasize = 0; }
 
     /* iterates over the `data` buffer             */
@@ -116,47 +367,44 @@ int zxs_fprint_basic_line(FILE* file, BYTE* data, unsigned datasize) {
     in_quotes = in_rem = FALSE;
     for( i = 0 ; i < datasize && !err_code ; i++ )
     {
-        keyword = control_name = NULL;
-        byte    = data[i];
-
-        /*== CONTROL CHARS ==*/
-        if( byte < 0x20 ) {
-            control_name = ZXS_CTRL_CHARS[byte];
-            param1       = (i+1)<datasize ? data[i+1] : 0;
-            param2       = (i+2)<datasize ? data[i+2] : 0;
-            fprintf(file, control_name, param1, param2);
-
-            /* 0E: marker for a 5-byte number (already printed in ASCII format), 
-             * skip these bytes */
-            if( byte == 0x0E ) { i += 5; }
-            else               { i += zxs_count_parameters(control_name); }
+        byte  = data[i];
+        token = &ZXS_TOKENS[byte];
+        if( in_quotes && ZXS_QUOTED_UDG_START <= byte && byte < ZXS_QUOTED_UDG_END ) {
+            token = &ZXS_QUOTED_UDG_TOKENS[byte - ZXS_QUOTED_UDG_START];
+        }
 
-        /*== ASCII CHARS ==*/
-        } else if( byte < 0x80 ) {
-            if( byte == 0x7F ) { fprintf(file, ZXS_COPYRIGHT_CHAR); }
-            else               { fprintf(file, "%c", byte);         }
+        /*== PLAIN CHARS (ASCII, GRAPHICS, UDG) ==*/
+        if( token->length == 1 ) {
+            out_buf_putc(out, token->text[0]);
+            last_char = byte;
 
-            /*== GRAPHICS CHARS ==*/
-        } else if( byte < 0x90 ) {
-            fprintf(file, "%s", ZXS_GRAPH_CHARS[byte - ZXS_GRAPH_CHARS_START]);
+        /*== KEYWORDS ==*/
+        } else if( token->flags & ZXS_TOKEN_KEYWORD ) {
+            if( last_char == ' ' && (token->flags & ZXS_TOKEN_LEADING_SPACE) ) {
+                out_buf_write(out, token->text + 1, token->length - 1);
+            } else {
+                out_buf_write(out, token->text, token->length);
+            }
+            last_char = (token->flags & ZXS_TOKEN_TRAILING_SPACE) != 0;
 
-            /*== USER-DEFINED GRAPHICS CHARS (UDG) ==*/
-        } else if( byte < (in_quotes ? 0xA5 : 0xA3) ) {
-            fprintf(file, "%s", ZXS_UDG_CHARS[byte - ZXS_UDG_CHARS_START]);
+        /*== CONTROL CHARS WITH PARAMETERS ==*/
+        } else if( token->flags & ZXS_TOKEN_FORMAT ) {
+            sprintf(formatted, token->text,
+                    (i+1)<datasize ? data[i+1] : 0,
+                    (i+2)<datasize ? data[i+2] : 0);
+            out_buf_write(out, formatted, strlen(formatted));
+            last_char = byte;
 
-        /*== KEYWORDS ==*/
+        /*== ANY OTHER MULTI-CHAR TOKEN ==*/
         } else {
-            keyword = ZXS_KEYWORDS[byte - ZXS_KEYWORDS_START];
-            if( last_char == ' ' && keyword[0] == ' ' ) { ++keyword; }
-            last_char = (keyword[ strlen(keyword)-1 ] == ' ');
-            fprintf(file, "%s", keyword);
+            out_buf_write(out, token->text, token->length);
+            last_char = byte;
         }
+        /* skip the parameters of control chars, or the 5-byte number    */
+        /* following the 0E marker (already printed in ASCII format)    */
+        i += token->skip;
 
-        /* before closing the loop, */
         /* update the flags according to the processed byte */
-        if( !keyword ) {  /* any non-keyword byte */
-            last_char = byte;
-        }
         if( byte == 0x22 ) { /* quote */
             if( !in_rem ) { in_quotes = !in_quotes; }
         }
@@ -164,41 +412,55 @@ int zxs_fprint_basic_line(FILE* file, BYTE* data, unsigned datasize) {
             in_rem = TRUE;
         }
     }
-    return err_code;
+    return err_code ? err_code : out->err_code;
 }
 
 /**
- * Prints a ZX Spectrum BASIC program in human-readable format to a file.
- * @param file     FILE pointer to the output file.
+ * Returns the message that describes an error code of the decoders.
+ * @param err_code  The error code (one of the ZXS_ERROR values).
+ * @return A static string with the message.
+ */
+MODULE_FUNC const char* zxs_get_error_message(int err_code) {
+    switch( err_code ) {
+        case ZXS_OK:                  return "No error";
+        case ZXS_ERR_OUTPUT:          return "Cannot write the output";
+        case ZXS_ERR_TRUNCATED_BASIC: return "Exceeding input buffer limit during detokenization";
+        case ZXS_ERR_INVALID_NUMBERS: return "Invalid or truncated number array";
+        case ZXS_ERR_INVALID_STRINGS: return "Invalid or truncated string array";
+    }
+    return "Unknown error";
+}
+
+/**
+ * Writes a ZX Spectrum BASIC program in human-readable format to an output buffer.
+ * @param out      Pointer to the output buffer.
  * @param data     Pointer to the byte array containing the tokenized BASIC program data.
  * @param datasize Size of the data array in bytes.
  * @return         0 on success, or an error code indicating what went wrong.
  */
-int zxs_fprint_basic_program(FILE* file, BYTE* data, unsigned datasize) {
-    const char BUFFER_READ_OVERFLOW_MSG[] = "Exceeding input buffer limit during detokenization";
+MODULE_FUNC int zxs_write_basic_program(OutBuf* out, const BYTE* data, unsigned datasize) {
     unsigned line_number, line_length;
     int err_code = 0;
 
     /* check parameters */
-    if( file == NULL ) { err_code = 1; /* invalid parameter */ }
+    if( out  == NULL ) { err_code = ZXS_ERR_OUTPUT; /* invalid parameter */ }
     if( data == NULL ) { datasize = 0; }
 
     /* process 'data' buffer (line by line) until all bytes have been consumed */
     while( datasize>0 && !err_code )
     {
         /* extract line number and length in the safest way possible */
-        if( 2 > datasize ) { error(BUFFER_READ_OVERFLOW_MSG); return 1; }
+        if( 2 > datasize ) { out_buf_flush(out); return ZXS_ERR_TRUNCATED_BASIC; }
         line_number = GET_BE_WORD(data, 0); data+=2; datasize-=2;
         if( line_number >= 16384 ) { return 0; }
-        if( 2 > datasize ) { error(BUFFER_READ_OVERFLOW_MSG); return 1; }
+        if( 2 > datasize ) { out_buf_flush(out); return ZXS_ERR_TRUNCATED_BASIC; }
         line_length = GET_LE_WORD(data, 0); data+=2; datasize-=2;
-        if( line_length > datasize ) { error(BUFFER_READ_OVERFLOW_MSG); return 1; }
+        if( line_length > datasize ) { out_buf_flush(out); return ZXS_ERR_TRUNCATED_BASIC; }
         
         /* process and print the BASIC line */
-        fprintf(file, "%5d", line_number);
-        err_code = zxs_fprint_basic_line(file, data, line_length);
+        out_buf_put_uint(out, line_number, 5);
+        err_code = zxs_write_basic_line(out, data, line_length);
         if( err_code ) { return err_code; }
-        /* printf("\n"); */
 
         data     += line_length;
         datasize -= line_length;
@@ -206,5 +468,78 @@ int zxs_fprint_basic_program(FILE* file, BYTE* data, unsigned datasize) {
     return err_code;
 }
 
+/**
+ * Writes the characters of a ZX Spectrum string as they appear between quotes in a BASIC listing.
+ * 
+ * Graphics, UDGs and keywords are written as in a BASIC line, quotes are
+ * doubled (as BASIC requires inside a string) and control chars, that can
+ * not be shown, are written as their hexadecimal code, e.g. "{0D}".
+ * 
+ * @param out       Pointer to the output buffer.
+ * @param data      Pointer to the characters of the string.
+ * @param datasize  Number of characters in the string.
+ * @return          0 on success, or an error code indicating what went wrong.
+ */
+MODULE_FUNC int zxs_write_string(OutBuf* out, const BYTE* data, unsigned datasize) {
+    static const char HEX[] = "0123456789ABCDEF";
+    const ZXSToken *token;
+    unsigned i; BYTE byte;
+
+    if( out  == NULL ) { return 1; /* invalid parameter */ }
+    if( data == NULL ) { datasize = 0; }
+    for( i = 0 ; i < datasize ; i++ )
+    {
+        byte  = data[i];
+        token = &ZXS_TOKENS[byte];
+        if( ZXS_QUOTED_UDG_START <= byte && byte < ZXS_QUOTED_UDG_END ) {
+            token = &ZXS_QUOTED_UDG_TOKENS[byte - ZXS_QUOTED_UDG_START];
+        }
+        if( byte < 0x20 ) {
+            out_buf_putc(out, '{'); out_buf_putc(out, HEX[byte >> 4]); out_buf_putc(out, HEX[byte & 0x0F]); out_buf_putc(out, '}');
+        } else if( byte == 0x22 ) { /* quote */
+            out_buf_write(out, "\"\"", 2);
+        } else {
+            out_buf_write(out, token->text, token->length);
+        }
+    }
+    return out->err_code;
+}
+
+/**
+ * Prints a ZX Spectrum BASIC line in human-readable format to a file.
+ * @param file         FILE pointer to the output file.
+ * @param data         Pointer to the byte array containing the BASIC line data.
+ * @param datasize     Size of the data array in bytes.
+ * @return             0 on success, or an error code indicating what went wrong.
+ */
+MODULE_FUNC int zxs_fprint_basic_line(FILE* file, const BYTE* data, unsigned datasize) {
+    char memory[ZXS_BAS_BUFFER_SIZE]; OutBuf out;
+    int err_code;
+    if( file == NULL ) { return 1; /* invalid parameter */ }
+    out_buf_init(&out, file, memory, sizeof(memory));
+    err_code = zxs_write_basic_line(&out, data, datasize);
+    if( out_buf_flush(&out) && !err_code ) { err_code = ZXS_ERR_OUTPUT; }
+    return err_code;
+}
+
+/**
+ * Prints a ZX Spectrum BASIC program in human-readable format to a file.
+ * @param file     FILE pointer to the output file.
+ * @param data     Pointer to the byte array containing the tokenized BASIC program data.
+ * @param datasize Size of the data array in bytes.
+ * @return         0 on success, or an error code indicating what went wrong.
+ */
+MODULE_FUNC int zxs_fprint_basic_program(FILE* file, const BYTE* data, unsigned datasize) {
+    char memory[ZXS_BAS_BUFFER_SIZE]; OutBuf out;
+    long long timer = stats_start_timer();
+    int err_code;
+    if( file == NULL ) { return 1; /* invalid parameter */ }
+    out_buf_init(&out, file, memory, sizeof(memory));
+    err_code = zxs_write_basic_program(&out, data, datasize);
+    if( out_buf_flush(&out) && !err_code ) { err_code = ZXS_ERR_OUTPUT; }
+    stats_end_timer(STATS_TIME_BASIC, timer);
+    return err_code;
+}
+
 #endif /* ZXS_BAS_H */
 
@@ -0,0 +1,281 @@
+/*
+| File    : zxs_find.h
+| Purpose : Token-level search of the lines of tokenized BASIC programs.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef ZXS_FIND_H
+#define ZXS_FIND_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "common.h"
+#include "zxs_bas.h"
+#include "zxs_arr.h"
+
+/*
+  A query is a list of terms separated by spaces, that must appear in this
+  order within the same BASIC line (not necessarily next to each other):
+
+    USR, POKE, GO TO, ...  a keyword (case-insensitive, inner spaces optional)
+    23296, 16384-23295     a number, or a range of numbers (both included)
+    "", "text"             a string literal with exactly this content
+
+  e.g. 'LOAD "" CODE' or 'POKE 23296-23551'. Lines are never detokenized:
+  keywords are matched by their token byte, numbers by the value of their
+  hidden 5-byte form (after the 0E marker) and strings by their bytes.
+  Anything after a REM is not examined, it may hold arbitrary bytes.
+*/
+
+/** Maximum number of terms in a query */
+#define ZXS_QUERY_MAX_TERMS 16
+
+/** Maximum total length of the strings in a query (in bytes) */
+#define ZXS_QUERY_MAX_TEXT  256
+
+/**
+ * The types of the terms of a query
+ */
+typedef enum ZXS_TERM {
+    ZXS_TERM_KEYWORD,         /**< A keyword, matched by its token byte */
+    ZXS_TERM_NUMBER,          /**< A number literal within a range */
+    ZXS_TERM_STRING           /**< A string literal with a given content */
+} ZXS_TERM;
+
+/**
+ * A term of a query
+ */
+typedef struct ZXSQueryTerm {
+    ZXS_TERM    type;         /**< The type of term */
+    BYTE        token;        /**< Token byte of the keyword (ZXS_TERM_KEYWORD) */
+    double      min, max;     /**< Range of the values that match (ZXS_TERM_NUMBER) */
+    const BYTE* text;         /**< Content of the string (ZXS_TERM_STRING, points into `ZXSBasicQuery.text`) */
+    unsigned    length;       /**< Length of the content of the string in bytes (ZXS_TERM_STRING) */
+} ZXSQueryTerm;
+
+/**
+ * A parsed query (see `zxs_parse_basic_query()`)
+ */
+typedef struct ZXSBasicQuery {
+    ZXSQueryTerm terms[ZXS_QUERY_MAX_TERMS];  /**< The terms, in the order they must appear */
+    int          term_count;                  /**< Number of elements in `terms` */
+    BYTE         required[ZXS_QUERY_MAX_TERMS]; /**< A byte that any line matching each term must contain */
+    BYTE         text[ZXS_QUERY_MAX_TEXT];    /**< The contents of all the strings of the query */
+} ZXSBasicQuery;
+
+/**
+ * A line of a BASIC program found by `zxs_find_basic_line()`
+ */
+typedef struct ZXSBasicLine {
+    unsigned    number;       /**< The line number */
+    const BYTE* data;         /**< The tokenized line, ending with its 0D byte */
+    unsigned    length;       /**< Length of `data` in bytes */
+    unsigned    next;         /**< Offset in the program where the search goes on (0 to start from the first line) */
+} ZXSBasicLine;
+
+/*----------------------- INTERNAL HELPER FUNCTIONS ------------------------*/
+
+/**
+ * Finds the token of a keyword given by its name.
+ * @param name    The name, compared ignoring case and spaces, e.g. "go to" or "GOTO".
+ * @param length  Length of `name` in characters.
+ * @return The token byte, or 0 if no keyword has this name.
+ */
+MODULE_FUNC BYTE _zxs_find_keyword(const char* name, unsigned length) {
+    const char *text, *end; unsigned i; int byte;
+    for( byte = 0xA3 ; byte <= 0xFF ; ++byte ) {
+        if( !(ZXS_TOKENS[byte].flags & ZXS_TOKEN_KEYWORD) ) { continue; }
+        text = ZXS_TOKENS[byte].text; end = text + ZXS_TOKENS[byte].length;
+        for( i = 0 ; ; ++i ) {
+            while( text < end && *text == ' ' ) { ++text; }
+            while( i < length && name[i] == ' ' ) { ++i; }
+            if( text == end || i == length ) { break; }
+            if( toupper((unsigned char)name[i]) != *text ) { break; }
+            ++text;
+        }
+        if( text == end && i == length ) { return (BYTE)byte; }
+    }
+    return 0;
+}
+
+/**
+ * Checks if an element of a BASIC line matches a term of a query.
+ * @param term    The term.
+ * @param token   The token byte of the element (0E for numbers, 22 for strings).
+ * @param text    The content of the string, or the 5 bytes of the number.
+ * @param length  Length of the content of the string.
+ * @return TRUE if the element matches the term.
+ */
+MODULE_FUNC BOOL _zxs_term_matches(const ZXSQueryTerm* term, BYTE token, const BYTE* text, unsigned length) {
+    double value;
+    switch( term->type ) {
+        case ZXS_TERM_KEYWORD: return token == term->token;
+        case ZXS_TERM_STRING:  return token == 0x22 && length == term->length && memcmp(text, term->text, length) == 0;
+        case ZXS_TERM_NUMBER:
+            if( token != 0x0E ) { return FALSE; }
+            value = zxs_number_to_double(text);
+            return term->min <= value && value <= term->max;
+    }
+    return FALSE;
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Parses a query for `zxs_find_basic_line()`.
+ * @param[out] query  The ZXSBasicQuery structure to fill in.
+ * @param[in]  text   The query, e.g. 'LOAD "" CODE' (see the syntax at the top of this file).
+ * @return NULL on success, or a pointer to the position in `text` of the first term that is not valid.
+ */
+MODULE_FUNC const char* zxs_parse_basic_query(ZXSBasicQuery* query, const char* text) {
+    ZXSQueryTerm* term; const char *start, *end, *next;
+    unsigned text_length = 0;
+    BYTE token; char* number_end;
+
+    memset(query, 0, sizeof(ZXSBasicQuery));
+    for( start = text ; *start ; start = end ) {
+        while( *start == ' ' ) { ++start; }
+        if( !*start ) { break; }
+        if( query->term_count == ZXS_QUERY_MAX_TERMS ) { return start; }
+        term = &query->terms[query->term_count];
+
+        /* a string between quotes */
+        if( *start == '"' ) {
+            end = strchr(start + 1, '"');
+            if( !end || text_length + (end - start - 1) > ZXS_QUERY_MAX_TEXT ) { return start; }
+            term->type   = ZXS_TERM_STRING;
+            term->text   = query->text + text_length;
+            term->length = (unsigned)(end - start - 1);
+            memcpy(query->text + text_length, start + 1, term->length);
+            text_length += term->length;
+            query->required[query->term_count++] = 0x22;
+            ++end; continue;
+        }
+        for( end = start ; *end && *end != ' ' ; ++end ) { }
+
+        /* a number or a range of numbers */
+        if( isdigit((unsigned char)*start) || *start == '.' ) {
+            term->type = ZXS_TERM_NUMBER;
+            term->min  = term->max = strtod(start, &number_end);
+            if( *number_end == '-' ) { term->max = strtod(number_end + 1, &number_end); }
+            if( number_end != end || term->max < term->min ) { return start; }
+            query->required[query->term_count++] = 0x0E;
+            continue;
+        }
+
+        /* a keyword, that may be written in two words (e.g. "GO TO" or "OPEN #") */
+        token = _zxs_find_keyword(start, (unsigned)(end - start));
+        if( !token && *end == ' ' ) {
+            for( next = end + 1 ; *next && *next != ' ' ; ++next ) { }
+            token = _zxs_find_keyword(start, (unsigned)(next - start));
+            if( token ) { end = next; }
+        }
+        if( !token ) { return start; }
+        term->type  = ZXS_TERM_KEYWORD;
+        term->token = token;
+        query->required[query->term_count++] = token;
+    }
+    return query->term_count > 0 ? NULL : text;
+}
+
+/**
+ * Checks if a tokenized BASIC line matches a query.
+ * 
+ * The line is first discarded, with one `memchr()` per term, if it does not
+ * contain the bytes that the terms require (a keyword token, a number marker
+ * or a quote), which are usually missing in most of the lines. Only then it
+ * is walked element by element, as the ZX-Spectrum itself would.
+ * 
+ * @param query   The query.
+ * @param data    Pointer to the tokenized line (without its line number and length).
+ * @param length  Length of the line in bytes.
+ * @return TRUE if the line contains all the terms of the query, in order.
+ */
+MODULE_FUNC BOOL zxs_match_basic_line(const ZXSBasicQuery* query, const BYTE* data, unsigned length) {
+    unsigned i, start; int t = 0;
+    BYTE byte;
+
+    for( t = 0 ; t < query->term_count ; ++t ) {
+        if( !memchr(data, query->required[t], length) ) { return FALSE; }
+    }
+    t = 0;
+    for( i = 0 ; i < length ; i += 1 + ZXS_TOKENS[byte].skip ) {
+        byte = data[i];
+        if( byte == 0x0E ) {
+            if( i + 5 >= length ) { break; }
+            if( _zxs_term_matches(&query->terms[t], byte, &data[i+1], 5) && ++t == query->term_count ) { return TRUE; }
+        }
+        else if( byte == 0x22 ) {
+            /* inside a string, a quote is written as two quotes */
+            for( start = ++i ; i < length && (data[i] != 0x22 || (i+1 < length && data[i+1] == 0x22)) ; ++i ) {
+                if( data[i] == 0x22 ) { ++i; }
+            }
+            if( _zxs_term_matches(&query->terms[t], 0x22, &data[start], i - start) && ++t == query->term_count ) { return TRUE; }
+            byte = 0x20; /* the closing quote has no parameters */
+        }
+        else if( ZXS_TOKENS[byte].flags & ZXS_TOKEN_KEYWORD ) {
+            if( _zxs_term_matches(&query->terms[t], byte, NULL, 0) && ++t == query->term_count ) { return TRUE; }
+            if( byte == 0xEA ) { break; } /* REM */
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * Finds the next line of a tokenized BASIC program that matches a query.
+ * 
+ * The program is walked as `zxs_write_basic_program()` does, stopping at
+ * the variables area or at a truncated line, but nothing is written.
+ * 
+ * @param query     The query.
+ * @param data      Pointer to the tokenized BASIC program.
+ * @param datasize  Size of the program in bytes.
+ * @param line      The line found, its `next` field must be 0 for the first call and is kept between calls.
+ * @return TRUE if a matching line was found, FALSE when there are no more.
+ */
+MODULE_FUNC BOOL zxs_find_basic_line(const ZXSBasicQuery* query, const BYTE* data, unsigned datasize, ZXSBasicLine* line) {
+    unsigned offset = line->next, number, length;
+    while( offset + 4 <= datasize ) {
+        number = GET_BE_WORD(data, offset);
+        length = GET_LE_WORD(data, offset + 2);
+        if( number >= 16384 || length > datasize - offset - 4 ) { break; }
+        offset += 4 + length;
+        if( zxs_match_basic_line(query, &data[offset - length], length) ) {
+            line->number = number;
+            line->data   = &data[offset - length];
+            line->length = length;
+            line->next   = offset;
+            return TRUE;
+        }
+    }
+    line->next = datasize;
+    return FALSE;
+}
+
+#endif /* ZXS_FIND_H */
@@ -0,0 +1,253 @@
+/*
+| File    : zxs_idx.h
+| Purpose : Persistent cache of ZX-Spectrum TAP block indexes.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef ZXS_IDX_H
+#define ZXS_IDX_H
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "file_dir.h"
+#include "zxs_tap.h"
+
+/*
+  Layout of an index file (all values are little-endian):
+
+    offset  size  description
+    ------  ----  -----------------------------------------------------
+       0      8   magic "ZXTAPIDX"
+       8      2   format version (ZXS_IDX_VERSION)
+      10      2   flags (ZXS_IDX_FLAG_HASH if a content hash is stored)
+      12      8   size of the tape file in bytes
+      20      8   last modification time of the tape file
+      28      8   content hash of the tape file (0 if not stored)
+      36      4   number of blocks
+      40      -   one record per block:
+                    8 bytes  offset of the block within the tape
+                    2 bytes  size of the block data
+                    1 byte   block type (flag byte)
+                    1 byte   checksum stored in the tape
+                   17 bytes  raw header data (only in header blocks)
+     end      4   FNV-1a hash of all the previous bytes of the index file
+*/
+
+#define ZXS_IDX_EXTENSION   ".zxidx"  /**< Extension added to the tape filename to get the index filename */
+#define ZXS_IDX_VERSION     1         /**< Version of the index file format */
+#define ZXS_IDX_FLAG_HASH   0x0001    /**< The index file stores a content hash of the tape */
+#define _ZXS_IDX_MAGIC      "ZXTAPIDX"
+#define _ZXS_IDX_HEAD_SIZE  40
+#define _ZXS_IDX_REC_SIZE   12
+
+/**
+ * The properties of a tape file that an index file is valid for
+ */
+typedef struct ZXSIndexKey {
+    unsigned long long tape_size;  /**< Size of the tape file in bytes */
+    long long          tape_mtime; /**< Last modification time of the tape file */
+    unsigned long long tape_hash;  /**< Content hash of the tape file (0 = not used) */
+} ZXSIndexKey;
+
+/*----------------------- INTERNAL HELPER FUNCTIONS ------------------------*/
+
+MODULE_FUNC void _zxs_idx_put(BYTE* ptr, unsigned long long value, int size) {
+    int i;
+    for( i = 0 ; i < size ; ++i ) { ptr[i] = (BYTE)(value >> (8*i)); }
+}
+
+MODULE_FUNC unsigned long long _zxs_idx_get(const BYTE* ptr, int size) {
+    unsigned long long value = 0; int i;
+    for( i = size-1 ; i >= 0 ; --i ) { value = (value << 8) | ptr[i]; }
+    return value;
+}
+
+MODULE_FUNC unsigned _zxs_idx_hash32(const BYTE* data, size_t size) {
+    unsigned hash = 2166136261u; size_t i;
+    for( i = 0 ; i < size ; ++i ) { hash = (hash ^ data[i]) * 16777619u; }
+    return hash & 0xFFFFFFFFu;
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+/**
+ * Calculates the content hash of a tape (FNV-1a 64-bit)
+ * @param data  Pointer to the tape content.
+ * @param size  Size of the tape content in bytes.
+ * @return The 64-bit hash value, never 0 (0 is reserved to mean "no hash").
+ */
+MODULE_FUNC unsigned long long zxs_tape_hash(const BYTE* data, size_t size) {
+    unsigned long long hash = 14695981039346656037ULL; size_t i;
+    for( i = 0 ; i < size ; ++i ) { hash = (hash ^ data[i]) * 1099511628211ULL; }
+    return hash ? hash : 1;
+}
+
+/**
+ * Allocates the path of the index file associated with a tape file.
+ * @param tape_path  The path of the tape file.
+ * @return
+ *    The allocated path (e.g. "game.tap.zxidx") or NULL on failure.
+ *    The caller is responsible for freeing this memory.
+ */
+MODULE_FUNC char* zxs_alloc_index_path(const char* tape_path) {
+    return alloc_concat5(tape_path, ZXS_IDX_EXTENSION, NULL, NULL, NULL);
+}
+
+/**
+ * Saves a block index to an index file.
+ * 
+ * The file is first written under a temporary name and then renamed,
+ * so concurrent readers never see a partially written index.
+ * 
+ * @param index  The block index to save.
+ * @param key    The properties of the tape file the index belongs to.
+ * @param path   The path of the index file.
+ * @return TRUE on success, FALSE otherwise.
+ */
+MODULE_FUNC BOOL zxs_save_index(const ZXSTapIndex* index, const ZXSIndexKey* key, const char* path) {
+    const ZXSIndexEntry *entry;
+    ZXSTapBlock block;
+    BYTE  *buffer, *ptr; size_t size;
+    char  *temp_path;
+    FILE  *file;
+    BOOL   success;
+    int    i;
+    assert( index!=NULL && key!=NULL && path!=NULL );
+
+    /* build the whole index file in memory */
+    size   = _ZXS_IDX_HEAD_SIZE + index->entry_count * _ZXS_IDX_REC_SIZE
+           + index->header_count * ZXS_HEADER_SIZE + 4;
+    buffer = (BYTE*)malloc(size);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !buffer ) { return FALSE; }
+    memcpy(buffer, _ZXS_IDX_MAGIC, 8);
+    _zxs_idx_put(buffer +  8, ZXS_IDX_VERSION, 2);
+    _zxs_idx_put(buffer + 10, key->tape_hash ? ZXS_IDX_FLAG_HASH : 0, 2);
+    _zxs_idx_put(buffer + 12, key->tape_size, 8);
+    _zxs_idx_put(buffer + 20, (unsigned long long)key->tape_mtime, 8);
+    _zxs_idx_put(buffer + 28, key->tape_hash, 8);
+    _zxs_idx_put(buffer + 36, index->entry_count, 4);
+    ptr = buffer + _ZXS_IDX_HEAD_SIZE;
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        entry = &index->entries[i];
+        _zxs_idx_put(ptr + 0, entry->offset  , 8);
+        _zxs_idx_put(ptr + 8, entry->datasize, 2);
+        ptr[10] = (BYTE)entry->type;
+        ptr[11] = (BYTE)entry->checksum;
+        ptr    += _ZXS_IDX_REC_SIZE;
+        if( entry->is_header ) {
+            if( !zxs_index_block(index, i, &block) ) { free(buffer); return FALSE; }
+            memcpy(ptr, block.data, ZXS_HEADER_SIZE);
+            ptr += ZXS_HEADER_SIZE;
+        }
+    }
+    _zxs_idx_put(ptr, _zxs_idx_hash32(buffer, ptr - buffer), 4);
+
+    /* write it to disk */
+    temp_path = alloc_concat5(path, ".tmp", NULL, NULL, NULL);
+    file      = temp_path ? fopen(temp_path, "wb") : NULL;
+    success   = file && fwrite(buffer, 1, size, file) == size;
+    if( file ) { success = (fclose(file) == 0) && success; }
+    if( success ) {
+        remove(path);
+        success = (rename(temp_path, path) == 0);
+    }
+    if( !success && file ) { remove(temp_path); }
+    free(temp_path);
+    free(buffer);
+    return success;
+}
+
+/**
+ * Loads a block index from an index file.
+ * 
+ * The index is only loaded if the file is intact and it was created for a
+ * tape with exactly the same properties as `key`. When `key` has no content
+ * hash, the hash stored in the file (if any) is ignored.
+ * 
+ * @param[out] index  The ZXSTapIndex structure to fill in (release it with `zxs_free_index()`).
+ * @param[in]  tape   The tape the index belongs to.
+ * @param[in]  key    The current properties of the tape file.
+ * @param[in]  path   The path of the index file.
+ * @return TRUE if the index was loaded, FALSE if the file is missing, stale or damaged.
+ */
+MODULE_FUNC BOOL zxs_load_index(ZXSTapIndex* index, ZXSTape* tape, const ZXSIndexKey* key, const char* path) {
+    FileMap     map;
+    ZXSTapBlock block;
+    const BYTE *ptr, *end;
+    unsigned    flags, count, i;
+    BOOL        success;
+    assert( index!=NULL && tape!=NULL && key!=NULL && path!=NULL );
+
+    memset( index, 0, sizeof(ZXSTapIndex) );
+    index->tape      = tape;
+    index->allocator = tape->allocator;
+    if( !map_file(&map, path) ) { return FALSE; }
+
+    /* validate the file integrity and that it matches the tape */
+    success = map.size >= _ZXS_IDX_HEAD_SIZE + 4 && memcmp(map.data, _ZXS_IDX_MAGIC, 8) == 0;
+    if( success ) {
+        end   = map.data + map.size - 4;
+        flags = (unsigned)_zxs_idx_get(map.data + 10, 2);
+        count = (unsigned)_zxs_idx_get(map.data + 36, 4);
+        success = _zxs_idx_get(map.data + 8, 2) == ZXS_IDX_VERSION
+               && _zxs_idx_get(end, 4) == _zxs_idx_hash32(map.data, end - map.data)
+               && _zxs_idx_get(map.data + 12, 8) == key->tape_size
+               && (long long)_zxs_idx_get(map.data + 20, 8) == key->tape_mtime
+               && key->tape_size == tape->size;
+        if( success && key->tape_hash ) {
+            success = (flags & ZXS_IDX_FLAG_HASH) && _zxs_idx_get(map.data + 28, 8) == key->tape_hash;
+        }
+    }
+    /* load all the block records */
+    ptr = map.data + _ZXS_IDX_HEAD_SIZE;
+    for( i = 0 ; success && i < count ; ++i ) {
+        success = (end - ptr) >= _ZXS_IDX_REC_SIZE;
+        if( success ) {
+            block.offset   = (size_t)_zxs_idx_get(ptr + 0, 8);
+            block.datasize = (unsigned)_zxs_idx_get(ptr + 8, 2);
+            block.type     = (ZXS_BLKTYPE)ptr[10];
+            block.checksum = ptr[11];
+            block.data     = ptr += _ZXS_IDX_REC_SIZE;
+            if( block.type == ZXS_BLKTYPE_HEADER && block.datasize == ZXS_HEADER_SIZE ) {
+                success = (end - ptr) >= ZXS_HEADER_SIZE;
+                ptr    += ZXS_HEADER_SIZE;
+            }
+            success = success && block.offset + 4 + block.datasize <= tape->size;
+        }
+        success = success && zxs_index_add_block(index, &block);
+    }
+    success = success && ptr == end && zxs_complete_index(index);
+    if( !success ) { zxs_free_index(index); index->tape = tape; index->allocator = tape->allocator; }
+    unmap_file(&map);
+    return success;
+}
+
+#endif /* ZXS_IDX_H */
@@ -34,12 +34,27 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "common.h"
+#include "stats.h"
+#if !defined(ZXS_TAP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   include <emmintrin.h>
+#   define ZXS_TAP_HAS_SSE2
+#endif
 
 /** Size of header blocks in the ZX-Spectrum TAP file (in bytes) */
 #define ZXS_HEADER_SIZE 17
 
+/** Size of a dump of the ZX-Spectrum screen memory, bitmap and attributes (in bytes) */
+#define ZXS_SCREEN_SIZE 6912
+
+/** Maximum size of a TAP block, including its 2-byte length (in bytes) */
+#define ZXS_MAX_BLOCK_SIZE (2 + 0xFFFF)
+
+/** Number of bytes of a damaged tape examined at a time while resynchronising (see `zxs_next_tap_block()`) */
+#define ZXS_RESYNC_CHUNK_SIZE (2 * ZXS_MAX_BLOCK_SIZE)
+
 /**
  * Block types for ZX-Spectrum TAP file blocks
  */
@@ -61,14 +76,44 @@ typedef enum ZXS_DATATYPE {
 
 /**
  * A ZX-Spectrum TAP file block
+ * 
+ * Blocks are lightweight views: `data` points directly into the memory
+ * that holds the tape content, so no copy of the payload is ever made.
+ * When the tape is read lazily from a file, `data` is NULL until the
+ * payload is materialised with `zxs_load_block_data()` (header blocks
+ * always have their 17 bytes available).
  */
 typedef struct ZXSTapBlock {
     ZXS_BLKTYPE type;         /**< Block type (00 for headers, FF for data blocks) */
     unsigned    checksum;     /**< 8-bit checksum of the data block for error detection */
     unsigned    datasize;     /**< Size of the data array in bytes */
-    BYTE        data[1];      /**< Flexible array containing the actual block data */
+    const BYTE* data;         /**< Pointer to the actual block data */
+    size_t      offset;       /**< Offset of the block within the tape (where its 2-byte length is) */
 } ZXSTapBlock;
 
+/**
+ * A ZX-Spectrum TAP file, either loaded in memory (e.g. a memory mapped file),
+ * read lazily from an open file or read sequentially from a stream (a pipe)
+ */
+typedef struct ZXSTape {
+    const BYTE* data;         /**< Pointer to the first byte of the tape content (NULL when read from `file`) */
+    size_t      size;         /**< Size of the tape content in bytes */
+    size_t      position;     /**< Offset of the next block to be read */
+    FILE*       file;         /**< File the tape is read from (NULL when the tape is in memory) */
+    int         fd;           /**< Descriptor of the file mapped at `data`, to copy payloads without reading them (-1 if none) */
+    const ZXSAllocator* allocator; /**< Allocator for `buffer` and the indices of the tape (NULL = C library) */
+    BYTE*       buffer;       /**< Reusable buffer where payloads read from `file` are materialised */
+    unsigned    buffer_size;  /**< Size of `buffer` in bytes */
+    BYTE        header_data[ZXS_HEADER_SIZE]; /**< Data of the last header read from `file` */
+    BYTE*       window;        /**< Buffer of ZXS_MAX_BLOCK_SIZE bytes with the last block read from a stream (NULL if not a stream) */
+    const ZXSReader* reader;   /**< Decoder the stream is read through, e.g. a decompressor (NULL = fread() from `file`) */
+    size_t      window_offset; /**< Offset within the tape of the first byte in `window` */
+    unsigned    window_length; /**< Number of bytes of the tape currently in `window` */
+    BOOL        robust;        /**< TRUE to resynchronise after damaged blocks instead of ending the tape (tapes in memory only) */
+    unsigned    resync_count;  /**< Number of damaged areas skipped while resynchronising */
+    size_t      skipped_bytes; /**< Total number of bytes in the damaged areas skipped */
+} ZXSTape;
+
 /**
  * The information in a ZX-Spetrum TAP block header
  */
@@ -80,13 +125,74 @@ typedef struct ZXSHeader {
     unsigned     param2;       /**< Additional parameter 2 (specific to the block type) */
 } ZXSHeader;
 
+/**
+ * An entry in the block index of a ZX-Spectrum tape
+ */
+typedef struct ZXSIndexEntry {
+    size_t      offset;       /**< Offset of the block within the tape */
+    ZXS_BLKTYPE type;         /**< Block type (flag byte) */
+    unsigned    checksum;     /**< 8-bit checksum stored in the tape */
+    unsigned    datasize;     /**< Size of the block data in bytes */
+    BOOL        is_header;    /**< TRUE if the block is a valid header */
+    ZXSHeader   header;       /**< Parsed header information (only valid if `is_header` is TRUE) */
+} ZXSIndexEntry;
+
+/**
+ * An in-memory index of all blocks in a ZX-Spectrum tape
+ * 
+ * It is built in one single pass over the tape and allows to access any
+ * block, any header (by its position) and any named header in O(1).
+ */
+typedef struct ZXSTapIndex {
+    ZXSTape*       tape;            /**< The tape being indexed */
+    const ZXSAllocator* allocator;  /**< Allocator of all the index tables, taken from the tape (NULL = C library) */
+    ZXSIndexEntry* entries;         /**< All blocks in the tape, in order of appearance */
+    int            entry_count;     /**< Number of blocks in `entries` */
+    int            entry_capacity;  /**< Number of allocated elements in `entries` */
+    int*           headers;         /**< Position in `entries` of each header, in order of appearance */
+    int            header_count;    /**< Number of headers in `headers` */
+    int*           name_table;      /**< Hash table of header names, stores position in `headers` + 1 (0 = empty slot) */
+    unsigned       name_table_size; /**< Number of slots in `name_table` (always a power of two) */
+} ZXSTapIndex;
+
+/**
+ * A segment of a tape in memory, whose blocks are indexed independently of the others
+ * 
+ * Large tapes can be indexed in parallel by scanning several consecutive
+ * segments at the same time with `zxs_scan_segment()` and stitching the
+ * partial indices together with `zxs_merge_segments()`.
+ */
+typedef struct ZXSTapSegment {
+    ZXSTape*    tape;         /**< The tape the segment belongs to */
+    size_t      start;        /**< Offset where the segment starts */
+    size_t      end;          /**< Offset where the segment ends (where the next one starts) */
+    size_t      first;        /**< Offset of the first block found from `start` */
+    size_t      next;         /**< Offset after the last block found, before `end` only if the scan stopped there */
+    ZXSTapIndex index;        /**< The blocks found, starting with the one at `first` */
+    BOOL        success;      /**< FALSE if there was not enough memory to index the segment */
+} ZXSTapSegment;
+
+/*----------------------- INTERNAL HELPER FUNCTIONS ------------------------*/
+
+MODULE_FUNC void* _zxs_realloc(const ZXSAllocator* allocator, void* ptr, size_t size) {
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    return allocator ? allocator->realloc_fn(allocator->user, ptr, size) : realloc(ptr, size);
+}
+
+MODULE_FUNC void _zxs_free(const ZXSAllocator* allocator, void* ptr) {
+    if( !ptr ) { return; }
+    if( allocator ) { allocator->free_fn(allocator->user, ptr); } else { free(ptr); }
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
 /**
  * Converts a ZXS_DATATYPE value to its corresponding string representation.
  * @param datatype  The ZXS_DATATYPE value to convert.
  * @param buffer64  A buffer of at least 64 characters.
  * @return The string representation of the data type.
  */
-const char *zxs_get_datatype_name(ZXS_DATATYPE datatype, char* buffer64) {
+MODULE_FUNC const char *zxs_get_datatype_name(ZXS_DATATYPE datatype, char* buffer64) {
     const char* name;
     assert( buffer64 != NULL );
     switch( datatype ) {
@@ -102,37 +208,459 @@ const char *zxs_get_datatype_name(ZXS_DATATYPE datatype, char* buffer64) {
 }
 
 /**
- * Reads a ZX-Spectrum TAP file block from a file
- * @param tap_file The file pointer to the ZX Spectrum TAP file
- * @return A pointer to the allocated ZXSTapBlock structure on success, or NULL on failure
- * @note   The caller is responsible for freeing the allocated memory using free()
+ * Initializes a ZX-Spectrum tape over a memory buffer containing the TAP file content
+ * @param tape  The ZXSTape structure to initialize.
+ * @param data  Pointer to the TAP file content (it must remain valid while the tape is used).
+ * @param size  Size of the TAP file content in bytes.
  */
-ZXSTapBlock* zxs_read_tap_block(FILE* tap_file) {
-    ZXSTapBlock* block = NULL;
-    unsigned block_length, datasize;
-    BYTE length[2], type, checksum;
-    BOOL error = FALSE;
-    
-    /* read the length of the block (2 bytes) */
-    error        = fread(length, sizeof(length), 1, tap_file) != 1;
-    block_length = GET_LE_WORD(length, 0);
-    datasize     = block_length - 2;
-
-    /* read the spectrum generated data (flag + data + checksum) */
-    block = malloc(sizeof(ZXSTapBlock) + datasize);
-    error = error || block == NULL;
-    error = error || fread(&type      , sizeof(BYTE),        1, tap_file) != 1;
-    error = error || fread(block->data, sizeof(BYTE), datasize, tap_file) != datasize;
-    error = error || fread(&checksum  , sizeof(BYTE),        1, tap_file) != 1;
-
-    /* if there was an error then return NULL */
-    if( error ) { free(block); return NULL; }
-
-    /* set the block properties and return it */
-    block->type     = (ZXS_BLKTYPE)type;
-    block->checksum = checksum;
+MODULE_FUNC void zxs_init_tape(ZXSTape* tape, const BYTE* data, size_t size) {
+    assert( tape!=NULL );
+    assert( data!=NULL || size==0 );
+    memset(tape, 0, sizeof(ZXSTape));
+    tape->data     = data;
+    tape->size     = size;
+    tape->position = 0;
+    tape->fd       = -1;
+}
+
+/**
+ * Initializes a ZX-Spectrum tape that is read lazily from an open file
+ * 
+ * Only the block lengths, flags, checksums and headers are read from the
+ * file while scanning the tape, payloads are skipped with `fseek()` and
+ * only read when requested through `zxs_load_block_data()`.
+ * 
+ * @param tape  The ZXSTape structure to initialize (release it with `zxs_free_tape()`).
+ * @param file  The TAP file opened in binary read mode (it must remain open while the tape is used).
+ * @param size  Size of the TAP file in bytes.
+ */
+MODULE_FUNC void zxs_init_tape_file(ZXSTape* tape, FILE* file, size_t size) {
+    assert( tape!=NULL && file!=NULL );
+    memset(tape, 0, sizeof(ZXSTape));
+    tape->file = file;
+    tape->size = size;
+    tape->fd   = -1;
+}
+
+/**
+ * Initializes a ZX-Spectrum tape that is read sequentially from a stream
+ * 
+ * Blocks are read one by one into `window`, a fixed buffer reused for
+ * every block, so the memory used does not depend on the size of the
+ * tape and no allocation is ever made to read it. Only the last block
+ * read is available: its view and any other obtained before are invalid
+ * once the next block is read. The size of the tape is the number of
+ * bytes read so far, which is the total size after the last block.
+ * 
+ * The bytes of the stream can also be passed through a decoder, setting
+ * `tape->reader` after this call (e.g. to read a compressed tape).
+ * 
+ * @param tape    The ZXSTape structure to initialize.
+ * @param file    The stream opened in binary read mode (e.g. stdin), it doesn't need to support `fseek()`.
+ * @param window  Buffer of at least ZXS_MAX_BLOCK_SIZE bytes (it must remain valid while the tape is used).
+ */
+MODULE_FUNC void zxs_init_tape_stream(ZXSTape* tape, FILE* file, BYTE* window) {
+    assert( tape!=NULL && file!=NULL && window!=NULL );
+    memset(tape, 0, sizeof(ZXSTape));
+    tape->file   = file;
+    tape->fd     = -1;
+    tape->window = window;
+}
+
+/**
+ * Releases the memory used by a tape (the tape content itself is not released)
+ * @param tape The ZXSTape to release.
+ */
+MODULE_FUNC void zxs_free_tape(ZXSTape* tape) {
+    assert( tape!=NULL );
+    _zxs_free(tape->allocator, tape->buffer);
+    tape->buffer      = NULL;
+    tape->buffer_size = 0;
+}
+
+/**
+ * Reads the length, flag, checksum and (for headers) the data of the next block of a file
+ * @param tape          The ZXSTape being read from its file.
+ * @param block         Pointer to the ZXSTapBlock structure to store the block properties.
+ * @param block_length  The length of the block (as stored in the tape), already validated.
+ * @return TRUE on success, FALSE if the file could not be read.
+ */
+MODULE_FUNC BOOL _zxs_read_file_block(ZXSTape* tape, ZXSTapBlock* block, unsigned block_length) {
+    BYTE flag_and_header[1 + ZXS_HEADER_SIZE + 1];
+    unsigned datasize = block_length - 2;
+    FILE* file = tape->file;
+
+    if( fread(flag_and_header, 1, 1, file) != 1 ) { return FALSE; }
+    block->type     = (ZXS_BLKTYPE)flag_and_header[0];
     block->datasize = datasize;
-    return block;
+    block->data     = NULL;
+
+    /* headers are loaded whole, any other payload is skipped */
+    if( block->type == ZXS_BLKTYPE_HEADER && datasize == ZXS_HEADER_SIZE ) {
+        if( fread(&flag_and_header[1], 1, ZXS_HEADER_SIZE + 1, file) != ZXS_HEADER_SIZE + 1 ) { return FALSE; }
+        memcpy(tape->header_data, &flag_and_header[1], ZXS_HEADER_SIZE);
+        block->data     = tape->header_data;
+        block->checksum = flag_and_header[1 + ZXS_HEADER_SIZE];
+        return TRUE;
+    }
+    if( fseek(file, (long)datasize, SEEK_CUR) != 0 ) { return FALSE; }
+    if( fread(&flag_and_header[1], 1, 1, file) != 1 ) { return FALSE; }
+    block->checksum = flag_and_header[1];
+    return TRUE;
+}
+
+/**
+ * Sets the properties of a block from its bytes in memory.
+ * @param block         Pointer to the ZXSTapBlock structure to fill in.
+ * @param ptr           Pointer to the block, starting with its 2-byte length.
+ * @param block_length  The length of the block (as stored in the tape), already validated.
+ * @param offset        Offset of the block within the tape.
+ */
+MODULE_FUNC void _zxs_set_block(ZXSTapBlock* block, const BYTE* ptr, unsigned block_length, size_t offset) {
+    block->type     = (ZXS_BLKTYPE)ptr[2];
+    block->datasize = block_length - 2;
+    block->data     = &ptr[3];
+    block->checksum = ptr[2 + block_length - 1];
+    block->offset   = offset;
+}
+
+/**
+ * Reads from the stream of a tape until its window holds a given number of bytes.
+ * @param tape    The ZXSTape being read from a stream.
+ * @param length  The number of bytes required in the window.
+ * @return TRUE on success, FALSE if the stream ended before.
+ */
+MODULE_FUNC BOOL _zxs_fill_window(ZXSTape* tape, unsigned length) {
+    size_t count;
+    if( tape->window_length < length ) {
+        count = tape->reader
+              ? tape->reader->read_fn(tape->reader->user, tape->window + tape->window_length, length - tape->window_length)
+              : fread(tape->window + tape->window_length, 1, length - tape->window_length, tape->file);
+        tape->window_length += (unsigned)count;
+        tape->size           = tape->window_offset + tape->window_length;
+    }
+    return tape->window_length >= length;
+}
+
+/**
+ * Reads the next block of a tape that is read from a stream.
+ * 
+ * When no complete block can be read the rest of the stream is consumed,
+ * so the size of the tape includes any trailing bytes.
+ * 
+ * @param tape   The ZXSTape being read from a stream.
+ * @param block  Pointer to the ZXSTapBlock structure to store the block view.
+ * @return TRUE if a complete block was read, FALSE at the end of the stream or if the block is truncated.
+ */
+MODULE_FUNC BOOL _zxs_read_stream_block(ZXSTape* tape, ZXSTapBlock* block) {
+    unsigned block_length = 0;
+    long long timer = stats_start_timer();
+    BOOL success;
+
+    /* the previous block is discarded, the window starts at the next one */
+    tape->window_offset = tape->position;
+    tape->window_length = 0;
+    success = _zxs_fill_window(tape, 2);
+    if( success ) {
+        block_length = GET_LE_WORD(tape->window, 0);
+        success      = block_length >= 2 && _zxs_fill_window(tape, 2 + block_length);
+    }
+    if( !success ) {
+        while( _zxs_fill_window(tape, ZXS_MAX_BLOCK_SIZE) ) {
+            tape->window_offset = tape->size;
+            tape->window_length = 0;
+        }
+        stats_end_timer(STATS_TIME_READ, timer);
+        return FALSE;
+    }
+    _zxs_set_block(block, tape->window, block_length, tape->position);
+    tape->position += 2 + block_length;
+    stats_end_timer(STATS_TIME_READ, timer);
+    STATS_ADD(STATS_BLOCKS_READ, 1);
+    STATS_ADD(STATS_PAYLOAD_BYTES, block->datasize);
+    return TRUE;
+}
+
+/**
+ * XORs together all the bytes of a memory area
+ * 
+ * The bytes are combined 64 at a time (SSE2) or 8 at a time (64-bit words)
+ * using several independent accumulators, so large payloads are processed
+ * at memory bandwidth.
+ * 
+ * @param data  Pointer to the bytes to combine.
+ * @param size  Number of bytes.
+ * @return The XOR of all the bytes (0 if `size` is 0).
+ */
+MODULE_FUNC BYTE zxs_xor_bytes(const BYTE* data, size_t size) {
+    unsigned long long acc0 = 0, acc1 = 0, word0, word1;
+    size_t i = 0;
+#   ifdef ZXS_TAP_HAS_SSE2
+    __m128i vec0 = _mm_setzero_si128(), vec1 = vec0, vec2 = vec0, vec3 = vec0;
+    for( ; i+64 <= size ; i += 64 ) {
+        vec0 = _mm_xor_si128(vec0, _mm_loadu_si128((const __m128i*)(data + i     )));
+        vec1 = _mm_xor_si128(vec1, _mm_loadu_si128((const __m128i*)(data + i + 16)));
+        vec2 = _mm_xor_si128(vec2, _mm_loadu_si128((const __m128i*)(data + i + 32)));
+        vec3 = _mm_xor_si128(vec3, _mm_loadu_si128((const __m128i*)(data + i + 48)));
+    }
+    vec0 = _mm_xor_si128(_mm_xor_si128(vec0, vec1), _mm_xor_si128(vec2, vec3));
+    vec0 = _mm_xor_si128(vec0, _mm_srli_si128(vec0, 8));
+    acc0 = (unsigned long long)(unsigned)_mm_cvtsi128_si32(vec0)
+         | (unsigned long long)(unsigned)_mm_cvtsi128_si32(_mm_srli_si128(vec0, 4)) << 32;
+#   endif
+    for( ; i+16 <= size ; i += 16 ) {
+        memcpy(&word0, data + i    , 8);
+        memcpy(&word1, data + i + 8, 8);
+        acc0 ^= word0; acc1 ^= word1;
+    }
+    acc0 ^= acc1;
+    acc0 ^= acc0 >> 32; acc0 ^= acc0 >> 16; acc0 ^= acc0 >> 8;
+    for( ; i < size ; ++i ) { acc0 ^= data[i]; }
+    return (BYTE)acc0;
+}
+
+/**
+ * Checks whether a plausible block starts at a given offset of a tape in memory.
+ * 
+ * Its length must fit within the tape and its flag must be a standard one
+ * (00 or FF). The end of the tape is also accepted, as the boundary after
+ * its last block.
+ * 
+ * @param tape    The ZXSTape in memory.
+ * @param offset  The offset within the tape (not beyond its end).
+ * @return TRUE if a plausible block starts at `offset`, FALSE otherwise.
+ */
+MODULE_FUNC BOOL _zxs_is_block_start(const ZXSTape* tape, size_t offset) {
+    unsigned block_length; BYTE flag;
+    if( offset == tape->size ) { return TRUE; }
+    if( tape->size - offset < 4 ) { return FALSE; }
+    block_length = GET_LE_WORD(tape->data, offset);
+    flag         = tape->data[offset + 2];
+    return block_length >= 2 && block_length <= tape->size - offset - 2 &&
+           (flag == ZXS_BLKTYPE_HEADER || flag == ZXS_BLKTYPE_DATA);
+}
+
+/**
+ * Finds the next plausible block of a damaged tape in memory.
+ * 
+ * A candidate needs a length that fits, a standard flag (headers also their
+ * exact length and a known data type), a matching checksum and a plausible
+ * block right after it. Since the checksum is the XOR of the flag and the
+ * data, the XOR from the flag to the checksum is 0 in a sound block, so
+ * with the running XOR of the bytes (`prefix[i]` is the XOR of the first
+ * `i` ones) each candidate is checked in constant time whatever its length.
+ * The running XOR is computed one chunk of ZXS_RESYNC_CHUNK_SIZE bytes at
+ * a time and consecutive chunks overlap by one block, so the search is
+ * linear in the number of bytes skipped.
+ * 
+ * @param tape   The ZXSTape in memory, its `buffer` is used for the running XOR.
+ * @param start  Offset within the tape where the search starts.
+ * @return The offset of the next plausible block, or the size of the tape if there is none.
+ */
+MODULE_FUNC size_t _zxs_resync(ZXSTape* tape, size_t start) {
+    const BYTE* bytes; BYTE* prefix; BYTE flag;
+    size_t   base, length, step, i;
+    unsigned block_length;
+
+    if( tape->buffer_size < ZXS_RESYNC_CHUNK_SIZE + 1 ) {
+        prefix = (BYTE*)_zxs_realloc(tape->allocator, tape->buffer, ZXS_RESYNC_CHUNK_SIZE + 1);
+        if( !prefix ) { return tape->size; }
+        tape->buffer      = prefix;
+        tape->buffer_size = ZXS_RESYNC_CHUNK_SIZE + 1;
+    }
+    prefix = tape->buffer;
+    for( base = start ; base < tape->size ; base += step ) {
+        length = tape->size - base < ZXS_RESYNC_CHUNK_SIZE ? tape->size - base : ZXS_RESYNC_CHUNK_SIZE;
+        step   = base + length == tape->size ? length : length - ZXS_MAX_BLOCK_SIZE;
+        bytes  = tape->data + base;
+        for( i = 0, prefix[0] = 0 ; i < length ; ++i ) { prefix[i+1] = prefix[i] ^ bytes[i]; }
+
+        for( i = 0 ; i < step && length - i >= 4 ; ++i ) {
+            block_length = GET_LE_WORD(bytes, i);
+            flag         = bytes[i + 2];
+            if( block_length < 2 || block_length > length - i - 2 ) { continue; }
+            if( flag != ZXS_BLKTYPE_DATA &&
+                (flag != ZXS_BLKTYPE_HEADER || block_length != 2 + ZXS_HEADER_SIZE || bytes[i + 3] > ZXS_DATATYPE_CODE) )
+            { continue; }
+            if( prefix[i + 2] == prefix[i + 2 + block_length] && _zxs_is_block_start(tape, base + i + 2 + block_length) ) {
+                return base + i;
+            }
+        }
+    }
+    return tape->size;
+}
+
+/**
+ * Reads the next block of a tape in memory, skipping any damaged area before it.
+ * 
+ * A block is accepted when its length fits within the tape and either a
+ * plausible block follows it or its checksum matches, so a block with a
+ * corrupt payload is still returned (and reported by a verification) as
+ * long as the tape stays in sync. Otherwise the tape is resynchronised at
+ * the next plausible block (see `_zxs_resync()`).
+ * 
+ * @param tape   The ZXSTape in memory.
+ * @param block  Pointer to the ZXSTapBlock structure to store the block view.
+ * @return TRUE if a block was read, FALSE at the end of the tape.
+ */
+MODULE_FUNC BOOL _zxs_read_robust_block(ZXSTape* tape, ZXSTapBlock* block) {
+    const BYTE* ptr;
+    size_t   next;
+    unsigned block_length;
+
+    while( tape->size - tape->position >= 4 ) {
+        ptr          = tape->data + tape->position;
+        block_length = GET_LE_WORD(ptr, 0);
+        if( block_length >= 2 && block_length <= tape->size - tape->position - 2 &&
+            (_zxs_is_block_start(tape, tape->position + 2 + block_length) || zxs_xor_bytes(ptr + 2, block_length) == 0) )
+        {
+            _zxs_set_block(block, ptr, block_length, tape->position);
+            tape->position += 2 + block_length;
+            STATS_ADD(STATS_BLOCKS_READ, 1);
+            STATS_ADD(STATS_PAYLOAD_BYTES, block->datasize);
+            return TRUE;
+        }
+        next = _zxs_resync(tape, tape->position + 1);
+        STATS_ADD(STATS_SKIPPED_BYTES, next - tape->position);
+        tape->skipped_bytes += next - tape->position;
+        tape->resync_count  += 1;
+        tape->position       = next;
+    }
+    return FALSE;
+}
+
+/**
+ * Reads the next ZX-Spectrum TAP block from a tape
+ * 
+ * The returned block is a view into the tape content, its `data` pointer
+ * remains valid as long as the memory passed to `zxs_init_tape()` does.
+ * For tapes read from a file, see `zxs_init_tape_file()`.
+ * 
+ * A damaged block ends the tape, unless the tape is in memory and has
+ * `robust` set, then the damaged area is skipped and reading resumes at
+ * the next plausible block (see `_zxs_read_robust_block()`).
+ * 
+ * @param[in]  tape   The ZXSTape to read the block from.
+ * @param[out] block  Pointer to the ZXSTapBlock structure to store the block view.
+ * @return TRUE if a complete block was read, FALSE at the end of the tape or if the block is truncated.
+ */
+MODULE_FUNC BOOL zxs_next_tap_block(ZXSTape* tape, ZXSTapBlock* block) {
+    const BYTE* ptr; BYTE length[2];
+    size_t   remaining;
+    unsigned block_length;
+
+    assert( tape!=NULL && block!=NULL );
+    if( tape->window ) { return _zxs_read_stream_block(tape, block); }
+    if( tape->robust && !tape->file ) { return _zxs_read_robust_block(tape, block); }
+
+    /* read the length of the block (2 bytes) */
+    remaining = tape->size - tape->position;
+    if( remaining < 2 ) { return FALSE; }
+    if( tape->file ) {
+        if( fread(length, 1, 2, tape->file) != 2 ) { return FALSE; }
+        ptr = length;
+    } else {
+        ptr = tape->data + tape->position;
+    }
+    block_length = GET_LE_WORD(ptr, 0);
+
+    /* the spectrum generated data (flag + data + checksum) must fit within the tape */
+    if( block_length < 2 || block_length > remaining - 2 ) { return FALSE; }
+
+    /* lazy read from file */
+    if( tape->file ) {
+        if( !_zxs_read_file_block(tape, block, block_length) ) { return FALSE; }
+        block->offset   = tape->position;
+        tape->position += 2 + block_length;
+        STATS_ADD(STATS_BLOCKS_READ, 1);
+        STATS_ADD(STATS_PAYLOAD_BYTES, block->datasize);
+        return TRUE;
+    }
+
+    /* set the block properties pointing to the tape content */
+    _zxs_set_block(block, ptr, block_length, tape->position);
+    tape->position += 2 + block_length;
+    STATS_ADD(STATS_BLOCKS_READ, 1);
+    STATS_ADD(STATS_PAYLOAD_BYTES, block->datasize);
+    return TRUE;
+}
+
+/**
+ * Reads the ZX-Spectrum TAP block located at a given offset of a tape
+ * 
+ * For tapes in memory the tape itself is not modified, so this function
+ * can be called concurrently from several threads. For tapes read from a
+ * file, the next block read by `zxs_next_tap_block()` is the one after it.
+ * For tapes read from a stream, only the last block read is available.
+ * 
+ * @param[in]  tape    The ZXSTape to read the block from.
+ * @param[in]  offset  Offset of the block within the tape (as stored in `ZXSTapBlock.offset`).
+ * @param[out] block   Pointer to the ZXSTapBlock structure to store the block view.
+ * @return TRUE if a complete block was read, FALSE otherwise.
+ */
+MODULE_FUNC BOOL zxs_read_tap_block_at(ZXSTape* tape, size_t offset, ZXSTapBlock* block) {
+    ZXSTape view;
+    assert( tape!=NULL && block!=NULL );
+    if( offset > tape->size ) { return FALSE; }
+    if( tape->window ) {
+        if( offset != tape->window_offset || tape->window_length < 2 ) { return FALSE; }
+        if( tape->window_length != 2u + (unsigned)GET_LE_WORD(tape->window, 0) ) { return FALSE; }
+        _zxs_set_block(block, tape->window, tape->window_length - 2, offset);
+        return TRUE;
+    }
+    if( !tape->file ) {
+        view          = *tape;
+        view.position = offset;
+        view.robust   = FALSE;
+        return zxs_next_tap_block(&view, block);
+    }
+    if( offset != tape->position ) {
+        if( fseek(tape->file, (long)offset, SEEK_SET) != 0 ) { return FALSE; }
+    }
+    tape->position = offset;
+    return zxs_next_tap_block(tape, block);
+}
+
+/**
+ * Makes the payload of a block available in `block->data`
+ * 
+ * For tapes in memory this does nothing, the block is already a view of
+ * its payload. For tapes read from a file, the payload is read into a
+ * buffer owned by the tape, which is reused by the next call.
+ * 
+ * @param tape   The ZXSTape the block was read from.
+ * @param block  The block whose payload is required.
+ * @return TRUE on success, FALSE if the payload could not be read.
+ */
+MODULE_FUNC BOOL zxs_load_block_data(ZXSTape* tape, ZXSTapBlock* block) {
+    BYTE* new_buffer; long long timer;
+    assert( tape!=NULL && block!=NULL );
+    if( !tape->file || (block->data && block->data != tape->header_data) ) { return TRUE; }
+
+    if( tape->buffer_size < block->datasize ) {
+        new_buffer = (BYTE*)_zxs_realloc(tape->allocator, tape->buffer, block->datasize);
+        if( !new_buffer ) { return FALSE; }
+        tape->buffer      = new_buffer;
+        tape->buffer_size = block->datasize;
+    }
+    timer = stats_start_timer();
+    if( fseek(tape->file, (long)(block->offset + 3), SEEK_SET) != 0 ||
+        fread(tape->buffer, 1, block->datasize, tape->file) != block->datasize )
+    { fseek(tape->file, (long)tape->position, SEEK_SET); return FALSE; }
+
+    block->data = tape->buffer;
+    stats_end_timer(STATS_TIME_READ, timer);
+    return fseek(tape->file, (long)tape->position, SEEK_SET) == 0;
+}
+
+/**
+ * Calculates the checksum of a block as the ZX-Spectrum does (XOR of the flag and all data bytes)
+ * @param block  The block, its payload must be available (see `zxs_load_block_data()`).
+ * @return The 8-bit checksum, it matches `block->checksum` if the block is not corrupt.
+ */
+MODULE_FUNC unsigned zxs_calc_block_checksum(const ZXSTapBlock* block) {
+    assert( block!=NULL && (block->data!=NULL || block->datasize==0) );
+    return ((unsigned)block->type ^ zxs_xor_bytes(block->data, block->datasize)) & 0xFF;
 }
 
 /**
@@ -141,7 +669,7 @@ ZXSTapBlock* zxs_read_tap_block(FILE* tap_file) {
  * @param[in]  block  Pointer to the ZXSTapBlock containing the header data.
  * @return TRUE if the block is a valid header block and parsing succeeds, FALSE otherwise.
  */
-BOOL zxs_parse_header(ZXSHeader *header, const ZXSTapBlock *block) {
+MODULE_FUNC BOOL zxs_parse_header(ZXSHeader *header, const ZXSTapBlock *block) {
     int i;
 
     assert( header!=NULL );
@@ -163,4 +691,286 @@ BOOL zxs_parse_header(ZXSHeader *header, const ZXSTapBlock *block) {
     return TRUE;
 }
 
+/*------------------------------ BLOCK INDEX -------------------------------*/
+
+/**
+ * Calculates the hash value of a header name (FNV-1a)
+ * @param name The null-terminated name.
+ * @return The 32-bit hash value of the name.
+ */
+MODULE_FUNC unsigned _zxs_name_hash(const char* name) {
+    unsigned hash = 2166136261u;
+    for( ; *name ; ++name ) { hash = (hash ^ (BYTE)*name) * 16777619u; }
+    return hash & 0xFFFFFFFFu;
+}
+
+/**
+ * Completes a block index once all its blocks have been added
+ * 
+ * It builds the hash table of header names. When several headers share the
+ * same name, only the first one is stored, so lookups return the same header
+ * that a linear search would find.
+ * 
+ * @param index The block index with all its blocks already added.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+MODULE_FUNC BOOL zxs_complete_index(ZXSTapIndex* index) {
+    unsigned size, slot; int i; const char* name;
+
+    for( size = 16 ; size < 2 * (unsigned)index->header_count ; size *= 2 ) { }
+    index->name_table      = (int*)_zxs_realloc(index->allocator, NULL, size * sizeof(int));
+    index->name_table_size = size;
+    if( !index->name_table ) { return FALSE; }
+    memset(index->name_table, 0, size * sizeof(int));
+
+    for( i = 0 ; i < index->header_count ; ++i ) {
+        name = index->entries[ index->headers[i] ].header.filename;
+        slot = _zxs_name_hash(name) & (size - 1);
+        while( index->name_table[slot] &&
+               strcmp(index->entries[ index->headers[index->name_table[slot]-1] ].header.filename, name) != 0 )
+        { slot = (slot + 1) & (size - 1); }
+        if( !index->name_table[slot] ) { index->name_table[slot] = i + 1; }
+    }
+    return TRUE;
+}
+
+/**
+ * Releases all memory used by a block index
+ * @param index The block index to release.
+ */
+MODULE_FUNC void zxs_free_index(ZXSTapIndex* index) {
+    assert( index!=NULL );
+    _zxs_free( index->allocator, index->entries    );
+    _zxs_free( index->allocator, index->headers    );
+    _zxs_free( index->allocator, index->name_table );
+    memset( index, 0, sizeof(ZXSTapIndex) );
+}
+
+/**
+ * Adds a block to a block index under construction
+ * 
+ * Only the block properties and, for headers, the 17 bytes of header data
+ * are used, so the block payload does not need to be available.
+ * 
+ * @param index  The block index being built.
+ * @param block  The block to add.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+MODULE_FUNC BOOL zxs_index_add_block(ZXSTapIndex* index, const ZXSTapBlock* block) {
+    ZXSIndexEntry *entry, *new_entries;
+    int *new_headers;
+
+    if( index->entry_count == index->entry_capacity ) {
+        index->entry_capacity = index->entry_capacity ? index->entry_capacity * 2 : 64;
+        new_entries = (ZXSIndexEntry*)_zxs_realloc(index->allocator, index->entries, index->entry_capacity * sizeof(ZXSIndexEntry));
+        new_headers = (int*)_zxs_realloc(index->allocator, index->headers, index->entry_capacity * sizeof(int));
+        if( new_entries ) { index->entries = new_entries; }
+        if( new_headers ) { index->headers = new_headers; }
+        if( !new_entries || !new_headers ) { return FALSE; }
+    }
+    entry = &index->entries[ index->entry_count ];
+    entry->offset    = block->offset;
+    entry->type      = block->type;
+    entry->checksum  = block->checksum;
+    entry->datasize  = block->datasize;
+    entry->is_header = zxs_parse_header(&entry->header, block);
+    if( entry->is_header ) { index->headers[ index->header_count++ ] = index->entry_count; }
+    ++index->entry_count;
+    return TRUE;
+}
+
+/**
+ * Builds the block index of a ZX-Spectrum tape by reading all its blocks once
+ * @param[out] index  The ZXSTapIndex structure to fill in (release it with `zxs_free_index()`).
+ * @param[in]  tape   The tape to index, it is read from the beginning.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+MODULE_FUNC BOOL zxs_build_index(ZXSTapIndex* index, ZXSTape* tape) {
+    ZXSTapBlock block;
+    BOOL success = TRUE;
+
+    assert( index!=NULL && tape!=NULL );
+    memset( index, 0, sizeof(ZXSTapIndex) );
+    index->tape      = tape;
+    index->allocator = tape->allocator;
+    tape->position   = 0;
+    while( success && zxs_next_tap_block(tape, &block) ) {
+        success = zxs_index_add_block(index, &block);
+    }
+    success = success && zxs_complete_index(index);
+    if( !success ) { zxs_free_index(index); }
+    return success;
+}
+
+/**
+ * Appends the blocks of another index to a block index under construction
+ * @param index  The block index being built.
+ * @param part   The index with the blocks to append.
+ * @param first  Position in `part` of the first block to append.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+MODULE_FUNC BOOL _zxs_index_append(ZXSTapIndex* index, const ZXSTapIndex* part, int first) {
+    ZXSIndexEntry *new_entries; int *new_headers;
+    int i, count = part->entry_count - first, capacity = index->entry_capacity;
+
+    if( count <= 0 ) { return TRUE; }
+    if( index->entry_count + count > capacity ) {
+        for( capacity = capacity ? capacity : 64 ; capacity < index->entry_count + count ; capacity *= 2 ) { }
+        new_entries = (ZXSIndexEntry*)_zxs_realloc(index->allocator, index->entries, capacity * sizeof(ZXSIndexEntry));
+        new_headers = (int*)_zxs_realloc(index->allocator, index->headers, capacity * sizeof(int));
+        if( new_entries ) { index->entries = new_entries; }
+        if( new_headers ) { index->headers = new_headers; }
+        if( !new_entries || !new_headers ) { return FALSE; }
+        index->entry_capacity = capacity;
+    }
+    memcpy(&index->entries[index->entry_count], &part->entries[first], count * sizeof(ZXSIndexEntry));
+    for( i = 0 ; i < count ; ++i ) {
+        if( index->entries[index->entry_count].is_header ) { index->headers[ index->header_count++ ] = index->entry_count; }
+        ++index->entry_count;
+    }
+    return TRUE;
+}
+
+/**
+ * Indexes the blocks of one segment of a tape in memory
+ * 
+ * The first block of the segment is not known until the previous segments
+ * are indexed, so it is guessed as the first plausible block from `start`
+ * (see `_zxs_resync()`); `zxs_merge_segments()` later corrects any wrong
+ * guess. Blocks are then read as `zxs_next_tap_block()` does, until the
+ * first one at or after `end`. The tape itself is not modified, so several
+ * segments of the same tape can be scanned concurrently (as long as its
+ * allocator is thread safe).
+ * 
+ * @param segment  The segment, with `tape`, `start` and `end` set (release its `index` with `zxs_free_index()`).
+ */
+MODULE_FUNC void zxs_scan_segment(ZXSTapSegment* segment) {
+    ZXSTape view; ZXSTapBlock block;
+    BOOL success = TRUE;
+
+    assert( segment!=NULL && segment->tape!=NULL );
+    assert( !segment->tape->file && !segment->tape->window );
+    memset(&segment->index, 0, sizeof(ZXSTapIndex));
+    segment->index.tape      = segment->tape;
+    segment->index.allocator = segment->tape->allocator;
+
+    view             = *segment->tape;
+    view.buffer      = NULL;
+    view.buffer_size = 0;
+    segment->first   = segment->start == 0 ? 0 : _zxs_resync(&view, segment->start);
+    view.position    = segment->first;
+    while( success && view.position < segment->end && zxs_next_tap_block(&view, &block) ) {
+        success = zxs_index_add_block(&segment->index, &block);
+    }
+    segment->next    = view.position;
+    segment->success = success;
+    zxs_free_tape(&view);
+}
+
+/**
+ * Builds the block index of a tape in memory from the indices of its segments
+ * 
+ * The segments are stitched in order. A segment whose first block is not
+ * where the previous one ended guessed a wrong boundary (e.g. a payload
+ * that looks like a block), then the tape is read from the right boundary
+ * until it meets one of the blocks found in the segment, from where both
+ * scans are the same. The result is the same index that `zxs_build_index()`
+ * builds, including the damaged areas skipped (`resync_count` and
+ * `skipped_bytes` of the tape).
+ * 
+ * @param[out] index          The ZXSTapIndex structure to fill in (release it with `zxs_free_index()`).
+ * @param[in]  segments       The consecutive segments covering the whole tape, already scanned.
+ * @param[in]  segment_count  Number of elements in `segments`.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+MODULE_FUNC BOOL zxs_merge_segments(ZXSTapIndex* index, const ZXSTapSegment* segments, int segment_count) {
+    const ZXSTapSegment* segment; const ZXSIndexEntry* entry;
+    ZXSTape *tape, view; ZXSTapBlock block;
+    size_t expected = 0, tape_end = 0;
+    BOOL success = TRUE, met;
+    int i, k;
+
+    assert( index!=NULL && segments!=NULL && segment_count>0 );
+    tape = segments[0].tape;
+    memset( index, 0, sizeof(ZXSTapIndex) );
+    index->tape      = tape;
+    index->allocator = tape->allocator;
+    for( k = 0 ; success && k < segment_count ; ++k ) {
+        segment = &segments[k];
+        if( !segment->success ) { success = FALSE; break; }
+        if( expected >= segment->end ) { continue; }
+
+        i = 0; met = expected == segment->first;
+        if( !met ) {
+            view             = *tape;
+            view.buffer      = NULL;
+            view.buffer_size = 0;
+            view.position    = expected;
+            while( success && view.position < segment->end ) {
+                while( i < segment->index.entry_count && segment->index.entries[i].offset < view.position ) { ++i; }
+                met = i < segment->index.entry_count && segment->index.entries[i].offset == view.position;
+                if( met || !zxs_next_tap_block(&view, &block) ) { break; }
+                success = zxs_index_add_block(index, &block);
+            }
+            expected = view.position;
+            zxs_free_tape(&view);
+        }
+        if( met ) {
+            success  = success && _zxs_index_append(index, &segment->index, i);
+            expected = segment->next;
+        }
+        /* the tape ends where a scan stopped before the end of its segment */
+        if( expected < segment->end ) { break; }
+    }
+
+    /* every gap between blocks is a damaged area skipped while resynchronising */
+    tape->resync_count  = 0;
+    tape->skipped_bytes = 0;
+    for( i = 0 ; i <= index->entry_count ; ++i ) {
+        entry = i < index->entry_count ? &index->entries[i] : NULL;
+        if( (entry ? entry->offset : expected) > tape_end ) {
+            tape->resync_count  += 1;
+            tape->skipped_bytes += (entry ? entry->offset : expected) - tape_end;
+        }
+        if( entry ) { tape_end = entry->offset + 4 + entry->datasize; }
+    }
+    tape->position = expected;
+    success = success && zxs_complete_index(index);
+    if( !success ) { zxs_free_index(index); }
+    return success;
+}
+
+/**
+ * Finds the first header with a given name in a block index
+ * @param index  The block index.
+ * @param name   The name of the header to find.
+ * @return The position of the header in the index headers (0 = first header), or -1 if not found.
+ */
+MODULE_FUNC int zxs_index_find_name(const ZXSTapIndex* index, const char* name) {
+    unsigned slot; int position;
+    assert( index!=NULL && name!=NULL );
+    if( !index->name_table ) { return -1; }
+    slot = _zxs_name_hash(name) & (index->name_table_size - 1);
+    while( (position = index->name_table[slot]) != 0 ) {
+        if( strcmp(index->entries[ index->headers[position-1] ].header.filename, name) == 0 ) {
+            return position - 1;
+        }
+        slot = (slot + 1) & (index->name_table_size - 1);
+    }
+    return -1;
+}
+
+/**
+ * Gets a block view from a block index
+ * @param[in]  index     The block index.
+ * @param[in]  position  The position of the block in the index entries.
+ * @param[out] block     Pointer to the ZXSTapBlock structure to store the block view.
+ * @return TRUE on success, FALSE if the position is out of range or the block can not be read.
+ */
+MODULE_FUNC BOOL zxs_index_block(const ZXSTapIndex* index, int position, ZXSTapBlock* block) {
+    assert( index!=NULL && block!=NULL );
+    if( position < 0 || position >= index->entry_count ) { return FALSE; }
+    return zxs_read_tap_block_at(index->tape, index->entries[position].offset, block);
+}
+
 #endif /* ZXS_TAP_H */
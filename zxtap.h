@@ -0,0 +1,451 @@
+/*
+| File    : zxtap.h
+| Purpose : Reentrant library API to parse and convert ZX-Spectrum TAP files.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#ifndef ZXTAP_H
+#define ZXTAP_H
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+  This header is the whole library: it only declares the API, unless
+  ZXTAP_IMPLEMENTATION is defined before including it, in exactly one
+  translation unit of the program (libzxtap.c does it for the static
+  library), which then also compiles the implementation:
+
+      #define ZXTAP_IMPLEMENTATION
+      #include "zxtap.h"
+
+  The library has no global state. Everything it needs (options, where
+  the messages go, how memory is allocated and where the statistics are
+  collected) is taken from a context provided by the caller, so any number of tapes can be parsed at the
+  same time from different threads without any locking. An open tape is
+  never modified after `zxtap_open_memory()`/`zxtap_open_file()` return,
+  so it can also be shared by several threads once it is open.
+*/
+
+/**
+ * Error codes returned by the library functions
+ */
+typedef enum ZXTAP_ERROR {
+    ZXTAP_OK                  = 0,  /**< No error */
+    ZXTAP_ERR_OUTPUT          = 1,  /**< The output could not be written */
+    ZXTAP_ERR_TRUNCATED_BASIC = 2,  /**< The BASIC program ends in the middle of a line */
+    ZXTAP_ERR_INVALID_NUMBERS = 3,  /**< The number array is invalid or truncated */
+    ZXTAP_ERR_INVALID_STRINGS = 4,  /**< The character array is invalid or truncated */
+    ZXTAP_ERR_PARAMETER       = 5,  /**< Invalid parameter (e.g. a position out of range) */
+    ZXTAP_ERR_MEMORY          = 6,  /**< Not enough memory */
+    ZXTAP_ERR_READ            = 7,  /**< The tape file could not be read */
+    ZXTAP_ERR_NOT_HEADER      = 8,  /**< The block is not a valid header */
+    ZXTAP_ERR_NO_DATA         = 9,  /**< The header is not followed by a data block */
+    ZXTAP_ERR_DATATYPE        = 10  /**< The header has an unknown data type */
+} ZXTAP_ERROR;
+
+/**
+ * Severity of the messages reported through the context
+ */
+typedef enum ZXTAP_LEVEL {
+    ZXTAP_LEVEL_WARNING,      /**< Something unusual that did not stop the operation */
+    ZXTAP_LEVEL_ERROR         /**< The reason why an operation failed */
+} ZXTAP_LEVEL;
+
+/** Option: binary code is written as raw bytes instead of Intel HEX records */
+#define ZXTAP_OPTION_RAW_CODE  0x01
+
+/** Option: damaged areas of the tape are skipped, resuming at the next plausible block */
+#define ZXTAP_OPTION_ROBUST    0x02
+
+/**
+ * Counters of the work done by the library, collected through a context
+ * 
+ * They are added without any locking, so the tapes opened with the same
+ * ZXTapStats must be used from one thread at a time (give each thread its
+ * own context and stats, and add them up when finished).
+ */
+typedef struct ZXTapStats {
+    long long  blocks_read;     /**< Number of tape blocks read while opening the tapes */
+    long long  payload_bytes;   /**< Bytes in the payloads of the blocks read */
+    long long  skipped_bytes;   /**< Bytes of damaged tapes skipped with ZXTAP_OPTION_ROBUST */
+    long long  allocations;     /**< Number of allocations and reallocations */
+    long long  blocks_written;  /**< Number of data blocks converted by `zxtap_write_data()` */
+    long long  output_bytes;    /**< Bytes of converted data written */
+} ZXTapStats;
+
+/**
+ * The context that every tape is opened with
+ * 
+ * It is copied when a tape is opened, so it can be a local variable of
+ * the caller. Initialize it with `zxtap_init_context()` and then set the
+ * fields that need to differ from the defaults.
+ */
+typedef struct ZXTapContext {
+    unsigned  options;                                          /**< Combination of ZXTAP_OPTION_xxx flags */
+    void    (*report)(void* user, ZXTAP_LEVEL level, const char* message); /**< Error sink (NULL = messages are discarded) */
+    void*   (*realloc_fn)(void* user, void* ptr, size_t size);  /**< Same as realloc(), `ptr` is NULL to allocate (NULL = C library) */
+    void    (*free_fn)(void* user, void* ptr);                  /**< Same as free() (NULL = C library) */
+    void*     user;                                             /**< Passed as is to all the hooks */
+    ZXTapStats* stats;                                          /**< Where the counters are added (NULL = not collected) */
+} ZXTapContext;
+
+/** An open tape (opaque) */
+typedef struct ZXTapFile ZXTapFile;
+
+/**
+ * The properties of a block of an open tape
+ */
+typedef struct ZXTapBlockInfo {
+    size_t               offset;      /**< Offset of the block within the tape */
+    unsigned             flag;        /**< Flag byte (00 for headers, FF for data blocks) */
+    unsigned             size;        /**< Size of the block data in bytes */
+    const unsigned char* data;        /**< The block data, valid until the tape is closed */
+    int                  checksum_ok; /**< Non-zero if the checksum stored in the tape is correct */
+    int                  is_header;   /**< Non-zero if the block is a valid header (the fields below are set) */
+    int                  datatype;    /**< Type of data described by the header (0=BASIC, 1=numbers, 2=strings, 3=code) */
+    char                 name[12];    /**< Filename in the header (null-terminated) */
+    unsigned             length;      /**< Length of the program/data described by the header */
+    unsigned             param1;      /**< Parameter 1 of the header (autostart line, start address, ...) */
+    unsigned             param2;      /**< Parameter 2 of the header (program length, ...) */
+} ZXTapBlockInfo;
+
+/**
+ * Initializes a context with the default options, no error sink, the C library allocator and no statistics.
+ * @param context  The context to initialize.
+ */
+void zxtap_init_context(ZXTapContext* context);
+
+/**
+ * Gets the counters collected so far through a context.
+ * @param[in]  context  The context, its `stats` field points to where the counters are added.
+ * @param[out] stats    Receives a copy of the counters (all zero if the context collects none).
+ */
+void zxtap_get_stats(const ZXTapContext* context, ZXTapStats* stats);
+
+/**
+ * Opens a tape that is already in memory, without copying it.
+ * @param[in]  context  The context (copied into the tape).
+ * @param[in]  data     The TAP file content, it must remain valid until the tape is closed.
+ * @param[in]  size     Size of the TAP file content in bytes.
+ * @param[out] tape     Receives the open tape, release it with `zxtap_close()`.
+ * @return ZXTAP_OK on success, or an error code indicating what went wrong.
+ */
+int zxtap_open_memory(const ZXTapContext* context, const void* data, size_t size, ZXTapFile** tape);
+
+/**
+ * Opens a tape file, reading all its content into memory.
+ * @param[in]  context  The context (copied into the tape).
+ * @param[in]  path     The path of the TAP file.
+ * @param[out] tape     Receives the open tape, release it with `zxtap_close()`.
+ * @return ZXTAP_OK on success, or an error code indicating what went wrong.
+ */
+int zxtap_open_file(const ZXTapContext* context, const char* path, ZXTapFile** tape);
+
+/**
+ * Closes a tape, releasing all its memory.
+ * @param tape  The tape to close. (may be NULL)
+ */
+void zxtap_close(ZXTapFile* tape);
+
+/**
+ * Returns the number of blocks of a tape.
+ * @param tape  The open tape.
+ */
+int zxtap_get_block_count(const ZXTapFile* tape);
+
+/**
+ * Gets the properties of a block of a tape.
+ * @param[in]  tape      The open tape.
+ * @param[in]  position  Position of the block in the tape (0 = first block).
+ * @param[out] info      Receives the properties of the block.
+ * @return ZXTAP_OK on success, or an error code indicating what went wrong.
+ */
+int zxtap_get_block(const ZXTapFile* tape, int position, ZXTapBlockInfo* info);
+
+/**
+ * Finds the first header with a given name.
+ * @param tape  The open tape.
+ * @param name  The filename stored in the header.
+ * @return The position of the header block in the tape, or -1 if there is no header with that name.
+ */
+int zxtap_find_header(const ZXTapFile* tape, const char* name);
+
+/**
+ * Writes the content of the data block that follows a header, converted
+ * according to the type of the header: BASIC programs as listings, arrays
+ * as DIM/DATA lines and binary code as Intel HEX records (or raw bytes
+ * with ZXTAP_OPTION_RAW_CODE).
+ * @param tape      The open tape.
+ * @param position  Position of the header block in the tape.
+ * @param output    The stream where the converted data is written.
+ * @return ZXTAP_OK on success, or an error code indicating what went wrong.
+ */
+int zxtap_write_data(const ZXTapFile* tape, int position, FILE* output);
+
+/**
+ * Returns the message that describes an error code.
+ * @param err_code  The error code (one of the ZXTAP_ERROR values).
+ * @return A static string with the message.
+ */
+const char* zxtap_get_error_message(int err_code);
+
+#endif /* ZXTAP_H */
+
+/*============================== IMPLEMENTATION =============================*/
+#if defined(ZXTAP_IMPLEMENTATION) && !defined(ZXTAP_IMPLEMENTED)
+#define ZXTAP_IMPLEMENTED
+#define ZXS_NO_STATS
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "zxs_tap.h"
+#include "zxs_bas.h"
+#include "zxs_arr.h"
+#include "fmt_hex.h"
+
+/** Size of the output buffer used when converting a data block */
+#define ZXTAP_BUFFER_SIZE OUT_BUF_SIZE
+
+struct ZXTapFile {
+    ZXTapContext  context;    /**< Copy of the context the tape was opened with */
+    ZXSAllocator  allocator;  /**< The allocator hooks of the context */
+    ZXSTape       tape;       /**< The tape content */
+    ZXSTapIndex   index;      /**< Index of all the blocks of the tape */
+    BYTE*         content;    /**< The tape content read by `zxtap_open_file()` (NULL if not owned) */
+};
+
+/*----------------------- INTERNAL HELPER FUNCTIONS ------------------------*/
+
+/* the allocator hooks of a tape receive the tape itself, to count the allocations */
+MODULE_FUNC void* _zxtap_realloc(void* user, void* ptr, size_t size) {
+    const ZXTapContext* context = &((ZXTapFile*)user)->context;
+    if( context->stats ) { ++context->stats->allocations; }
+    return context->realloc_fn ? context->realloc_fn(context->user, ptr, size) : realloc(ptr, size);
+}
+
+MODULE_FUNC void _zxtap_free(void* user, void* ptr) {
+    const ZXTapContext* context = &((ZXTapFile*)user)->context;
+    if( context->free_fn ) { context->free_fn(context->user, ptr); } else { free(ptr); }
+}
+
+MODULE_FUNC void _zxtap_report(const ZXTapContext* context, ZXTAP_LEVEL level, const char* format, ...) {
+    char message[512]; va_list args;
+    if( !context->report ) { return; }
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    context->report(context->user, level, message);
+}
+
+MODULE_FUNC int _zxtap_create(const ZXTapContext* context, ZXTapFile** tape) {
+    ZXTapFile* new_tape;
+    assert( context!=NULL && tape!=NULL );
+    *tape    = NULL;
+    new_tape = (ZXTapFile*)(context->realloc_fn ? context->realloc_fn(context->user, NULL, sizeof(ZXTapFile))
+                                                : malloc(sizeof(ZXTapFile)));
+    if( context->stats ) { ++context->stats->allocations; }
+    if( !new_tape ) { _zxtap_report(context, ZXTAP_LEVEL_ERROR, "Not enough memory to open the tape"); return ZXTAP_ERR_MEMORY; }
+    memset(new_tape, 0, sizeof(ZXTapFile));
+    new_tape->context              = *context;
+    new_tape->allocator.realloc_fn = _zxtap_realloc;
+    new_tape->allocator.free_fn    = _zxtap_free;
+    new_tape->allocator.user       = new_tape;
+    *tape = new_tape;
+    return ZXTAP_OK;
+}
+
+MODULE_FUNC int _zxtap_build_index(ZXTapFile* tape, const BYTE* data, size_t size) {
+    ZXTapStats* stats = tape->context.stats;
+    int i;
+    zxs_init_tape(&tape->tape, data, size);
+    tape->tape.allocator = &tape->allocator;
+    tape->tape.robust    = (tape->context.options & ZXTAP_OPTION_ROBUST) != 0;
+    if( !zxs_build_index(&tape->index, &tape->tape) ) {
+        _zxtap_report(&tape->context, ZXTAP_LEVEL_ERROR, "Not enough memory to index the tape");
+        return ZXTAP_ERR_MEMORY;
+    }
+    if( stats ) {
+        stats->blocks_read   += tape->index.entry_count;
+        stats->skipped_bytes += (long long)tape->tape.skipped_bytes;
+        for( i = 0 ; i < tape->index.entry_count ; ++i ) { stats->payload_bytes += tape->index.entries[i].datasize; }
+    }
+    if( tape->tape.resync_count > 0 ) {
+        _zxtap_report(&tape->context, ZXTAP_LEVEL_WARNING, "Damaged areas of the tape were skipped");
+    }
+    return ZXTAP_OK;
+}
+
+/*============================ PUBLIC FUNCTIONS ============================*/
+
+void zxtap_init_context(ZXTapContext* context) {
+    assert( context!=NULL );
+    memset(context, 0, sizeof(ZXTapContext));
+}
+
+void zxtap_get_stats(const ZXTapContext* context, ZXTapStats* stats) {
+    assert( context!=NULL && stats!=NULL );
+    if( context->stats ) { *stats = *context->stats; } else { memset(stats, 0, sizeof(ZXTapStats)); }
+}
+
+int zxtap_open_memory(const ZXTapContext* context, const void* data, size_t size, ZXTapFile** tape) {
+    int err_code;
+    if( !context || !tape || (!data && size>0) ) { return ZXTAP_ERR_PARAMETER; }
+    err_code = _zxtap_create(context, tape);
+    if( !err_code ) { err_code = _zxtap_build_index(*tape, (const BYTE*)data, size); }
+    if( err_code ) { zxtap_close(*tape); *tape = NULL; }
+    return err_code;
+}
+
+int zxtap_open_file(const ZXTapContext* context, const char* path, ZXTapFile** tape) {
+    FILE* file; long size = -1;
+    int err_code;
+    if( !context || !path || !tape ) { return ZXTAP_ERR_PARAMETER; }
+    err_code = _zxtap_create(context, tape);
+    if( err_code ) { return err_code; }
+
+    file = fopen(path, "rb");
+    if( file && fseek(file, 0, SEEK_END) == 0 ) { size = ftell(file); }
+    if( size < 0 || fseek(file, 0, SEEK_SET) != 0 ) {
+        _zxtap_report(context, ZXTAP_LEVEL_ERROR, "Cannot open the file '%s'", path);
+        err_code = ZXTAP_ERR_READ;
+    }
+    if( !err_code ) {
+        (*tape)->content = (BYTE*)_zxs_realloc(&(*tape)->allocator, NULL, size>0 ? (size_t)size : 1);
+        if( !(*tape)->content ) {
+            _zxtap_report(context, ZXTAP_LEVEL_ERROR, "Not enough memory to read the file '%s'", path);
+            err_code = ZXTAP_ERR_MEMORY;
+        }
+    }
+    if( !err_code && fread((*tape)->content, 1, (size_t)size, file) != (size_t)size ) {
+        _zxtap_report(context, ZXTAP_LEVEL_ERROR, "Cannot read the file '%s'", path);
+        err_code = ZXTAP_ERR_READ;
+    }
+    if( file ) { fclose(file); }
+    if( !err_code ) { err_code = _zxtap_build_index(*tape, (*tape)->content, (size_t)size); }
+    if( err_code ) { zxtap_close(*tape); *tape = NULL; }
+    return err_code;
+}
+
+void zxtap_close(ZXTapFile* tape) {
+    if( !tape ) { return; }
+    zxs_free_index(&tape->index);
+    zxs_free_tape(&tape->tape);
+    _zxs_free(&tape->allocator, tape->content);
+    tape->allocator.free_fn(tape->allocator.user, tape);
+}
+
+int zxtap_get_block_count(const ZXTapFile* tape) {
+    assert( tape!=NULL );
+    return tape->index.entry_count;
+}
+
+int zxtap_get_block(const ZXTapFile* tape, int position, ZXTapBlockInfo* info) {
+    const ZXSIndexEntry* entry; ZXSTapBlock block;
+    if( !tape || !info || !zxs_index_block(&tape->index, position, &block) ) { return ZXTAP_ERR_PARAMETER; }
+    entry = &tape->index.entries[position];
+    memset(info, 0, sizeof(ZXTapBlockInfo));
+    info->offset      = entry->offset;
+    info->flag        = entry->type;
+    info->size        = entry->datasize;
+    info->data        = block.data;
+    info->checksum_ok = zxs_calc_block_checksum(&block) == entry->checksum;
+    info->is_header   = entry->is_header;
+    if( entry->is_header ) {
+        info->datatype = entry->header.datatype;
+        info->length   = entry->header.length;
+        info->param1   = entry->header.param1;
+        info->param2   = entry->header.param2;
+        memcpy(info->name, entry->header.filename, sizeof(info->name));
+    }
+    return ZXTAP_OK;
+}
+
+int zxtap_find_header(const ZXTapFile* tape, const char* name) {
+    int header;
+    if( !tape || !name ) { return -1; }
+    header = zxs_index_find_name(&tape->index, name);
+    return header >= 0 ? tape->index.headers[header] : -1;
+}
+
+int zxtap_write_data(const ZXTapFile* tape, int position, FILE* output) {
+    char memory[ZXTAP_BUFFER_SIZE]; OutBuf out;
+    const ZXSHeader* header; ZXSTapBlock block;
+    int err_code;
+
+    if( !tape || !output || position < 0 || position >= tape->index.entry_count ) { return ZXTAP_ERR_PARAMETER; }
+    if( !tape->index.entries[position].is_header ) {
+        _zxtap_report(&tape->context, ZXTAP_LEVEL_ERROR, "The block %d is not a header", position);
+        return ZXTAP_ERR_NOT_HEADER;
+    }
+    header = &tape->index.entries[position].header;
+    if( !zxs_index_block(&tape->index, position+1, &block) ) {
+        _zxtap_report(&tape->context, ZXTAP_LEVEL_ERROR, "No data block found after the header '%s'", header->filename);
+        return ZXTAP_ERR_NO_DATA;
+    }
+
+    out_buf_init(&out, output, memory, sizeof(memory));
+    switch( header->datatype ) {
+        case ZXS_DATATYPE_BASIC:   err_code = zxs_write_basic_program(&out, block.data, block.datasize);                break;
+        case ZXS_DATATYPE_NUMBERS: err_code = zxs_write_number_array(&out, header->param1, block.data, block.datasize); break;
+        case ZXS_DATATYPE_STRINGS: err_code = zxs_write_string_array(&out, header->param1, block.data, block.datasize); break;
+        case ZXS_DATATYPE_CODE:
+            if( tape->context.options & ZXTAP_OPTION_RAW_CODE ) { out_buf_write(&out, (const char*)block.data, block.datasize); }
+            else                                                { write_hex_data(&out, header->param1, block.data, block.datasize); }
+            err_code = out.err_code;
+            break;
+        default:
+            _zxtap_report(&tape->context, ZXTAP_LEVEL_ERROR, "Unknown data type in header '%s' (%d)", header->filename, header->datatype);
+            return ZXTAP_ERR_DATATYPE;
+    }
+    if( out_buf_flush(&out) && !err_code ) { err_code = ZXTAP_ERR_OUTPUT; }
+    if( tape->context.stats ) {
+        tape->context.stats->blocks_written += 1;
+        tape->context.stats->output_bytes   += (long long)out.flushed;
+    }
+    if( err_code ) {
+        _zxtap_report(&tape->context, ZXTAP_LEVEL_ERROR, "%s in '%s'", zxtap_get_error_message(err_code), header->filename);
+    }
+    return err_code;
+}
+
+const char* zxtap_get_error_message(int err_code) {
+    switch( err_code ) {
+        case ZXTAP_ERR_PARAMETER:  return "Invalid parameter";
+        case ZXTAP_ERR_MEMORY:     return "Not enough memory";
+        case ZXTAP_ERR_READ:       return "Cannot read the tape file";
+        case ZXTAP_ERR_NOT_HEADER: return "The block is not a header";
+        case ZXTAP_ERR_NO_DATA:    return "No data block found after the header";
+        case ZXTAP_ERR_DATATYPE:   return "Unknown data type in header";
+    }
+    /* the first codes are the same as the ones of the decoders */
+    return zxs_get_error_message(err_code);
+}
+
+#endif /* ZXTAP_IMPLEMENTATION */
@@ -29,24 +29,51 @@
 |    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
 |    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 \_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE /* the system calls of file_dir.h and fdopen(), also with -std=c99 */
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <time.h>
+#include <errno.h>
+#ifdef _WIN32
+#   include <io.h>
+#   include <fcntl.h>
+#else
+#   include <signal.h>
+#   include <unistd.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#endif
 #include "common.h"
 #include "file_dir.h"
 #include "zxs_bas.h"
+#include "zxs_arr.h"
+#include "zxs_find.h"
 #include "zxs_tap.h"
+#include "zxs_idx.h"
 #include "fmt_hex.h"
+#include "thread_pool.h"
+#include "stats.h"
+#include "dedup_store.h"
+#include "render_cache.h"
+#include "manifest.h"
+#include "fmt_tar.h"
+#include "fmt_zip.h"
 const char  VERSION[] = "v1.0";
 const char* HELP[]    = {
-"Usage: zxtapi [OPTIONS] FILE.tap"                                                       ,
+"Usage: zxtapi [OPTIONS] FILE.tap [FILE.tap|DIR ...]"                                    ,
 ""                                                                                       ,
 "Description:"                                                                           ,
 "  ZXTapInspector (zxtapi) is a command-line tool for inspecting ZX Spectrum .tap files.",
 "  It enables you to list blocks, view detailed block information, extract BASIC code,"  ,
 "  and convert tape data into usable file formats."                                      ,
+"  Tapes compressed with gzip (FILE.tap.gz) and the .tap files inside zip archives are"  ,
+"  decompressed on the fly, without temporary files; the tapes of a zip archive are"     ,
+"  processed in parallel (see -j)."                                                      ,
 ""                                                                                       ,
 "Options:"                                                                               ,
 "  -l, --list"                                                                           ,
@@ -57,6 +84,7 @@ const char* HELP[]    = {
 "          - A numeric index (e.g., \"1\" for the first block)"                          ,
 "          - A block name prefixed with a colon (e.g., \":loader\")"                     ,
 "        Depending on the block type, it is displayed in an appropriate format"          ,
+"        This option can be repeated to print several blocks in one run."                ,
 ""                                                                                       ,
 "  -b, --basic"                                                                          ,
 "        Output the first BASIC program found within the .tap file."                     ,
@@ -64,12 +92,119 @@ const char* HELP[]    = {
 "  -c, --code"                                                                           ,
 "        Output the first binary code found within the .tap file."                       ,
 ""                                                                                       ,
+"  --image"                                                                              ,
+"        Load all the binary code blocks of the tape into a single 64K memory image,"    ,
+"        each one at its start address, and output it as Intel HEX records of the"       ,
+"        loaded ranges (or as a raw 64K image with --raw). Blocks that overwrite others" ,
+"        are reported. If the output is a directory, one FILE.hex is created per tape."  ,
+""                                                                                       ,
 "  -x, --extract"                                                                        ,
 "        Extract all blocks from the .tap file into separate files:"                     ,
 "          - any BASIC program is saved as a .bas untokenized text file."                ,
 "          - any binary code is saved as a Intel HEX (.hex) format."                     ,
+"          - number and character arrays are saved as DIM/DATA (.txt) text files."       ,
 "        The extracted files are placed in a folder named after the original tape file." ,
 ""                                                                                       ,
+"  --raw"                                                                                ,
+"        With -x, save binary code as raw bytes (.bin, or headerless .scr for 6912 byte" ,
+"        screens) copied straight from the tape file, instead of converting it to HEX."  ,
+"        With --image, output the whole 64K memory image as raw bytes."                  ,
+""                                                                                       ,
+"  --tar <file>"                                                                         ,
+"        With -x, write all the extracted files, of all the tapes, to a single tar"      ,
+"        archive instead of creating them ('-' writes the archive to stdout)."           ,
+""                                                                                       ,
+"  --incremental"                                                                        ,
+"        With -x, extract into the folder of the last run (without a numeric suffix)"    ,
+"        and keep a manifest of the files created there. Unchanged tapes are skipped,"   ,
+"        and only the files of the blocks that changed are written again."               ,
+""                                                                                       ,
+"  --verify"                                                                             ,
+"        Check the checksum of every block and report the corrupt ones, followed by"     ,
+"        a pass/fail line for each tape file."                                           ,
+""                                                                                       ,
+"  --robust"                                                                             ,
+"        Don't stop at the first damaged block of a tape, skip the damaged area and"     ,
+"        resume at the next plausible block (a length that fits, a standard flag and"    ,
+"        a matching checksum). --verify reports each area skipped as an error."          ,
+""                                                                                       ,
+"  --max-memory <size>"                                                                  ,
+"        Limit the memory used to index each tape, e.g. 64M (suffixes K, M and G)."      ,
+"        A tape needing more fails with an error, without affecting the others."         ,
+""                                                                                       ,
+"  --cache <size>"                                                                       ,
+"        Keep in memory, up to <size> (e.g. 64M), the output of every BASIC program,"    ,
+"        array and code block, so the identical blocks found in other tapes are written" ,
+"        again without detokenizing or encoding them."                                   ,
+""                                                                                       ,
+"  --cache-dir <dir>"                                                                    ,
+"        Also save the cached output in <dir>, to reuse it in later runs (the memory"    ,
+"        used is 64M unless --cache is given, each version keeps its own entries)."      ,
+""                                                                                       ,
+"  --dedup-store <dir>"                                                                  ,
+"        Save the payload of every data block in <dir>/objects, named after its XXH64"   ,
+"        hash, writing each distinct payload only once (also across runs). A reference"  ,
+"        line per block (hash, size, tape, block, name, stored|duplicate) is appended"   ,
+"        to <dir>/refs.tsv, or written to the file given with -o."                       ,
+""                                                                                       ,
+"  --find-basic <query>"                                                                 ,
+"        Print the lines of the BASIC programs that contain all the terms of <query>,"   ,
+"        in order, as TAPE:PROGRAM:LINE: followed by the line. Terms are keywords"       ,
+"        (USR, GO TO, ...), numbers or ranges (16384-23295) and strings (\"\")"          ,
+"        matched on the tokenized program, e.g. 'LOAD \"\" CODE' or 'POKE 23296-23551'." ,
+""                                                                                       ,
+"  --diff"                                                                               ,
+"        Compare the two tapes given (the old one first) block by block and print the"   ,
+"        blocks removed, added or changed, aligning the blocks that were inserted. Only" ,
+"        the changed blocks are decoded: the header fields that differ, the BASIC lines" ,
+"        that differ, or the ranges of different bytes of code and arrays. The exit"     ,
+"        status is 0 if the tapes have the same blocks, 1 if not and 2 on error."        ,
+""                                                                                       ,
+"  --format=<text|ndjson|binary>"                                                        ,
+"        Format of the block list written by -l/-d: a table (default), one JSON object"  ,
+"        per block and line, or fixed size little-endian records of 32 bytes."           ,
+""                                                                                       ,
+"  -o, --output <path>"                                                                  ,
+"        Send the output of the preceding command to <path> instead of stdout. For -x,"  ,
+"        <path> is the directory where the tape folders are created."                    ,
+"        Commands can be combined; all of them share a single scan of each tape."        ,
+""                                                                                       ,
+"  -i, --index[=hash]"                                                                   ,
+"        Keep the block index of the tape in a FILE.tap.zxidx file next to it, so later" ,
+"        runs on the same tape do not need to parse it again. The index file is rebuilt" ,
+"        whenever the size or modification time of the tape changes; with '=hash' a"     ,
+"        content hash of the tape is also checked."                                      ,
+""                                                                                       ,
+"  -j, --jobs <n>"                                                                       ,
+"        Number of tape files processed in parallel when several files are given"        ,
+"        (default: the number of processors). Tapes larger than 16 MB are also split"    ,
+"        in segments whose blocks are found in parallel."                                ,
+""                                                                                       ,
+"  -, --stdin"                                                                           ,
+"        Read a tape from the standard input, in place of a FILE.tap, e.g. from a pipe." ,
+"        Its blocks are processed as they arrive, nothing is written to disk and its"    ,
+"        files are extracted to a folder named 'stdin' (--incremental is not allowed)."  ,
+"        The tape may also be compressed with gzip."                                     ,
+""                                                                                       ,
+"  --files-from <file>"                                                                  ,
+"        Read the paths of the tape files to process from <file>, one per line."         ,
+"        Use '-' to read them from the standard input."                                  ,
+""                                                                                       ,
+"  --serve"                                                                              ,
+"        Run as a server that answers requests from stdin on stdout, without starting a" ,
+"        process per tape. Each request is a 32-bit little-endian length followed by a"  ,
+"        command line (list, print N|:NAME, basic, code or verify), a newline and the"   ,
+"        tape bytes. Each response is a length and the result as newline delimited JSON.",
+""                                                                                       ,
+"  --serve-socket <path>"                                                                ,
+"        Same as --serve, but answering the clients connected to the Unix domain socket" ,
+"        <path>, each client on its own thread (-j sets the threads indexing the tapes).",
+""                                                                                       ,
+"  --stats[=json]"                                                                       ,
+"        When finished, print to stderr the time spent reading, indexing, detokenizing," ,
+"        encoding HEX and in the filesystem, plus some counters (blocks read, bytes"     ,
+"        written, allocations, files created, ...). Timers add up all the threads."      ,
+""                                                                                       ,
 "  -h, --help"                                                                           ,
 "        Show this help message and exit."                                               ,
 ""                                                                                       ,
@@ -85,12 +220,125 @@ const char* HELP[]    = {
 ""                                                                                       ,
 "  zxtapi -x example.tap"                                                                ,
 "      Extract and convert all blocks from 'example.tap' into separate files."           ,
+""                                                                                       ,
+"  zxtapi -l -o list.txt -b -o loader.bas -x example.tap"                                ,
+"      List, detokenize and extract 'example.tap' in a single run."                      ,
+""                                                                                       ,
+"  zxtapi --verify games/"                                                               ,
+"      Check the integrity of every tape found in the 'games' directory tree."           ,
+""                                                                                       ,
+"  zxtapi -x game.tap.gz"                                                                ,
+"      Extract all blocks of a compressed tape without decompressing it to disk."        ,
+""                                                                                       ,
+"  zxtapi --diff game-v1.tap game-v2.tap"                                                ,
+"      Show the blocks that changed between two versions of a tape."                     ,
+""                                                                                       ,
+"  zxtapi --find-basic 'RANDOMIZE USR' games/"                                           ,
+"      Find the BASIC lines that call machine code in every tape under 'games'."         ,
+""                                                                                       ,
+"  zxtapi -l -j 8 games/"                                                                ,
+"      List the blocks of every tape found in the 'games' directory tree, 8 at a time."  ,
 "", NULL
 };
 
 /* The index of the first header in a TAP file */
 #define FIRST_HEADER_INDEX 1
 
+/* Size of the buffer used to write the machine-readable block lists */
+#define LIST_BUFFER_SIZE OUT_BUF_SIZE
+
+/* Size of each record of the binary block list */
+#define LIST_RECORD_SIZE 32
+
+/* Path that reads the tape from the standard input, and the name the tape is given */
+#define STDIN_PATH "-"
+#define STDIN_NAME "stdin"
+
+/* Name of the manifest file written in the output directory by incremental extractions */
+#define MANIFEST_FILE "zxtapi.manifest"
+
+/* How the persistent index file (FILE.tap.zxidx) is used */
+typedef enum INDEX_MODE {
+    INDEX_MODE_NONE,    /**< Do not use index files, always parse the tape */
+    INDEX_MODE_CACHED,  /**< Use the index file if the tape size and mtime match */
+    INDEX_MODE_HASHED   /**< Like INDEX_MODE_CACHED, also checking the tape content hash */
+} INDEX_MODE;
+
+/* The formats in which the block list can be written */
+typedef enum LIST_FORMAT {
+    LIST_FORMAT_TEXT,   /**< A table meant to be read by people */
+    LIST_FORMAT_NDJSON, /**< One JSON object per block and line */
+    LIST_FORMAT_BINARY  /**< Fixed size little-endian records (see `fwrite_block_list_binary()`) */
+} LIST_FORMAT;
+
+/* The commands available from the command line */
+typedef enum CMD {
+    CMD_HELP, CMD_VERSION, CMD_LIST, CMD_DETAILS, CMD_PRINT, CMD_BASIC, CMD_BINARY, CMD_EXTRACT, CMD_VERIFY, CMD_DEDUP, CMD_FIND_BASIC,
+    CMD_IMAGE
+} CMD;
+
+/**
+ * An output stream, shared by all the actions that write to the same destination
+ */
+typedef struct OutputStream {
+    const char* path;            /**< Path of the output file (NULL for the standard output) */
+    FILE*       file;            /**< The open output file */
+    BOOL        has_header;      /**< TRUE if the "==> FILE.tap <==" line is written to it in batch mode */
+    BOOL        is_archive;      /**< TRUE if it is a tar archive, whose end is written when it's closed */
+} OutputStream;
+
+/**
+ * The state shared by all the tapes extracted to the same tar archive
+ */
+typedef struct TarArchive {
+    Mutex        lock;           /**< Protects `folders` */
+    UniqueNamer  folders;        /**< Names of the tape folders already used in the archive */
+} TarArchive;
+
+/**
+ * A folder where CMD_IMAGE writes the memory image of each tape, shared by all its threads
+ */
+typedef struct ImageFolder {
+    Mutex        lock;           /**< Protects `names` */
+    UniqueNamer  names;          /**< Names of the image files already used in the folder */
+} ImageFolder;
+
+/**
+ * One of the commands given on the command line
+ */
+typedef struct Action {
+    CMD          cmd;            /**< The command to execute */
+    const char*  selected_name;  /**< Name of the block selected with --print (NULL for index selections) */
+    int          selected_index; /**< Index of the block selected with --print (-1 for name selections) */
+    const char*  output_path;    /**< Destination given with --output (for CMD_EXTRACT, the parent directory) */
+    int          stream;         /**< Position in `Command.streams` of the stream the action writes to */
+    LIST_FORMAT  format;         /**< Format of the block list written by CMD_LIST and CMD_DETAILS */
+    BOOL         incremental;    /**< TRUE if CMD_EXTRACT only regenerates the files of the blocks that changed */
+    BOOL         raw;            /**< TRUE if CMD_EXTRACT saves binary code as raw bytes instead of Intel HEX */
+    const char*  tar_path;       /**< Tar archive where CMD_EXTRACT writes the files ("-" for stdout, NULL for none) */
+    TarArchive*  archive;        /**< The open tar archive of `tar_path` */
+    const char*  store_dir;      /**< Directory given with --dedup-store */
+    DedupStore*  store;          /**< The open store where CMD_DEDUP saves the payloads */
+    ZXSBasicQuery* query;        /**< The query of CMD_FIND_BASIC */
+    ImageFolder* images;         /**< The folder where CMD_IMAGE writes the images (NULL to write them to the stream) */
+} Action;
+
+/**
+ * The commands to apply to each tape file, as specified on the command line
+ * 
+ * All the actions are applied to the tape after one single scan of it,
+ * as consumers of the same block index.
+ */
+typedef struct Command {
+    Action*       actions;       /**< The actions to apply, in command line order */
+    int           action_count;  /**< Number of elements in `actions` */
+    OutputStream* streams;       /**< The output streams (the first one is always stdout) */
+    int           stream_count;  /**< Number of elements in `streams` */
+    INDEX_MODE    index_mode;    /**< How the persistent index file is used */
+    BOOL          robust;        /**< TRUE to skip the damaged areas of the tapes instead of stopping there */
+    size_t        max_memory;    /**< Memory budget of each tape in bytes (0 = no limit) */
+} Command;
+
 /**
  * Macro to check the arguments passed by command line
  * @param arg   The argument to compare.
@@ -111,6 +359,21 @@ typedef struct BinaryCode {
     char         data[1];      /**< Flexible array containing the actual binary code data */
 } BinaryCode;
 
+/* Size of the address space of the ZX Spectrum */
+#define ZX_MEMORY_SIZE 65536
+
+/**
+ * The 64K address space of the ZX Spectrum, where the binary code blocks of a tape are loaded
+ */
+typedef struct MemoryImage {
+    BYTE         data[ZX_MEMORY_SIZE];        /**< The contents of the memory (0 where nothing was loaded) */
+    BYTE         loaded[ZX_MEMORY_SIZE / 8];  /**< Bitmap of the addresses where a block was loaded */
+    int          block_count;                 /**< Number of blocks loaded */
+} MemoryImage;
+
+/* Checks whether a block was loaded at an address of a MemoryImage */
+#define IMAGE_IS_LOADED(image, address) (((image)->loaded[(address) >> 3] >> ((address) & 7)) & 1)
+
 
 const char *get_selected_name(const char* print_param) {
     if( !print_param ) { return ""; }
@@ -158,9 +421,13 @@ void print_colored_error(const char *err_type,
                          const char *bra_color,
                          const char *tex_color,
                          const char *format, va_list vlist) {
-    fprintf (stderr, "\n%s[%s%s%s]%s ", bra_color, err_color, err_type, bra_color, tex_color);
-    vfprintf(stderr, format, vlist);
-    fprintf (stderr, "\n");
+    char message[1024]; int length;
+
+    /* the message is written with a single call, so messages from different threads don't mix */
+    length = sprintf(message, "\n%s[%s%s%s]%s ", bra_color, err_color, err_type, bra_color, tex_color);
+    vsnprintf(message + length, sizeof(message) - length - 1, format, vlist);
+    strcat(message, "\n");
+    fputs(message, stderr);
 }
 
 /**
@@ -215,6 +482,203 @@ void print_help(int argc, char *argv[]) {
 }
 
 
+/*----------------------------- MEMORY BUDGET ------------------------------*/
+
+/**
+ * A limit on the memory allocated for one tape (its block index and buffers)
+ * 
+ * It is installed as the allocator of the tape, so a damaged tape with a
+ * huge number of blocks makes its own indexing fail instead of exhausting
+ * the memory shared by all the tapes processed in parallel.
+ */
+typedef struct MemoryBudget {
+    ZXSAllocator allocator;      /**< The allocator hooks, `allocator.user` points to the budget itself */
+    Mutex        lock;           /**< Protects `used` and `exceeded`, segments of a tape are indexed in parallel */
+    size_t       limit;          /**< Maximum number of bytes allocated at the same time */
+    size_t       used;           /**< Number of bytes allocated now */
+    BOOL         exceeded;       /**< TRUE if an allocation was refused because of the limit */
+} MemoryBudget;
+
+/* The size of each allocation of a budget, stored right before it (the union keeps it aligned) */
+typedef union BudgetHeader { size_t size; double align_double; void* align_pointer; } BudgetHeader;
+
+void* _budget_realloc(void* user, void* ptr, size_t size) {
+    MemoryBudget* budget = (MemoryBudget*)user;
+    BudgetHeader* header = ptr ? (BudgetHeader*)ptr - 1 : NULL;
+    size_t old_size      = header ? header->size : 0;
+    BOOL   allowed;
+
+    /* the bytes are reserved first, so concurrent allocations can't overrun the limit together */
+    mutex_lock(&budget->lock);
+    allowed = size <= old_size || size - old_size <= budget->limit - budget->used;
+    if( allowed ) { budget->used = budget->used - old_size + size; } else { budget->exceeded = TRUE; }
+    mutex_unlock(&budget->lock);
+    if( !allowed ) { return NULL; }
+
+    header = (BudgetHeader*)realloc(header, sizeof(BudgetHeader) + size);
+    if( !header ) {
+        mutex_lock(&budget->lock); budget->used = budget->used - size + old_size; mutex_unlock(&budget->lock);
+        return NULL;
+    }
+    header->size = size;
+    return header + 1;
+}
+
+void _budget_free(void* user, void* ptr) {
+    MemoryBudget* budget = (MemoryBudget*)user;
+    BudgetHeader* header = (BudgetHeader*)ptr - 1;
+    mutex_lock(&budget->lock);
+    budget->used -= header->size;
+    mutex_unlock(&budget->lock);
+    free(header);
+}
+
+/**
+ * Initializes a memory budget.
+ * @param budget  The MemoryBudget structure to initialize (release it with `free_memory_budget()`).
+ * @param limit   Maximum number of bytes that can be allocated through it at the same time.
+ * @return The allocator to install in a tape, or NULL if `limit` is 0 (no limit, the C library is used).
+ */
+const ZXSAllocator* init_memory_budget(MemoryBudget* budget, size_t limit) {
+    memset(budget, 0, sizeof(MemoryBudget));
+    budget->allocator.realloc_fn = _budget_realloc;
+    budget->allocator.free_fn    = _budget_free;
+    budget->allocator.user       = budget;
+    budget->limit                = limit;
+    mutex_init(&budget->lock);
+    return limit > 0 ? &budget->allocator : NULL;
+}
+
+/**
+ * Releases the resources of a memory budget, once everything allocated through it is freed.
+ * @param budget  The MemoryBudget to release.
+ */
+void free_memory_budget(MemoryBudget* budget) {
+    mutex_destroy(&budget->lock);
+}
+
+/**
+ * Parses a memory size given on the command line, e.g. "512K", "64M" or "1G".
+ * @param text  The size, a number of bytes optionally followed by K, M or G.
+ * @param size  Where the number of bytes is stored.
+ * @return TRUE on success, FALSE if `text` is not a valid size.
+ */
+BOOL parse_memory_size(const char* text, size_t* size) {
+    char* end; unsigned long value; int shift = 0;
+
+    /* strtoul() would accept spaces and a sign, wrapping a negative size around */
+    if( *text < '0' || *text > '9' ) { return FALSE; }
+    errno = 0;
+    value = strtoul(text, &end, 10);
+    if( end == text || errno == ERANGE ) { return FALSE; }
+    switch( *end ) {
+        case 'K': case 'k': shift = 10; ++end; break;
+        case 'M': case 'm': shift = 20; ++end; break;
+        case 'G': case 'g': shift = 30; ++end; break;
+        default: break;
+    }
+    if( *end != '\0' || value == 0 || value > ((size_t)-1 >> shift) ) { return FALSE; }
+    *size = (size_t)value << shift;
+    return TRUE;
+}
+
+/**
+ * Reports why the block index of a tape could not be built.
+ * @param tape       The tape, its allocator (if any) is a MemoryBudget.
+ * @param tape_path  The path of the tape file.
+ */
+void error_indexing_tape(const ZXSTape* tape, const char* tape_path) {
+    const MemoryBudget* budget = tape->allocator ? (const MemoryBudget*)tape->allocator->user : NULL;
+    if( budget && budget->exceeded ) {
+        error("Indexing file '%s' exceeds the memory budget of %lu bytes", tape_path, (unsigned long)budget->limit);
+    } else {
+        error("Not enough memory to index file '%s'", tape_path);
+    }
+}
+
+/*------------------------------ RENDER CACHE ------------------------------*/
+
+/** The cache of rendered payloads shared by all the tapes of the run (NULL when disabled) */
+RenderCache* render_cache = NULL;
+
+/**
+ * Renders the payload of a data block into an output buffer, in the format given by its header.
+ * @param out     The output buffer where the text is written.
+ * @param header  The header of the block, its type must be one of the known ones.
+ * @param block   The data block following the header.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int write_zx_tap_data(OutBuf* out, const ZXSHeader* header, const ZXSTapBlock* block) {
+    long long timer = stats_start_timer();
+    int err_code;
+    switch( header->datatype ) {
+        case ZXS_DATATYPE_BASIC:
+            err_code = zxs_write_basic_program(out, block->data, block->datasize);
+            stats_end_timer(STATS_TIME_BASIC, timer);
+            break;
+        case ZXS_DATATYPE_NUMBERS:
+            err_code = zxs_write_number_array(out, header->param1, block->data, block->datasize);
+            break;
+        case ZXS_DATATYPE_STRINGS:
+            err_code = zxs_write_string_array(out, header->param1, block->data, block->datasize);
+            break;
+        default:
+            err_code = write_hex_data(out, header->param1, block->data, block->datasize);
+            stats_end_timer(STATS_TIME_HEX, timer);
+            break;
+    }
+    return err_code;
+}
+
+/**
+ * Prints the payload of a data block, reusing the output rendered for an identical payload.
+ * 
+ * The payload is looked up by its hash, its size and its format: the type of
+ * block and the parameter that is part of the output (the address of the HEX records or
+ * the name of the arrays; the autostart line is not, so the loaders that only
+ * differ on it are shared). On a miss the text is rendered in memory and, if
+ * it fits in a cache entry, added to the cache before being written.
+ * 
+ * @param output  FILE pointer to the output file where data will be printed.
+ * @param cache   The render cache.
+ * @param header  The header of the block, its type must be one of the known ones.
+ * @param block   The data block following the header.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int fprint_cached_zx_tap_data(FILE* output, RenderCache* cache, const ZXSHeader* header, const ZXSTapBlock* block) {
+    char fallback[16*1024]; char *memory; size_t memory_size;
+    const RenderEntry* entry;
+    unsigned long long hash;
+    unsigned long format;
+    OutBuf out;
+    int err_code;
+
+    hash   = hash64(block->data, block->datasize, 0);
+    format = (unsigned long)header->datatype << 16 | (header->datatype == ZXS_DATATYPE_BASIC ? 0 : header->param1);
+    entry  = render_cache_find(cache, hash, (unsigned long)block->datasize, format);
+    if( entry ) {
+        err_code = fwrite(entry->text, 1, entry->length, output) != entry->length ? ZXS_ERR_OUTPUT : 0;
+        STATS_ADD(STATS_OUTPUT_BYTES, entry->length);
+        render_cache_release(cache, entry);
+        return err_code;
+    }
+    /* the text is kept in memory while it fits, the same way as fprint_hex_data(), */
+    /* the listings rarely grow beyond 8 times the size of their payload           */
+    memory_size = (size_t)block->datasize * 8 + 1024;
+    if( memory_size > cache->max_entry ) { memory_size = cache->max_entry; }
+    memory = (char*)malloc(memory_size);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( memory == NULL ) { memory = fallback; memory_size = sizeof(fallback); }
+    out_buf_init(&out, output, memory, memory_size);
+    err_code = write_zx_tap_data(&out, header, block);
+    if( !err_code && out.flushed == 0 ) { render_cache_add(cache, hash, (unsigned long)block->datasize, format, out.data, out.length); }
+    if( out_buf_flush(&out) && !err_code ) { err_code = ZXS_ERR_OUTPUT; }
+    if( memory != fallback ) { free(memory); }
+    return err_code;
+}
+
 /*---------------------- BLOCK HEADER/DATA FUNCTIONS ----------------------*/
 
 /**
@@ -223,76 +687,76 @@ void print_help(int argc, char *argv[]) {
  * The criteria can be based on name, index, or header type. If multiple criteria are provided,
  * the function prioritizes name checks first, then index checks.
  * 
- * @param header    Pointer to the ZXHeaderInfo where the matched header will be stored. 
- * @param tap_file  FILE pointer to the TAP file being processed.
- * @param name      Optional block name to match. If NULL, name-based filtering is skipped.
- * @param index     Optional block index to match. If -1, index-based filtering is skipped.
- * @param type      Header type to match. This parameter is only used if both name and index are omitted.
+ * @param index         Pointer to the block index of the TAP file being processed.
+ * @param name          Optional block name to match. If NULL, name-based filtering is skipped.
+ * @param header_index  Optional header index to match. If -1, index-based filtering is skipped.
+ * @param type          Header type to match. This parameter is only used if both name and index are omitted.
  * @return
- *    TRUE if a matching header is found, FALSE otherwise.
+ *    The position of the matching header within the index entries, or -1 if no header matches.
  */
-BOOL find_zx_tap_header(ZXSHeader* header, FILE* tap_file, const char* name, int index, ZXS_DATATYPE type) {
-    ZXSTapBlock *block;
-    int          header_index;
-    BOOL is_block_valid, found;
+int find_zx_tap_header(const ZXSTapIndex* index, const char* name, int header_index, ZXS_DATATYPE type) {
+    const ZXSHeader *header;
+    int i, position = -1;
 
-    /* loop through all TAP blocks until the target header is found */
-    header_index   = FIRST_HEADER_INDEX;
-    is_block_valid = TRUE; found = FALSE;
-    while( is_block_valid && !found )
-    {
-        /* read next block from TAP file */
-        block           = zxs_read_tap_block(tap_file);
-        is_block_valid  = (block != NULL);
-        if( is_block_valid && zxs_parse_header(header, block) ) {
-            /* check if the current header matches the selected criteria */
-            if( !found && name     ) { found = (0==strcmp(header->filename, name)); }
-            if( !found && index>=0 ) { found = (header_index == index); }
-            if( !name && index<0   ) {
-                if( type == ZXS_DATATYPE_ANY ) { found = TRUE; }
-                else                           { found = (header->datatype == type ); }
-            }
-            ++header_index;
+    /* name and index lookups are resolved directly by the block index */
+    if( position<0 && name ) {
+        position = zxs_index_find_name(index, name);
+    }
+    if( position<0 && header_index>=0 ) {
+        i = header_index - FIRST_HEADER_INDEX;
+        position = (0 <= i && i < index->header_count) ? i : -1;
+    }
+    /* without name and index, look for the first header of the requested type */
+    if( !name && header_index<0 ) {
+        for( i = 0 ; position<0 && i < index->header_count ; ++i ) {
+            header = &index->entries[ index->headers[i] ].header;
+            if( type == ZXS_DATATYPE_ANY || header->datatype == type ) { position = i; }
         }
-        free( block ); block = NULL;
     }
-    return found;
+    return position>=0 ? index->headers[position] : -1;
 }
 
 /**
  * Prints data from a ZX TAP file block based on the header's data type.
  * 
- * This function reads the next data block in the TAP file and prints its
- * contents to the specified output. The function assumes the provided header
- * is valid and corresponds to the data block to be printed.
+ * This function prints the contents of the data block that follows a header
+ * to the specified output. The function assumes the provided header is valid
+ * and corresponds to the data block to be printed.
  * 
  * @param output     FILE pointer to the output file where data will be printed. (may be stdout)
- * @param tap_file   FILE pointer to the TAP file being processed.
  * @param header     Pointer to a ZXSHeader containing the block header information.
+ * @param block      Pointer to the data block following the header. (NULL if there is no data block)
  * @return
  *    0 on success, or an error code indicating what went wrong
  */
-int fprint_zx_tap_data(FILE* output, FILE* tap_file, const ZXSHeader* header) {
-    ZXSTapBlock *block;
+int fprint_zx_tap_data(FILE* output, const ZXSHeader* header, const ZXSTapBlock* block) {
     int err_code = 0;
 
-    /* read the data block, assuming that the header has already been read */
-    block = zxs_read_tap_block(tap_file);
-    switch( header->datatype ) {
+    /* the payloads already rendered in this run (or a previous one) come from the cache */
+    if( render_cache && block && header->datatype <= ZXS_DATATYPE_CODE ) {
+        err_code = fprint_cached_zx_tap_data(output, render_cache, header, block);
+    }
+    else switch( header->datatype ) {
 
         case ZXS_DATATYPE_BASIC:
             if( !err_code && block==NULL )
             { err_code = 1; error("Error reading BASIC program, no data block found"); }
             if( !err_code )
-            { err_code = !err_code && zxs_fprint_basic_program(output, block->data, block->datasize); }
+            { err_code = zxs_fprint_basic_program(output, block->data, block->datasize); }
             break;
 
         case ZXS_DATATYPE_NUMBERS:
-            err_code = 1; error("Number array blocks are not supported yet.");
+            if( !err_code && block==NULL )
+            { err_code = 1; error("Error reading number array, no data block found"); }
+            if( !err_code )
+            { err_code = zxs_fprint_number_array(output, header->param1, block->data, block->datasize); }
             break;
 
         case ZXS_DATATYPE_STRINGS:
-            err_code = 1; error("String array blocks are not supported yet.");
+            if( !err_code && block==NULL )
+            { err_code = 1; error("Error reading string array, no data block found"); }
+            if( !err_code )
+            { err_code = zxs_fprint_string_array(output, header->param1, block->data, block->datasize); }
             break;
 
         case ZXS_DATATYPE_CODE:
@@ -306,65 +770,360 @@ int fprint_zx_tap_data(FILE* output, FILE* tap_file, const ZXSHeader* header) {
             err_code = 1; error("Unknown data type in header (%d).", header->datatype);
             break;
     }
-    /* free the data block and return */
-    free(block);
+    /* the decoders only return the reason, the message is reported here */
+    if( err_code > ZXS_ERR_OUTPUT ) { error("%s", zxs_get_error_message(err_code)); }
     return err_code;
 }
 
-/*------------------------------ SUB-COMMANDS ------------------------------*/
+/**
+ * Prints the data block that follows a header of the block index.
+ * @param output    FILE pointer to the output file where data will be printed.
+ * @param index     Pointer to the block index of the TAP file being processed.
+ * @param position  The position of the header within the index entries.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int fprint_zx_indexed_data(FILE* output, const ZXSTapIndex* index, int position) {
+    ZXSTapBlock data_block, *block;
+    assert( index->entries[position].is_header );
+
+    /* the data block is the one immediately after the header,    */
+    /* its payload is only materialised here, when it is printed */
+    block = zxs_index_block(index, position+1, &data_block) ? &data_block : NULL;
+    if( block && !zxs_load_block_data(index->tape, block) ) {
+        error("Cannot read the data block at offset %lu", (unsigned long)block->offset);
+        return 1;
+    }
+    return fprint_zx_tap_data(output, &index->entries[position].header, block);
+}
+
+/* Minimum size of the segments of a tape that are indexed in parallel */
+#define SEGMENT_MIN_SIZE (8 << 20)
 
 /**
- * Prints a formatted list of all TAP blocks in a TAP file.
- * @param output    FILE pointer to the output stream where the block list will be printed.
- * @param tap_file  FILE pointer to the TAP file being processed.
+ * Scans a tape segment as a thread pool task.
+ * @param arg Pointer to the ZXSTapSegment to scan.
+ */
+void run_segment_job(void* arg) {
+    zxs_scan_segment((ZXSTapSegment*)arg);
+}
+
+/**
+ * Builds the block index of a tape, splitting it in segments that are scanned in parallel.
+ * 
+ * Only tapes in memory of several SEGMENT_MIN_SIZE bytes are split, in up
+ * to one segment per thread, the others are scanned sequentially.
+ * Either way the result is the same as with `zxs_build_index()`.
+ * 
+ * @param[out] index  The ZXSTapIndex structure to fill in (release it with `zxs_free_index()`).
+ * @param[in]  tape   The tape to index.
+ * @param[in]  pool   Thread pool used to scan the segments in parallel. (may be NULL)
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+BOOL build_tape_index(ZXSTapIndex* index, ZXSTape* tape, ThreadPool* pool) {
+    ZXSTapSegment* segments; TaskGroup group;
+    size_t segment_size;
+    int i, segment_count;
+    BOOL success;
+
+    segment_count = pool ? pool->thread_count + 1 : 1;
+    if( tape->size / SEGMENT_MIN_SIZE < (size_t)segment_count ) { segment_count = (int)(tape->size / SEGMENT_MIN_SIZE); }
+    if( segment_count < 2 || tape->file || tape->window ) { return zxs_build_index(index, tape); }
+
+    segments = (ZXSTapSegment*)calloc(segment_count, sizeof(ZXSTapSegment));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !segments ) { return FALSE; }
+    segment_size  = tape->size / segment_count;
+    group.pending = 0;
+    for( i = 0 ; i < segment_count ; ++i ) {
+        segments[i].tape  = tape;
+        segments[i].start = i * segment_size;
+        segments[i].end   = i == segment_count - 1 ? tape->size : (i + 1) * segment_size;
+        thread_pool_submit(pool, &group, run_segment_job, &segments[i]);
+    }
+    thread_pool_wait(pool, &group);
+    success = zxs_merge_segments(index, segments, segment_count);
+    for( i = 0 ; i < segment_count ; ++i ) { zxs_free_index(&segments[i].index); }
+    free(segments);
+    return success;
+}
+
+/**
+ * Gets the block index of a tape, using the persistent index file if requested.
+ * 
+ * When the index file is enabled and it is up to date, the index is loaded
+ * from it without parsing the tape, otherwise the tape is parsed and the
+ * index file is (re)written for future runs.
+ * 
+ * @param[out] index       The ZXSTapIndex structure to fill in.
+ * @param[in]  tape        The tape to index.
+ * @param[in]  tape_path   The path of the tape file.
+ * @param[in]  index_mode  How the persistent index file is used.
+ * @param[in]  pool        Thread pool used to parse large tapes in parallel. (may be NULL)
  * @return
  *    0 on success, or an error code indicating what went wrong
  */
-int fprint_block_list(FILE* output, FILE* tap_file) {
-    ZXSTapBlock *block;
-    ZXSHeader    header;
-    int          header_index, block_index;
-    BOOL         is_block_valid;
+int get_tape_index(ZXSTapIndex* index, ZXSTape* tape, const char* tape_path, INDEX_MODE index_mode, ThreadPool* pool) {
+    ZXSIndexKey key; FileInfo info;
+    char *index_path;
+    BOOL  loaded;
+
+    if( index_mode == INDEX_MODE_NONE || !get_file_info(tape_path, &info) ) {
+        if( build_tape_index(index, tape, pool) ) { return 0; }
+        error_indexing_tape(tape, tape_path); return 1;
+    }
+    key.tape_size  = info.size;
+    key.tape_mtime = info.mtime;
+    key.tape_hash  = index_mode == INDEX_MODE_HASHED && tape->data ? zxs_tape_hash(tape->data, tape->size) : 0;
+    index_path     = zxs_alloc_index_path(tape_path);
+    loaded         = zxs_load_index(index, tape, &key, index_path);
+    if( !loaded ) {
+        if( !build_tape_index(index, tape, pool) )
+        { error_indexing_tape(tape, tape_path); free(index_path); return 1; }
+        if( !zxs_save_index(index, &key, index_path) )
+        { warning("Cannot write index file '%s'", index_path); }
+    }
+    free(index_path);
+    return 0;
+}
+
+/*------------------------------ SUB-COMMANDS ------------------------------*/
+
+/* Lines of the table printed by the block list */
+static const char LIST_THEADER[]=" IDX | name       | type          | Length | Param1 | Param2 |\n";
+static const char LIST_TLINE[]  ="-----|------------|---------------|--------|--------|--------|\n";
+static const BOOL LIST_PADDING  = TRUE;
+
+/**
+ * Writes the line of one block in the formatted list of TAP blocks.
+ * @param buf           The output buffer.
+ * @param entry         The block to write.
+ * @param header_index  The index of the next header, updated when `entry` is a header.
+ * @param block_index   The index of the next data block after the last header.
+ */
+void write_block_list_entry(OutBuf* buf, const ZXSIndexEntry* entry, int* header_index, int* block_index) {
+    const ZXSHeader *header;
     char buffer20[20];
     char datatype_name_buffer[32];
-    int  err_code = 0;
-    static const char THEADER[]=" IDX | name       | type          | Length | Param1 | Param2 |\n";
-    static const char TLINE[]  ="-----|------------|---------------|--------|--------|--------|\n";
-    static const BOOL padding = TRUE;
+
+    if( entry->is_header )
+    {
+        header = &entry->header;
+        if( *header_index != FIRST_HEADER_INDEX ) { out_buf_write(buf, LIST_TLINE, sizeof(LIST_TLINE) - 1); }
+        out_buf_putc(buf, ' ');
+        out_buf_put_uint(buf, (unsigned)*header_index, 3);
+        out_buf_write(buf, "  :", 3);
+        out_buf_put_string(buf, header->filename, 12); out_buf_putc(buf, ' ');
+        out_buf_put_string(buf, zxs_get_datatype_name(header->datatype, datatype_name_buffer), 15);
+        out_buf_putc(buf, ' ');
+        out_buf_put_uint(buf, header->length, 6); out_buf_write(buf, "   ", 3);
+        out_buf_put_uint(buf, header->param1, 6); out_buf_write(buf, "   ", 3);
+        out_buf_put_uint(buf, header->param2, 6); out_buf_putc(buf, '\n');
+        ++*header_index; *block_index=0;
+    }
+    else {
+        sprintf(buffer20, "\\data%d", *block_index);
+        out_buf_write(buf, "                    ", 20);
+        out_buf_put_string(buf, buffer20, 15); out_buf_putc(buf, ' ');
+        out_buf_put_uint(buf, entry->datasize, 6); out_buf_putc(buf, '\n');
+    }
+}
+
+/**
+ * Writes a formatted list of all TAP blocks in a TAP file (see `fprint_block_list()`).
+ * @param buf       The output buffer.
+ * @param index     Pointer to the block index of the TAP file being processed.
+ */
+void write_block_list(OutBuf* buf, const ZXSTapIndex* index) {
+    int header_index, block_index, i;
 
     /* loop through all TAP blocks */
     header_index   = FIRST_HEADER_INDEX;
     block_index    = 0;
-    is_block_valid = TRUE;
-    fprintf(output, "%s%s%s", padding ? "\n" : "", THEADER, TLINE);
-    while( is_block_valid )
-    {
-        /* read next block from TAP file */
-        block           = zxs_read_tap_block(tap_file);
-        is_block_valid  = (block != NULL);
-        if( is_block_valid ) {
-            if( zxs_parse_header(&header, block) )
-            {
-                if( header_index != FIRST_HEADER_INDEX ) { fprintf(output, TLINE); }
-                sprintf(buffer20, "\":%s\"", header.filename);
-                fprintf(output, " %3d  :%-12s %-15s %6d   %6d   %6d\n",
-                       header_index, header.filename,
-                       zxs_get_datatype_name(header.datatype, datatype_name_buffer),
-                       header.length, header.param1, header.param2
-                       );
-                ++header_index; block_index=0;
-            }
-            else {
-                sprintf(buffer20, "\\data%d", block_index);
-                fprintf(output, "       %-12s %-15s %6d\n", 
-                       "", buffer20, block->datasize
-                       );
-            }
-        }
-        free( block ); block = NULL;
+    if( LIST_PADDING ) { out_buf_putc(buf, '\n'); }
+    out_buf_write(buf, LIST_THEADER, sizeof(LIST_THEADER) - 1);
+    out_buf_write(buf, LIST_TLINE  , sizeof(LIST_TLINE)   - 1);
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        write_block_list_entry(buf, &index->entries[i], &header_index, &block_index);
     }
-    fprintf(output, "%s%s", TLINE, padding ?  "\n" : "");
-    return err_code;
+    out_buf_write(buf, LIST_TLINE, sizeof(LIST_TLINE) - 1);
+    if( LIST_PADDING ) { out_buf_putc(buf, '\n'); }
+}
+
+/**
+ * Prints a formatted list of all TAP blocks in a TAP file.
+ * @param output    FILE pointer to the output stream where the block list will be printed.
+ * @param index     Pointer to the block index of the TAP file being processed.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int fprint_block_list(FILE* output, const ZXSTapIndex* index) {
+    char memory[LIST_BUFFER_SIZE];
+    OutBuf buf;
+
+    out_buf_init(&buf, output, memory, sizeof(memory));
+    write_block_list(&buf, index);
+    return out_buf_flush(&buf);
+}
+
+/**
+ * Checks the checksum of a block of the index.
+ * @param index     Pointer to the block index of the TAP file.
+ * @param position  Position of the block in the index.
+ * @return TRUE if the payload of the block could be read and its checksum matches.
+ */
+BOOL is_checksum_ok(const ZXSTapIndex* index, int position) {
+    ZXSTapBlock block;
+    if( !zxs_index_block(index, position, &block) || !zxs_load_block_data(index->tape, &block) ) { return FALSE; }
+    return zxs_calc_block_checksum(&block) == block.checksum;
+}
+
+/**
+ * Writes the JSON object of one block of the block list (see `fprint_block_list_ndjson()`).
+ * @param buf       The output buffer.
+ * @param index     Pointer to the block index of the TAP file being processed.
+ * @param position  Position of the block in the index.
+ * @param filename  The path of the TAP file, written in the object.
+ */
+void write_block_list_ndjson_entry(OutBuf* buf, const ZXSTapIndex* index, int position, const char* filename) {
+    const ZXSIndexEntry *entry = &index->entries[position];
+    const ZXSHeader     *header;
+    static const char NO_HEADER[] = ",\"datatype\":null,\"filename\":null,\"length\":null,\"param1\":null,\"param2\":null}\n";
+
+    out_buf_write(buf, "{\"file\":", 8);
+    out_buf_put_json_string(buf, filename, strlen(filename));
+    out_buf_write(buf, ",\"index\":"   , 9); out_buf_put_uint(buf, (unsigned)position + 1, 0);
+    out_buf_write(buf, ",\"offset\":"  , 10); out_buf_put_uint(buf, (unsigned)entry->offset, 0);
+    out_buf_write(buf, ",\"flag\":"    , 8); out_buf_put_uint(buf, entry->type, 0);
+    out_buf_write(buf, ",\"datasize\":", 12); out_buf_put_uint(buf, entry->datasize, 0);
+    if( is_checksum_ok(index, position) ) { out_buf_write(buf, ",\"checksum_ok\":true" , 19); }
+    else                                  { out_buf_write(buf, ",\"checksum_ok\":false", 20); }
+    if( entry->is_header ) {
+        header = &entry->header;
+        out_buf_write(buf, ",\"datatype\":", 12); out_buf_put_uint(buf, header->datatype, 0);
+        out_buf_write(buf, ",\"filename\":", 12);
+        out_buf_put_json_string(buf, header->filename, strlen(header->filename));
+        out_buf_write(buf, ",\"length\":"  , 10); out_buf_put_uint(buf, header->length, 0);
+        out_buf_write(buf, ",\"param1\":"  , 10); out_buf_put_uint(buf, header->param1, 0);
+        out_buf_write(buf, ",\"param2\":"  , 10); out_buf_put_uint(buf, header->param2, 0);
+        out_buf_write(buf, "}\n", 2);
+    }
+    else {
+        out_buf_write(buf, NO_HEADER, sizeof(NO_HEADER) - 1);
+    }
+}
+
+/**
+ * Writes the list of all TAP blocks in a TAP file as newline delimited JSON.
+ * 
+ * Each line is one object with the keys: file, index, offset, flag, datasize,
+ * checksum_ok, datatype, filename, length, param1 and param2; the last five
+ * are null for the blocks that are not headers.
+ * 
+ * @param output    FILE pointer to the output stream where the block list will be written.
+ * @param index     Pointer to the block index of the TAP file being processed.
+ * @param filename  The path of the TAP file, written in every object.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int fprint_block_list_ndjson(FILE* output, const ZXSTapIndex* index, const char* filename) {
+    char memory[LIST_BUFFER_SIZE];
+    OutBuf buf;
+    int i;
+
+    out_buf_init(&buf, output, memory, sizeof(memory));
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        write_block_list_ndjson_entry(&buf, index, i, filename);
+    }
+    return out_buf_flush(&buf);
+}
+
+
+/**
+ * Writes the head of the binary block list (see `fwrite_block_list_binary()`).
+ * @param buf          The output buffer.
+ * @param block_count  Number of records in the list.
+ * @param filename     The path of the TAP file, written after the head.
+ */
+void write_block_list_binary_head(OutBuf* buf, int block_count, const char* filename) {
+    BYTE head[16];
+    size_t filename_length = strlen(filename);
+    memcpy(head, "ZXTB", 4);
+    SET_LE_WORD (head,  4, 1);
+    SET_LE_WORD (head,  6, LIST_RECORD_SIZE);
+    SET_LE_DWORD(head,  8, (unsigned)block_count);
+    SET_LE_DWORD(head, 12, (unsigned)filename_length);
+    out_buf_write(buf, (const char*)head, sizeof(head));
+    out_buf_write(buf, filename, filename_length);
+}
+
+/**
+ * Builds the record of one block of the binary block list (see `fwrite_block_list_binary()`).
+ * @param[out] record    Buffer of LIST_RECORD_SIZE bytes where the record is built.
+ * @param[in]  index     Pointer to the block index of the TAP file being processed.
+ * @param[in]  position  Position of the block in the index.
+ */
+void build_block_list_record(BYTE* record, const ZXSTapIndex* index, int position) {
+    const ZXSIndexEntry *entry = &index->entries[position];
+    memset(record, 0, LIST_RECORD_SIZE);
+    SET_LE_DWORD(record, 0, (unsigned)position + 1);
+    SET_LE_DWORD(record, 4, (unsigned)entry->offset);
+    SET_LE_DWORD(record, 8, entry->datasize);
+    record[12] = (BYTE)entry->type;
+    record[13] = entry->is_header ? (BYTE)entry->header.datatype : 0xFF;
+    record[14] = (BYTE)((entry->is_header ? 1 : 0) | (is_checksum_ok(index, position) ? 2 : 0));
+    record[15] = (BYTE)entry->checksum;
+    if( entry->is_header ) {
+        memcpy(&record[16], entry->header.filename, 10);
+        SET_LE_WORD(record, 26, entry->header.length);
+        SET_LE_WORD(record, 28, entry->header.param1);
+        SET_LE_WORD(record, 30, entry->header.param2);
+    }
+}
+
+/**
+ * Writes the list of all TAP blocks in a TAP file as fixed size binary records.
+ * 
+ * All the values are little-endian. The list starts with a 16 byte head
+ * followed by the path of the TAP file (not null-terminated):
+ *     0  "ZXTB"       magic
+ *     4  u16          version (1)
+ *     6  u16          size of each record (32)
+ *     8  u32          number of records
+ *    12  u32          length of the path
+ * 
+ * Then there is one record per block:
+ *     0  u32          index of the block in the tape (1 = first block)
+ *     4  u32          offset of the block within the tape
+ *     8  u32          size of the block data
+ *    12  u8           flag byte
+ *    13  u8           datatype (0xFF if the block is not a header)
+ *    14  u8           bit 0: the block is a header, bit 1: the checksum is ok
+ *    15  u8           checksum stored in the tape
+ *    16  char[10]     filename, padded with zeros (all zeros if not a header)
+ *    26  u16          length    (0 if not a header)
+ *    28  u16          param1    (0 if not a header)
+ *    30  u16          param2    (0 if not a header)
+ * 
+ * @param output    FILE pointer to the output stream where the block list will be written.
+ * @param index     Pointer to the block index of the TAP file being processed.
+ * @param filename  The path of the TAP file, written after the head.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int fwrite_block_list_binary(FILE* output, const ZXSTapIndex* index, const char* filename) {
+    BYTE record[LIST_RECORD_SIZE];
+    char memory[LIST_BUFFER_SIZE];
+    OutBuf buf;
+    int i;
+
+    out_buf_init(&buf, output, memory, sizeof(memory));
+    write_block_list_binary_head(&buf, index->entry_count, filename);
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        build_block_list_record(record, index, i);
+        out_buf_write(&buf, (const char*)record, sizeof(record));
+    }
+    return out_buf_flush(&buf);
 }
 
 /**
@@ -375,27 +1134,27 @@ int fprint_block_list(FILE* output, FILE* tap_file) {
  * such as missing blocks or invalid block types.
  * 
  * @param output         File pointer to the output file where the BASIC program will be printed.
- * @param tap_file       File pointer to the TAP file containing the ZX Spectrum data.
+ * @param index          Pointer to the block index of the TAP file containing the ZX Spectrum data.
  * @param selected_name  Optional block name to match. If NULL, name-based filtering is skipped.
  * @param selected_idx   Optional block index to match. If -1, index-based filtering is skipped.
  * @return
  *    0 on success, or an error code indicating what went wrong
  */
-int fprint_zx_basic_program(FILE* output, FILE* tap_file, const char* selected_name, int selected_idx) {
-    ZXSHeader header; BOOL found;
+int fprint_zx_basic_program(FILE* output, const ZXSTapIndex* index, const char* selected_name, int selected_idx) {
+    int position;
     int err_code = 0;
 
     /* search for the selected BASIC program header in the TAP file */
-    found = find_zx_tap_header(&header, tap_file, selected_name, selected_idx, ZXS_DATATYPE_BASIC);
+    position = find_zx_tap_header(index, selected_name, selected_idx, ZXS_DATATYPE_BASIC);
 
     /* handle error cases */
-    if( !found  )
+    if( position<0 )
     { error("No BASIC program found"); return err_code=1; }
-    if( found && header.datatype!=ZXS_DATATYPE_BASIC )
+    if( index->entries[position].header.datatype!=ZXS_DATATYPE_BASIC )
     { error("Selected block is not a BASIC program"); return err_code=1; }
 
     /* print the actual BASIC program */
-    err_code = fprint_zx_tap_data(output, tap_file, &header);
+    err_code = fprint_zx_indexed_data(output, index, position);
     return err_code;
 }
 
@@ -406,27 +1165,27 @@ int fprint_zx_basic_program(FILE* output, FILE* tap_file, const char* selected_n
  * the content in Intel HEX format. It supports optional filtering by filename or index.
  * 
  * @param output         File pointer to the output file where the binary data will be printed.
- * @param tap_file       File pointer to the TAP file containing the ZX Spectrum data.
+ * @param index          Pointer to the block index of the TAP file containing the ZX Spectrum data.
  * @param selected_name  Optional block name to match. If NULL, name-based filtering is skipped.
  * @param selected_idx   Optional block index to match. If -1, index-based filtering is skipped.
  * @return
  *    0 on success, or an error code indicating what went wrong
  */
-int fprint_zx_binary_code(FILE* output, FILE* tap_file, const char* selected_name, int selected_idx) {
-    ZXSHeader header; BOOL found;
+int fprint_zx_binary_code(FILE* output, const ZXSTapIndex* index, const char* selected_name, int selected_idx) {
+    int position;
     int err_code = 0;
 
     /* search for the selected binary code in the TAP file */
-    found = find_zx_tap_header(&header, tap_file, selected_name, selected_idx, ZXS_DATATYPE_CODE);
+    position = find_zx_tap_header(index, selected_name, selected_idx, ZXS_DATATYPE_CODE);
 
     /* handle error cases */
-    if( !found  )
+    if( position<0 )
     { error("No binary code found"); return err_code=1; }
-    if( found && header.datatype!=ZXS_DATATYPE_CODE )
+    if( index->entries[position].header.datatype!=ZXS_DATATYPE_CODE )
     { error("Selected block is not a binary code"); return err_code=1; }
 
     /* print the actual binary code */
-    err_code = fprint_zx_tap_data(output, tap_file, &header);
+    err_code = fprint_zx_indexed_data(output, index, position);
     return err_code;
 }
 
@@ -438,21 +1197,21 @@ int fprint_zx_binary_code(FILE* output, FILE* tap_file, const char* selected_nam
  * and other block types, though some types may not be fully implemented.
  * 
  * @param output         File pointer to the output file where the block content will be printed.
- * @param tap_file       File pointer to the TAP file containing the ZX Spectrum data.
+ * @param index          Pointer to the block index of the TAP file containing the ZX Spectrum data.
  * @param selected_name  Optional block name to match. If NULL, name-based filtering is skipped.
  * @param selected_idx   Optional block index to match. If -1, index-based filtering is skipped.
  * @return
  *    0 on success, or an error code indicating what went wrong
  */
-int fprint_any_zx_block(FILE* output, FILE* tap_file, const char* selected_name, int selected_idx) {
-    ZXSHeader header; ZXSTapBlock *block; BOOL found;
+int fprint_any_zx_block(FILE* output, const ZXSTapIndex* index, const char* selected_name, int selected_idx) {
+    int position;
     int err_code = 0;
     
     /* search for the first header that matches the given name or index */
     /* and if it is found, print the next block content                 */
-    found = find_zx_tap_header(&header, tap_file, selected_name, selected_idx, ZXS_DATATYPE_ANY);
-    if( found ) {
-        err_code = fprint_zx_tap_data(output, tap_file, &header);
+    position = find_zx_tap_header(index, selected_name, selected_idx, ZXS_DATATYPE_ANY);
+    if( position>=0 ) {
+        err_code = fprint_zx_indexed_data(output, index, position);
     }
     else {
         /* handle the not-found error */
@@ -462,94 +1221,2625 @@ int fprint_any_zx_block(FILE* output, FILE* tap_file, const char* selected_name,
     return err_code;
 }
 
-int extract_zx_block(const char* output_dir, const char* output_name, FILE* tap_file, const ZXSHeader *header) {
-    char *output_ext=NULL, *output_path=NULL;
-    FILE *output=NULL;
-    int err_code = 0;
-
-    switch( header->datatype ) {
-        case ZXS_DATATYPE_BASIC:  output_ext = ".bas"; break;
-        case ZXS_DATATYPE_CODE :  output_ext = ".hex"; break;
-        default:
-            output_ext = ".txt";
-            break;
-    }
-    if( !err_code ) {
-        output_path = alloc_unique_path(output_dir, output_name, output_ext);
-        if( !output_path ) { err_code=1; error("Cannot allocate memory for output path"); }
-    }
-    if( !err_code ) {
-        output = fopen(output_path, "wb");
-        if( !output ) { err_code=1; error("Cannot open output file \"%s\"", output_path); }
+/**
+ * Verifies the checksum of one block, printing a line if it is corrupt.
+ * @param output    File pointer to the output stream where the report is printed.
+ * @param index     Pointer to the block index of the TAP file.
+ * @param position  Position of the block in the index.
+ * @param filename  The name of the TAP file, used to prefix the line.
+ * @return TRUE if the block is correct.
+ */
+BOOL verify_zx_block(FILE* output, const ZXSTapIndex* index, int position, const char* filename) {
+    ZXSTapBlock block; unsigned checksum;
+    if( !zxs_index_block(index, position, &block) || !zxs_load_block_data(index->tape, &block) ) {
+        fprintf(output, "%s: block %d at offset %lu can not be read\n",
+                filename, position+1, (unsigned long)index->entries[position].offset);
+        return FALSE;
     }
-    if( !err_code ) {
-        err_code = fprint_zx_tap_data(output, tap_file, header);
+    checksum = zxs_calc_block_checksum(&block);
+    if( checksum != block.checksum ) {
+        fprintf(output, "%s: block %d at offset %lu has a bad checksum (stored %02X, calculated %02X)\n",
+                filename, position+1, (unsigned long)block.offset, block.checksum, checksum);
+        return FALSE;
     }
-    if( output     ) { fclose(output);    }
-    if( output_path) { free(output_path); }
-    return err_code;
+    return TRUE;
 }
 
-int extract_all_zx_blocks(const char* dir_name, FILE* tap_file, const char* selected_name, int selected_idx) {
-    ZXSTapBlock *block;
-    ZXSHeader    header;
-    int          header_index;
-    BOOL is_block_valid, is_header_valid, found;
-    char *output_dir, *output_name;
-    int err_code = 0;
-
-    if( dir_name==NULL || dir_name[0]=='\0' )  {
-        dir_name = "output";
-    }
-    output_dir = alloc_unique_path(NULL, dir_name, NULL);
-    if( !create_directory(output_dir) ) {
+/**
+ * Prints the pass/fail line of the verification of a TAP file.
+ * 
+ * Any damaged area skipped between blocks (see `--robust`) and any
+ * trailing bytes after the last block, that do not form a complete block,
+ * are reported first and each of them is counted as one more error.
+ * 
+ * @param output         File pointer to the output stream where the report is printed.
+ * @param index          Pointer to the block index of the TAP file.
+ * @param filename       The name of the TAP file, used to prefix each line.
+ * @param corrupt_count  Number of corrupt blocks found by `verify_zx_block()`.
+ * @return
+ *    0 if all blocks are correct, or 1 if any of them is corrupt
+ */
+int fprint_verify_result(FILE* output, const ZXSTapIndex* index, const char* filename, int corrupt_count) {
+    const ZXSTape* tape = index->tape;
+    const ZXSIndexEntry* entry;
+    size_t tape_end = 0;
+    int i;
+
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        entry = &index->entries[i];
+        if( entry->offset > tape_end ) {
+            fprintf(output, "%s: %lu damaged bytes at offset %lu were skipped\n",
+                    filename, (unsigned long)(entry->offset - tape_end), (unsigned long)tape_end);
+            ++corrupt_count;
+        }
+        tape_end = entry->offset + 4 + entry->datasize;
+    }
+    if( tape_end < tape->size ) {
+        fprintf(output, "%s: %lu bytes at offset %lu do not form a complete block\n",
+                filename, (unsigned long)(tape->size - tape_end), (unsigned long)tape_end);
+        ++corrupt_count;
+    }
+    if( corrupt_count == 0 ) { fprintf(output, "%s: OK (%d blocks)\n", filename, index->entry_count); }
+    else                     { fprintf(output, "%s: FAILED (%d errors in %d blocks)\n",
+                                       filename, corrupt_count, index->entry_count); }
+    return corrupt_count > 0 ? 1 : 0;
+}
+
+/**
+ * Verifies the checksum of every block in a TAP file.
+ * 
+ * A line is printed for each corrupt block, each damaged area skipped and
+ * any trailing bytes that do not form a complete block, followed by a
+ * pass/fail line for the file.
+ * 
+ * @param output    File pointer to the output stream where the report is printed.
+ * @param index     Pointer to the block index of the TAP file.
+ * @param filename  The name of the TAP file, used to prefix each line of the report.
+ * @return
+ *    0 if all blocks are correct, or 1 if any of them is corrupt
+ */
+int verify_zx_tape(FILE* output, const ZXSTapIndex* index, const char* filename) {
+    int i, corrupt_count = 0;
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        if( !verify_zx_block(output, index, i, filename) ) { ++corrupt_count; }
+    }
+    return fprint_verify_result(output, index, filename, corrupt_count);
+}
+
+/**
+ * Returns the extension of the file where a block is extracted to.
+ * @param header  The header of the block.
+ * @param raw     TRUE if binary code is extracted as raw bytes instead of Intel HEX.
+ * @return The extension including the dot, e.g., ".bas".
+ */
+const char* get_extract_extension(const ZXSHeader* header, BOOL raw) {
+    switch( header->datatype ) {
+        case ZXS_DATATYPE_BASIC:  return ".bas";
+        case ZXS_DATATYPE_CODE :  return !raw ? ".hex" : header->length == ZXS_SCREEN_SIZE ? ".scr" : ".bin";
+        default:                  return ".txt";
+    }
+}
+
+/**
+ * Writes the payload of the data block that follows a header to a file, as is.
+ * 
+ * The bytes are copied straight from the tape file to the output file
+ * (see `write_file_range()`), they are never read by the program.
+ * 
+ * @param output_path  The path of the file to create.
+ * @param index        Pointer to the block index of the tape.
+ * @param position     The position of the header within the index entries.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int extract_zx_raw_block(const char* output_path, const ZXSTapIndex* index, int position) {
+    ZXSTapBlock block;
+    const ZXSTape* tape = index->tape;
+    long long timer;
+    BOOL success;
+
+    if( !zxs_index_block(index, position+1, &block) ) {
+        error("Error reading binary code, no data block found"); return 1;
+    }
+    if( !zxs_load_block_data(index->tape, &block) ) {
+        error("Cannot read the data block at offset %lu", (unsigned long)block.offset); return 1;
+    }
+    timer = stats_start_timer();
+    if( tape->data && !tape->file ) {
+        success = write_file_range(output_path, tape->fd, tape->data, (size_t)(block.data - tape->data), block.datasize);
+    } else {
+        success = write_file_range(output_path, -1, block.data, 0, block.datasize);
+    }
+    stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+    if( !success ) { error("Cannot write output file \"%s\"", output_path); return 1; }
+    STATS_ADD(STATS_FILES_CREATED, 1);
+    return 0;
+}
+
+int extract_zx_block(const char* output_path, const ZXSTapIndex* index, int position, BOOL raw) {
+    FILE *output=NULL;
+    long long timer;
+    int err_code = 0;
+
+    if( raw && index->entries[position].header.datatype == ZXS_DATATYPE_CODE ) {
+        return extract_zx_raw_block(output_path, index, position);
+    }
+    if( !err_code ) {
+        timer  = stats_start_timer();
+        output = fopen(output_path, "wb");
+        stats_end_timer(STATS_TIME_FILESYSTEM, timer);
+        if( !output ) { err_code=1; error("Cannot open output file \"%s\"", output_path); }
+        else          { STATS_ADD(STATS_FILES_CREATED, 1); }
+    }
+    if( !err_code ) {
+        err_code = fprint_zx_indexed_data(output, index, position);
+    }
+    if( output     ) { fclose(output);    }
+    return err_code;
+}
+
+/**
+ * A block extracted by a worker thread (see `extract_all_zx_blocks()`)
+ */
+typedef struct BlockJob {
+    const ZXSTapIndex* index;        /**< The block index of the tape */
+    int                position;     /**< Position of the block header within the index entries */
+    char*              output_path;  /**< Path of the file where the block is extracted to */
+    BOOL               raw;          /**< TRUE if binary code is extracted as raw bytes */
+    int                err_code;     /**< Result of the extraction */
+} BlockJob;
+
+/**
+ * Extracts a block as a thread pool task.
+ * @param arg Pointer to the BlockJob to process.
+ */
+void run_block_job(void* arg) {
+    BlockJob* job = (BlockJob*)arg;
+    job->err_code = extract_zx_block(job->output_path, job->index, job->position, job->raw);
+}
+
+/**
+ * Extracts a list of blocks, in parallel when a thread pool is available.
+ * @param jobs       The blocks to extract, each job receives its result in `err_code`.
+ * @param job_count  Number of elements in `jobs`.
+ * @param index      Pointer to the block index of the tape.
+ * @param pool       Thread pool used to extract the blocks in parallel. (may be NULL)
+ * @return
+ *    0 if all the blocks were extracted, or the error code of the first one that failed
+ */
+int run_block_jobs(BlockJob* jobs, int job_count, const ZXSTapIndex* index, ThreadPool* pool) {
+    TaskGroup group;
+    int i, err_code = 0;
+
+    /* tapes read lazily from a file must be read sequentially */
+    group.pending = 0;
+    for( i = 0 ; i < job_count && !err_code ; ++i ) {
+        if( pool && !index->tape->file ) { thread_pool_submit(pool, &group, run_block_job, &jobs[i]); }
+        else                             { run_block_job(&jobs[i]); err_code = jobs[i].err_code;      }
+    }
+    if( pool ) { thread_pool_wait(pool, &group); }
+    for( i = 0 ; i < job_count ; ++i ) {
+        if( !err_code ) { err_code = jobs[i].err_code; }
+    }
+    return err_code;
+}
+
+int extract_all_zx_blocks(const char* dir_name, const ZXSTapIndex* index, const char* selected_name, int selected_idx,
+                          BOOL raw, ThreadPool* pool) {
+    const ZXSHeader *header;
+    int  header_index, position, i, job_count;
+    BOOL found;
+    char *output_dir; const char *output_name;
+    UniqueNamer namer;
+    BlockJob *jobs;
+    int err_code = 0;
+
+    if( dir_name==NULL || dir_name[0]=='\0' )  {
+        dir_name = "output";
+    }
+    output_dir = alloc_new_directory(dir_name);
+    if( !output_dir ) {
+        error("Cannot create output directory \"%s\"", dir_name);
+        return 1;
+    }
+    memset(&namer, 0, sizeof(namer));
+    jobs = (BlockJob*)calloc(index->header_count + 1, sizeof(BlockJob));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !jobs || !unique_namer_init(&namer, output_dir) ) {
+        error("Not enough memory to extract the blocks");
+        err_code = 1;
+    }
+
+    /* loop through all TAP headers assigning a file to each selected block, */
+    /* this is done sequentially so the names are always the same           */
+    job_count = 0;
+    for( i = 0 ; i < index->header_count && !err_code ; ++i )
+    {
+        position     = index->headers[i];
+        header       = &index->entries[position].header;
+        header_index = FIRST_HEADER_INDEX + i;
+
+        /* check if the current block matches the selected criteria */
+        found = FALSE;
+        if( !found && selected_name   ) { found = strcmp(header->filename, selected_name)==0; }
+        if( !found && selected_idx>=0 ) { found = header_index==selected_idx;                 }
+        if( !selected_name && selected_idx<0 ) { found = TRUE; }
+
+        if( found ) {
+            output_name = strlen(header->filename)>0 ? header->filename : "data";
+            jobs[job_count].index       = index;
+            jobs[job_count].position    = position;
+            jobs[job_count].raw         = raw;
+            jobs[job_count].output_path = unique_namer_alloc_path(&namer, output_name, get_extract_extension(header, raw));
+            if( !jobs[job_count].output_path ) { err_code=1; error("Cannot allocate memory for output path"); }
+            else { ++job_count; }
+        }
+    }
+
+    if( !err_code ) { err_code = run_block_jobs(jobs, job_count, index, pool); }
+    for( i = 0 ; i < job_count ; ++i ) { free( jobs[i].output_path ); }
+    unique_namer_free( &namer );
+    free( jobs );
+    free( output_dir );
+    return err_code;
+}
+
+
+/**
+ * Converts ZX-Spectrum TAP file to HEX Intel format
+ * @param output_filename  The name of the output file where the converted HEX data will be written.
+ *                         If the file already exists, it will be overwritten. 
+ * @param index            Pointer to the block index of the TAP file being converted.
+ * @return 0 on successful completion. 
+ */
+int convert_zx_tap_to_hex(const char* output_filename, const ZXSTapIndex* index) {
+    fatal_error( "Not implemented yet" );
+    return 0;
+}
+
+/**
+ * Calculates the hash of a header and its data block, as extracted by `extract_zx_block()`.
+ * @param[in]  index     Pointer to the block index of the tape.
+ * @param[in]  position  Position of the header within the index entries.
+ * @param[out] hash      Receives the hash of the header and data block.
+ * @return TRUE on success, FALSE if the blocks could not be read.
+ */
+BOOL hash_zx_indexed_data(const ZXSTapIndex* index, int position, unsigned long long* hash) {
+    ZXSTapBlock block; int i;
+    *hash = 0;
+    for( i = position ; i <= position + 1 && i < index->entry_count ; ++i ) {
+        if( !zxs_index_block(index, i, &block) || !zxs_load_block_data(index->tape, &block) ) { return FALSE; }
+        *hash = hash64(block.data, block.datasize, *hash ^ block.type);
+    }
+    return TRUE;
+}
+
+/**
+ * Extracts all blocks of a tape into a directory, regenerating only what changed since the last run.
+ * 
+ * The files created are recorded in a manifest in the output directory,
+ * with the size, modification time and hash of the tape. When the tape is
+ * unchanged, and all its files are still there, nothing is done; otherwise
+ * only the files of the blocks whose content changed are written again,
+ * in place, and the files of the blocks no longer in the tape are removed.
+ * 
+ * @param dir_name   The output directory, it's created if it does not exist.
+ * @param index      Pointer to the block index of the tape.
+ * @param tape_path  The path of the tape file.
+ * @param raw        TRUE if binary code is extracted as raw bytes instead of Intel HEX.
+ * @param pool       Thread pool used to extract the blocks in parallel. (may be NULL)
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int extract_zx_blocks_incrementally(const char* dir_name, const ZXSTapIndex* index, const char* tape_path,
+                                    BOOL raw, ThreadPool* pool) {
+    const ZXSTape* tape = index->tape;
+    const ZXSHeader *header;
+    Manifest old_manifest, new_manifest;
+    ManifestEntry* entry;
+    FileInfo info;
+    UniqueNamer namer;
+    BlockJob* jobs = NULL;
+    int* job_entries = NULL;
+    char *manifest_path, *path; const char *output_name, *ext, *name;
+    unsigned long long hash;
+    BOOL loaded, unchanged;
+    int  i, position, job_count = 0, err_code = 0;
+
+    if( dir_name==NULL || dir_name[0]=='\0' )  {
+        dir_name = "output";
+    }
+    if( !is_directory(dir_name) && !create_directory(dir_name) ) {
         error("Cannot create output directory \"%s\"", dir_name);
+        return 1;
+    }
+    manifest_path = alloc_concat5(dir_name, "/", MANIFEST_FILE, NULL, NULL);
+    if( !manifest_path ) { error("Not enough memory to extract the blocks"); return 1; }
+    manifest_init(&old_manifest, VERSION);
+    manifest_init(&new_manifest, VERSION);
+    loaded = manifest_load(&old_manifest, manifest_path) && strcmp(old_manifest.generator, VERSION)==0;
+    if( !get_file_info(tape_path, &info) ) { info.size = tape->size; info.mtime = 0; }
+    new_manifest.source_size  = info.size;
+    new_manifest.source_mtime = info.mtime;
+
+    /* an unchanged tape whose files were all written and are still there */
+    /* is skipped entirely, if only its modification time changed the     */
+    /* manifest is updated                                                */
+    unchanged = loaded && old_manifest.source_size == info.size;
+    for( i = 0 ; i < old_manifest.entry_count && unchanged ; ++i ) {
+        path      = alloc_concat5(dir_name, "/", old_manifest.entries[i].name, NULL, NULL);
+        unchanged = path && old_manifest.entries[i].hash != 0 && path_exists(path);
+        free(path);
+    }
+    if( unchanged && old_manifest.source_mtime != info.mtime ) {
+        new_manifest.source_hash = tape->data ? hash64(tape->data, tape->size, 0) : 0;
+        unchanged = new_manifest.source_hash == old_manifest.source_hash;
+        if( unchanged ) {
+            old_manifest.source_mtime = info.mtime;
+            if( !manifest_save(&old_manifest, manifest_path) ) { warning("Cannot write manifest file '%s'", manifest_path); }
+        }
+    }
+    if( unchanged ) {
+        manifest_free(&old_manifest);
+        free(manifest_path);
+        return 0;
+    }
+    if( !new_manifest.source_hash ) { new_manifest.source_hash = tape->data ? hash64(tape->data, tape->size, 0) : 0; }
+
+    /* the names in the old manifest are reserved even if their files were removed */
+    memset(&namer, 0, sizeof(namer));
+    jobs        = (BlockJob*)calloc(index->header_count + 1, sizeof(BlockJob));
+    job_entries = (int*)calloc(index->header_count + 1, sizeof(int));
+    STATS_ADD(STATS_ALLOCATIONS, 2);
+    if( !jobs || !job_entries || !unique_namer_init(&namer, dir_name) ) {
+        error("Not enough memory to extract the blocks");
         err_code = 1;
     }
-    
-    /* loop through all TAP blocks extracting the selected ones */
-    header_index   = FIRST_HEADER_INDEX;
-    is_block_valid = TRUE;
-    while( is_block_valid && !err_code )
-    {
-        /* read next block from TAP file */
-        block           = zxs_read_tap_block(tap_file);
-        is_block_valid  = (block != NULL);
-        is_header_valid = zxs_parse_header(&header, block);
-        if( is_header_valid )
-        {
-            /* check if the current block matches the selected criteria */
-            found = FALSE;
-            if( !found && selected_name   ) { found = strcmp(header.filename, selected_name)==0; }
-            if( !found && selected_idx>=0 ) { found = header_index==selected_idx;                }
-            if( !selected_name && selected_idx<0 ) { found = TRUE; }
-
-            /* placeholder for block extraction */
-            if( found ) {
-                output_name = strlen(header.filename)>0 ? header.filename : "data";
-                err_code = extract_zx_block(output_dir, output_name, tap_file, &header);
-            }
-            ++header_index;
-        }
-        free( block ); block = NULL;
+    for( i = 0 ; i < old_manifest.entry_count && !err_code ; ++i ) {
+        if( !unique_namer_reserve(&namer, old_manifest.entries[i].name) ) { error("Not enough memory to extract the blocks"); err_code = 1; }
+    }
+
+    /* match each block with the file created for it in the last run */
+    for( i = 0 ; i < index->header_count && !err_code ; ++i )
+    {
+        position    = index->headers[i];
+        header      = &index->entries[position].header;
+        output_name = strlen(header->filename)>0 ? header->filename : "data";
+        ext         = get_extract_extension(header, raw);
+        if( !hash_zx_indexed_data(index, position, &hash) ) {
+            error("Cannot read the block at offset %lu", (unsigned long)index->entries[position].offset);
+            err_code = 1; break;
+        }
+        entry = manifest_match(&old_manifest, position, hash);
+        if( entry && !unique_namer_is_name_of(entry->name, output_name, ext) ) { entry = NULL; }
+        if( entry ) {
+            entry->used = TRUE;
+            path = alloc_concat5(dir_name, "/", entry->name, NULL, NULL);
+        } else {
+            path = unique_namer_alloc_path(&namer, output_name, ext);
+        }
+        if( !path ) { error("Cannot allocate memory for output path"); err_code = 1; break; }
+        for( name = path + strlen(path) ; name > path && name[-1] != '/' && name[-1] != '\\' ; --name ) { }
+        if( !manifest_add(&new_manifest, position, hash, name) ) { error("Not enough memory to extract the blocks"); err_code = 1; }
+
+        /* the file is regenerated only if its block changed or the file was removed */
+        if( entry && entry->hash == hash && path_exists(path) ) { free(path); continue; }
+        jobs[job_count].index       = index;
+        jobs[job_count].position    = position;
+        jobs[job_count].output_path = path;
+        jobs[job_count].raw         = raw;
+        job_entries[job_count]      = new_manifest.entry_count - 1;
+        ++job_count;
+    }
+    if( !err_code ) { err_code = run_block_jobs(jobs, job_count, index, pool); }
+
+    /* a file that failed is recorded with no hash, so it's written again next time */
+    for( i = 0 ; i < job_count ; ++i ) {
+        if( jobs[i].err_code && job_entries[i] < new_manifest.entry_count ) { new_manifest.entries[ job_entries[i] ].hash = 0; }
+        free( jobs[i].output_path );
+    }
+    /* the files of the blocks that are no longer in the tape are removed */
+    for( i = 0 ; i < old_manifest.entry_count && !err_code ; ++i ) {
+        if( old_manifest.entries[i].used ) { continue; }
+        path = alloc_concat5(dir_name, "/", old_manifest.entries[i].name, NULL, NULL);
+        if( path ) { remove(path); free(path); }
+    }
+    if( new_manifest.entry_count > 0 && !manifest_save(&new_manifest, manifest_path) ) {
+        warning("Cannot write manifest file '%s'", manifest_path);
+    }
+    unique_namer_free( &namer );
+    manifest_free( &new_manifest );
+    manifest_free( &old_manifest );
+    free( job_entries );
+    free( jobs );
+    free( manifest_path );
+    return err_code;
+}
+
+/**
+ * A tape whose blocks are being written to a tar archive
+ */
+typedef struct TarTape {
+    TarArchive*  archive;        /**< The archive shared by all the tapes */
+    const char*  base_dir;       /**< Folder within the archive where the tape folder is placed (may be NULL) */
+    char*        folder;         /**< The folder of the tape within the archive */
+    UniqueNamer  members;        /**< Names of the members already used in `folder` */
+    long long    mtime;          /**< Modification time given to the members */
+    FILE*        scratch;        /**< Temporary file where the blocks are converted (NULL until needed) */
+    BOOL         raw;            /**< TRUE if binary code is extracted as raw bytes instead of Intel HEX */
+} TarTape;
+
+/**
+ * Prepares a tape to write its blocks to a tar archive, reserving its folder.
+ * @param tar_tape   The TarTape structure to initialize (release it with `tar_tape_close()`).
+ * @param archive    The state shared by all the tapes written to the archive.
+ * @param base_dir   Folder within the archive where the tape folder is placed. (may be NULL)
+ * @param tape_path  The path of the tape file.
+ * @param raw        TRUE if binary code is extracted as raw bytes instead of Intel HEX.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+BOOL tar_tape_open(TarTape* tar_tape, TarArchive* archive, const char* base_dir, const char* tape_path, BOOL raw) {
+    FileInfo info;
+    char *name;
+
+    memset(tar_tape, 0, sizeof(TarTape));
+    tar_tape->archive  = archive;
+    tar_tape->base_dir = base_dir;
+    tar_tape->raw      = raw;
+    name = alloc_name(tape_path);
+    mutex_lock(&archive->lock);
+    tar_tape->folder = name ? unique_namer_alloc_path(&archive->folders, name, NULL) : NULL;
+    mutex_unlock(&archive->lock);
+    free(name);
+    if( !tar_tape->folder || !unique_namer_init(&tar_tape->members, "") ) {
+        error("Not enough memory to extract the blocks"); free(tar_tape->folder); tar_tape->folder = NULL; return FALSE;
+    }
+    /* a tape that is not a file (a stream) gets the current time */
+    tar_tape->mtime = get_file_info(tape_path, &info) ? info.mtime : (long long)time(NULL);
+    return TRUE;
+}
+
+/**
+ * Writes the data block that follows a header as a member of the tar archive.
+ * @param tar_tape  The tape being written to the archive.
+ * @param output    The archive stream.
+ * @param index     Pointer to the block index of the tape.
+ * @param position  The position of the header within the index entries.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int tar_tape_add_block(TarTape* tar_tape, FILE* output, const ZXSTapIndex* index, int position) {
+    const ZXSHeader *header = &index->entries[position].header;
+    ZXSTapBlock block;
+    char *member_name, *member_path; const char *output_name;
+    long size;
+    int err_code = 0;
+
+    output_name = strlen(header->filename)>0 ? header->filename : "data";
+    member_name = unique_namer_alloc_path(&tar_tape->members, output_name, get_extract_extension(header, tar_tape->raw));
+    member_path = member_name ? alloc_concat5(tar_tape->base_dir, tar_tape->base_dir ? "/" : NULL,
+                                              tar_tape->folder, "/", member_name) : NULL;
+    free(member_name);
+    if( !member_path ) { error("Cannot allocate memory for output path"); return 1; }
+
+    if( tar_tape->raw && header->datatype == ZXS_DATATYPE_CODE ) {
+        /* raw code is written straight from the tape */
+        if( !zxs_index_block(index, position+1, &block) || !zxs_load_block_data(index->tape, &block) )
+        { error("Cannot read the data block of '%s'", member_path); err_code = 1; }
+        else if( !tar_write_member(output, member_path, block.data, block.datasize, tar_tape->mtime) )
+        { error("Cannot write '%s' to the archive", member_path); err_code = 1; }
+    }
+    else {
+        /* the size must be known before the data, so the block is converted first */
+        if( !tar_tape->scratch ) { tar_tape->scratch = tmpfile(); }
+        else                     { rewind(tar_tape->scratch);     }
+        if( !tar_tape->scratch ) { error("Cannot create a temporary file"); err_code = 1; }
+        else if( fprint_zx_indexed_data(tar_tape->scratch, index, position) != 0 ) { err_code = 1; }
+        else if( fflush(tar_tape->scratch) != 0 || (size = ftell(tar_tape->scratch)) < 0 ||
+                 !tar_copy_member(output, member_path, tar_tape->scratch, (unsigned long long)size, tar_tape->mtime) )
+        { error("Cannot write '%s' to the archive", member_path); err_code = 1; }
+        if( tar_tape->scratch ) { fseek(tar_tape->scratch, 0, SEEK_SET); }
+    }
+    free(member_path);
+    return err_code;
+}
+
+/**
+ * Releases the resources used by a tape written to a tar archive.
+ * @param tar_tape  The tape being written.
+ */
+void tar_tape_close(TarTape* tar_tape) {
+    if( tar_tape->scratch ) { fclose(tar_tape->scratch); }
+    if( tar_tape->folder  ) { unique_namer_free(&tar_tape->members); }
+    free(tar_tape->folder);
+    memset(tar_tape, 0, sizeof(TarTape));
+}
+
+/**
+ * Extracts all blocks of a tape as members of a tar archive.
+ * 
+ * The members are named as the files `extract_all_zx_blocks()` creates,
+ * within a folder named after the tape, but nothing is written to the
+ * filesystem: each block is converted into a scratch file (or taken as is
+ * from the tape, with `raw`) and then appended to the archive stream.
+ * 
+ * @param output     The archive stream.
+ * @param archive    The state shared by all the tapes written to the archive.
+ * @param base_dir   Folder within the archive where the tape folder is placed. (may be NULL)
+ * @param index      Pointer to the block index of the tape.
+ * @param tape_path  The path of the tape file.
+ * @param raw        TRUE if binary code is extracted as raw bytes instead of Intel HEX.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int extract_all_zx_blocks_to_tar(FILE* output, TarArchive* archive, const char* base_dir, const ZXSTapIndex* index,
+                                 const char* tape_path, BOOL raw) {
+    TarTape tar_tape;
+    int i, err_code = 0;
+
+    if( !tar_tape_open(&tar_tape, archive, base_dir, tape_path, raw) ) { return 1; }
+    for( i = 0 ; i < index->header_count ; ++i ) {
+        if( tar_tape_add_block(&tar_tape, output, index, index->headers[i]) != 0 ) { err_code = 1; }
+    }
+    tar_tape_close(&tar_tape);
+    return err_code;
+}
+
+/**
+ * Saves the payload of one data block in a dedup store, writing its reference line.
+ * @param output    FILE pointer to the output stream where the reference is written.
+ * @param store     The dedup store where the payload is saved.
+ * @param index     Pointer to the block index of the tape.
+ * @param position  Position of the data block in the index.
+ * @param filename  The path of the tape file.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int store_zx_block(FILE* output, DedupStore* store, const ZXSTapIndex* index, int position, const char* filename) {
+    ZXSTapBlock block;
+    unsigned long long hash;
+    char name[12], *ptr;
+    int result;
+
+    if( !zxs_index_block(index, position, &block) || !zxs_load_block_data(index->tape, &block) ) {
+        error("Cannot read block %d of '%s'", position+1, filename); return 1;
+    }
+    result = dedup_store_add(store, block.data, block.datasize, &hash);
+    if( result < 0 ) { return 1; }
+
+    /* the name of the header, with the characters that would break the line replaced */
+    strcpy(name, position > 0 && index->entries[position-1].is_header ? index->entries[position-1].header.filename : "");
+    for( ptr = name ; *ptr ; ++ptr ) { if( (unsigned char)*ptr < ' ' || *ptr == 0x7F ) { *ptr = '?'; } }
+    fprintf(output, "%08lx%08lx\t%u\t%s\t%d\t%s\t%s\n",
+            (unsigned long)(hash >> 32), (unsigned long)(hash & 0xFFFFFFFFUL), block.datasize,
+            filename, position+1, name, result > 0 ? "stored" : "duplicate");
+    return 0;
+}
+
+/**
+ * Saves the payload of every data block of a tape in a dedup store.
+ * 
+ * For each data block a reference line is written to `output` with the
+ * tab-separated fields: hash, size, tape, block index, name of the header
+ * that precedes the block and whether the payload was "stored" or was a
+ * "duplicate" of one already in the store.
+ * 
+ * @param output    FILE pointer to the output stream where the references are written.
+ * @param store     The dedup store where the payloads are saved.
+ * @param index     Pointer to the block index of the tape.
+ * @param filename  The path of the tape file.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int store_zx_blocks(FILE* output, DedupStore* store, const ZXSTapIndex* index, const char* filename) {
+    int i, err_code = 0;
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        if( index->entries[i].is_header ) { continue; }
+        if( store_zx_block(output, store, index, i, filename) != 0 ) { err_code = 1; }
+    }
+    return err_code;
+}
+
+/**
+ * Prints the lines of a BASIC program that match a query.
+ * 
+ * Each line found is printed as "TAPE:PROGRAM:LINE:" followed by the line
+ * itself, the only one that is detokenized.
+ * 
+ * @param output    File pointer to the output stream where the lines are printed.
+ * @param query     The query the lines must match.
+ * @param index     Pointer to the block index of the TAP file.
+ * @param position  Position of the header of the BASIC program within the index entries.
+ * @param filename  The name of the TAP file, used to prefix each line.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int fprint_basic_matches(FILE* output, const ZXSBasicQuery* query, const ZXSTapIndex* index, int position, const char* filename) {
+    const char* name = index->entries[position].header.filename;
+    char memory[LIST_BUFFER_SIZE]; OutBuf buf;
+    ZXSTapBlock block; ZXSBasicLine line;
+
+    /* a header without its data block has no lines */
+    if( !zxs_index_block(index, position+1, &block) || block.type != ZXS_BLKTYPE_DATA ) { return 0; }
+    if( !zxs_load_block_data(index->tape, &block) ) {
+        error("Cannot read the data block at offset %lu", (unsigned long)block.offset); return 1;
+    }
+    out_buf_init(&buf, output, memory, sizeof(memory));
+    line.next = 0;
+    while( zxs_find_basic_line(query, block.data, block.datasize, &line) ) {
+        out_buf_write(&buf, filename, strlen(filename)); out_buf_putc(&buf, ':');
+        out_buf_write(&buf, name, strlen(name));         out_buf_putc(&buf, ':');
+        out_buf_put_uint(&buf, line.number, 0);          out_buf_putc(&buf, ':');
+        zxs_write_basic_line(&buf, line.data, line.length);
+    }
+    return out_buf_flush(&buf);
+}
+
+/**
+ * Prints the lines of all the BASIC programs in a TAP file that match a query.
+ * @param output    File pointer to the output stream where the lines are printed.
+ * @param query     The query the lines must match.
+ * @param index     Pointer to the block index of the TAP file.
+ * @param filename  The name of the TAP file, used to prefix each line.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int find_basic_lines(FILE* output, const ZXSBasicQuery* query, const ZXSTapIndex* index, const char* filename) {
+    int i, err_code = 0;
+    for( i = 0 ; i < index->header_count ; ++i ) {
+        if( index->entries[ index->headers[i] ].header.datatype == ZXS_DATATYPE_BASIC ) {
+            err_code |= fprint_basic_matches(output, query, index, index->headers[i], filename);
+        }
+    }
+    return err_code;
+}
+
+/**
+ * Loads the binary code that follows a header of the block index into a memory image.
+ * 
+ * The block is copied at its start address, a warning reports the bytes
+ * loaded over the ones of previous blocks and the bytes beyond the end
+ * of the address space, which are dropped.
+ * 
+ * @param image     The memory image.
+ * @param index     Pointer to the block index of the tape.
+ * @param position  The position of the header within the index entries.
+ * @param filename  The path of the tape file.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int load_zx_memory_image(MemoryImage* image, const ZXSTapIndex* index, int position, const char* filename) {
+    const ZXSHeader* header = &index->entries[position].header;
+    unsigned start, end, address, overlap_count = 0, first_overlap = 0;
+    ZXSTapBlock block;
+
+    if( !zxs_index_block(index, position+1, &block) ) {
+        error("Error reading binary code '%s' of '%s', no data block found", header->filename, filename); return 1;
+    }
+    if( !zxs_load_block_data(index->tape, &block) ) {
+        error("Cannot read the data block at offset %lu", (unsigned long)block.offset); return 1;
+    }
+    start = header->param1 < ZX_MEMORY_SIZE ? header->param1 : ZX_MEMORY_SIZE;
+    end   = start + block.datasize;
+    if( end > ZX_MEMORY_SIZE ) {
+        warning("Binary code '%s' of '%s' exceeds the 64K address space, its last %u bytes were dropped",
+                header->filename, filename, end - ZX_MEMORY_SIZE);
+        end = ZX_MEMORY_SIZE;
+    }
+    for( address = start ; address < end ; ++address ) {
+        if( IMAGE_IS_LOADED(image, address) && overlap_count++ == 0 ) { first_overlap = address; }
+        image->loaded[address >> 3] |= (BYTE)(1 << (address & 7));
+    }
+    if( overlap_count > 0 ) {
+        warning("Binary code '%s' at %u-%u of '%s' overwrites %u bytes loaded by previous blocks, from address %u",
+                header->filename, start, end - 1, filename, overlap_count, first_overlap);
+    }
+    memcpy(image->data + start, block.data, end - start);
+    ++image->block_count;
+    return 0;
+}
+
+/**
+ * Finds the next range of consecutive addresses where a memory image was loaded.
+ * @param image    The memory image.
+ * @param address  The address where the search starts.
+ * @param[out] end Receives the address that follows the range.
+ * @return The first address of the range, or ZX_MEMORY_SIZE if there are no more ranges.
+ */
+unsigned next_memory_image_range(const MemoryImage* image, unsigned address, unsigned* end) {
+    while( address < ZX_MEMORY_SIZE && !IMAGE_IS_LOADED(image, address) ) { ++address; }
+    for( *end = address ; *end < ZX_MEMORY_SIZE && IMAGE_IS_LOADED(image, *end) ; ++(*end) ) { }
+    return address;
+}
+
+/**
+ * Writes a memory image to a file.
+ * 
+ * As Intel HEX there are only records for the ranges where something was
+ * loaded, they are all built in memory and written at once.
+ * 
+ * @param output  FILE pointer to the output file.
+ * @param image   The memory image.
+ * @param raw     TRUE to write the 64K of the image as raw bytes instead of Intel HEX.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int fwrite_memory_image(FILE* output, const MemoryImage* image, BOOL raw) {
+    char fallback[16*1024]; char *memory; size_t memory_size = 0;
+    unsigned start, end;
+    long long timer;
+    OutBuf out;
+
+    if( raw ) {
+        STATS_ADD(STATS_OUTPUT_BYTES, ZX_MEMORY_SIZE);
+        return fwrite(image->data, 1, ZX_MEMORY_SIZE, output) != ZX_MEMORY_SIZE;
+    }
+    timer = stats_start_timer();
+    for( start = next_memory_image_range(image, 0, &end) ; start < ZX_MEMORY_SIZE ;
+         start = next_memory_image_range(image, end, &end) ) { memory_size += hex_data_length(end - start); }
+    memory = memory_size > 0 ? (char*)malloc(memory_size) : NULL;
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( memory == NULL ) { memory = fallback; memory_size = sizeof(fallback); }
+    out_buf_init(&out, output, memory, memory_size);
+    for( start = next_memory_image_range(image, 0, &end) ; start < ZX_MEMORY_SIZE ;
+         start = next_memory_image_range(image, end, &end) ) { write_hex_data(&out, start, image->data + start, end - start); }
+    out_buf_flush(&out);
+    if( memory != fallback ) { free(memory); }
+    stats_end_timer(STATS_TIME_HEX, timer);
+    return out.err_code;
+}
+
+/**
+ * Writes the memory image of a tape to the output of CMD_IMAGE.
+ * @param output    FILE pointer to the output stream of the action (not used if it writes to a folder).
+ * @param action    The CMD_IMAGE action.
+ * @param image     The memory image where the binary code of the tape was loaded.
+ * @param filename  The path of the tape file.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int write_zx_memory_image(FILE* output, const Action* action, const MemoryImage* image, const char* filename) {
+    char *name, *path = NULL;
+    FILE* file;
+    int err_code;
+
+    if( image->block_count == 0 ) { error("No binary code found in '%s'", filename); return 1; }
+    if( !action->images ) { return fwrite_memory_image(output, image, action->raw); }
+
+    /* one file per tape, named after it */
+    name = alloc_name(filename);
+    if( name ) {
+        mutex_lock(&action->images->lock);
+        path = unique_namer_alloc_path(&action->images->names, name, action->raw ? ".bin" : ".hex");
+        mutex_unlock(&action->images->lock);
+    }
+    free(name);
+    if( !path ) { error("Cannot allocate memory for output path"); return 1; }
+    file = fopen(path, "wb");
+    if( !file ) { error("Cannot open output file \"%s\"", path); free(path); return 1; }
+    STATS_ADD(STATS_FILES_CREATED, 1);
+    err_code = fwrite_memory_image(file, image, action->raw);
+    if( fclose(file) != 0 ) { err_code = 1; }
+    if( err_code ) { error("Cannot write output file \"%s\"", path); }
+    free(path);
+    return err_code;
+}
+
+/**
+ * Loads all the binary code blocks of a tape into a single memory image and writes it.
+ * @param output    FILE pointer to the output stream of the action.
+ * @param action    The CMD_IMAGE action.
+ * @param index     Pointer to the block index of the tape.
+ * @param filename  The path of the tape file.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int merge_zx_binary_code(FILE* output, const Action* action, const ZXSTapIndex* index, const char* filename) {
+    MemoryImage* image;
+    int i, err_code = 0;
+
+    image = (MemoryImage*)calloc(1, sizeof(MemoryImage));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !image ) { error("Not enough memory to build the memory image"); return 1; }
+    for( i = 0 ; i < index->header_count ; ++i ) {
+        if( index->entries[ index->headers[i] ].header.datatype == ZXS_DATATYPE_CODE ) {
+            err_code |= load_zx_memory_image(image, index, index->headers[i], filename);
+        }
+    }
+    err_code |= write_zx_memory_image(output, action, image, filename);
+    free(image);
+    return err_code;
+}
+
+/*------------------------------- TAPE FILES -------------------------------*/
+
+/**
+ * Applies one action to a tape whose block index is already built.
+ * @param output    FILE pointer to the output stream of the action.
+ * @param action    The action to apply.
+ * @param index     Pointer to the block index of the tape.
+ * @param filename  The path of the tape file.
+ * @param pool      Thread pool used to process the blocks of the tape in parallel. (may be NULL)
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int run_action(FILE* output, const Action* action, const ZXSTapIndex* index, const char* filename, ThreadPool* pool) {
+    char *name, *dir_name;
+    int err_code = 0;
+
+    switch( action->cmd ) {
+        case CMD_LIST:
+        case CMD_DETAILS:
+            switch( action->format ) {
+                case LIST_FORMAT_NDJSON: err_code = fprint_block_list_ndjson(output, index, filename); break;
+                case LIST_FORMAT_BINARY: err_code = fwrite_block_list_binary(output, index, filename); break;
+                default:                 err_code = fprint_block_list(output, index);                  break;
+            }
+            break;
+        case CMD_PRINT:
+            err_code = fprint_any_zx_block(output, index, action->selected_name, action->selected_index);
+            break;
+        case CMD_BASIC:
+            err_code = fprint_zx_basic_program(output, index, NULL, -1);
+            break;
+        case CMD_BINARY:
+            err_code = fprint_zx_binary_code(output, index, NULL, -1);
+            break;
+        case CMD_EXTRACT:
+            if( action->archive ) {
+                err_code = extract_all_zx_blocks_to_tar(output, action->archive, action->output_path, index, filename, action->raw);
+                break;
+            }
+            name     = alloc_name(filename);
+            dir_name = action->output_path ? alloc_concat5(action->output_path, "/", name, NULL, NULL) : name;
+            err_code = action->incremental ? extract_zx_blocks_incrementally(dir_name, index, filename, action->raw, pool)
+                                           : extract_all_zx_blocks(dir_name, index, NULL, -1, action->raw, pool);
+            if( dir_name != name ) { free(dir_name); }
+            free(name);
+            break;
+        case CMD_VERIFY:
+            err_code = verify_zx_tape(output, index, filename);
+            break;
+        case CMD_DEDUP:
+            err_code = store_zx_blocks(output, action->store, index, filename);
+            break;
+        case CMD_FIND_BASIC:
+            err_code = find_basic_lines(output, action->query, index, filename);
+            break;
+        case CMD_IMAGE:
+            err_code = merge_zx_binary_code(output, action, index, filename);
+            break;
+        default:
+            error( "Unknown command '%d'", action->cmd ); err_code = 1;
+    }
+    return err_code;
+}
+
+/**
+ * The progress of an action on a tape that is read as a stream
+ * 
+ * Streamed tapes can't be indexed first and processed later, because only
+ * the last block read is available, so each action gets every block as
+ * soon as it is read and keeps here what it needs from the previous ones.
+ */
+typedef struct StreamedAction {
+    const Action* action;         /**< The action being applied */
+    FILE*         output;         /**< The output stream of the action */
+    int           header_index;   /**< Index of the next header in the text list */
+    int           block_index;    /**< Index of the next data block in the text list */
+    BYTE*         records;        /**< Records of the binary list, written once the number of blocks is known */
+    size_t        records_size;   /**< Number of allocated bytes in `records` */
+    int           corrupt_count;  /**< Number of corrupt blocks found by CMD_VERIFY */
+    int           pending;        /**< Position of the header whose data block is the next one (-1 if none) */
+    BOOL          done;           /**< TRUE when the block selected to be printed has been printed */
+    char*         output_dir;     /**< The folder where CMD_EXTRACT creates the files */
+    UniqueNamer   names;          /**< Names of the files already created in `output_dir` */
+    TarTape       tar_tape;       /**< The tape written by CMD_EXTRACT to a tar archive */
+    MemoryImage*  image;          /**< The memory image where CMD_IMAGE loads the binary code */
+    int           err_code;       /**< Result of the action */
+} StreamedAction;
+
+/**
+ * Starts applying an action to a streamed tape.
+ * @param streamed  The StreamedAction structure to initialize.
+ * @param action    The action to apply.
+ * @param output    The output stream of the action.
+ * @param filename  The name of the tape.
+ */
+void streamed_action_begin(StreamedAction* streamed, const Action* action, FILE* output, const char* filename) {
+    char *name, *dir_name;
+
+    memset(streamed, 0, sizeof(StreamedAction));
+    streamed->action       = action;
+    streamed->output       = output;
+    streamed->header_index = FIRST_HEADER_INDEX;
+    streamed->pending      = -1;
+    switch( action->cmd ) {
+        case CMD_LIST:
+        case CMD_DETAILS:
+            if( action->format == LIST_FORMAT_TEXT )
+            { fprintf(output, "%s%s%s", LIST_PADDING ? "\n" : "", LIST_THEADER, LIST_TLINE); }
+            break;
+        case CMD_EXTRACT:
+            if( action->incremental ) {
+                error("--incremental can't be used with a tape read from a stream");
+                streamed->err_code = 1; break;
+            }
+            if( action->archive ) {
+                if( !tar_tape_open(&streamed->tar_tape, action->archive, action->output_path, filename, action->raw) )
+                { streamed->err_code = 1; }
+                break;
+            }
+            name     = alloc_name(filename);
+            dir_name = action->output_path ? alloc_concat5(action->output_path, "/", name, NULL, NULL) : name;
+            streamed->output_dir = dir_name ? alloc_new_directory(dir_name) : NULL;
+            if( !streamed->output_dir ) { error("Cannot create output directory \"%s\"", dir_name ? dir_name : ""); }
+            else if( !unique_namer_init(&streamed->names, streamed->output_dir) ) {
+                error("Not enough memory to extract the blocks");
+                free(streamed->output_dir); streamed->output_dir = NULL;
+            }
+            if( !streamed->output_dir ) { streamed->err_code = 1; }
+            if( dir_name != name ) { free(dir_name); }
+            free(name);
+            break;
+        case CMD_IMAGE:
+            streamed->image = (MemoryImage*)calloc(1, sizeof(MemoryImage));
+            STATS_ADD(STATS_ALLOCATIONS, 1);
+            if( !streamed->image ) { error("Not enough memory to build the memory image"); streamed->err_code = 1; }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Applies an action to the data block that follows a header of a streamed tape.
+ * @param streamed  The action being applied.
+ * @param index     The block index of the tape, its last block is the data block (if any).
+ * @param position  The position of the header within the index entries.
+ * @param filename  The name of the tape.
+ */
+void streamed_action_data(StreamedAction* streamed, const ZXSTapIndex* index, int position, const char* filename) {
+    const ZXSHeader* header = &index->entries[position].header;
+    const Action* action = streamed->action;
+    char* output_path; const char* output_name;
+
+    switch( action->cmd ) {
+        case CMD_PRINT:
+        case CMD_BASIC:
+        case CMD_BINARY:
+            streamed->err_code = fprint_zx_indexed_data(streamed->output, index, position);
+            streamed->done     = TRUE;
+            break;
+        case CMD_EXTRACT:
+            if( action->archive ) {
+                streamed->err_code |= tar_tape_add_block(&streamed->tar_tape, streamed->output, index, position);
+                break;
+            }
+            output_name = strlen(header->filename)>0 ? header->filename : "data";
+            output_path = unique_namer_alloc_path(&streamed->names, output_name, get_extract_extension(header, action->raw));
+            if( !output_path ) { error("Cannot allocate memory for output path"); streamed->err_code = 1; break; }
+            streamed->err_code |= extract_zx_block(output_path, index, position, action->raw);
+            free(output_path);
+            break;
+        case CMD_FIND_BASIC:
+            streamed->err_code |= fprint_basic_matches(streamed->output, action->query, index, position, filename);
+            break;
+        case CMD_IMAGE:
+            streamed->err_code |= load_zx_memory_image(streamed->image, index, position, filename);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Applies an action to the block just read from a streamed tape.
+ * @param streamed  The action being applied.
+ * @param index     The block index of the tape, the block is the last one.
+ * @param filename  The name of the tape.
+ */
+void streamed_action_block(StreamedAction* streamed, const ZXSTapIndex* index, const char* filename) {
+    const Action* action = streamed->action;
+    const int position   = index->entry_count - 1;
+    const ZXSIndexEntry* entry = &index->entries[position];
+    const char* name; ZXS_DATATYPE type; BOOL selected;
+    char memory[LIST_BUFFER_SIZE]; OutBuf buf; BYTE* new_records;
+    size_t records_length;
+
+    if( streamed->pending >= 0 ) {
+        streamed_action_data(streamed, index, streamed->pending, filename);
+        streamed->pending = -1;
+    }
+    switch( action->cmd ) {
+        case CMD_LIST:
+        case CMD_DETAILS:
+            if( action->format == LIST_FORMAT_TEXT ) {
+                out_buf_init(&buf, streamed->output, memory, sizeof(memory));
+                write_block_list_entry(&buf, entry, &streamed->header_index, &streamed->block_index);
+                streamed->err_code |= out_buf_flush(&buf);
+            }
+            else if( action->format == LIST_FORMAT_NDJSON ) {
+                out_buf_init(&buf, streamed->output, memory, sizeof(memory));
+                write_block_list_ndjson_entry(&buf, index, position, filename);
+                streamed->err_code |= out_buf_flush(&buf);
+            }
+            else {
+                /* the records are only 32 bytes per block, they wait until the count is known */
+                records_length = (size_t)index->entry_count * LIST_RECORD_SIZE;
+                if( records_length > streamed->records_size ) {
+                    new_records = (BYTE*)realloc(streamed->records, 2 * records_length);
+                    STATS_ADD(STATS_ALLOCATIONS, 1);
+                    if( !new_records ) { error("Not enough memory to list the blocks"); streamed->err_code = 1; break; }
+                    streamed->records      = new_records;
+                    streamed->records_size = 2 * records_length;
+                }
+                build_block_list_record(streamed->records + records_length - LIST_RECORD_SIZE, index, position);
+            }
+            break;
+        case CMD_PRINT:
+        case CMD_BASIC:
+        case CMD_BINARY:
+            if( streamed->done || !entry->is_header ) { break; }
+            name = action->cmd == CMD_PRINT ? action->selected_name : NULL;
+            type = action->cmd == CMD_BASIC ? ZXS_DATATYPE_BASIC : action->cmd == CMD_BINARY ? ZXS_DATATYPE_CODE : ZXS_DATATYPE_ANY;
+            if     ( name )                        { selected = strcmp(entry->header.filename, name) == 0; }
+            else if( action->selected_index >= 0 ) { selected = index->header_count - 1 + FIRST_HEADER_INDEX == action->selected_index; }
+            else                                   { selected = type == ZXS_DATATYPE_ANY || entry->header.datatype == type; }
+            if( selected ) { streamed->pending = position; }
+            break;
+        case CMD_EXTRACT:
+            /* nothing is extracted if the output could not be prepared */
+            if( entry->is_header && (streamed->output_dir || streamed->tar_tape.folder) ) { streamed->pending = position; }
+            break;
+        case CMD_VERIFY:
+            if( !verify_zx_block(streamed->output, index, position, filename) ) { ++streamed->corrupt_count; }
+            break;
+        case CMD_DEDUP:
+            if( !entry->is_header ) { streamed->err_code |= store_zx_block(streamed->output, action->store, index, position, filename); }
+            break;
+        case CMD_FIND_BASIC:
+            if( entry->is_header && entry->header.datatype == ZXS_DATATYPE_BASIC ) { streamed->pending = position; }
+            break;
+        case CMD_IMAGE:
+            if( streamed->image && entry->is_header && entry->header.datatype == ZXS_DATATYPE_CODE ) { streamed->pending = position; }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Finishes applying an action to a streamed tape, once all its blocks have been read.
+ * @param streamed  The action being applied.
+ * @param index     The block index of the tape.
+ * @param filename  The name of the tape.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int streamed_action_end(StreamedAction* streamed, const ZXSTapIndex* index, const char* filename) {
+    const Action* action = streamed->action;
+    char memory[LIST_BUFFER_SIZE]; OutBuf buf;
+
+    /* a header at the end of the tape, without data block, is reported as such */
+    if( streamed->pending >= 0 ) { streamed_action_data(streamed, index, streamed->pending, filename); }
+    switch( action->cmd ) {
+        case CMD_LIST:
+        case CMD_DETAILS:
+            if( action->format == LIST_FORMAT_TEXT ) {
+                fprintf(streamed->output, "%s%s", LIST_TLINE, LIST_PADDING ?  "\n" : "");
+            }
+            else if( action->format == LIST_FORMAT_BINARY && !streamed->err_code ) {
+                out_buf_init(&buf, streamed->output, memory, sizeof(memory));
+                write_block_list_binary_head(&buf, index->entry_count, filename);
+                out_buf_write(&buf, (const char*)streamed->records, (size_t)index->entry_count * LIST_RECORD_SIZE);
+                streamed->err_code = out_buf_flush(&buf);
+            }
+            free(streamed->records);
+            break;
+        case CMD_PRINT:
+            if( !streamed->done && action->selected_name ) {
+                error("No block found with name \"%s\"", action->selected_name); streamed->err_code = 1;
+            }
+            if( !streamed->done && action->selected_index >= 0 ) {
+                error("No block at index %d", action->selected_index); streamed->err_code = 1;
+            }
+            break;
+        case CMD_BASIC:
+            if( !streamed->done ) { error("No BASIC program found"); streamed->err_code = 1; }
+            break;
+        case CMD_BINARY:
+            if( !streamed->done ) { error("No binary code found"); streamed->err_code = 1; }
+            break;
+        case CMD_EXTRACT:
+            if( action->archive ) { tar_tape_close(&streamed->tar_tape); }
+            if( streamed->output_dir ) { unique_namer_free(&streamed->names); free(streamed->output_dir); }
+            break;
+        case CMD_VERIFY:
+            streamed->err_code = fprint_verify_result(streamed->output, index, filename, streamed->corrupt_count);
+            break;
+        case CMD_IMAGE:
+            if( streamed->image ) { streamed->err_code |= write_zx_memory_image(streamed->output, action, streamed->image, filename); }
+            free(streamed->image);
+            break;
+        default:
+            break;
+    }
+    return streamed->err_code;
+}
+
+/**
+ * Processes a tape read from the standard input according to the commands given on the command line.
+ * 
+ * The tape is read one block at a time into a fixed buffer of the maximum
+ * block size, and every action is applied to each block as it is read, so
+ * the payloads are never stored on disk nor in memory all at once (only
+ * the entries of the block index, some 40 bytes per block, are kept).
+ * 
+ * @param outputs   The FILE pointers where each of the `command->streams` is written.
+ * @param command   The commands to apply to the tape.
+ * @param input     The stream the tape is read from, decompressed on the fly if needed.
+ * @param filename  The name of the tape.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int process_tape_stream(FILE* const* outputs, const Command* command, Unzipper* input, const char* filename) {
+    StreamedAction* streamed;
+    ZXSTape tape; ZXSTapIndex index; ZXSTapBlock block;
+    MemoryBudget budget; ZXSReader reader;
+    BYTE* window;
+    int i, err_code = 0;
+
+    window   = (BYTE*)malloc(ZXS_MAX_BLOCK_SIZE);
+    streamed = (StreamedAction*)calloc(command->action_count, sizeof(StreamedAction));
+    STATS_ADD(STATS_ALLOCATIONS, 2);
+    if( !window || !streamed ) { error("Not enough memory"); free(window); free(streamed); return 1; }
+
+    reader.read_fn = unzip_read;
+    reader.user    = input;
+    zxs_init_tape_stream(&tape, input->inflater.file, window);
+    tape.reader    = &reader;
+    tape.allocator = init_memory_budget(&budget, command->max_memory);
+    memset(&index, 0, sizeof(index));
+    index.tape      = &tape;
+    index.allocator = tape.allocator;
+    for( i = 0 ; i < command->action_count ; ++i ) {
+        const Action* action = &command->actions[i];
+        streamed_action_begin(&streamed[i], action, outputs[action->stream], filename);
+    }
+    while( zxs_next_tap_block(&tape, &block) ) {
+        if( !zxs_index_add_block(&index, &block) ) { error_indexing_tape(&tape, filename); err_code = 1; break; }
+        for( i = 0 ; i < command->action_count ; ++i ) {
+            streamed_action_block(&streamed[i], &index, filename);
+        }
+    }
+    if( ferror(input->inflater.file) ) { error("Cannot read the tape '%s'", filename); err_code = 1; }
+    else if( input->error )            { error("Cannot decompress the tape '%s': %s", filename, input->error); err_code = 1; }
+    for( i = 0 ; i < command->action_count ; ++i ) {
+        err_code |= streamed_action_end(&streamed[i], &index, filename);
+    }
+    zxs_free_index(&index);
+    free_memory_budget(&budget);
+    free(streamed);
+    free(window);
+    return err_code;
+}
+
+/**
+ * Checks if a path has a given extension (case-insensitive).
+ * @param path       The path to check.
+ * @param extension  The extension, in lowercase and including the dot (e.g. ".tap").
+ * @return TRUE if the path ends with `extension`, FALSE otherwise.
+ */
+BOOL has_extension(const char* path, const char* extension) {
+    size_t length = strlen(path), ext_length = strlen(extension), i;
+    char ch;
+    if( length < ext_length ) { return FALSE; }
+    for( path += length - ext_length, i = 0 ; i < ext_length ; ++i ) {
+        ch = path[i] >= 'A' && path[i] <= 'Z' ? (char)(path[i] - 'A' + 'a') : path[i];
+        if( ch != extension[i] ) { return FALSE; }
+    }
+    return TRUE;
+}
+
+/**
+ * Allocates the name of the tape compressed with gzip in a file, the path without its ".gz" extension.
+ * @param path  The path of the compressed file.
+ * @return The allocated name (the path itself if it has not the extension), or NULL if out of memory.
+ */
+char* alloc_gunzipped_name(const char* path) {
+    char* name = strdup_(path);
+    if( name && has_extension(name, ".gz") ) { name[ strlen(name) - 3 ] = '\0'; }
+    return name;
+}
+
+/**
+ * Processes a tape read from a file that may be compressed (see `process_tape_stream()`).
+ * @param outputs   The FILE pointers where each of the `command->streams` is written.
+ * @param command   The commands to apply to the tape.
+ * @param file      The file the tape is read from, from its current position.
+ * @param member    The member of the zip archive `file` to read, or NULL if the file is the tape (maybe compressed with gzip).
+ * @param filename  The name of the tape.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int process_unzipped_tape(FILE* const* outputs, const Command* command, FILE* file, const ZipEntry* member, const char* filename) {
+    Unzipper* unzip;
+    int err_code;
+
+    unzip = (Unzipper*)malloc(sizeof(Unzipper));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !unzip ) { error("Not enough memory"); return 1; }
+    if( member ? unzip_open_member(unzip, file, member) : unzip_open(unzip, file) ) {
+        err_code = process_tape_stream(outputs, command, unzip, filename);
+    }
+    else {
+        error("Cannot decompress the tape '%s': %s", filename, unzip->error); err_code = 1;
+    }
+    free(unzip);
+    return err_code;
+}
+
+/**
+ * Opens the zip archive that holds a tape (see `add_tape_file()`), reporting the error if it can not be opened.
+ * @param filename  The path of the tape, the path of the archive followed by '/' and the name of the member.
+ * @param member    The member of the archive.
+ * @return The archive opened in binary read mode, or NULL on error.
+ */
+FILE* open_zip_archive_of(const char* filename, const ZipEntry* member) {
+    char* archive_path; FILE* archive;
+
+    archive_path = strdup_(filename);
+    if( !archive_path ) { error("Not enough memory"); return NULL; }
+    archive_path[ strlen(filename) - strlen(member->name) - 1 ] = '\0';
+    archive = fopen(archive_path, "rb");
+    if( !archive ) { error("Failed to open file '%s'", archive_path); }
+    free(archive_path);
+    return archive;
+}
+
+/**
+ * Processes a tape stored in a zip archive (see `add_tape_file()`).
+ * @param outputs   The FILE pointers where each of the `command->streams` is written.
+ * @param command   The commands to apply to the tape.
+ * @param filename  The path of the tape, the path of the archive followed by '/' and the name of the member.
+ * @param member    The member of the archive.
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int process_zip_member(FILE* const* outputs, const Command* command, const char* filename, const ZipEntry* member) {
+    FILE* archive;
+    int err_code;
+
+    archive = open_zip_archive_of(filename, member);
+    if( !archive ) { return 1; }
+    err_code = process_unzipped_tape(outputs, command, archive, member, filename);
+    fclose(archive);
+    return err_code;
+}
+
+/**
+ * Processes one tape file according to the commands given on the command line.
+ * 
+ * The tape is read and its headers are parsed only once, whatever the
+ * number of actions, all of them are then applied to the same block index.
+ * The tapes compressed with gzip or stored in zip archives are read as
+ * streams instead, decompressed on the fly.
+ * 
+ * @param outputs   The FILE pointers where each of the `command->streams` is written.
+ * @param command   The commands to apply to the tape.
+ * @param filename  The path of the tape file.
+ * @param member    The member of a zip archive to read (see `add_tape_file()`), or NULL if `filename` is the tape.
+ * @param pool      Thread pool used to process the blocks of the tape in parallel. (may be NULL)
+ * @return
+ *    0 on success, or an error code indicating what went wrong
+ */
+int process_tape_file(FILE* const* outputs, const Command* command, const char* filename, const ZipEntry* member, ThreadPool* pool) {
+    FileMap tap_map; ZXSTape tape; ZXSTapIndex index;
+    FILE *tap_file = NULL; FileInfo tap_info;
+    MemoryBudget budget;
+    BOOL only_headers, compressed;
+    BYTE magic[3];
+    char* name;
+    long long timer;
+    int i, err_code = 0;
+
+    if( strcmp(filename, STDIN_PATH) == 0 ) {
+#       ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#       endif
+        return process_unzipped_tape(outputs, command, stdin, NULL, STDIN_NAME);
+    }
+    if( member ) { return process_zip_member(outputs, command, filename, member); }
+
+    /* the text listing only needs the headers, then payloads are skipped */
+    /* (unless the tape may need to be resynchronised, which requires it in memory) */
+    only_headers = command->index_mode != INDEX_MODE_HASHED && !command->robust;
+    for( i = 0 ; i < command->action_count ; ++i ) {
+        const CMD cmd = command->actions[i].cmd;
+        if( cmd != CMD_LIST && cmd != CMD_DETAILS ) { only_headers = FALSE; }
+        if( command->actions[i].format != LIST_FORMAT_TEXT ) { only_headers = FALSE; }
+    }
+
+    memset(&tap_map, 0, sizeof(tap_map));
+    timer = stats_start_timer();
+    if( only_headers ) {
+        tap_file = fopen(filename, "rb");
+        if( tap_file && !get_file_info(filename, &tap_info) ) { fclose(tap_file); tap_file = NULL; }
+        if( !tap_file ) { error("Failed to open file '%s'", filename); return 1; }
+        compressed = fread(magic, 1, 3, tap_file) == 3 && gzip_is_file(magic, 3);
+        rewind(tap_file);
+        zxs_init_tape_file(&tape, tap_file, (size_t)tap_info.size);
+    }
+    else {
+        if( !map_file(&tap_map, filename) ) { error("Failed to open file '%s'", filename); return 1; }
+        compressed = gzip_is_file(tap_map.data, tap_map.size);
+        zxs_init_tape(&tape, tap_map.data, tap_map.size);
+        tape.fd     = tap_map.fd;
+        tape.robust = command->robust;
+    }
+    if( compressed ) {
+        /* the tape in FILE.tap.gz is named FILE.tap */
+        if( !tap_file ) { unmap_file(&tap_map); tap_file = fopen(filename, "rb"); }
+        if( !tap_file ) { error("Failed to open file '%s'", filename); return 1; }
+        stats_end_timer(STATS_TIME_READ, timer);
+        name     = alloc_gunzipped_name(filename);
+        err_code = process_unzipped_tape(outputs, command, tap_file, NULL, name ? name : filename);
+        free(name);
+        fclose(tap_file);
+        return err_code;
+    }
+    tape.allocator = init_memory_budget(&budget, command->max_memory);
+    stats_end_timer(STATS_TIME_READ, timer);
+    timer    = stats_start_timer();
+    err_code = get_tape_index(&index, &tape, filename, command->index_mode, pool);
+    stats_end_timer(STATS_TIME_INDEX, timer);
+    if( !err_code && tape.resync_count > 0 ) {
+        warning("Skipped %u damaged areas of '%s' (%lu bytes)",
+                tape.resync_count, filename, (unsigned long)tape.skipped_bytes);
+    }
+    if( !err_code ) {
+        /* every action consumes the same block index */
+        for( i = 0 ; i < command->action_count ; ++i ) {
+            const Action* action = &command->actions[i];
+            err_code |= run_action(outputs[action->stream], action, &index, filename, pool);
+        }
+        zxs_free_index(&index);
+    }
+    zxs_free_tape(&tape);
+    free_memory_budget(&budget);
+    if( tap_file ) { fclose(tap_file);  }
+    else           { unmap_file(&tap_map); }
+    return err_code;
+}
+
+/*------------------------------- BATCH MODE -------------------------------*/
+
+/**
+ * A list of file paths
+ */
+typedef struct FileList {
+    char**    paths;     /**< The allocated paths */
+    ZipEntry* members;   /**< For the tapes inside zip archives, the member of each path (its `name` is NULL for plain files) */
+    int       count;     /**< Number of paths in the list */
+    int       capacity;  /**< Number of allocated elements in `paths` and `members` */
+} FileList;
+
+/**
+ * A tape file processed by a worker thread in batch mode
+ */
+typedef struct TapeJob {
+    const Command*  command;   /**< The commands to apply to the tape */
+    const char*     filename;  /**< The path of the tape file */
+    const ZipEntry* member;    /**< The member of the zip archive holding the tape, NULL if `filename` is the tape */
+    ThreadPool*     pool;      /**< The thread pool running the job */
+    FILE**          outputs;   /**< Where each output stream is written (temporary files when running in parallel) */
+    BOOL            deferred;  /**< TRUE if the job writes directly to the streams, so it runs on the calling thread */
+    int             err_code;  /**< Result of processing the tape */
+} TapeJob;
+
+/**
+ * Adds a copy of a path to a list of files.
+ * @param files  The file list.
+ * @param path   The path to add.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+BOOL add_file(FileList* files, const char* path) {
+    char **new_paths, *new_path; ZipEntry* new_members;
+    int capacity;
+    if( files->count == files->capacity ) {
+        capacity    = files->capacity ? files->capacity * 2 : 64;
+        new_paths   = (char**)realloc(files->paths, capacity * sizeof(char*));
+        if( new_paths ) { files->paths = new_paths; }
+        new_members = new_paths ? (ZipEntry*)realloc(files->members, capacity * sizeof(ZipEntry)) : NULL;
+        if( new_members ) { files->members = new_members; }
+        STATS_ADD(STATS_ALLOCATIONS, 2);
+        if( !new_paths || !new_members ) { return FALSE; }
+        files->capacity = capacity;
+    }
+    new_path = strdup_(path);
+    if( !new_path ) { return FALSE; }
+    memset(&files->members[ files->count ], 0, sizeof(ZipEntry));
+    files->paths[ files->count++ ] = new_path;
+    return TRUE;
+}
+
+/**
+ * Adds a tape stored in a zip archive to a list of files.
+ * 
+ * Its path is the path of the archive followed by '/' and the name of the
+ * member, so the tape is named after the member (e.g. "games.zip/GAME.TAP").
+ * 
+ * @param files    The file list.
+ * @param archive  The path of the zip archive.
+ * @param member   The member of the archive, from its directory.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+BOOL add_zip_member(FileList* files, const char* archive, const ZipEntry* member) {
+    char *path, *name;
+    BOOL success;
+    path    = alloc_concat5(archive, "/", member->name, NULL, NULL);
+    name    = strdup_(member->name);
+    success = path && name && add_file(files, path);
+    if( success ) {
+        files->members[ files->count - 1 ]      = *member;
+        files->members[ files->count - 1 ].name = name;
+    }
+    else { free(name); }
+    free(path);
+    return success;
+}
+
+/**
+ * Releases all memory used by a list of files.
+ * @param files The file list to release.
+ */
+void free_file_list(FileList* files) {
+    int i;
+    for( i = 0 ; i < files->count ; ++i ) { free(files->paths[i]); free(files->members[i].name); }
+    free(files->paths);
+    free(files->members);
+    memset(files, 0, sizeof(FileList));
+}
+
+/**
+ * Checks if a path has the ".tap" extension (case-insensitive).
+ * @param path The path to check.
+ * @return TRUE if the path ends with ".tap", FALSE otherwise.
+ */
+BOOL has_tap_extension(const char* path) {
+    return has_extension(path, ".tap");
+}
+
+/**
+ * Adds a tape file to a list of files, or all the tapes inside it if it is a zip archive.
+ * 
+ * Only the files without the ".tap" extension are checked, so the tapes
+ * are not opened twice. The members of an archive are added one by one,
+ * that way they are processed in parallel as any other tape.
+ * 
+ * @param files  The file list.
+ * @param path   The path of the file.
+ * @return TRUE on success, FALSE if there was not enough memory.
+ */
+BOOL add_tape_file(FileList* files, const char* path) {
+    ZipDirectory dir; FILE* file; BYTE magic[4];
+    BOOL is_zip, success = TRUE;
+    int i, tape_count = 0;
+
+    file   = has_tap_extension(path) ? NULL : fopen(path, "rb");
+    is_zip = file && fread(magic, 1, 4, file) == 4 && zip_is_archive(magic, 4);
+    if( !is_zip ) {
+        if( file ) { fclose(file); }
+        return add_file(files, path);
+    }
+    if( !zip_read_directory(&dir, file) ) {
+        fclose(file);
+        warning("Cannot read the directory of the zip archive '%s'", path);
+        return TRUE;
+    }
+    fclose(file);
+    for( i = 0 ; success && i < dir.count ; ++i ) {
+        if( !has_tap_extension(dir.entries[i].name) ) { continue; }
+        success = add_zip_member(files, path, &dir.entries[i]);
+        ++tape_count;
+    }
+    if( success && tape_count == 0 ) { warning("No tapes found in the zip archive '%s'", path); }
+    zip_free_directory(&dir);
+    return success;
+}
+
+/**
+ * Adds the tape files found in a directory entry (used with `for_each_dir_entry()`).
+ */
+BOOL _add_tape_files_entry(const char* path, BOOL is_dir, void* user_data) {
+    FileList* files = (FileList*)user_data;
+    if( is_dir ) { for_each_dir_entry(path, _add_tape_files_entry, files); return TRUE; }
+    if( has_tap_extension(path) ) { return add_file(files, path); }
+    if( has_extension(path, ".tap.gz") || has_extension(path, ".zip") ) { return add_tape_file(files, path); }
+    return TRUE;
+}
+
+/**
+ * Adds all the tape files (*.tap, *.tap.gz and the tapes in *.zip) found in a directory tree to a list of files.
+ * @param files  The file list.
+ * @param dir    The path of the directory to search recursively.
+ * @return TRUE on success, FALSE if the directory could not be read.
+ */
+BOOL add_tape_files_from_dir(FileList* files, const char* dir) {
+    return for_each_dir_entry(dir, _add_tape_files_entry, files);
+}
+
+/**
+ * Adds the paths listed in a text file (one per line) to a list of files.
+ * @param files      The file list.
+ * @param list_path  The path of the text file, or "-" to read the paths from stdin.
+ * @return TRUE on success, FALSE if the list could not be read.
+ */
+BOOL add_files_from_list(FileList* files, const char* list_path) {
+    char line[4096]; size_t length;
+    BOOL success = TRUE;
+    FILE* list_file = strcmp(list_path, "-")==0 ? stdin : fopen(list_path, "r");
+    if( !list_file ) { return FALSE; }
+
+    while( success && fgets(line, sizeof(line), list_file) ) {
+        length = strlen(line);
+        while( length>0 && (line[length-1]=='\n' || line[length-1]=='\r') ) { line[--length] = '\0'; }
+        if( length>0 ) { success = add_tape_file(files, line); }
+    }
+    if( list_file != stdin ) { fclose(list_file); }
+    return success;
+}
+
+/**
+ * Processes a tape file as a thread pool task (see `process_tape_files()`).
+ * @param arg Pointer to the TapeJob to process.
+ */
+void run_tape_job(void* arg) {
+    TapeJob* job = (TapeJob*)arg;
+    int i;
+    for( i = 0 ; i < job->command->stream_count ; ++i ) {
+        if( job->command->streams[i].has_header ) { fprintf(job->outputs[i], "==> %s <==\n", job->filename); }
+    }
+    job->err_code = process_tape_file(job->outputs, job->command, job->filename, job->member, job->pool);
+}
+
+/**
+ * Copies everything written to a temporary file to an output stream.
+ * @param output     The output stream.
+ * @param temp_file  The temporary file, it is closed after the copy.
+ * @return
+ *    TRUE if the whole file was copied, FALSE on any read or write error
+ */
+BOOL flush_temp_file(FILE* output, FILE* temp_file) {
+    char buffer[65536]; size_t size; BOOL success = TRUE;
+    if( fflush(temp_file) != 0 || fseek(temp_file, 0, SEEK_SET) != 0 ) { success = FALSE; }
+    while( success && (size = fread(buffer, 1, sizeof(buffer), temp_file)) > 0 ) {
+        success = fwrite(buffer, 1, size, output) == size;
+    }
+    if( ferror(temp_file) ) { success = FALSE; }
+    fclose(temp_file);
+    return success;
+}
+
+/**
+ * Processes a list of tape files, possibly in parallel.
+ * 
+ * Each tape is processed by a task of a thread pool with `job_count` threads,
+ * the same pool is also used to process the blocks of each tape in parallel.
+ * The outputs of each tape are collected separately and written to their
+ * streams in the same order as the files were given, so they never interleave.
+ * A tape whose outputs cannot be collected is processed by the calling thread
+ * once the previous tapes were written, and a failure to copy the collected
+ * output counts as a failure of that tape.
+ * 
+ * @param command    The commands to apply to each tape.
+ * @param files      The list of tape files.
+ * @param job_count  Number of tapes processed at the same time.
+ * @return
+ *    0 if all files were processed successfully, or 1 if any of them failed
+ */
+int process_tape_files(const Command* command, const FileList* files, int job_count) {
+    ThreadPool pool; TaskGroup group;
+    TapeJob* jobs; FILE** direct_outputs; FILE** outputs;
+    int i, s, first, last, chunk_size, failed_count = 0;
+    const int stream_count = command->stream_count;
+
+    /* the calling thread also runs tasks while it waits, so one thread less is started */
+    if( !thread_pool_init(&pool, job_count-1) ) { warning("Cannot start all the worker threads"); }
+
+    /* outputs[] holds the output files of every job in the current chunk, */
+    /* direct_outputs[] the streams themselves                            */
+    chunk_size     = pool.thread_count > 0 ? 8 * (pool.thread_count + 1) : 1;
+    jobs           = (TapeJob*)calloc(files->count, sizeof(TapeJob));
+    outputs        = (FILE**)calloc((size_t)chunk_size * stream_count, sizeof(FILE*));
+    direct_outputs = (FILE**)calloc(stream_count, sizeof(FILE*));
+    STATS_ADD(STATS_ALLOCATIONS, 3);
+    if( !jobs || !outputs || !direct_outputs ) {
+        error("Not enough memory"); thread_pool_destroy(&pool);
+        free(jobs); free(outputs); free(direct_outputs);
+        return 1;
+    }
+    for( s = 0 ; s < stream_count ; ++s ) { direct_outputs[s] = command->streams[s].file; }
+
+    /* a single tape is processed directly */
+    if( files->count == 1 ) {
+        failed_count = process_tape_file(direct_outputs, command, files->paths[0],
+                                         files->members[0].name ? &files->members[0] : NULL, &pool) ? 1 : 0;
+    }
+    /* several tapes are processed in chunks, so only a bounded number of outputs is kept */
+    for( first = 0 ; first < files->count && files->count > 1 ; first = last ) {
+        last = first + chunk_size < files->count ? first + chunk_size : files->count;
+        group.pending = 0;
+        for( i = first ; i < last ; ++i ) {
+            jobs[i].command  = command;
+            jobs[i].filename = files->paths[i];
+            jobs[i].member   = files->members[i].name ? &files->members[i] : NULL;
+            jobs[i].pool     = &pool;
+            jobs[i].outputs  = &outputs[ (i - first) * stream_count ];
+            jobs[i].deferred = pool.thread_count == 0;
+            for( s = 0 ; s < stream_count ; ++s ) { jobs[i].outputs[s] = NULL; }
+            for( s = 0 ; s < stream_count && !jobs[i].deferred ; ++s ) {
+                jobs[i].outputs[s] = tmpfile();
+                jobs[i].deferred   = jobs[i].outputs[s] == NULL;
+            }
+            /* without a temporary file for every stream the job would write to the shared   */
+            /* streams while other jobs do, so it runs on this thread when its turn comes    */
+            if( jobs[i].deferred ) {
+                for( s = 0 ; s < stream_count ; ++s ) {
+                    if( jobs[i].outputs[s] ) { fclose(jobs[i].outputs[s]); }
+                    jobs[i].outputs[s] = direct_outputs[s];
+                }
+            }
+            else { thread_pool_submit(&pool, &group, run_tape_job, &jobs[i]); }
+        }
+        thread_pool_wait(&pool, &group);
+        for( i = first ; i < last ; ++i ) {
+            if( jobs[i].deferred ) { run_tape_job(&jobs[i]); }
+            for( s = 0 ; s < stream_count && !jobs[i].deferred ; ++s ) {
+                if( !flush_temp_file(direct_outputs[s], jobs[i].outputs[s]) && !jobs[i].err_code ) {
+                    error("Cannot write the output of '%s'", jobs[i].filename);
+                    jobs[i].err_code = 1;
+                }
+            }
+            if( jobs[i].err_code ) { ++failed_count; }
+        }
+    }
+    thread_pool_destroy(&pool);
+
+    if( files->count > 1 ) {
+        for( i = 0 ; i < command->action_count && command->actions[i].cmd != CMD_VERIFY ; ++i ) { }
+        if( i < command->action_count ) {
+            fprintf(direct_outputs[ command->actions[i].stream ], "%d of %d files passed verification\n",
+                    files->count - failed_count, files->count);
+        }
+        else if( failed_count > 0 ) {
+            error("%d of %d files could not be processed", failed_count, files->count);
+        }
+    }
+    free(jobs); free(outputs); free(direct_outputs);
+    return failed_count > 0 ? 1 : 0;
+}
+
+/*-------------------------------- TAPE DIFF -------------------------------*/
+
+/* Maximum number of blocks inserted or removed that are aligned, beyond it the rest of the tapes are taken as replaced */
+#define DIFF_MAX_EDITS 2048
+
+/* Maximum number of ranges of different bytes reported for each changed data block */
+#define DIFF_MAX_RANGES 16
+
+/**
+ * One of the two tapes being compared
+ */
+typedef struct DiffTape {
+    const char*         filename;  /**< The path of the tape */
+    FileMap             map;       /**< The tape file mapped in memory (unused when `content` is set) */
+    BYTE*               content;   /**< The decompressed tape, for the tapes in gzip files or zip archives (NULL otherwise) */
+    ZXSTape             tape;      /**< The tape, in memory */
+    ZXSTapIndex         index;     /**< The block index of the tape */
+    unsigned long long* hashes;    /**< The hash of each block of `index` (type, checksum and payload) */
+} DiffTape;
+
+/**
+ * Reads a whole decompressed tape into memory.
+ * @param[in]  unzip     The Unzipper the tape is read through.
+ * @param[in]  filename  The name of the tape, for the error messages.
+ * @param[out] size      Receives the size of the tape in bytes.
+ * @return The allocated content of the tape, or NULL on error (then the error is reported).
+ */
+BYTE* read_unzipped_tape(Unzipper* unzip, const char* filename, size_t* size) {
+    BYTE *content = NULL, *grown;
+    size_t capacity = 0, count;
+
+    *size = 0;
+    do {
+        if( *size == capacity ) {
+            capacity = capacity ? 2 * capacity : ZXS_MAX_BLOCK_SIZE;
+            grown    = (BYTE*)realloc(content, capacity);
+            STATS_ADD(STATS_ALLOCATIONS, 1);
+            if( !grown ) { error("Not enough memory"); free(content); return NULL; }
+            content = grown;
+        }
+        count  = unzip_read(unzip, content + *size, capacity - *size);
+        *size += count;
+    } while( count > 0 );
+    if( unzip->error ) { error("Cannot decompress the tape '%s': %s", filename, unzip->error); free(content); return NULL; }
+    return content;
+}
+
+/**
+ * Loads a tape to compare, building its block index and the hash of every block.
+ * @param diff      The DiffTape structure to fill in (release it with `free_diff_tape()`).
+ * @param command   The global options (--robust).
+ * @param filename  The path of the tape file.
+ * @param member    The member of a zip archive to read (see `add_tape_file()`), or NULL if `filename` is the tape.
+ * @return TRUE on success, FALSE on error (then the error is reported).
+ */
+BOOL load_diff_tape(DiffTape* diff, const Command* command, const char* filename, const ZipEntry* member) {
+    Unzipper* unzip; FILE* file;
+    ZXSTapBlock block;
+    BOOL compressed = member != NULL;
+    size_t size;
+    int i;
+
+    memset(diff, 0, sizeof(DiffTape));
+    diff->filename = filename;
+    if( !member ) {
+        if( !map_file(&diff->map, filename) ) { error("Failed to open file '%s'", filename); return FALSE; }
+        compressed = gzip_is_file(diff->map.data, diff->map.size);
+        if( compressed ) { unmap_file(&diff->map); memset(&diff->map, 0, sizeof(FileMap)); }
+        else {
+            zxs_init_tape(&diff->tape, diff->map.data, diff->map.size);
+            diff->tape.fd = diff->map.fd;
+        }
+    }
+    /* compressed tapes are decompressed in memory, they are usually small */
+    if( compressed ) {
+        file  = member ? open_zip_archive_of(filename, member) : fopen(filename, "rb");
+        if( !file ) { if( !member ) { error("Failed to open file '%s'", filename); } return FALSE; }
+        unzip = (Unzipper*)malloc(sizeof(Unzipper));
+        STATS_ADD(STATS_ALLOCATIONS, 1);
+        if( !unzip ) { error("Not enough memory"); fclose(file); return FALSE; }
+        if( member ? unzip_open_member(unzip, file, member) : unzip_open(unzip, file) ) {
+            diff->content = read_unzipped_tape(unzip, filename, &size);
+        }
+        else { error("Cannot decompress the tape '%s': %s", filename, unzip->error); }
+        free(unzip);
+        fclose(file);
+        if( !diff->content ) { return FALSE; }
+        zxs_init_tape(&diff->tape, diff->content, size);
     }
-    free( output_dir );
+    diff->tape.robust = command->robust;
+    if( !build_tape_index(&diff->index, &diff->tape, NULL) ) {
+        error_indexing_tape(&diff->tape, filename); return FALSE;
+    }
+    if( diff->tape.resync_count > 0 ) {
+        warning("Skipped %u damaged areas of '%s' (%lu bytes)",
+                diff->tape.resync_count, filename, (unsigned long)diff->tape.skipped_bytes);
+    }
+    /* the seed of each hash mixes the flag, the checksum and the size of the block */
+    diff->hashes = (unsigned long long*)malloc((diff->index.entry_count + 1) * sizeof(unsigned long long));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !diff->hashes ) { error("Not enough memory"); return FALSE; }
+    for( i = 0 ; i < diff->index.entry_count ; ++i ) {
+        if( !zxs_index_block(&diff->index, i, &block) ) { error("Cannot read the block %d of '%s'", i + 1, filename); return FALSE; }
+        diff->hashes[i] = hash64(block.data, block.datasize,
+                                 block.type ^ ((unsigned long long)block.checksum << 8) ^ ((unsigned long long)block.datasize << 16));
+    }
+    return TRUE;
+}
+
+/**
+ * Releases all the resources of a tape loaded with `load_diff_tape()`.
+ */
+void free_diff_tape(DiffTape* diff) {
+    zxs_free_index(&diff->index);
+    zxs_free_tape(&diff->tape);
+    free(diff->hashes);
+    free(diff->content);
+    if( diff->map.data || diff->map.size ) { unmap_file(&diff->map); }
+    memset(&diff->map, 0, sizeof(FileMap));
+    diff->hashes = NULL; diff->content = NULL;
+}
+
+/**
+ * Aligns two sequences of block hashes, finding the shortest list of blocks removed and added (Myers' algorithm).
+ *
+ * When more than DIFF_MAX_EDITS blocks are removed or added, the search
+ * is abandoned and all the blocks of `a` are taken as replaced by the
+ * blocks of `b`, which is still a valid (although longer) alignment.
+ *
+ * @param[out] ops  Receives one operation per step: '=' (block in both), '-' (block of `a` removed) or '+' (block of `b` added).
+ *                  It must have room for `n + m` operations.
+ * @param[in]  a    The hashes of the blocks of the first tape.
+ * @param[in]  n    Number of blocks in `a`.
+ * @param[in]  b    The hashes of the blocks of the second tape.
+ * @param[in]  m    Number of blocks in `b`.
+ * @return The number of operations stored in `ops`, or -1 if there was not enough memory.
+ */
+int align_diff_blocks(char* ops, const unsigned long long* a, int n, const unsigned long long* b, int m) {
+    int *trace, *v, *prev;
+    int max_edits, d, k, x, y, prev_k, count, i;
+    char op;
+
+    /* the V array of the step `d` holds 2*d+1 points and starts at `trace + d*d` */
+    max_edits = n + m < DIFF_MAX_EDITS ? n + m : DIFF_MAX_EDITS;
+    trace     = (int*)malloc((size_t)(max_edits + 1) * (max_edits + 1) * sizeof(int));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    if( !trace ) { return -1; }
+
+    for( d = 0 ; d <= max_edits ; ++d ) {
+        v = trace + d * d + d; prev = trace + (d - 1) * (d - 1) + (d - 1);
+        for( k = -d ; k <= d ; k += 2 ) {
+            if     ( d == 0 )                                        { x = 0;           }
+            else if( k == -d || (k != d && prev[k - 1] < prev[k + 1]) ) { x = prev[k + 1];  }
+            else                                                     { x = prev[k - 1] + 1; }
+            for( y = x - k ; x < n && y < m && a[x] == b[y] ; ++x, ++y ) { }
+            v[k] = x;
+            if( x >= n && y >= m ) { break; }
+        }
+        if( k <= d ) { break; }
+    }
+    if( d > max_edits ) {
+        /* too many differences, replace everything */
+        for( count = 0 ; count < n ; ++count ) { ops[count] = '-'; }
+        for( i = 0 ; i < m ; ++i ) { ops[count++] = '+'; }
+        free(trace);
+        return count;
+    }
+
+    /* walk backwards from the end through the steps found, the operations come out reversed */
+    count = 0; x = n; y = m;
+    for( ; d > 0 ; --d ) {
+        prev = trace + (d - 1) * (d - 1) + (d - 1);
+        k    = x - y;
+        if( k == -d || (k != d && prev[k - 1] < prev[k + 1]) ) { prev_k = k + 1; op = '+'; }
+        else                                                   { prev_k = k - 1; op = '-'; }
+        for( ; x > prev[prev_k] + (op == '-') && y > prev[prev_k] - prev_k + (op == '+') ; --x, --y ) { ops[count++] = '='; }
+        ops[count++] = op;
+        x = prev[prev_k]; y = x - prev_k;
+    }
+    for( ; x > 0 ; --x ) { ops[count++] = '='; }
+    for( i = 0 ; i < count / 2 ; ++i ) { op = ops[i]; ops[i] = ops[count - 1 - i]; ops[count - 1 - i] = op; }
+    free(trace);
+    return count;
+}
+
+/**
+ * Returns the header of the data block at a position of the index, or NULL if the block is not preceded by a header.
+ */
+const ZXSHeader* get_data_block_header(const ZXSTapIndex* index, int position) {
+    if( position < 1 || index->entries[position].is_header || !index->entries[position - 1].is_header ) { return NULL; }
+    return &index->entries[position - 1].header;
+}
+
+/**
+ * Prints the description of a block of a tape being compared, e.g. `+ block 3: header "game" BASIC-PROGRAM`.
+ * @param output        The output stream.
+ * @param mark          The character that starts the line: '-' removed, '+' added or '~' changed.
+ * @param diff          The tape of the block.
+ * @param position      The position of the block in the index of the tape.
+ * @param old_position  The position of the block in the old tape when it changed, -1 otherwise.
+ */
+void fprint_diff_block(FILE* output, char mark, const DiffTape* diff, int position, int old_position) {
+    const ZXSIndexEntry* entry = &diff->index.entries[position];
+    const ZXSHeader* header;
+    char datatype_name_buffer[32];
+
+    fprintf(output, "%c block ", mark);
+    if( old_position >= 0 ) { fprintf(output, "%d -> ", old_position + 1); }
+    fprintf(output, "%d", position + 1);
+    if( entry->is_header ) {
+        fprintf(output, ": header \"%s\" %s\n", entry->header.filename,
+                zxs_get_datatype_name(entry->header.datatype, datatype_name_buffer));
+    }
+    else if( (header = get_data_block_header(&diff->index, position)) != NULL ) {
+        fprintf(output, ": data of \"%s\", %u bytes\n", header->filename, entry->datasize);
+    }
+    else {
+        fprintf(output, ": data (flag %02X), %u bytes\n", (unsigned)entry->type, entry->datasize);
+    }
+}
+
+/**
+ * Prints the fields that differ between two headers.
+ */
+void fprint_header_diff(FILE* output, const ZXSIndexEntry* old_entry, const ZXSIndexEntry* new_entry) {
+    const ZXSHeader *a = &old_entry->header, *b = &new_entry->header;
+    char name_a[32], name_b[32];
+
+    if( strcmp(a->filename, b->filename) != 0 ) { fprintf(output, "      name: \"%s\" -> \"%s\"\n", a->filename, b->filename); }
+    if( a->datatype != b->datatype ) {
+        fprintf(output, "      type: %s -> %s\n",
+                zxs_get_datatype_name(a->datatype, name_a), zxs_get_datatype_name(b->datatype, name_b));
+    }
+    if( a->length != b->length ) { fprintf(output, "      length: %u -> %u\n", a->length, b->length); }
+    if( a->param1 != b->param1 ) { fprintf(output, "      param1: %u -> %u\n", a->param1, b->param1); }
+    if( a->param2 != b->param2 ) { fprintf(output, "      param2: %u -> %u\n", a->param2, b->param2); }
+}
+
+/**
+ * Reads the next line of a BASIC program.
+ * @param[in]     data     The tokenized BASIC program.
+ * @param[in]     size     Size of the program (including its variables) in bytes.
+ * @param[in,out] offset   Offset of the line, updated to the offset of the next one.
+ * @param[out]    number   Receives the line number.
+ * @param[out]    length   Receives the length of the line in bytes, it starts at `*offset - length`.
+ * @return TRUE if a line was read, FALSE at the end of the program (where its variables start, if any).
+ */
+BOOL next_basic_line(const BYTE* data, unsigned size, unsigned* offset, unsigned* number, unsigned* length) {
+    if( *offset + 4 > size ) { return FALSE; }
+    *number = GET_BE_WORD(data, *offset);
+    *length = GET_LE_WORD(data, *offset + 2);
+    if( *number >= 16384 || *offset + 4 + *length > size ) { return FALSE; }
+    *offset += 4 + *length;
+    return TRUE;
+}
+
+/**
+ * Prints a detokenized line of a BASIC program, prefixed by '-' or '+'.
+ */
+void fprint_diff_basic_line(FILE* output, char mark, unsigned number, const BYTE* line, unsigned length) {
+    fprintf(output, "      %c%5u", mark, number);
+    zxs_fprint_basic_line(output, line, length);
+    if( length == 0 || line[length - 1] != 0x0D ) { fputc('\n', output); }
+}
+
+/**
+ * Prints the lines that differ between two BASIC programs, matched by their line numbers.
+ * The variables saved with the programs are only compared as a whole.
+ */
+void fprint_basic_diff(FILE* output, const BYTE* a, unsigned size_a, const BYTE* b, unsigned size_b) {
+    unsigned offset_a = 0, offset_b = 0, next_a, next_b;
+    unsigned number_a = 0, number_b = 0, length_a = 0, length_b = 0;
+    BOOL has_a, has_b;
+
+    next_a = offset_a; has_a = next_basic_line(a, size_a, &next_a, &number_a, &length_a);
+    next_b = offset_b; has_b = next_basic_line(b, size_b, &next_b, &number_b, &length_b);
+    while( has_a || has_b ) {
+        if( has_a && has_b && number_a == number_b ) {
+            if( length_a != length_b || memcmp(a + offset_a + 4, b + offset_b + 4, length_a) != 0 ) {
+                fprint_diff_basic_line(output, '-', number_a, a + offset_a + 4, length_a);
+                fprint_diff_basic_line(output, '+', number_b, b + offset_b + 4, length_b);
+            }
+            offset_a = next_a; has_a = next_basic_line(a, size_a, &next_a, &number_a, &length_a);
+            offset_b = next_b; has_b = next_basic_line(b, size_b, &next_b, &number_b, &length_b);
+        }
+        else if( has_a && (!has_b || number_a < number_b) ) {
+            fprint_diff_basic_line(output, '-', number_a, a + offset_a + 4, length_a);
+            offset_a = next_a; has_a = next_basic_line(a, size_a, &next_a, &number_a, &length_a);
+        }
+        else {
+            fprint_diff_basic_line(output, '+', number_b, b + offset_b + 4, length_b);
+            offset_b = next_b; has_b = next_basic_line(b, size_b, &next_b, &number_b, &length_b);
+        }
+    }
+    if( size_a - offset_a != size_b - offset_b || memcmp(a + offset_a, b + offset_b, size_a - offset_a) != 0 ) {
+        fprintf(output, "      variables: %u -> %u bytes\n", size_a - offset_a, size_b - offset_b);
+    }
+}
+
+/**
+ * Prints the ranges of bytes that differ between two blocks.
+ * @param output   The output stream.
+ * @param a        The data of the old block.
+ * @param size_a   Size of `a` in bytes.
+ * @param b        The data of the new block.
+ * @param size_b   Size of `b` in bytes.
+ * @param address  The address where the code is loaded, or -1 if the blocks are not binary code.
+ */
+void fprint_bytes_diff(FILE* output, const BYTE* a, unsigned size_a, const BYTE* b, unsigned size_b, long address) {
+    unsigned common = size_a < size_b ? size_a : size_b, offset, start;
+    int range_count = 0;
+
+    for( offset = 0 ; offset < common ; ) {
+        if( a[offset] == b[offset] ) { ++offset; continue; }
+        for( start = offset ; offset < common && a[offset] != b[offset] ; ++offset ) { }
+        if( ++range_count > DIFF_MAX_RANGES ) { continue; }
+        fprintf(output, "      bytes %04X-%04X", start, offset - 1);
+        if( address >= 0 ) {
+            fprintf(output, " (address %04lX-%04lX)", (address + start) & 0xFFFF, (address + offset - 1) & 0xFFFF);
+        }
+        fprintf(output, ": %u differ\n", offset - start);
+    }
+    if( range_count > DIFF_MAX_RANGES ) { fprintf(output, "      ... and %d more ranges\n", range_count - DIFF_MAX_RANGES); }
+    if( size_a != size_b ) { fprintf(output, "      size: %u -> %u bytes\n", size_a, size_b); }
+}
+
+/**
+ * Prints how a block changed from one tape to the other, decoding the blocks as needed.
+ * @param output     The output stream.
+ * @param a          The old tape.
+ * @param position_a The position of the block in the old tape.
+ * @param b          The new tape.
+ * @param position_b The position of the block in the new tape.
+ */
+void fprint_changed_block(FILE* output, const DiffTape* a, int position_a, const DiffTape* b, int position_b) {
+    const ZXSIndexEntry *entry_a = &a->index.entries[position_a], *entry_b = &b->index.entries[position_b];
+    const ZXSHeader *header_a, *header_b;
+    ZXSTapBlock block_a, block_b;
+    BOOL same_payload;
+
+    fprint_diff_block(output, '~', b, position_b, position_a);
+    if( !zxs_index_block(&a->index, position_a, &block_a) || !zxs_index_block(&b->index, position_b, &block_b) ) { return; }
+    same_payload = block_a.datasize == block_b.datasize && memcmp(block_a.data, block_b.data, block_a.datasize) == 0;
+    header_a     = get_data_block_header(&a->index, position_a);
+    header_b     = get_data_block_header(&b->index, position_b);
+    if( same_payload ) {
+        /* only the flag or the checksum stored in the tape changed */
+        if( block_a.type != block_b.type ) { fprintf(output, "      flag: %02X -> %02X\n", (unsigned)block_a.type, (unsigned)block_b.type); }
+        if( block_a.checksum != block_b.checksum ) { fprintf(output, "      checksum: %02X -> %02X\n", block_a.checksum, block_b.checksum); }
+    }
+    else if( entry_a->is_header ) {
+        fprint_header_diff(output, entry_a, entry_b);
+    }
+    else if( header_a && header_b && header_a->datatype == ZXS_DATATYPE_BASIC && header_b->datatype == ZXS_DATATYPE_BASIC ) {
+        fprint_basic_diff(output, block_a.data, block_a.datasize, block_b.data, block_b.datasize);
+    }
+    else {
+        fprint_bytes_diff(output, block_a.data, block_a.datasize, block_b.data, block_b.datasize,
+                          header_b && header_b->datatype == ZXS_DATATYPE_CODE ? (long)header_b->param1 : -1L);
+    }
+}
+
+/**
+ * Compares two tapes block by block and prints their differences.
+ *
+ * The blocks are compared by their hashes and aligned, so blocks inserted
+ * or removed are reported as such. Within each run of blocks that differ,
+ * a removed block and an added block of the same kind (header or data)
+ * are reported as one block that changed: the fields of the headers that
+ * differ, the lines of the BASIC programs or the ranges of bytes of any
+ * other data. Only those blocks are decoded.
+ *
+ * @param command  The global options (--robust).
+ * @param files    The two tapes, the old one first.
+ * @return 0 if the tapes have the same blocks, 1 if they differ or 2 on error.
+ */
+int diff_tapes(const Command* command, const FileList* files) {
+    DiffTape tapes[2], *a = &tapes[0], *b = &tapes[1];
+    FILE* output = stdout;
+    char* ops;
+    int n, m, prefix, suffix, count, o, i, j, end, ia, ib;
+    int unchanged = 0, changed = 0, removed = 0, added = 0;
+
+    for( i = 0 ; i < 2 ; ++i ) {
+        if( !load_diff_tape(&tapes[i], command, files->paths[i], files->members[i].name ? &files->members[i] : NULL) ) {
+            if( i == 1 ) { free_diff_tape(a); }
+            free_diff_tape(&tapes[i]);
+            return 2;
+        }
+    }
+    n = a->index.entry_count;
+    m = b->index.entry_count;
+    ops = (char*)malloc(n + m + 1);
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+
+    /* the blocks at the start and end of both tapes are usually the same, only the middle is aligned */
+    for( prefix = 0 ; prefix < n && prefix < m && a->hashes[prefix] == b->hashes[prefix] ; ++prefix ) { }
+    for( suffix = 0 ; suffix < n - prefix && suffix < m - prefix && a->hashes[n - 1 - suffix] == b->hashes[m - 1 - suffix] ; ++suffix ) { }
+    count = ops ? align_diff_blocks(ops + prefix, a->hashes + prefix, n - prefix - suffix, b->hashes + prefix, m - prefix - suffix) : -1;
+    if( count < 0 ) { error("Not enough memory"); free(ops); free_diff_tape(a); free_diff_tape(b); return 2; }
+    memset(ops, '=', prefix);
+    memset(ops + prefix + count, '=', suffix);
+    count += prefix + suffix;
+
+    fprintf(output, "--- %s\n+++ %s\n", a->filename, b->filename);
+    for( o = 0, i = 0, j = 0 ; o < count ; ) {
+        if( ops[o] == '=' ) { ++unchanged; ++i; ++j; ++o; continue; }
+
+        /* a run of blocks removed and added, pairing those of the same kind */
+        for( end = o ; end < count && ops[end] != '=' ; ++end ) { }
+        ia = i; ib = j;
+        for( ; o < end ; ++o ) { if( ops[o] == '-' ) { ++i; } else { ++j; } }
+        while( ia < i || ib < j ) {
+            if( ia < i && ib < j && a->index.entries[ia].is_header == b->index.entries[ib].is_header ) {
+                fprint_changed_block(output, a, ia++, b, ib++); ++changed;
+            }
+            else if( ia < i && !(ib + 1 < j && b->index.entries[ib + 1].is_header == a->index.entries[ia].is_header) ) {
+                fprint_diff_block(output, '-', a, ia++, -1); ++removed;
+            }
+            else {
+                fprint_diff_block(output, '+', b, ib++, -1); ++added;
+            }
+        }
+    }
+    fprintf(output, "%d unchanged, %d changed, %d removed, %d added blocks\n", unchanged, changed, removed, added);
+
+    free(ops);
+    free_diff_tape(a);
+    free_diff_tape(b);
+    return unchanged == n && unchanged == m ? 0 : 1;
+}
+
+/*------------------------------- SERVER MODE ------------------------------*/
+
+/* Maximum size of a request, the command plus the tape */
+#define SERVE_MAX_REQUEST (64 << 20)
+
+/* Size of the chunks in which the requests that are too large are skipped */
+#define SERVE_SKIP_SIZE 4096
+
+/* Name of the tape of every request, written in the block lists */
+#define SERVE_TAPE_NAME "request"
+
+/**
+ * The buffers used to answer requests, reused from one request to the next
+ */
+typedef struct ServeWorker {
+    BYTE*               request;        /**< The last request read (grown as needed) */
+    size_t              request_size;   /**< Number of allocated bytes in `request` */
+    char*               text;           /**< Where the blocks are rendered (grown as needed) */
+    size_t              text_size;      /**< Number of allocated bytes in `text` */
+    char*               response;       /**< Where the responses are built (grown as needed) */
+    size_t              response_size;  /**< Number of allocated bytes in `response` */
+    struct ServeWorker* next;           /**< Next idle worker of the server */
+} ServeWorker;
+
+/**
+ * A server that answers the requests of its clients
+ * 
+ * Each request is one frame: a 32-bit little-endian length followed by
+ * that many bytes, the command line (`list`, `print N`, `print :NAME`,
+ * `basic`, `code` or `verify`) ended by a newline and then the bytes of
+ * the tape. Each response is one frame with newline delimited JSON: the
+ * objects produced by the command followed by a status object, e.g.
+ * {"status":"ok"} or {"status":"error","message":"..."}.
+ */
+typedef struct Server {
+    const Command* command;      /**< The global options (--robust, --max-memory) applied to every tape */
+    ThreadPool*    pool;         /**< The thread pool used by all the requests */
+    Mutex          lock;         /**< Protects `idle` */
+    ServeWorker*   idle;         /**< The workers whose buffers are not in use */
+} Server;
+
+/**
+ * Takes an idle worker of the server, creating a new one if all of them are in use.
+ * @return The worker, or NULL if out of memory.
+ */
+ServeWorker* take_serve_worker(Server* server) {
+    ServeWorker* worker;
+    mutex_lock(&server->lock);
+    worker = server->idle;
+    if( worker ) { server->idle = worker->next; }
+    mutex_unlock(&server->lock);
+    if( worker ) { return worker; }
+
+    /* its buffers are allocated by the first requests */
+    worker = (ServeWorker*)calloc(1, sizeof(ServeWorker));
+    STATS_ADD(STATS_ALLOCATIONS, 1);
+    return worker;
+}
+
+/**
+ * Returns a worker to the server, keeping its buffers for the next requests.
+ */
+void release_serve_worker(Server* server, ServeWorker* worker) {
+    mutex_lock(&server->lock);
+    worker->next = server->idle;
+    server->idle = worker;
+    mutex_unlock(&server->lock);
+}
+
+/**
+ * Reads the next request frame.
+ * @param input   The stream where the requests come from.
+ * @param worker  The worker that receives the request in its `request` buffer.
+ * @param size    Receives the size of the request (0 if it was too large and was discarded).
+ * @return TRUE if a frame was read, FALSE at the end of the input or if it was truncated.
+ */
+BOOL read_serve_request(FILE* input, ServeWorker* worker, size_t* size) {
+    BYTE prefix[4], *new_request; unsigned long length;
+    char skipped[SERVE_SKIP_SIZE]; size_t chunk;
+
+    if( fread(prefix, 1, 4, input) != 4 ) { return FALSE; }
+    length = GET_LE_DWORD(prefix, 0);
+    *size  = (size_t)length;
+    if( length <= SERVE_MAX_REQUEST && *size + 1 > worker->request_size ) {
+        new_request = (BYTE*)realloc(worker->request, *size + 1);
+        STATS_ADD(STATS_ALLOCATIONS, 1);
+        if( new_request ) { worker->request = new_request; worker->request_size = *size + 1; }
+    }
+    if( *size + 1 > worker->request_size ) {
+        /* too large, its bytes are skipped to stay in sync with the client */
+        for( *size = 0 ; length > 0 ; length -= (unsigned long)chunk ) {
+            chunk = length < SERVE_SKIP_SIZE ? (size_t)length : SERVE_SKIP_SIZE;
+            if( fread(skipped, 1, chunk, input) != chunk ) { return FALSE; }
+        }
+        return TRUE;
+    }
+    if( fread(worker->request, 1, *size, input) != *size ) { return FALSE; }
+    worker->request[*size] = '\0';
+    return TRUE;
+}
+
+/**
+ * Writes the status object that ends a response.
+ * @param out      The output buffer of the response.
+ * @param message  The error message, or NULL if the request succeeded.
+ */
+void write_serve_status(OutBuf* out, const char* message) {
+    if( !message ) { out_buf_write(out, "{\"status\":\"ok\"}\n", 16); return; }
+    out_buf_write(out, "{\"status\":\"error\",\"message\":", 28);
+    out_buf_put_json_string(out, message, strlen(message));
+    out_buf_write(out, "}\n", 2);
+}
+
+/**
+ * Writes a data block rendered as text, as a JSON object with the header of the block.
+ * @param out       The output buffer of the response.
+ * @param worker    The worker, its `text` buffer is used to render the block.
+ * @param index     The block index of the tape.
+ * @param position  The position of the header within the index entries.
+ * @return NULL on success, or the error message.
+ */
+const char* write_serve_block(OutBuf* out, ServeWorker* worker, const ZXSTapIndex* index, int position) {
+    const ZXSHeader* header = &index->entries[position].header;
+    ZXSTapBlock block; OutBuf text;
+    int err_code;
+
+    if( header->datatype > ZXS_DATATYPE_CODE ) { return "Unknown data type in header"; }
+    if( !zxs_index_block(index, position+1, &block) ) { return "No data block found after the header"; }
+    out_buf_init_memory(&text, worker->text, worker->text_size);
+    err_code = write_zx_tap_data(&text, header, &block);
+    worker->text      = text.data;
+    worker->text_size = text.size;
+    if( text.err_code ) { return "Not enough memory to render the block"; }
+    if( err_code      ) { return zxs_get_error_message(err_code); }
+
+    out_buf_write(out, "{\"index\":", 9);     out_buf_put_uint(out, (unsigned)position + 1, 0);
+    out_buf_write(out, ",\"datatype\":", 12); out_buf_put_uint(out, header->datatype, 0);
+    out_buf_write(out, ",\"filename\":", 12); out_buf_put_json_string(out, header->filename, strlen(header->filename));
+    out_buf_write(out, ",\"text\":", 8);      out_buf_put_json_string(out, text.data, text.length);
+    out_buf_write(out, "}\n", 2);
+    return NULL;
+}
+
+/**
+ * Writes the checksum verification of a tape, one object per corrupt block plus a summary.
+ * @param out    The output buffer of the response.
+ * @param index  The block index of the tape.
+ */
+void write_serve_verification(OutBuf* out, const ZXSTapIndex* index) {
+    int i, corrupt_count = 0;
+    for( i = 0 ; i < index->entry_count ; ++i ) {
+        if( is_checksum_ok(index, i) ) { continue; }
+        out_buf_write(out, "{\"index\":", 9);   out_buf_put_uint(out, (unsigned)i + 1, 0);
+        out_buf_write(out, ",\"offset\":", 10); out_buf_put_uint(out, (unsigned)index->entries[i].offset, 0);
+        out_buf_write(out, ",\"checksum_ok\":false}\n", 22);
+        ++corrupt_count;
+    }
+    out_buf_write(out, "{\"blocks\":", 10);        out_buf_put_uint(out, (unsigned)index->entry_count, 0);
+    out_buf_write(out, ",\"corrupt_blocks\":", 18); out_buf_put_uint(out, (unsigned)corrupt_count, 0);
+    out_buf_write(out, ",\"skipped_bytes\":", 17);  out_buf_put_uint(out, (unsigned)index->tape->skipped_bytes, 0);
+    out_buf_write(out, "}\n", 2);
+}
+
+/**
+ * Answers one request, writing the objects of its response to an output buffer.
+ * @param out     The output buffer of the response.
+ * @param server  The server.
+ * @param worker  The worker, holding the request in its `request` buffer.
+ * @param size    Size of the request (0 if it was discarded).
+ */
+void answer_serve_request(OutBuf* out, Server* server, ServeWorker* worker, size_t size) {
+    char *line, *arg, *end;
+    const char *message = NULL;
+    const BYTE* data;
+    ZXSTape tape; ZXSTapIndex index; MemoryBudget budget;
+    int i, position;
+
+    if( size == 0 ) { write_serve_status(out, "The request is empty or too large"); return; }
+    line = (char*)worker->request;
+    end  = (char*)memchr(line, '\n', size);
+    if( !end ) { write_serve_status(out, "The command line of the request is not ended by a newline"); return; }
+    *end = '\0';
+    data = (const BYTE*)(end + 1);
+    arg  = strchr(line, ' ');
+    if( arg ) { *arg++ = '\0'; }
+
+    /* the tape is indexed in place, in the request buffer */
+    zxs_init_tape(&tape, data, size - (size_t)(data - worker->request));
+    tape.robust    = server->command->robust;
+    tape.allocator = init_memory_budget(&budget, server->command->max_memory);
+    memset(&index, 0, sizeof(index));
+    index.allocator = tape.allocator;
+    if( !build_tape_index(&index, &tape, server->pool) ) {
+        message = budget.exceeded ? "Indexing the tape exceeds the memory budget" : "Not enough memory to index the tape";
+    }
+    else if( strcmp(line, "list") == 0 ) {
+        for( i = 0 ; i < index.entry_count ; ++i ) { write_block_list_ndjson_entry(out, &index, i, SERVE_TAPE_NAME); }
+    }
+    else if( strcmp(line, "verify") == 0 ) {
+        write_serve_verification(out, &index);
+    }
+    else if( strcmp(line, "print") == 0 || strcmp(line, "basic") == 0 || strcmp(line, "code") == 0 ) {
+        if( line[0] == 'p' && !arg ) { message = "Missing the block to print"; }
+        else {
+            position = line[0] == 'p' ? find_zx_tap_header(&index, get_selected_name(arg), get_selected_name(arg) ? -1 : atoi(arg), ZXS_DATATYPE_ANY)
+                     : find_zx_tap_header(&index, NULL, -1, line[0] == 'b' ? ZXS_DATATYPE_BASIC : ZXS_DATATYPE_CODE);
+            if( position < 0 ) { message = "No block found"; }
+            else               { message = write_serve_block(out, worker, &index, position); }
+        }
+    }
+    else {
+        message = "Unknown command";
+    }
+    write_serve_status(out, message);
+    zxs_free_index(&index);
+    zxs_free_tape(&tape);
+    free_memory_budget(&budget);
+}
+
+/**
+ * Answers all the requests read from a stream until it ends.
+ * @param server  The server.
+ * @param input   The stream where the requests come from.
+ * @param output  The stream where the responses are written.
+ * @return TRUE if the input ended normally, FALSE if a response could not be written.
+ */
+BOOL serve_stream(Server* server, FILE* input, FILE* output) {
+    ServeWorker* worker;
+    BYTE prefix[4]; size_t size;
+    BOOL success = TRUE;
+    OutBuf out;
+
+    worker = take_serve_worker(server);
+    if( !worker ) { error("Not enough memory"); return FALSE; }
+#   ifdef _WIN32
+    _setmode(_fileno(input), _O_BINARY); _setmode(_fileno(output), _O_BINARY);
+#   endif
+    while( success && read_serve_request(input, worker, &size) ) {
+        /* the whole response is built in memory, its length goes first */
+        out_buf_init_memory(&out, worker->response, worker->response_size);
+        answer_serve_request(&out, server, worker, size);
+        worker->response      = out.data;
+        worker->response_size = out.size;
+        if( out.err_code ) { error("Not enough memory to answer a request"); success = FALSE; break; }
+        SET_LE_DWORD(prefix, 0, (unsigned long)out.length);
+        success = fwrite(prefix, 1, 4, output) == 4
+               && fwrite(out.data, 1, out.length, output) == out.length
+               && fflush(output) == 0;
+    }
+    release_serve_worker(server, worker);
+    return success;
+}
+
+#ifndef _WIN32
+
+/**
+ * A connection of a client to the server socket
+ */
+typedef struct ServeConnection {
+    Server*  server;         /**< The server */
+    int      fd;             /**< The socket of the connection */
+} ServeConnection;
+
+/**
+ * Answers the requests of a connection on its own thread, closing it when the client does.
+ * @param arg  Pointer to the ServeConnection, freed when finished.
+ */
+void* run_serve_connection(void* arg) {
+    ServeConnection* connection = (ServeConnection*)arg;
+    FILE *input, *output = NULL;
+    int output_fd;
+
+    input     = fdopen(connection->fd, "rb");
+    output_fd = input ? dup(connection->fd) : -1;
+    output    = output_fd >= 0 ? fdopen(output_fd, "wb") : NULL;
+    if( input && output ) { serve_stream(connection->server, input, output); }
+    if( output ) { fclose(output); } else if( output_fd >= 0 ) { close(output_fd); }
+    if( input  ) { fclose(input);  } else { close(connection->fd); }
+    free(connection);
+    return NULL;
+}
+
+/**
+ * Answers the requests of the clients connected to a Unix domain socket, until the process is stopped.
+ * Each connection is answered by its own thread, so an idle client never holds up the others,
+ * while the thread pool is only used to index the tapes of the requests.
+ * @param server  The server.
+ * @param path    The path of the socket, it must not exist.
+ * @return 1 if the socket could not be created (otherwise it does not return).
+ */
+int serve_socket(Server* server, const char* path) {
+    struct sockaddr_un address;
+    ServeConnection* connection;
+    pthread_t thread;
+    int listen_fd, fd;
+
+    if( strlen(path) >= sizeof(address.sun_path) ) { error("The socket path '%s' is too long", path); return 1; }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, 64) != 0 ) {
+        error("Cannot listen on the socket '%s'", path);
+        if( listen_fd >= 0 ) { close(listen_fd); }
+        return 1;
+    }
+    /* a client that goes away must not end the server */
+    signal(SIGPIPE, SIG_IGN);
+    for( ;; ) {
+        fd = accept(listen_fd, NULL, NULL);
+        if( fd < 0 ) { continue; }
+        connection = (ServeConnection*)malloc(sizeof(ServeConnection));
+        if( !connection ) { close(fd); continue; }
+        connection->server = server;
+        connection->fd     = fd;
+        if( pthread_create(&thread, NULL, run_serve_connection, connection) != 0 ) {
+            warning("Cannot start a thread for a new connection");
+            close(fd); free(connection); continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+#endif /* !_WIN32 */
+
+/**
+ * Runs the server mode, answering requests until the input ends.
+ * @param command      The global options applied to every tape of the requests.
+ * @param socket_path  The Unix domain socket where the clients connect, or NULL to use stdin/stdout.
+ * @param job_count    Number of threads of the pool shared by all the requests.
+ * @return
+ *    0 on success, or 1 if the server could not be started or a response could not be written
+ */
+int run_server(const Command* command, const char* socket_path, int job_count) {
+    ServeWorker* worker;
+    ThreadPool pool;
+    Server server;
+    int err_code;
+
+    /* with a socket the main thread only accepts connections, with stdio it also answers */
+    if( !thread_pool_init(&pool, socket_path ? job_count : job_count - 1) ) { warning("Cannot start all the worker threads"); }
+    memset(&server, 0, sizeof(server));
+    server.command = command;
+    server.pool    = &pool;
+    mutex_init(&server.lock);
+#   ifdef _WIN32
+    if( socket_path ) { error("Unix domain sockets are not supported on this platform, use --serve"); err_code = 1; }
+#   else
+    if( socket_path ) { err_code = serve_socket(&server, socket_path); }
+#   endif
+    else              { err_code = serve_stream(&server, stdin, stdout) ? 0 : 1; }
+
+    while( (worker = server.idle) != NULL ) {
+        server.idle = worker->next;
+        free(worker->response); free(worker->text); free(worker->request); free(worker);
+    }
+    mutex_destroy(&server.lock);
+    thread_pool_destroy(&pool);
     return err_code;
 }
 
+/**
+ * Adds an action to the command.
+ * @param command      The command being built from the command line.
+ * @param cmd          The command of the action.
+ * @param print_param  For CMD_PRINT, the parameter given to --print.
+ * @return The added action.
+ */
+Action* add_action(Command* command, CMD cmd, const char* print_param) {
+    Action* action = &command->actions[ command->action_count++ ];
+    memset(action, 0, sizeof(Action));
+    action->cmd            = cmd;
+    action->selected_index = -1;
+    action->format         = LIST_FORMAT_TEXT;
+    if( cmd == CMD_PRINT ) {
+        action->selected_name  = get_selected_name(print_param);
+        action->selected_index = action->selected_name ? -1 : atoi(print_param);
+    }
+    return action;
+}
 
 /**
- * Converts ZX-Spectrum TAP file to HEX Intel format
- * @param output_filename  The name of the output file where the converted HEX data will be written.
- *                         If the file already exists, it will be overwritten. 
- * @param tap_file         Pointer to the TAP file stream (must be opened in read mode).
- * @return 0 on successful completion. 
+ * Opens the output streams of all the actions of a command.
+ * 
+ * Actions without --output write to stdout, actions with the same
+ * destination share the same stream.
+ * 
+ * @param command  The command built from the command line, with room for one stream per action plus stdout.
+ * @return TRUE on success, FALSE if any output file could not be created.
  */
-int convert_zx_tap_to_hex(const char* output_filename, FILE* tap_file) {
-    fatal_error( "Not implemented yet" );
-    return 0;
+BOOL open_output_streams(Command* command) {
+    Action* action; OutputStream* stream;
+    const char* path;
+    BOOL append = FALSE;
+    int i, s;
+
+    command->streams[0].path = NULL;
+    command->streams[0].file = stdout;
+    command->stream_count    = 1;
+    for( i = 0 ; i < command->action_count ; ++i ) {
+        action = &command->actions[i];
+        path   = action->output_path;
+        if( action->cmd == CMD_EXTRACT && action->tar_path ) {
+            /* the extracted files go to the archive, --output is a folder within it */
+            action->archive = (TarArchive*)malloc(sizeof(TarArchive));
+            if( !action->archive || !unique_namer_init(&action->archive->folders, "") )
+            { free(action->archive); action->archive = NULL; error("Not enough memory"); return FALSE; }
+            mutex_init(&action->archive->lock);
+            path = strcmp(action->tar_path, "-") != 0 ? action->tar_path : NULL;
+        }
+        else if( action->cmd == CMD_EXTRACT ) {
+            /* the extracted files go to a folder, stdout is not used */
+            if( action->output_path && !is_directory(action->output_path) && !create_directory(action->output_path) ) { return FALSE; }
+            action->stream = 0;
+            continue;
+        }
+        else if( action->cmd == CMD_IMAGE && action->output_path && is_directory(action->output_path) ) {
+            /* one image file per tape in the folder, stdout is not used */
+            action->images = (ImageFolder*)malloc(sizeof(ImageFolder));
+            if( !action->images || !unique_namer_init(&action->images->names, action->output_path) )
+            { free(action->images); action->images = NULL; error("Not enough memory"); return FALSE; }
+            mutex_init(&action->images->lock);
+            action->stream = 0;
+            continue;
+        }
+        if( action->cmd == CMD_DEDUP ) {
+            /* by default the references are appended to the refs.tsv file of the store */
+            action->store = (DedupStore*)malloc(sizeof(DedupStore));
+            if( !action->store || !dedup_store_open(action->store, action->store_dir) )
+            { free(action->store); action->store = NULL; error("Cannot open the dedup store '%s'", action->store_dir); return FALSE; }
+            if( !action->output_path ) { append = TRUE; path = action->output_path = action->store->refs_path; }
+        }
+        for( s = 0 ; s < command->stream_count ; ++s ) {
+            stream = &command->streams[s];
+            if( (!stream->path && !path) || (stream->path && path && strcmp(stream->path, path)==0) ) { break; }
+        }
+        if( s == command->stream_count ) {
+            stream       = &command->streams[ command->stream_count++ ];
+            stream->path = path;
+            stream->file = fopen(path, append ? "ab" : "wb");
+            if( !stream->file ) { error("Cannot create output file '%s'", path); return FALSE; }
+        }
+        append = FALSE;
+        action->stream = s;
+        if( action->archive ) { command->streams[s].is_archive = TRUE; }
+        else if( action->cmd != CMD_VERIFY && action->cmd != CMD_DEDUP && action->cmd != CMD_FIND_BASIC &&
+                 !(action->cmd == CMD_IMAGE && action->raw) && action->format == LIST_FORMAT_TEXT )
+        { command->streams[s].has_header = TRUE; }
+    }
+    return TRUE;
+}
+
+/**
+ * Closes the output streams opened with `open_output_streams()`.
+ * @param command  The command whose streams are closed.
+ * @return TRUE if all the output was written, FALSE if any write failed.
+ */
+BOOL close_output_streams(Command* command) {
+    BOOL success = TRUE;
+    int i, s;
+    for( s = 0 ; s < command->stream_count ; ++s ) {
+        if( command->streams[s].is_archive && !tar_write_end(command->streams[s].file) ) { success = FALSE; }
+        if( ferror(command->streams[s].file) ) { success = FALSE; }
+        if( s > 0 && fclose(command->streams[s].file) != 0 ) { success = FALSE; }
+    }
+    if( fflush(stdout) != 0 ) { success = FALSE; }
+    for( i = 0 ; i < command->action_count ; ++i ) {
+        if( command->actions[i].archive ) {
+            unique_namer_free(&command->actions[i].archive->folders);
+            mutex_destroy(&command->actions[i].archive->lock);
+            free(command->actions[i].archive); command->actions[i].archive = NULL;
+        }
+        if( command->actions[i].images ) {
+            unique_namer_free(&command->actions[i].images->names);
+            mutex_destroy(&command->actions[i].images->lock);
+            free(command->actions[i].images); command->actions[i].images = NULL;
+        }
+        if( !command->actions[i].store ) { continue; }
+        dedup_store_close(command->actions[i].store);
+        free(command->actions[i].store); command->actions[i].store = NULL;
+    }
+    command->stream_count = 1;
+    return success;
 }
 
+#ifndef ZXTAPI_NO_MAIN /* defined by programs that reuse zxtapi.c, e.g. zxtapi_bench.c */
+
 /*===========================================================================
 /////////////////////////////////// MAIN ////////////////////////////////////
 ===========================================================================*/
@@ -557,7 +3847,7 @@ int convert_zx_tap_to_hex(const char* output_filename, FILE* tap_file) {
 /**
  * Main function to process command-line arguments and handle file operations.
  * 
- * This function processes command-line arguments to check for help, version, and filename.
+ * This function processes command-line arguments to check for help, version, and filenames.
  * It validates the input and performs the necessary actions based on the provided flags.
  * 
  * @param argc Number of command-line arguments.
@@ -566,16 +3856,21 @@ int convert_zx_tap_to_hex(const char* output_filename, FILE* tap_file) {
  */
 int main(int argc, char *argv[]) {
     int  i;
-    FILE *tap_file = NULL;
-    char filename[1024] = "";
-    int  non_flag_count = 0;
     char *arg;
-    BinaryCode *code;
     int err_code = 0;
-    char *dir_name = NULL;
-    const char *selected_name  = NULL;
-    int         selected_index = FIRST_HEADER_INDEX;
-    enum { CMD_HELP, CMD_VERSION, CMD_LIST, CMD_DETAILS, CMD_PRINT, CMD_BASIC, CMD_BINARY, CMD_EXTRACT } cmd;
+    int job_count = 0;
+    BOOL print_stats = FALSE, stats_as_json = FALSE;
+    CMD  info_cmd = CMD_LIST;
+    LIST_FORMAT list_format = LIST_FORMAT_TEXT;
+    BOOL incremental = FALSE, raw = FALSE;
+    const char* tar_path = NULL, *term;
+    const char* cache_dir = NULL, *socket_path = NULL;
+    BOOL     serve = FALSE, diff = FALSE;
+    size_t   cache_size = 0;
+    RenderCache cache;
+    Action*  last_action = NULL;
+    Command  command;
+    FileList files;
 
     /* check if at least one parameter is provided */
     if (argc < 2) {
@@ -585,36 +3880,106 @@ int main(int argc, char *argv[]) {
     }
 
     /* process each argument */
-    cmd = CMD_LIST;
+    memset(&command, 0, sizeof(command));
+    memset(&files  , 0, sizeof(files));
+    command.actions = (Action*)malloc(argc * sizeof(Action));
+    command.streams = (OutputStream*)calloc(argc + 1, sizeof(OutputStream));
+    if( !command.actions || !command.streams ) { fatal_error("Not enough memory"); }
+    command.index_mode = INDEX_MODE_NONE;
     for(i = 1; i < argc; i++) {
         arg = argv[i];
-        if( arg[0] == '-' ) {
-            if      (ARG_EQ(arg, "-l", "--list"   )) { cmd = CMD_LIST;    }
-            else if (ARG_EQ(arg, "-d", "--detail" )) { cmd = CMD_DETAILS; }
-            else if (ARG_EQ(arg, "-p", "--print"  )) { cmd = CMD_PRINT; ++i;
+        if( arg[0] == '-' && arg[1] != '\0' ) {
+            if      (ARG_EQ(arg, "-l", "--list"   )) { last_action = add_action(&command, CMD_LIST   , NULL); }
+            else if (ARG_EQ(arg, "-d", "--detail" )) { last_action = add_action(&command, CMD_DETAILS, NULL); }
+            else if (ARG_EQ(arg, "-p", "--print"  )) { ++i;
                 if( i >= argc ) { fatal_error("Missing value for --print"); }
-                selected_name  = get_selected_name(argv[i]);
-                selected_index = selected_name ? -1 : atoi(argv[i]);
-            }
-            else if (ARG_EQ(arg, "-b", "--basic"  )) { cmd = CMD_BASIC;   }
-            else if (ARG_EQ(arg, "-c", "--code"   )) { cmd = CMD_BINARY;  }
-            else if (ARG_EQ(arg, "-x", "--extract")) { cmd = CMD_EXTRACT; }
-            else if (ARG_EQ(arg, "-h", "--help"   )) { cmd = CMD_HELP;    }
-            else if (ARG_EQ(arg, "-v", "--version")) { cmd = CMD_VERSION; }
+                last_action = add_action(&command, CMD_PRINT, argv[i]);
+            }
+            else if (ARG_EQ(arg, "-b", "--basic"  )) { last_action = add_action(&command, CMD_BASIC  , NULL); }
+            else if (ARG_EQ(arg, "-c", "--code"   )) { last_action = add_action(&command, CMD_BINARY , NULL); }
+            else if (ARG_EQ(arg, "-x", "--extract")) { last_action = add_action(&command, CMD_EXTRACT, NULL); }
+            else if (ARG_EQ(arg, "--image", "--image")) { last_action = add_action(&command, CMD_IMAGE, NULL); }
+            else if (ARG_EQ(arg, "--verify", "--verify")) { last_action = add_action(&command, CMD_VERIFY, NULL); }
+            else if (ARG_EQ(arg, "--dedup-store", "--dedup-store")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --dedup-store"); }
+                last_action = add_action(&command, CMD_DEDUP, NULL);
+                last_action->store_dir = argv[i];
+            }
+            else if (ARG_EQ(arg, "--find-basic", "--find-basic")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --find-basic"); }
+                last_action = add_action(&command, CMD_FIND_BASIC, NULL);
+                last_action->query = (ZXSBasicQuery*)malloc(sizeof(ZXSBasicQuery));
+                if( !last_action->query ) { fatal_error("Not enough memory"); }
+                if( (term = zxs_parse_basic_query(last_action->query, argv[i])) != NULL )
+                { fatal_error("Invalid term in the --find-basic query: '%s'", term); }
+            }
+            else if (ARG_EQ(arg, "-o", "--output" )) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --output"); }
+                if( !last_action ) { fatal_error("--output must follow the command whose output it receives"); }
+                last_action->output_path = argv[i];
+            }
+            else if (ARG_EQ(arg, "-i", "--index"  )) { command.index_mode = INDEX_MODE_CACHED; }
+            else if (ARG_EQ(arg, "--index=hash", "--index=hash")) { command.index_mode = INDEX_MODE_HASHED; }
+            else if (ARG_EQ(arg, "--incremental", "--incremental")) { incremental = TRUE; }
+            else if (ARG_EQ(arg, "--raw", "--raw")) { raw = TRUE; }
+            else if (ARG_EQ(arg, "--robust", "--robust")) { command.robust = TRUE; }
+            else if (ARG_EQ(arg, "--max-memory", "--max-memory")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --max-memory"); }
+                if( !parse_memory_size(argv[i], &command.max_memory) ) { fatal_error("Invalid memory size '%s'", argv[i]); }
+            }
+            else if (ARG_EQ(arg, "--cache", "--cache")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --cache"); }
+                if( !parse_memory_size(argv[i], &cache_size) || cache_size == 0 ) { fatal_error("Invalid memory size '%s'", argv[i]); }
+            }
+            else if (ARG_EQ(arg, "--cache-dir", "--cache-dir")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --cache-dir"); }
+                cache_dir = argv[i];
+            }
+            else if (ARG_EQ(arg, "--tar", "--tar")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --tar"); }
+                tar_path = argv[i];
+            }
+            else if (ARG_EQ(arg, "--format=text"  , "--format=text"  )) { list_format = LIST_FORMAT_TEXT;   }
+            else if (ARG_EQ(arg, "--format=ndjson", "--format=ndjson")) { list_format = LIST_FORMAT_NDJSON; }
+            else if (ARG_EQ(arg, "--format=binary", "--format=binary")) { list_format = LIST_FORMAT_BINARY; }
+            else if (ARG_EQ(arg, "-j", "--jobs"   )) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --jobs"); }
+                job_count = atoi(argv[i]);
+                if( job_count < 1 ) { fatal_error("Invalid number of jobs '%s'", argv[i]); }
+            }
+            else if (ARG_EQ(arg, "--stdin", "--stdin")) {
+                if( !add_file(&files, STDIN_PATH) ) { fatal_error("Not enough memory"); }
+            }
+            else if (ARG_EQ(arg, "--files-from", "--files-from")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --files-from"); }
+                if( !add_files_from_list(&files, argv[i]) ) { fatal_error("Cannot read the file list '%s'", argv[i]); }
+            }
+            else if (ARG_EQ(arg, "--diff", "--diff")) { diff = TRUE; }
+            else if (ARG_EQ(arg, "--serve", "--serve")) { serve = TRUE; }
+            else if (ARG_EQ(arg, "--serve-socket", "--serve-socket")) { ++i;
+                if( i >= argc ) { fatal_error("Missing value for --serve-socket"); }
+                serve = TRUE; socket_path = argv[i];
+            }
+            else if (ARG_EQ(arg, "--stats", "--stats=text")) { print_stats = TRUE; stats_as_json = FALSE; }
+            else if (ARG_EQ(arg, "--stats=json", "--stats=json")) { print_stats = TRUE; stats_as_json = TRUE; }
+            else if (ARG_EQ(arg, "-h", "--help"   )) { info_cmd = CMD_HELP;    }
+            else if (ARG_EQ(arg, "-v", "--version")) { info_cmd = CMD_VERSION; }
             else {
                 fatal_error( "Unknown flag '%s'", arg );
             }
         }
+        else if( is_directory(arg) ) {
+            /* a directory, process all the tapes it contains */
+            if( !add_tape_files_from_dir(&files, arg) ) { fatal_error("Cannot read directory '%s'", arg); }
+        }
         else {
-            /* assume this parameter is the filename */
-            strncpy(filename, arg, sizeof(filename)-1);
-            filename[sizeof(filename)-1] = '\0';
-            non_flag_count++;
+            /* assume this parameter is a filename (or a zip archive of tapes) */
+            if( !add_tape_file(&files, arg) ) { fatal_error("Not enough memory"); }
         }
     }
 
     /* handle help & version commands */
-    switch( cmd ) {
+    switch( info_cmd ) {
         case CMD_HELP:
             print_help(argc,argv);
             return 0;
@@ -625,40 +3990,65 @@ int main(int argc, char *argv[]) {
             break;
     }
 
-    /* check that exactly one filename was provided */
-    if( non_flag_count != 1 ) {
-        fatal_error("Exactly one filename was expected");
+    /* the server mode takes the tapes from its requests */
+    if( serve ) {
+        if( files.count > 0 || command.action_count > 0 ) { fatal_error("--serve can't be combined with commands or tape files"); }
+        if( job_count < 1 ) { job_count = get_cpu_count(); }
+        stats_enable( print_stats );
+        err_code = run_server(&command, socket_path, job_count);
+        if( print_stats ) { stats_fprint(stderr, stats_as_json); }
+        free(command.actions);
+        free(command.streams);
+        return err_code;
     }
 
-    /* proceed with file operations based on the selected command */
-    err_code  = 0;
-    tap_file = fopen(filename, "rb");
-    if( !tap_file ) { fatal_error("Failed to open file '%s'", filename); }
-    switch( cmd ) {
-        case CMD_LIST:
-            err_code = fprint_block_list(stdout, tap_file);
-            break;
-        case CMD_DETAILS:
-            err_code = fprint_block_list(stdout, tap_file);
-            break;
-        case CMD_PRINT:
-            err_code = fprint_any_zx_block(stdout, tap_file, selected_name, selected_index);
-            break;
-        case CMD_BASIC:
-            err_code = fprint_zx_basic_program(stdout, tap_file, NULL, -1);
-            break;
-        case CMD_BINARY:
-            err_code = fprint_zx_binary_code(stdout, tap_file, NULL, -1);
-            break;
-        case CMD_EXTRACT:
-            dir_name = alloc_name(filename);
-            err_code = extract_all_zx_blocks(dir_name, tap_file, NULL, -1);
-            free(dir_name);
-            break;
-        default:
-            fatal_error( "Unknown command '%d'", cmd );
+    /* the diff compares two tapes, without any other command */
+    if( diff ) {
+        if( files.count != 2 || command.action_count > 0 ) { fatal_error("--diff expects two tape files and no other commands"); }
+        stats_enable( print_stats );
+        err_code = diff_tapes(&command, &files);
+        if( print_stats ) { stats_fprint(stderr, stats_as_json); }
+        free_file_list(&files);
+        free(command.actions);
+        free(command.streams);
+        return err_code;
     }
-    fclose(tap_file);
+
+    /* check that at least one filename was provided */
+    if( files.count < 1 ) {
+        fatal_error("At least one filename was expected");
+    }
+
+    /* listing the blocks is the default command */
+    if( command.action_count == 0 ) { add_action(&command, CMD_LIST, NULL); }
+    for( i = 0 ; i < command.action_count ; ++i ) {
+        command.actions[i].format      = list_format;
+        command.actions[i].incremental = incremental;
+        command.actions[i].raw         = raw;
+        command.actions[i].tar_path    = command.actions[i].cmd == CMD_EXTRACT ? tar_path : NULL;
+    }
+    if( !open_output_streams(&command) ) { return 1; }
+    if( cache_size > 0 || cache_dir ) {
+        if( !render_cache_open(&cache, cache_size > 0 ? cache_size : RENDER_CACHE_DEFAULT_SIZE, cache_dir, VERSION) ) {
+            if( cache_dir ) { fatal_error("Cannot create the cache directory '%s'", cache_dir); }
+            else            { fatal_error("Not enough memory"); }
+        }
+        render_cache = &cache;
+    }
+
+    /* proceed with file operations based on the selected commands */
+    if( job_count < 1 ) { job_count = get_cpu_count(); }
+    stats_enable( print_stats );
+    err_code = process_tape_files(&command, &files, job_count);
+    if( !close_output_streams(&command) ) { error("Cannot write all the output files"); err_code = 1; }
+    if( render_cache ) { render_cache_close(render_cache); render_cache = NULL; }
+    if( print_stats ) { stats_fprint(stderr, stats_as_json); }
+
+    free_file_list(&files);
+    for( i = 0 ; i < command.action_count ; ++i ) { free(command.actions[i].query); }
+    free(command.actions);
+    free(command.streams);
     return err_code;
 }
 
+#endif /* ZXTAPI_NO_MAIN */
@@ -0,0 +1,481 @@
+/*
+| File    : zxtapi_bench.c
+| Purpose : Benchmarks of the ZXTapInspector core functions over synthetic tapes.
+| Author  : Martin Rizzo | <martinrizzo@gmail.com>
+| Repo    : https://github.com/martin-rizzo/ZXTapInspector
+| License : MIT
+|- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+|                               ZXTapInspector
+|    A simple CLI tool for inspecting and extracting ZX-Spectrum TAP files
+|
+|    Copyright (c) 2025 Martin Rizzo
+|
+|    Permission is hereby granted, free of charge, to any person obtaining
+|    a copy of this software and associated documentation files (the
+|    "Software"), to deal in the Software without restriction, including
+|    without limitation the rights to use, copy, modify, merge, publish,
+|    distribute, sublicense, and/or sell copies of the Software, and to
+|    permit persons to whom the Software is furnished to do so, subject to
+|    the following conditions:
+|
+|    The above copyright notice and this permission notice shall be
+|    included in all copies or substantial portions of the Software.
+|
+|    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+|    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+|    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+|    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+|    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+|    TORT OR OTHERWISE, ARISING FROM,OUT OF OR IN CONNECTION WITH THE
+|    SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+\_ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _ _*/
+#define ZXTAPI_NO_MAIN
+#include "zxtapi.c"
+#ifdef _WIN32
+#   include <direct.h>
+#   define remove_dir(path) _rmdir(path)
+#else
+#   include <time.h>
+#   define remove_dir(path) rmdir(path)
+#endif
+
+const char* BENCH_HELP[] = {
+"Usage: zxtapi_bench [OPTIONS]"                                                          ,
+""                                                                                       ,
+"Description:"                                                                           ,
+"  Generates synthetic tapes and measures the throughput of the main functions of"       ,
+"  zxtapi on them. Each result is printed as a JSON object on its own line."            ,
+""                                                                                       ,
+"Options:"                                                                               ,
+"  -s, --shape <name>"                                                                   ,
+"        Shape of the synthetic tape: 'headers' (many tiny blocks), 'code' (huge CODE"   ,
+"        blocks), 'basic' (large BASIC listings) or 'all' (default)."                    ,
+""                                                                                       ,
+"  -n, --scale <n>"                                                                      ,
+"        Multiplies the number of blocks of each synthetic tape (default: 1)."           ,
+""                                                                                       ,
+"  -t, --time <seconds>"                                                                 ,
+"        Minimum time each benchmark is repeated for (default: 0.5)."                   ,
+""                                                                                       ,
+"  -j, --jobs <n>"                                                                       ,
+"        Number of threads used by the extraction benchmark (default: the number of"     ,
+"        processors)."                                                                   ,
+""                                                                                       ,
+"  -h, --help"                                                                           ,
+"        Show this help message and exit."                                               ,
+"", NULL
+};
+
+/** Version of the format of the results, incremented when any field changes */
+#define BENCH_SCHEMA_VERSION 1
+
+/*---------------------------- SYNTHETIC TAPES -----------------------------*/
+
+/**
+ * A synthetic tape being generated in memory
+ */
+typedef struct SynthTape {
+    BYTE*    data;      /**< The content of the tape */
+    size_t   size;      /**< Number of bytes used in `data` */
+    size_t   capacity;  /**< Number of bytes allocated in `data` */
+    unsigned seed;      /**< State of the pseudo-random generator */
+} SynthTape;
+
+/**
+ * Returns the next pseudo-random number of a synthetic tape (so results do not depend on the C library).
+ * @param synth  The synthetic tape.
+ * @return A number in the range 0..32767.
+ */
+unsigned synth_random(SynthTape* synth) {
+    synth->seed = synth->seed * 1103515245u + 12345u;
+    return (synth->seed >> 16) & 0x7FFF;
+}
+
+/**
+ * Appends bytes to the content of a synthetic tape.
+ * @param synth  The synthetic tape.
+ * @param data   The bytes to append.
+ * @param size   Number of bytes to append.
+ */
+void synth_append(SynthTape* synth, const BYTE* data, size_t size) {
+    BYTE* new_data;
+    if( synth->size + size > synth->capacity ) {
+        synth->capacity = (synth->size + size) * 2;
+        new_data = (BYTE*)realloc(synth->data, synth->capacity);
+        if( !new_data ) { fatal_error("Not enough memory to generate the synthetic tape"); }
+        synth->data = new_data;
+    }
+    memcpy(synth->data + synth->size, data, size);
+    synth->size += size;
+}
+
+/**
+ * Appends a complete block (length, flag, data and checksum) to a synthetic tape.
+ * @param synth     The synthetic tape.
+ * @param flag      The flag byte of the block (ZXS_BLKTYPE_HEADER or ZXS_BLKTYPE_DATA).
+ * @param data      The data of the block.
+ * @param datasize  Number of bytes in `data` (at most 65533).
+ */
+void synth_add_block(SynthTape* synth, BYTE flag, const BYTE* data, unsigned datasize) {
+    BYTE prefix[3], checksum;
+    assert( datasize <= 65533 );
+    prefix[0] = (BYTE)((datasize + 2) & 0xFF);
+    prefix[1] = (BYTE)((datasize + 2) >> 8);
+    prefix[2] = flag;
+    checksum  = flag ^ zxs_xor_bytes(data, datasize);
+    synth_append(synth, prefix, 3);
+    synth_append(synth, data, datasize);
+    synth_append(synth, &checksum, 1);
+}
+
+/**
+ * Appends a header block to a synthetic tape.
+ * @param synth     The synthetic tape.
+ * @param datatype  Type of the data block that follows the header.
+ * @param name      Name stored in the header (up to 10 characters).
+ * @param length    Length of the data block that follows the header.
+ * @param param1    First parameter (autostart line or start address).
+ * @param param2    Second parameter (program length or 32768).
+ */
+void synth_add_header(SynthTape* synth, ZXS_DATATYPE datatype, const char* name,
+                      unsigned length, unsigned param1, unsigned param2) {
+    BYTE header[ZXS_HEADER_SIZE]; size_t name_length = strlen(name);
+    header[0] = (BYTE)datatype;
+    memset(&header[1], ' ', 10);
+    memcpy(&header[1], name, name_length < 10 ? name_length : 10);
+    header[11] = (BYTE)(length & 0xFF); header[12] = (BYTE)(length >> 8);
+    header[13] = (BYTE)(param1 & 0xFF); header[14] = (BYTE)(param1 >> 8);
+    header[15] = (BYTE)(param2 & 0xFF); header[16] = (BYTE)(param2 >> 8);
+    synth_add_block(synth, ZXS_BLKTYPE_HEADER, header, ZXS_HEADER_SIZE);
+}
+
+/**
+ * Generates a tokenized BASIC program with dense keywords, strings and 5-byte numbers.
+ * @param synth    The synthetic tape (only used for its random generator).
+ * @param program  Buffer where the program is generated.
+ * @param size     Maximum size of the program in bytes.
+ * @return The number of bytes of the generated program.
+ */
+unsigned synth_basic_program(SynthTape* synth, BYTE* program, unsigned size) {
+    static const BYTE KEYWORDS[] = { 0xF5, 0xEC, 0xED, 0xF1, 0xFA, 0xEB, 0xCC, 0xF3, 0xF4, 0xBE, 0xD9, 0xE3 };
+    unsigned length = 0, line_start, number, i, line_number = 10;
+
+    while( length + 64 <= size && line_number < 9999 ) {
+        line_start = length;
+        program[length++] = (BYTE)(line_number >> 8);
+        program[length++] = (BYTE)(line_number & 0xFF);
+        length += 2; /* line length, filled in below */
+        while( length - line_start < 48 ) {
+            program[length++] = KEYWORDS[ synth_random(synth) % sizeof(KEYWORDS) ];
+            if( synth_random(synth) % 3 == 0 ) {
+                /* a string in quotes */
+                program[length++] = '"';
+                for( i = 0 ; i < 4 ; ++i ) { program[length++] = (BYTE)('A' + synth_random(synth) % 26); }
+                program[length++] = '"';
+            } else {
+                /* a number, as digits followed by the 0x0E marker and its 5-byte form */
+                number = synth_random(synth) % 1000;
+                length += sprintf((char*)&program[length], "%u", number);
+                program[length++] = 0x0E;
+                program[length++] = 0x00;
+                program[length++] = 0x00;
+                program[length++] = (BYTE)(number & 0xFF);
+                program[length++] = (BYTE)(number >> 8);
+                program[length++] = 0x00;
+            }
+            program[length++] = ':';
+        }
+        program[length++] = 0x0D;
+        program[line_start + 2] = (BYTE)((length - line_start - 4) & 0xFF);
+        program[line_start + 3] = (BYTE)((length - line_start - 4) >> 8);
+        line_number += 10;
+    }
+    return length;
+}
+
+/**
+ * Generates a synthetic tape of a given shape.
+ * @param synth  The SynthTape structure to fill (release `synth->data` with `free()`).
+ * @param shape  Name of the shape: "headers", "code" or "basic".
+ * @param scale  Multiplier of the number of blocks.
+ * @return TRUE on success, FALSE if the shape is unknown.
+ */
+BOOL synth_generate(SynthTape* synth, const char* shape, int scale) {
+    static BYTE data[65533];
+    char name[16]; unsigned i, j, count, length;
+
+    memset(synth, 0, sizeof(SynthTape));
+    synth->seed = 1;
+    if( strcmp(shape, "headers") == 0 ) {
+        /* many tiny headers, each followed by a small CODE block */
+        count = 4000 * scale;
+        for( i = 0 ; i < count ; ++i ) {
+            sprintf(name, "b%u", i);
+            length = 1 + synth_random(synth) % 16;
+            memset(data, (int)i, length);
+            synth_add_header(synth, ZXS_DATATYPE_CODE, name, length, 32768, 32768);
+            synth_add_block (synth, ZXS_BLKTYPE_DATA, data, length);
+        }
+    }
+    else if( strcmp(shape, "code") == 0 ) {
+        /* a few huge CODE blocks */
+        count = 16 * scale; length = 49152;
+        for( i = 0 ; i < count ; ++i ) {
+            sprintf(name, "code%u", i);
+            for( j = 0 ; j < length ; ++j ) { data[j] = (BYTE)synth_random(synth); }
+            synth_add_header(synth, ZXS_DATATYPE_CODE, name, length, 16384, 32768);
+            synth_add_block (synth, ZXS_BLKTYPE_DATA, data, length);
+        }
+    }
+    else if( strcmp(shape, "basic") == 0 ) {
+        /* large BASIC listings */
+        count = 8 * scale;
+        for( i = 0 ; i < count ; ++i ) {
+            sprintf(name, "prog%u", i);
+            length = synth_basic_program(synth, data, 40000);
+            synth_add_header(synth, ZXS_DATATYPE_BASIC, name, length, 10, length);
+            synth_add_block (synth, ZXS_BLKTYPE_DATA, data, length);
+        }
+    }
+    else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*-------------------------------- TIMING ---------------------------------*/
+
+/**
+ * Returns the time elapsed since an arbitrary point, from a monotonic clock.
+ * @return The time in seconds.
+ */
+double get_seconds(void) {
+#   ifdef _WIN32
+        LARGE_INTEGER counter, frequency;
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&frequency);
+        return (double)counter.QuadPart / (double)frequency.QuadPart;
+#   else
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#   endif
+}
+
+/**
+ * The state shared by all the benchmarks of one synthetic tape
+ */
+typedef struct Bench {
+    const char*  shape;     /**< Name of the shape of the synthetic tape */
+    ZXSTapIndex* index;     /**< Block index of the synthetic tape */
+    OutBuf       sink;      /**< Where the formatted output is discarded */
+    ThreadPool*  pool;      /**< Thread pool used for the extraction */
+    double       min_time;  /**< Minimum time each benchmark is repeated for */
+    char*        work_dir;  /**< Directory where the extraction benchmark writes its files */
+} Bench;
+
+/**
+ * A function measured by the benchmarks
+ * @param bench   The benchmark state.
+ * @param bytes   Receives the number of bytes processed.
+ * @param blocks  Receives the number of blocks processed.
+ * @return The time spent in the measured part of the function, in seconds.
+ */
+typedef double (*BENCH_FUNC)(Bench* bench, double* bytes, double* blocks);
+
+/**
+ * Repeats a function for at least `bench->min_time` seconds and prints its throughput as a JSON line.
+ * 
+ * Nothing is printed if the tape has no blocks the function applies to.
+ * @param bench  The benchmark state.
+ * @param name   Name of the benchmark.
+ * @param func   The function to measure.
+ */
+void run_bench(Bench* bench, const char* name, BENCH_FUNC func) {
+    double elapsed = 0, bytes = 0, blocks = 0, total_bytes = 0, total_blocks = 0;
+    int iterations = 0;
+
+    do {
+        elapsed      += func(bench, &bytes, &blocks);
+        total_bytes  += bytes;
+        total_blocks += blocks;
+        ++iterations;
+        if( blocks == 0 ) { return; } /* nothing to measure in this tape */
+    } while( elapsed < bench->min_time );
+
+    if( elapsed <= 0 ) { elapsed = 1e-9; }
+    printf("{\"schema\":%d,\"version\":\"%s\",\"bench\":\"%s\",\"shape\":\"%s\","
+           "\"iterations\":%d,\"seconds\":%.6f,\"bytes\":%.0f,\"blocks\":%.0f,"
+           "\"mb_per_s\":%.3f,\"blocks_per_s\":%.1f}\n",
+           BENCH_SCHEMA_VERSION, VERSION, name, bench->shape,
+           iterations, elapsed, total_bytes / iterations, total_blocks / iterations,
+           total_bytes / elapsed / (1024.0 * 1024.0), total_blocks / elapsed);
+    fflush(stdout);
+}
+
+/*------------------------------- BENCHMARKS -------------------------------*/
+
+double bench_block_list(Bench* bench, double* bytes, double* blocks) {
+    double start = get_seconds();
+    write_block_list(&bench->sink, bench->index);
+    *bytes  = (double)bench->index->tape->size;
+    *blocks = (double)bench->index->entry_count;
+    return get_seconds() - start;
+}
+
+double bench_find_header(Bench* bench, double* bytes, double* blocks) {
+    const ZXSTapIndex* index = bench->index;
+    double start = get_seconds();
+    int i, found = 0;
+    for( i = 0 ; i < index->header_count ; ++i ) {
+        found += find_zx_tap_header(index, index->entries[ index->headers[i] ].header.filename,
+                                    -1, ZXS_DATATYPE_ANY) >= 0;
+    }
+    if( found != index->header_count ) { fatal_error("Header lookup failed"); }
+    *bytes  = (double)index->header_count * ZXS_HEADER_SIZE;
+    *blocks = (double)index->header_count;
+    return get_seconds() - start;
+}
+
+/**
+ * Formats the data block following every header of a given type.
+ * @param bench     The benchmark state.
+ * @param datatype  The type of header whose data block is formatted.
+ * @param bytes     Receives the number of bytes formatted.
+ * @param blocks    Receives the number of blocks formatted.
+ * @return The time spent formatting, in seconds.
+ */
+double _bench_format_blocks(Bench* bench, ZXS_DATATYPE datatype, double* bytes, double* blocks) {
+    const ZXSTapIndex* index = bench->index;
+    const ZXSIndexEntry* entry;
+    double start = get_seconds();
+    ZXSTapBlock block; int i;
+    *bytes = *blocks = 0;
+    for( i = 0 ; i < index->header_count ; ++i ) {
+        entry = &index->entries[ index->headers[i] ];
+        if( entry->header.datatype != datatype || !zxs_index_block(index, index->headers[i] + 1, &block) ) { continue; }
+        if( datatype == ZXS_DATATYPE_BASIC ) { zxs_write_basic_program(&bench->sink, block.data, block.datasize); }
+        else                                 { write_hex_data(&bench->sink, entry->header.param1, block.data, block.datasize); }
+        *bytes  += block.datasize;
+        *blocks += 1;
+    }
+    return get_seconds() - start;
+}
+
+double bench_basic(Bench* bench, double* bytes, double* blocks) {
+    return _bench_format_blocks(bench, ZXS_DATATYPE_BASIC, bytes, blocks);
+}
+
+double bench_hex(Bench* bench, double* bytes, double* blocks) {
+    return _bench_format_blocks(bench, ZXS_DATATYPE_CODE, bytes, blocks);
+}
+
+/**
+ * Removes a directory entry and, if it is a directory, all its content (used with `for_each_dir_entry()`).
+ */
+BOOL _remove_tree_entry(const char* path, BOOL is_dir, void* user_data) {
+    if( is_dir ) {
+        for_each_dir_entry(path, _remove_tree_entry, user_data);
+        remove_dir(path);
+    } else {
+        remove(path);
+    }
+    return TRUE;
+}
+
+double _bench_extract(Bench* bench, BOOL raw, double* bytes, double* blocks) {
+    double start, elapsed;
+    char* dir_name = alloc_concat5(bench->work_dir, "/", bench->shape, NULL, NULL);
+
+    /* only the extraction is measured, removing the files afterwards is not */
+    start   = get_seconds();
+    extract_all_zx_blocks(dir_name, bench->index, NULL, -1, raw, bench->pool);
+    elapsed = get_seconds() - start;
+    for_each_dir_entry(bench->work_dir, _remove_tree_entry, NULL);
+    free(dir_name);
+    *bytes  = (double)bench->index->tape->size;
+    *blocks = (double)bench->index->header_count;
+    return elapsed;
+}
+
+double bench_extract(Bench* bench, double* bytes, double* blocks) {
+    return _bench_extract(bench, FALSE, bytes, blocks);
+}
+
+double bench_extract_raw(Bench* bench, double* bytes, double* blocks) {
+    return _bench_extract(bench, TRUE, bytes, blocks);
+}
+
+/*===========================================================================
+/////////////////////////////////// MAIN ////////////////////////////////////
+===========================================================================*/
+
+int main(int argc, char *argv[]) {
+    static const char* ALL_SHAPES[] = { "headers", "code", "basic", NULL };
+    const char* single_shape[2] = { NULL, NULL };
+    const char** shapes = ALL_SHAPES;
+    int i, scale = 1, job_count = 0;
+    double min_time = 0.5;
+    SynthTape synth; ZXSTape tape; ZXSTapIndex index;
+    ThreadPool pool; Bench bench;
+    char *arg, sink_memory[OUT_BUF_SIZE];
+
+    for( i = 1 ; i < argc ; ++i ) {
+        arg = argv[i];
+        if( ARG_EQ(arg, "-s", "--shape") && i+1 < argc ) {
+            ++i; if( strcmp(argv[i], "all") != 0 ) { single_shape[0] = argv[i]; shapes = single_shape; }
+        }
+        else if( ARG_EQ(arg, "-n", "--scale") && i+1 < argc ) {
+            scale = atoi(argv[++i]);
+            if( scale < 1 ) { fatal_error("Invalid scale '%s'", argv[i]); }
+        }
+        else if( ARG_EQ(arg, "-t", "--time") && i+1 < argc ) {
+            min_time = atof(argv[++i]);
+        }
+        else if( ARG_EQ(arg, "-j", "--jobs") && i+1 < argc ) {
+            job_count = atoi(argv[++i]);
+            if( job_count < 1 ) { fatal_error("Invalid number of jobs '%s'", argv[i]); }
+        }
+        else if( ARG_EQ(arg, "-h", "--help") ) {
+            for( i = 0 ; BENCH_HELP[i] ; ++i ) { printf("%s\n", BENCH_HELP[i]); }
+            return 0;
+        }
+        else {
+            fatal_error("Unknown flag '%s'", arg);
+        }
+    }
+    for( i = 0 ; shapes[i] ; ++i ) {
+        if( !synth_generate(&synth, shapes[i], 0) ) { fatal_error("Unknown shape '%s'", shapes[i]); }
+        free(synth.data);
+    }
+    if( job_count < 1 ) { job_count = get_cpu_count(); }
+
+    memset(&bench, 0, sizeof(bench));
+    bench.min_time = min_time;
+    bench.pool     = &pool;
+    bench.work_dir = alloc_new_directory("zxtapi_bench.tmp");
+    out_buf_init_null(&bench.sink, sink_memory, sizeof(sink_memory));
+    if( !bench.work_dir ) { fatal_error("Cannot create the working directory"); }
+    if( !thread_pool_init(&pool, job_count-1) ) { warning("Cannot start all the worker threads"); }
+
+    for( i = 0 ; shapes[i] ; ++i ) {
+        synth_generate(&synth, shapes[i], scale);
+        zxs_init_tape(&tape, synth.data, synth.size);
+        if( !zxs_build_index(&index, &tape) ) { fatal_error("Not enough memory to index the synthetic tape"); }
+        bench.shape = shapes[i];
+        bench.index = &index;
+        run_bench(&bench, "block_list" , bench_block_list );
+        run_bench(&bench, "find_header", bench_find_header);
+        run_bench(&bench, "basic"      , bench_basic      );
+        run_bench(&bench, "hex"        , bench_hex        );
+        run_bench(&bench, "extract"    , bench_extract    );
+        run_bench(&bench, "extract_raw", bench_extract_raw);
+        zxs_free_index(&index);
+        zxs_free_tape(&tape);
+        free(synth.data);
+    }
+    thread_pool_destroy(&pool);
+    remove_dir(bench.work_dir);
+    free(bench.work_dir);
+    return 0;
+}